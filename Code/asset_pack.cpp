@@ -0,0 +1,410 @@
+#include "asset_pack.h"
+#include "asset_registry.h"
+#include "buffer_management.h"
+#include "lz4_codec.h"
+#include <mutex>
+#include <algorithm>
+
+// Entries that LZ4 does not shrink by at least 1/8 (images, already compressed) are stored
+#define ASSET_PACK_MIN_SAVING 8
+
+struct AssetPack
+{
+	MappedFile file;
+	const AssetPackHeader* header;
+	const AssetPackEntry* entries;
+	const char* strings;
+};
+
+// Read only while mounted, so any thread can look up entries without locking
+static AssetPack mountedPack;
+
+static std::mutex ioMutex;
+static AssetIoStats ioStats;
+static std::vector<std::string> looseFiles; // in the order they were first read
+static AssetMap looseFileSet;
+
+static void RecordLooseFile(const char* filepath)
+{
+	u64 pathHash = HashPath(filepath);
+	std::lock_guard<std::mutex> lock(ioMutex);
+	if (FindAsset(looseFileSet, pathHash) == UINT32_MAX)
+	{
+		RegisterAsset(looseFileSet, pathHash, (u32)looseFiles.size());
+		looseFiles.push_back(filepath);
+	}
+}
+
+// Compared as HashPath sees them, without case and with either slash
+static bool IsSamePath(const char* a, const char* b)
+{
+	for (;; ++a, ++b)
+	{
+		char ca = *a == '\\' ? '/' : (char)tolower((u8)*a);
+		char cb = *b == '\\' ? '/' : (char)tolower((u8)*b);
+		if (ca != cb)
+			return false;
+		if (ca == '\0')
+			return true;
+	}
+}
+
+static const AssetPackEntry* FindPackEntry(const char* filepath)
+{
+	if (!mountedPack.header)
+		return NULL;
+
+	u64 nameHash = HashPath(filepath);
+	const AssetPackEntry* begin = mountedPack.entries;
+	const AssetPackEntry* end = begin + mountedPack.header->entryCount;
+	const AssetPackEntry* entry = std::lower_bound(begin, end, nameHash, [](const AssetPackEntry& entry, u64 hash) { return entry.nameHash < hash; });
+	if (entry == end || entry->nameHash != nameHash)
+		return NULL;
+
+	// Another path with the same hash is not in the pack
+	return IsSamePath(mountedPack.strings + entry->nameOffset, filepath) ? entry : NULL;
+}
+
+static bool IsPackValid(const MappedFile& file)
+{
+	if (file.size < sizeof(AssetPackHeader))
+		return false;
+
+	const AssetPackHeader* header = (const AssetPackHeader*)file.data;
+	if (header->magic != ASSET_PACK_MAGIC || header->version != ASSET_PACK_VERSION || header->dataSize != file.size)
+		return false;
+
+	const u64 tocEnd = (u64)header->tocOffset + (u64)header->entryCount * sizeof(AssetPackEntry);
+	const u64 stringsEnd = (u64)header->stringsOffset + header->stringsSize;
+	if (header->tocOffset % ASSET_PACK_ALIGNMENT != 0 || tocEnd > file.size || stringsEnd > file.size)
+		return false;
+
+	// Every entry must lie inside the file, and the lookups need them sorted
+	const AssetPackEntry* entries = (const AssetPackEntry*)((const u8*)file.data + header->tocOffset);
+	for (u32 i = 0; i < header->entryCount; ++i)
+	{
+		const AssetPackEntry& entry = entries[i];
+		// Compared without adding, so huge values cannot wrap around and pass
+		if (entry.offset > file.size || entry.storedSize > file.size - entry.offset || entry.nameOffset >= header->stringsSize)
+			return false;
+		if (!memchr((const u8*)file.data + header->stringsOffset + entry.nameOffset, 0, header->stringsSize - entry.nameOffset))
+			return false;
+		if (entry.compression == AssetCompression_None ? entry.storedSize != entry.size : entry.compression != AssetCompression_LZ4)
+			return false;
+		if (i > 0 && entries[i - 1].nameHash >= entry.nameHash)
+			return false;
+	}
+
+	return true;
+}
+
+bool MountAssetPack(const char* filepath)
+{
+	UnmountAssetPack();
+
+	f64 startTime = GetTimestamp();
+
+	u32 calls = 0;
+	MappedFile file = MapFile(filepath, &calls);
+	bool valid = file.data && IsPackValid(file);
+	if (file.data && !valid)
+	{
+		ELOG("Asset pack %s is not valid, reading loose files", filepath);
+		UnmapFile(file, &calls);
+	}
+	{
+		std::lock_guard<std::mutex> lock(ioMutex);
+		ioStats.fileSystemCalls += calls;
+	}
+	if (!valid)
+		return false;
+
+	const u8* base = (const u8*)file.data;
+	mountedPack.file = file;
+	mountedPack.header = (const AssetPackHeader*)base;
+	mountedPack.entries = (const AssetPackEntry*)(base + mountedPack.header->tocOffset);
+	mountedPack.strings = (const char*)(base + mountedPack.header->stringsOffset);
+
+	std::lock_guard<std::mutex> lock(ioMutex);
+	ioStats.packMounted = true;
+	ioStats.packEntries = mountedPack.header->entryCount;
+	ioStats.packSize = file.size;
+	ioStats.mountMs = (GetTimestamp() - startTime) * 1000.0;
+	ioStats.ioMs += ioStats.mountMs;
+
+	ILOG("Mounted asset pack %s: %u entries, %.2f MB", filepath, ioStats.packEntries, ioStats.packSize / (1024.0 * 1024.0));
+	return true;
+}
+
+void UnmountAssetPack()
+{
+	if (!mountedPack.header)
+		return;
+
+	u32 calls = 0;
+	UnmapFile(mountedPack.file, &calls);
+	mountedPack = {};
+
+	std::lock_guard<std::mutex> lock(ioMutex);
+	ioStats.packMounted = false;
+	ioStats.fileSystemCalls += calls;
+}
+
+bool ReadAssetFile(const char* filepath, AssetFile& file)
+{
+	f64 startTime = GetTimestamp();
+
+	file.data = NULL;
+	file.size = 0;
+
+	const AssetPackEntry* entry = FindPackEntry(filepath);
+	if (entry)
+	{
+		const u8* stored = (const u8*)mountedPack.file.data + entry->offset;
+		bool valid = true;
+
+		if (entry->compression == AssetCompression_LZ4)
+		{
+			file.buffer.resize(entry->size);
+			valid = DecompressLZ4(stored, entry->storedSize, file.buffer.data(), entry->size);
+			file.data = file.buffer.data();
+		}
+		else
+		{
+			file.data = stored;
+		}
+		file.size = entry->size;
+
+		if (!valid)
+		{
+			ELOG("Asset pack entry %s is corrupt", filepath);
+			FreeAssetFile(file);
+		}
+
+		std::lock_guard<std::mutex> lock(ioMutex);
+		ioStats.ioMs += (GetTimestamp() - startTime) * 1000.0;
+		if (!valid)
+		{
+			ioStats.failedReads++;
+			return false;
+		}
+		ioStats.packReads++;
+		ioStats.bytesRead += entry->size;
+		ioStats.bytesStored += entry->storedSize;
+		return true;
+	}
+
+	// Dev mode, or a file that was not packed
+	u32 calls = 0;
+	file.mapping = MapFile(filepath, &calls);
+	file.data = (const u8*)file.mapping.data;
+	file.size = file.mapping.size;
+
+	if (file.data)
+		RecordLooseFile(filepath);
+
+	std::lock_guard<std::mutex> lock(ioMutex);
+	ioStats.ioMs += (GetTimestamp() - startTime) * 1000.0;
+	ioStats.fileSystemCalls += calls;
+	if (!file.data)
+	{
+		ioStats.failedReads++;
+		return false;
+	}
+	ioStats.looseReads++;
+	ioStats.bytesRead += file.size;
+	ioStats.bytesStored += file.size;
+	return true;
+}
+
+void FreeAssetFile(AssetFile& file)
+{
+	if (file.mapping.data)
+	{
+		u32 calls = 0;
+		UnmapFile(file.mapping, &calls);
+
+		std::lock_guard<std::mutex> lock(ioMutex);
+		ioStats.fileSystemCalls += calls;
+	}
+
+	std::vector<u8>().swap(file.buffer);
+	file.data = NULL;
+	file.size = 0;
+}
+
+u64 GetAssetTimestamp(const char* filepath)
+{
+	const AssetPackEntry* entry = FindPackEntry(filepath);
+	if (entry)
+		return entry->sourceTimestamp;
+
+	u64 timestamp = GetFileLastWriteTimestamp(filepath);
+	if (timestamp != 0)
+		RecordLooseFile(filepath);
+
+	std::lock_guard<std::mutex> lock(ioMutex);
+	ioStats.fileSystemCalls++;
+	return timestamp;
+}
+
+AssetIoStats GetAssetIoStats()
+{
+	std::lock_guard<std::mutex> lock(ioMutex);
+	return ioStats;
+}
+
+u32 GetLooseAssetCount()
+{
+	std::lock_guard<std::mutex> lock(ioMutex);
+	return (u32)looseFiles.size();
+}
+
+struct PackedFile
+{
+	std::string path;
+	AssetPackEntry entry;
+	std::vector<u8> stored;
+};
+
+bool BuildAssetPack(ThreadPool* pool, const char* filepath)
+{
+	if (mountedPack.header)
+	{
+		ELOG("Asset pack: cannot build %s while a pack is mounted", filepath);
+		return false;
+	}
+
+	std::vector<PackedFile> files;
+	{
+		std::lock_guard<std::mutex> lock(ioMutex);
+		files.resize(looseFiles.size());
+		for (u32 i = 0; i < looseFiles.size(); ++i)
+			files[i].path = looseFiles[i];
+	}
+
+	// Read and compress every file in the workers
+	std::vector<u8> failed(files.size(), 0);
+	ParallelFor(pool, (u32)files.size(), 1, [&](u32 begin, u32 end)
+		{
+			for (u32 i = begin; i < end; ++i)
+			{
+				PackedFile& packed = files[i];
+				MappedFile source = MapFile(packed.path.c_str());
+				if (!source.data)
+				{
+					failed[i] = 1;
+					continue;
+				}
+
+				const u8* data = (const u8*)source.data;
+				packed.entry.nameHash = HashPath(packed.path.c_str());
+				packed.entry.size = source.size;
+				packed.entry.sourceTimestamp = GetFileLastWriteTimestamp(packed.path.c_str());
+
+				packed.stored.resize(GetLZ4CompressBound(source.size));
+				u64 compressedSize = CompressLZ4(data, source.size, packed.stored.data(), packed.stored.size());
+				if (compressedSize > 0 && compressedSize <= source.size - source.size / ASSET_PACK_MIN_SAVING)
+				{
+					packed.entry.compression = AssetCompression_LZ4;
+					packed.stored.resize(compressedSize);
+				}
+				else
+				{
+					packed.entry.compression = AssetCompression_None;
+					packed.stored.assign(data, data + source.size);
+				}
+				packed.entry.storedSize = packed.stored.size();
+
+				UnmapFile(source);
+			}
+		});
+
+	// Files that disappeared since they were read are left out
+	std::vector<PackedFile*> entries;
+	for (u32 i = 0; i < files.size(); ++i)
+		if (!failed[i])
+			entries.push_back(&files[i]);
+
+	std::sort(entries.begin(), entries.end(), [](const PackedFile* a, const PackedFile* b) { return a->entry.nameHash < b->entry.nameHash; });
+	for (u32 i = 1; i < entries.size(); ++i)
+	{
+		if (entries[i - 1]->entry.nameHash == entries[i]->entry.nameHash)
+		{
+			ELOG("Asset pack: %s and %s have the same name hash", entries[i - 1]->path.c_str(), entries[i]->path.c_str());
+			return false;
+		}
+	}
+
+	std::vector<char> strings;
+	for (PackedFile* packed : entries)
+	{
+		packed->entry.nameOffset = (u32)strings.size();
+		strings.insert(strings.end(), packed->path.begin(), packed->path.end());
+		strings.push_back('\0');
+	}
+
+	AssetPackHeader header = {};
+	header.magic = ASSET_PACK_MAGIC;
+	header.version = ASSET_PACK_VERSION;
+	header.entryCount = (u32)entries.size();
+	header.tocOffset = Align((u32)sizeof(AssetPackHeader), ASSET_PACK_ALIGNMENT);
+	header.stringsOffset = header.tocOffset + header.entryCount * sizeof(AssetPackEntry);
+	header.stringsSize = (u32)strings.size();
+
+	u64 offset = Align(header.stringsOffset + header.stringsSize, ASSET_PACK_ALIGNMENT);
+	u64 storedBytes = 0;
+	for (PackedFile* packed : entries)
+	{
+		packed->entry.offset = offset;
+		offset = (offset + packed->entry.storedSize + ASSET_PACK_ALIGNMENT - 1) / ASSET_PACK_ALIGNMENT * ASSET_PACK_ALIGNMENT;
+		storedBytes += packed->entry.size;
+	}
+	header.dataSize = offset;
+
+	FILE* file = fopen(filepath, "wb");
+	if (!file)
+	{
+		ELOG("Asset pack: fopen() failed writing file %s", filepath);
+		return false;
+	}
+
+	const u8 zeros[ASSET_PACK_ALIGNMENT] = {};
+	u64 written = 0;
+	bool writeFailed = false;
+	auto Write = [&](const void* data, u64 size)
+	{
+		if (!writeFailed && fwrite(data, 1, size, file) != size)
+			writeFailed = true;
+		written += size;
+	};
+	auto PadTo = [&](u64 position)
+	{
+		Write(zeros, position - written);
+	};
+
+	Write(&header, sizeof(header));
+	PadTo(header.tocOffset);
+	for (PackedFile* packed : entries)
+		Write(&packed->entry, sizeof(AssetPackEntry));
+	Write(strings.data(), strings.size());
+	for (PackedFile* packed : entries)
+	{
+		PadTo(packed->entry.offset);
+		Write(packed->stored.data(), packed->stored.size());
+	}
+	PadTo(header.dataSize);
+
+	// A short write (a full disk) leaves a truncated pack, which must not be left to mount
+	if (fclose(file) != 0)
+		writeFailed = true;
+	if (writeFailed)
+	{
+		ELOG("Asset pack: fwrite() failed writing file %s", filepath);
+		remove(filepath);
+		return false;
+	}
+
+	ILOG("Asset pack %s: %u files, %.2f MB packed into %.2f MB", filepath, header.entryCount, storedBytes / (1024.0 * 1024.0), header.dataSize / (1024.0 * 1024.0));
+	return true;
+}
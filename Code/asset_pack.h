@@ -0,0 +1,109 @@
+//
+// asset_pack.h: Virtual file layer of the loaders. Files are read from an asset pack, a single
+// archive with a table of contents sorted by path hash that is memory mapped once at startup,
+// or from the loose files in the working directory when there is no pack or the file is not in
+// it. Packs are built from the loose files the app read, so a run in dev mode produces the pack
+// of the next runs.
+//
+
+#pragma once
+
+#include "job_system.h"
+
+#define ASSET_PACK_MAGIC     0x4B434150 // "PACK"
+#define ASSET_PACK_VERSION   1
+#define ASSET_PACK_FILENAME  "assets.pack"
+#define ASSET_PACK_ALIGNMENT 64         // of the table of contents and of every entry
+
+enum AssetCompression
+{
+	AssetCompression_None,
+	AssetCompression_LZ4,
+};
+
+struct AssetPackHeader
+{
+	u32 magic;
+	u32 version;
+	u32 entryCount;
+	u32 tocOffset;       // entries sorted by nameHash
+	u32 stringsOffset;
+	u32 stringsSize;
+	u64 dataSize;        // of the whole pack, to detect truncated files
+};
+
+struct AssetPackEntry
+{
+	u64 nameHash;        // HashPath of the path relative to the working directory
+	u64 offset;          // in bytes from the start of the pack
+	u64 storedSize;
+	u64 size;            // once decompressed
+	u64 sourceTimestamp; // of the loose file it was built from, checked by the baked caches
+	u32 nameOffset;      // in the string table
+	u32 compression;
+};
+
+// Contents of a file read through the virtual file layer
+struct AssetFile
+{
+	const u8* data;
+	u64 size;
+
+	// What owns the contents: nothing for a stored entry of the pack, the mapping of a loose
+	// file, or the buffer of a decompressed entry
+	MappedFile mapping;
+	std::vector<u8> buffer;
+};
+
+// Counted since startup, every file read of the loaders goes through here
+struct AssetIoStats
+{
+	bool packMounted;
+	u32 packEntries;
+	u64 packSize;
+	f64 mountMs;
+
+	u32 packReads;
+	u32 looseReads;
+	u32 failedReads;
+	u32 fileSystemCalls; // open/stat/map/unmap/close issued to the OS, failed ones and the mount included
+	u64 bytesRead;       // as the loaders see them
+	u64 bytesStored;     // as they are in the pack or on disk
+	f64 ioMs;            // opening, mapping and decompressing
+};
+
+/**
+ * Maps the pack and validates its table of contents. Returns false, and keeps reading loose
+ * files, if the pack does not exist or is malformed. Call before any loader runs.
+ */
+bool MountAssetPack(const char* filepath);
+
+void UnmountAssetPack();
+
+/**
+ * Reads a whole file. Stored entries of the pack are returned in place without any copy,
+ * compressed ones are decompressed and loose files are mapped. Safe in any thread.
+ */
+bool ReadAssetFile(const char* filepath, AssetFile& file);
+
+void FreeAssetFile(AssetFile& file);
+
+/**
+ * Last write time of the loose file a packed entry was built from, or of the loose file.
+ */
+u64 GetAssetTimestamp(const char* filepath);
+
+AssetIoStats GetAssetIoStats();
+
+/**
+ * Number of distinct loose files read so far, or whose timestamp was checked by a baked cache,
+ * which BuildAssetPack would pack.
+ */
+u32 GetLooseAssetCount();
+
+/**
+ * Writes a pack with every loose file counted by GetLooseAssetCount, compressing in the worker
+ * threads the entries that LZ4 shrinks enough. It is used from the next mount on, so it fails
+ * while a pack is mounted (entries may still be referenced in place).
+ */
+bool BuildAssetPack(ThreadPool* pool, const char* filepath);
@@ -0,0 +1,115 @@
+#include "asset_registry.h"
+#include <ctype.h>
+
+static const u64 Prime1 = 11400714785074694791ull;
+static const u64 Prime2 = 14029467366897019727ull;
+static const u64 Prime3 = 1609587929392839161ull;
+static const u64 Prime4 = 9650029242287828579ull;
+static const u64 Prime5 = 2870177450012600261ull;
+
+static u64 RotateLeft(u64 value, u32 bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static u64 Read64(const u8* p)
+{
+	u64 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static u32 Read32(const u8* p)
+{
+	u32 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static u64 Round(u64 accumulator, u64 input)
+{
+	accumulator += input * Prime2;
+	accumulator = RotateLeft(accumulator, 31);
+	return accumulator * Prime1;
+}
+
+static u64 MergeRound(u64 accumulator, u64 value)
+{
+	accumulator ^= Round(0, value);
+	return accumulator * Prime1 + Prime4;
+}
+
+u64 HashBytes(const void* data, u64 size, u64 seed)
+{
+	const u8* p = (const u8*)data;
+	const u8* end = p + size;
+	u64 hash;
+
+	if (size >= 32)
+	{
+		// Four independent lanes of 8 bytes each
+		u64 v1 = seed + Prime1 + Prime2;
+		u64 v2 = seed + Prime2;
+		u64 v3 = seed;
+		u64 v4 = seed - Prime1;
+
+		const u8* limit = end - 32;
+		do
+		{
+			v1 = Round(v1, Read64(p)); p += 8;
+			v2 = Round(v2, Read64(p)); p += 8;
+			v3 = Round(v3, Read64(p)); p += 8;
+			v4 = Round(v4, Read64(p)); p += 8;
+		} while (p <= limit);
+
+		hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+		hash = MergeRound(hash, v1);
+		hash = MergeRound(hash, v2);
+		hash = MergeRound(hash, v3);
+		hash = MergeRound(hash, v4);
+	}
+	else
+	{
+		hash = seed + Prime5;
+	}
+
+	hash += size;
+
+	for (; p + 8 <= end; p += 8)
+		hash = RotateLeft(hash ^ Round(0, Read64(p)), 27) * Prime1 + Prime4;
+
+	if (p + 4 <= end)
+	{
+		hash = RotateLeft(hash ^ (Read32(p) * Prime1), 23) * Prime2 + Prime3;
+		p += 4;
+	}
+
+	for (; p < end; ++p)
+		hash = RotateLeft(hash ^ (*p * Prime5), 11) * Prime1;
+
+	hash ^= hash >> 33;
+	hash *= Prime2;
+	hash ^= hash >> 29;
+	hash *= Prime3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+u64 HashPath(const char* path)
+{
+	std::string interned = path;
+	for (char& c : interned)
+		c = c == '\\' ? '/' : (char)tolower((u8)c);
+	return HashBytes(interned.data(), interned.size());
+}
+
+u32 FindAsset(const AssetMap& map, u64 hash)
+{
+	AssetMap::const_iterator it = map.find(hash);
+	return it != map.end() ? it->second : UINT32_MAX;
+}
+
+void RegisterAsset(AssetMap& map, u64 hash, u32 index)
+{
+	map.emplace(hash, index);
+}
@@ -0,0 +1,48 @@
+//
+// asset_registry.h: Hash maps used to find already loaded assets in O(1), both by the path
+// they were loaded from and by the hash of their contents, so identical textures, meshes and
+// materials are shared instead of being uploaded again.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <unordered_map>
+
+typedef std::unordered_map<u64, u32> AssetMap; // hash -> index in the App arrays
+
+struct AssetRegistry
+{
+	AssetMap texturePaths;     // interned path -> texture
+	AssetMap textureContents;  // GPU payload (pixels or blocks) -> texture
+	AssetMap meshContents;     // layouts, vertices and indices -> mesh
+	AssetMap materialContents; // parameters and textures -> material
+	AssetMap modelPaths;       // file path or procedural parameters -> model
+
+	// What deduplication saved
+	u32 duplicateTextures;
+	u32 duplicateMeshes;
+	u32 duplicateMaterials;
+	u32 duplicateModels;
+	u64 textureBytesSaved;
+	u64 meshBytesSaved;
+};
+
+/**
+ * 64 bit hash of a block of memory (xxHash64). Chained calls hash several blocks by passing
+ * the previous hash as the seed.
+ */
+u64 HashBytes(const void* data, u64 size, u64 seed = 0);
+
+/**
+ * Hash of a path after interning it: separators and case are normalized so different
+ * spellings of the same file map to the same asset.
+ */
+u64 HashPath(const char* path);
+
+/**
+ * Returns the index registered for the hash, or UINT32_MAX.
+ */
+u32 FindAsset(const AssetMap& map, u64 hash);
+
+void RegisterAsset(AssetMap& map, u64 hash, u32 index);
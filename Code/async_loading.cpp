@@ -0,0 +1,137 @@
+#include "async_loading.h"
+#include <deque>
+
+struct AsyncLoad
+{
+	AsyncLoad*          next; // in the completed stack
+	AsyncLoadFunction   load;
+	AsyncUploadFunction upload;
+	u64                 uploadBytes;
+};
+
+struct AsyncLoader
+{
+	// Workers push the loads they finish without taking a lock. The main thread takes the whole
+	// stack at once and never pops single entries, so the stack cannot suffer from ABA.
+	std::atomic<AsyncLoad*> completed{ NULL };
+
+	// Completed loads in the order they finished, waiting for upload budget. Main thread only.
+	std::deque<AsyncLoad*> ready;
+
+	JobCounter jobs;
+};
+
+static void PushCompleted(AsyncLoader* loader, AsyncLoad* load)
+{
+	AsyncLoad* head = loader->completed.load(std::memory_order_relaxed);
+	do
+	{
+		load->next = head;
+	} while (!loader->completed.compare_exchange_weak(head, load, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// Moves the completed stack, newest first, to the end of the ready list in completion order
+static void TakeCompleted(AsyncLoader* loader)
+{
+	AsyncLoad* load = loader->completed.exchange(NULL, std::memory_order_acquire);
+
+	AsyncLoad* reversed = NULL;
+	while (load)
+	{
+		AsyncLoad* next = load->next;
+		load->next = reversed;
+		reversed = load;
+		load = next;
+	}
+
+	for (load = reversed; load; load = load->next)
+		loader->ready.push_back(load);
+}
+
+AsyncLoader* CreateAsyncLoader()
+{
+	return new AsyncLoader();
+}
+
+void DestroyAsyncLoader(ThreadPool* pool, AsyncLoader* loader)
+{
+	WaitForCounter(pool, &loader->jobs);
+	TakeCompleted(loader);
+
+	for (AsyncLoad* load : loader->ready)
+		delete load;
+
+	delete loader;
+}
+
+void SubmitAsyncLoad(App* app, AsyncLoadFunction load, AsyncUploadFunction upload)
+{
+	AsyncLoader* loader = app->asyncLoader;
+
+	AsyncLoad* asyncLoad = new AsyncLoad();
+	asyncLoad->load = std::move(load);
+	asyncLoad->upload = std::move(upload);
+
+	app->streamingStats.pendingLoads++;
+
+	SubmitJob(app->threadPool, [loader, asyncLoad]
+		{
+			asyncLoad->uploadBytes = asyncLoad->load();
+			asyncLoad->load = nullptr;
+			PushCompleted(loader, asyncLoad);
+		}, &loader->jobs);
+}
+
+void ProcessAsyncLoads(App* app)
+{
+	AsyncLoader* loader = app->asyncLoader;
+	const StreamingSettings& settings = app->streamingSettings;
+	StreamingStats& stats = app->streamingStats;
+
+	if (stats.frameCount == 0)
+		stats.timeToFirstFrameMs = (GetTimestamp() - stats.initStartTime) * 1000.0;
+
+	TakeCompleted(loader);
+
+	// Uploads may submit more loads (a model requests its textures), they are counted as pending
+	f64 startTime = GetTimestamp();
+	u64 frameBytes = 0;
+	u32 frameUploads = 0;
+
+	while (!loader->ready.empty())
+	{
+		AsyncLoad* load = loader->ready.front();
+
+		f64 elapsedMs = (GetTimestamp() - startTime) * 1000.0;
+		bool overBudget = frameBytes + load->uploadBytes > settings.uploadBudgetBytes || elapsedMs >= settings.uploadBudgetMs;
+		if (overBudget && frameUploads > 0)
+			break;
+
+		loader->ready.pop_front();
+		load->upload();
+		frameBytes += load->uploadBytes;
+		frameUploads++;
+		delete load;
+
+		stats.pendingLoads--;
+		stats.uploadedLoads++;
+	}
+
+	f32 uploadMs = (f32)((GetTimestamp() - startTime) * 1000.0);
+	stats.uploadedBytes += frameBytes;
+	stats.completedLoads = (u32)loader->ready.size();
+
+	if (stats.pendingLoads == 0 && stats.uploadedLoads > 0 && stats.timeToResidentMs == 0.0)
+		stats.timeToResidentMs = (GetTimestamp() - stats.initStartTime) * 1000.0;
+
+	// Frame times while something streams are what the budget is meant to keep flat
+	f32 frameMs = app->deltaTime * 1000.0f;
+	u32 slot = stats.frameCount % STREAMING_FRAME_HISTORY;
+	stats.frameMs[slot] = frameMs;
+	stats.uploadMs[slot] = uploadMs;
+	stats.frameCount++;
+
+	if (stats.pendingLoads > 0 || frameUploads > 0)
+		stats.maxStreamingFrameMs = glm::max(stats.maxStreamingFrameMs, frameMs);
+	stats.maxUploadMs = glm::max(stats.maxUploadMs, uploadMs);
+}
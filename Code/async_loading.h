@@ -0,0 +1,33 @@
+//
+// async_loading.h: Loads that run in the worker threads while the app keeps rendering. Each load
+// has a CPU part (file I/O, decoding, processing) that runs in the pool and an upload part that
+// runs in the main thread, a few of them per frame within the streaming budget.
+//
+
+#pragma once
+
+#include "engine.h"
+#include <functional>
+
+// Runs in a worker thread, returns how many bytes the upload will send to the GPU
+typedef std::function<u64()> AsyncLoadFunction;
+
+// Runs in the main thread, the only part of a load allowed to touch OpenGL and the app
+typedef std::function<void()> AsyncUploadFunction;
+
+AsyncLoader* CreateAsyncLoader();
+
+/**
+ * Waits for the loads still running in the workers and drops the ones that were not uploaded.
+ * Must be called before the thread pool is destroyed.
+ */
+void DestroyAsyncLoader(ThreadPool* pool, AsyncLoader* loader);
+
+void SubmitAsyncLoad(App* app, AsyncLoadFunction load, AsyncUploadFunction upload);
+
+/**
+ * Called once per frame from the main thread. Uploads the completed loads in the order they
+ * finished while they fit in app->streamingSettings, at least one per frame so a large load
+ * cannot starve, and updates app->streamingStats.
+ */
+void ProcessAsyncLoads(App* app);
@@ -0,0 +1,1347 @@
+#include "benchmarks.h"
+#include "mipmap.h"
+#include "mesh_conversion.h"
+#include "obj_loader.h"
+#include "indirect_draws.h"
+#include "gpu_culling.h"
+#include "async_loading.h"
+#include "mesh_cache.h"
+#include "vertex_quantization.h"
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+
+#define BENCHMARK_LOG(app, ...)                 \
+{                                               \
+char benchmarkBuffer[1024] = {};                \
+sprintf(benchmarkBuffer, __VA_ARGS__);          \
+LogString(benchmarkBuffer);                     \
+(app)->benchmarkLog.push_back(benchmarkBuffer); \
+}
+
+void BenchmarkModelCache(App* app)
+{
+	const char* modelPath = "Patrick/Patrick.obj";
+	const u32 repetitions = 3;
+	std::string cachePath = std::string(modelPath) + MESH_CACHE_EXTENSION;
+
+	BENCHMARK_LOG(app, "Model cache: %s, %u loads each, %s", modelPath, repetitions, GetVertexQuantizationName(app->vertexQuantization));
+
+	f64 coldSeconds = 0.0;
+	f64 warmSeconds = 0.0;
+	for (u32 i = 0; i < repetitions; ++i)
+	{
+		// Cold: no cache, so the file is parsed, prepared and its cache written
+		remove(cachePath.c_str());
+		ModelData cold = {};
+		f64 startTime = GetTimestamp();
+		bool coldLoaded = LoadModelData(app->threadPool, modelPath, app->vertexQuantization, app->lodSettings, cold);
+		coldSeconds += GetTimestamp() - startTime;
+		FreeAssetFile(cold.cacheFile);
+
+		if (!coldLoaded || cold.fromCache)
+		{
+			BENCHMARK_LOG(app, "  %s", coldLoaded ? "could not load cold, the asset pack holds the cache" : "could not load the model");
+			return;
+		}
+
+		// Warm: the same model again, read from the cache just written
+		ModelData warm = {};
+		startTime = GetTimestamp();
+		bool warmLoaded = LoadModelData(app->threadPool, modelPath, app->vertexQuantization, app->lodSettings, warm);
+		warmSeconds += GetTimestamp() - startTime;
+		FreeAssetFile(warm.cacheFile);
+
+		if (!warmLoaded || !warm.fromCache)
+		{
+			BENCHMARK_LOG(app, "  the second load did not hit the cache");
+			return;
+		}
+	}
+
+	f64 coldMs = coldSeconds * 1000.0 / repetitions;
+	f64 warmMs = warmSeconds * 1000.0 / repetitions;
+	BENCHMARK_LOG(app, "  cold, import and cache write: %8.2f ms", coldMs);
+	BENCHMARK_LOG(app, "  warm, cache read:             %8.2f ms (%.1fx faster)", warmMs, warmMs > 0.0 ? coldMs / warmMs : 0.0);
+}
+
+void BenchmarkTextureDecode(App* app)
+{
+	const u32 repetitions = 8;
+
+	std::vector<std::string> files;
+	for (const Texture& texture : app->textures)
+		for (u32 i = 0; i < repetitions; ++i)
+			files.push_back(texture.filepath);
+
+	if (files.empty())
+	{
+		BENCHMARK_LOG(app, "Texture decode: no textures loaded");
+		return;
+	}
+
+	u32 maxThreads = std::thread::hardware_concurrency();
+	if (maxThreads == 0)
+		maxThreads = 1;
+
+	BENCHMARK_LOG(app, "Texture decode: %u images", (u32)files.size());
+
+	for (u32 threadCount = 1; ; threadCount *= 2)
+	{
+		if (threadCount > maxThreads)
+			threadCount = maxThreads;
+
+		std::atomic<u32> nextFile{ 0 };
+		std::atomic<u64> decodedBytes{ 0 };
+
+		auto decodeLoop = [&]
+		{
+			for (u32 fileIdx = nextFile++; fileIdx < files.size(); fileIdx = nextFile++)
+			{
+				Image image = LoadImage(files[fileIdx].c_str());
+				if (image.pixels)
+				{
+					decodedBytes += (u64)image.stride * image.size.y;
+					FreeImage(image);
+				}
+			}
+		};
+
+		f64 startTime = GetTimestamp();
+
+		std::vector<std::thread> threads;
+		for (u32 i = 0; i < threadCount; ++i)
+			threads.emplace_back(decodeLoop);
+		for (std::thread& thread : threads)
+			thread.join();
+
+		f64 seconds = GetTimestamp() - startTime;
+		f64 megabytes = (f64)decodedBytes / (f64)MB(1);
+
+		BENCHMARK_LOG(app, "  %2u threads: %8.2f ms, %8.2f MB/s", threadCount, seconds * 1000.0, megabytes / seconds);
+
+		if (threadCount == maxThreads)
+			break;
+	}
+}
+
+void BenchmarkMipGeneration(App* app)
+{
+	struct SourceImage
+	{
+		std::vector<u8> rgba;
+		ivec2 size;
+	};
+
+	std::vector<SourceImage> images;
+	u64 totalPixels = 0;
+	for (const Texture& texture : app->textures)
+	{
+		Image image = LoadImage(texture.filepath.c_str());
+		if (image.pixels)
+		{
+			images.push_back({ ConvertImageToRGBA8(image), image.size });
+			totalPixels += (u64)image.size.x * image.size.y;
+			FreeImage(image);
+		}
+	}
+
+	if (images.empty())
+	{
+		BENCHMARK_LOG(app, "Mip generation: no textures loaded");
+		return;
+	}
+
+	BENCHMARK_LOG(app, "Mip generation: %u images, %.2f Mpixels, %s, %s", (u32)images.size(), totalPixels / 1000000.0, MipChainUsesAVX2() ? "AVX2" : "SSE2", app->openglInfo.renderer);
+
+	// Driver generated mips, synchronized with glFinish to include the GPU (or llvmpipe) work
+	glFinish();
+	f64 startTime = GetTimestamp();
+	for (const SourceImage& image : images)
+	{
+		GLuint texHandle;
+		glGenTextures(1, &texHandle);
+		glBindTexture(GL_TEXTURE_2D, texHandle);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.size.x, image.size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.rgba.data());
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glFinish();
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glDeleteTextures(1, &texHandle);
+	}
+	f64 seconds = GetTimestamp() - startTime;
+	BENCHMARK_LOG(app, "  %-22s %8.2f ms", "glGenerateMipmap:", seconds * 1000.0);
+
+	for (u32 filter = 0; filter < MipFilter_Count; ++filter)
+	{
+		for (u32 srgb = 0; srgb < 2; ++srgb)
+		{
+			f64 cpuSeconds = 0.0;
+			startTime = GetTimestamp();
+			for (const SourceImage& image : images)
+			{
+				f64 cpuStartTime = GetTimestamp();
+				MipChain chain;
+				GenerateMipChain(app->threadPool, image.rgba.data(), image.size, (MipFilter)filter, srgb != 0, &chain);
+				cpuSeconds += GetTimestamp() - cpuStartTime;
+
+				GLuint texHandle = CreateTexture2DFromMipChain(chain, GL_RGBA8);
+				glFinish();
+				glDeleteTextures(1, &texHandle);
+			}
+			seconds = GetTimestamp() - startTime;
+
+			char name[64];
+			sprintf(name, "%s%s:", GetMipFilterName((MipFilter)filter), srgb ? " sRGB" : "");
+			BENCHMARK_LOG(app, "  %-22s %8.2f ms (CPU %8.2f ms, %8.2f Mpixels/s)", name, seconds * 1000.0, cpuSeconds * 1000.0, totalPixels / 1000000.0 / cpuSeconds);
+		}
+	}
+}
+
+static aiMesh* CreateSyntheticAssimpMesh(u32 vertexCount, bool hasTexCoords, bool hasTangentSpace)
+{
+	aiMesh* mesh = new aiMesh();
+	mesh->mPrimitiveTypes = aiPrimitiveType_TRIANGLE;
+	mesh->mNumVertices = vertexCount;
+	mesh->mVertices = new aiVector3D[vertexCount];
+	mesh->mNormals = new aiVector3D[vertexCount];
+	if (hasTexCoords)
+	{
+		mesh->mTextureCoords[0] = new aiVector3D[vertexCount];
+		mesh->mNumUVComponents[0] = 2;
+	}
+	if (hasTangentSpace)
+	{
+		mesh->mTangents = new aiVector3D[vertexCount];
+		mesh->mBitangents = new aiVector3D[vertexCount];
+	}
+
+	for (u32 i = 0; i < vertexCount; ++i)
+	{
+		f32 t = (f32)i;
+		mesh->mVertices[i].Set(t, t * 0.5f, t * 0.25f);
+		mesh->mNormals[i].Set(0.0f, 1.0f, 0.0f);
+		if (hasTexCoords)
+			mesh->mTextureCoords[0][i].Set(t * 0.001f, t * 0.002f, 0.0f);
+		if (hasTangentSpace)
+		{
+			mesh->mTangents[i].Set(1.0f, 0.0f, 0.0f);
+			mesh->mBitangents[i].Set(0.0f, 0.0f, 1.0f);
+		}
+	}
+
+	// One triangle per vertex, all of them valid
+	mesh->mNumFaces = vertexCount;
+	mesh->mFaces = new aiFace[vertexCount];
+	for (u32 i = 0; i < vertexCount; ++i)
+	{
+		aiFace& face = mesh->mFaces[i];
+		face.mNumIndices = 3;
+		face.mIndices = new unsigned int[3];
+		face.mIndices[0] = i;
+		face.mIndices[1] = (i + 1) % vertexCount;
+		face.mIndices[2] = (i + 2) % vertexCount;
+	}
+
+	return mesh;
+}
+
+// How ProcessAssimpMesh used to convert meshes, kept as the baseline
+static void ConvertAssimpMeshPushBack(const aiMesh* mesh, std::vector<float>& vertices, std::vector<u32>& indices)
+{
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+	{
+		vertices.push_back(mesh->mVertices[i].x);
+		vertices.push_back(mesh->mVertices[i].y);
+		vertices.push_back(mesh->mVertices[i].z);
+		vertices.push_back(mesh->mNormals[i].x);
+		vertices.push_back(mesh->mNormals[i].y);
+		vertices.push_back(mesh->mNormals[i].z);
+
+		if (mesh->mTextureCoords[0])
+		{
+			vertices.push_back(mesh->mTextureCoords[0][i].x);
+			vertices.push_back(mesh->mTextureCoords[0][i].y);
+		}
+
+		if (mesh->mTangents != nullptr && mesh->mBitangents)
+		{
+			vertices.push_back(mesh->mTangents[i].x);
+			vertices.push_back(mesh->mTangents[i].y);
+			vertices.push_back(mesh->mTangents[i].z);
+			vertices.push_back(-mesh->mBitangents[i].x);
+			vertices.push_back(-mesh->mBitangents[i].y);
+			vertices.push_back(-mesh->mBitangents[i].z);
+		}
+	}
+
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	{
+		aiFace face = mesh->mFaces[i];
+		for (unsigned int j = 0; j < face.mNumIndices; j++)
+		{
+			indices.push_back(face.mIndices[j]);
+		}
+	}
+}
+
+void BenchmarkVertexConversion(App* app)
+{
+	const u32 vertexCount = 1000000;
+	const char* attributeSetNames[] = { "P N", "P N UV", "P N T B", "P N UV T B" };
+
+	BENCHMARK_LOG(app, "Vertex conversion: %u vertices, %u triangles", vertexCount, vertexCount);
+
+	for (u32 attributeSet = 0; attributeSet < 4; ++attributeSet)
+	{
+		bool hasTexCoords = (attributeSet & 1) != 0;
+		bool hasTangentSpace = (attributeSet & 2) != 0;
+		aiMesh* mesh = CreateSyntheticAssimpMesh(vertexCount, hasTexCoords, hasTangentSpace);
+
+		f64 startTime = GetTimestamp();
+		{
+			std::vector<float> vertices;
+			std::vector<u32> indices;
+			ConvertAssimpMeshPushBack(mesh, vertices, indices);
+		}
+		f64 pushBackSeconds = GetTimestamp() - startTime;
+
+		startTime = GetTimestamp();
+		{
+			u32 floatsPerVertex = MakeAssimpVertexLayout(hasTexCoords, hasTangentSpace).stride / sizeof(float);
+			std::vector<float> vertices((size_t)vertexCount * floatsPerVertex);
+			std::vector<u32> indices(CountAssimpIndices(mesh));
+			ConvertAssimpVertices(mesh, hasTexCoords, hasTangentSpace, 0, vertexCount, vertices.data());
+			ConvertAssimpFaces(mesh, indices.data());
+		}
+		f64 kernelSeconds = GetTimestamp() - startTime;
+
+		startTime = GetTimestamp();
+		{
+			Submesh submesh = {};
+			ConvertAssimpMesh(app->threadPool, mesh, &submesh);
+		}
+		f64 parallelSeconds = GetTimestamp() - startTime;
+
+		BENCHMARK_LOG(app, "  %-11s push_back %7.1f Mvert/s, kernel %7.1f Mvert/s, parallel %7.1f Mvert/s",
+			attributeSetNames[attributeSet],
+			vertexCount / pushBackSeconds / 1000000.0,
+			vertexCount / kernelSeconds / 1000000.0,
+			vertexCount / parallelSeconds / 1000000.0);
+
+		delete mesh;
+	}
+}
+
+// A torus of segments x segments quads in four materials, about 180 bytes per quad
+static bool WriteSyntheticObj(const char* objPath, const char* mtlName, u32 segments)
+{
+	FILE* file = fopen(objPath, "wb");
+	if (!file)
+		return false;
+
+	static char buffer[MB(1)];
+	setvbuf(file, buffer, _IOFBF, sizeof(buffer));
+
+	fprintf(file, "# Synthetic OBJ for the import benchmark\nmtllib %s\n", mtlName);
+
+	const f32 majorRadius = 1.0f;
+	const f32 minorRadius = 0.25f;
+	for (u32 i = 0; i < segments; ++i)
+	{
+		f32 u = TAU * i / segments;
+		for (u32 j = 0; j < segments; ++j)
+		{
+			f32 v = TAU * j / segments;
+			vec3 normal = vec3(cosf(u) * cosf(v), sinf(v), sinf(u) * cosf(v));
+			vec3 position = vec3(cosf(u) * majorRadius, 0.0f, sinf(u) * majorRadius) + normal * minorRadius;
+			fprintf(file, "v %.6f %.6f %.6f\n", position.x, position.y, position.z);
+			fprintf(file, "vt %.6f %.6f\n", (f32)i / segments, (f32)j / segments);
+			fprintf(file, "vn %.6f %.6f %.6f\n", normal.x, normal.y, normal.z);
+		}
+	}
+
+	for (u32 i = 0; i < segments; ++i)
+	{
+		if (i % (segments / 4 + 1) == 0)
+			fprintf(file, "usemtl Material%u\n", i / (segments / 4 + 1));
+
+		for (u32 j = 0; j < segments; ++j)
+		{
+			u32 a = i * segments + j + 1;
+			u32 b = ((i + 1) % segments) * segments + j + 1;
+			u32 c = ((i + 1) % segments) * segments + (j + 1) % segments + 1;
+			u32 d = i * segments + (j + 1) % segments + 1;
+			fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, d, d, d, c, c, c, b, b, b);
+		}
+	}
+
+	bool written = ferror(file) == 0;
+	fclose(file);
+	return written;
+}
+
+void BenchmarkObjImport(App* app)
+{
+	const char* objPath = "benchmark_import.obj";
+	const char* mtlPath = "benchmark_import.mtl";
+	const u32 segments = 1300;
+
+	// Generated once and kept next to the executable, it takes a few seconds to write
+	MappedFile file = MapFile(objPath);
+	if (!file.data)
+	{
+		FILE* mtl = fopen(mtlPath, "wb");
+		if (mtl)
+		{
+			for (u32 i = 0; i < 4; ++i)
+				fprintf(mtl, "newmtl Material%u\nNs 64\nKd 0.8 %.1f 0.2\n\n", i, i * 0.25f);
+			fclose(mtl);
+		}
+
+		if (!WriteSyntheticObj(objPath, mtlPath, segments))
+		{
+			BENCHMARK_LOG(app, "OBJ import: could not write %s", objPath);
+			return;
+		}
+		file = MapFile(objPath);
+	}
+
+	if (!file.data)
+	{
+		BENCHMARK_LOG(app, "OBJ import: could not open %s", objPath);
+		return;
+	}
+
+	// Touch every page so both importers read the file from memory
+	volatile u8 touched = 0;
+	for (u64 i = 0; i < file.size; i += KB(4))
+		touched += ((const u8*)file.data)[i];
+	f64 megabytes = (f64)file.size / (f64)MB(1);
+	UnmapFile(file);
+
+	BENCHMARK_LOG(app, "OBJ import: %s, %.1f MB", objPath, megabytes);
+
+	const u32 maxWorkers = GetWorkerCount(app->threadPool);
+	for (u32 workerCount = 1; ; workerCount *= 2)
+	{
+		if (workerCount > maxWorkers)
+			workerCount = maxWorkers;
+
+		ThreadPool* pool = workerCount == maxWorkers ? app->threadPool : CreateThreadPool(workerCount);
+
+		f64 startTime = GetTimestamp();
+		ObjModel obj;
+		bool parsed = ParseObjModel(pool, objPath, obj);
+		f64 seconds = GetTimestamp() - startTime;
+
+		if (pool != app->threadPool)
+			DestroyThreadPool(pool);
+
+		if (!parsed)
+		{
+			BENCHMARK_LOG(app, "  native parser failed");
+			return;
+		}
+
+		u32 vertexCount = 0;
+		for (const Submesh& submesh : obj.mesh.submeshes)
+			vertexCount += (u32)(submesh.vertices.size() / (submesh.vbLayout.stride / sizeof(float)));
+
+		// The calling thread helps the workers
+		BENCHMARK_LOG(app, "  native, %2u threads: %8.2f ms, %8.2f MB/s, %u submeshes, %u vertices, %u triangles",
+			workerCount + 1, seconds * 1000.0, megabytes / seconds, (u32)obj.mesh.submeshes.size(), vertexCount, obj.triangleCount);
+
+		if (workerCount == maxWorkers)
+			break;
+	}
+
+	// Assimp with the flags of ImportModel, up to the same submesh data
+	{
+		f64 startTime = GetTimestamp();
+
+		const aiScene* scene = aiImportFile(objPath, LOAD_MODEL_POSTPROCESS_FLAGS);
+		if (!scene)
+		{
+			BENCHMARK_LOG(app, "  Assimp failed: %s", aiGetErrorString());
+			return;
+		}
+
+		u32 vertexCount = 0;
+		u32 triangleCount = 0;
+		std::vector<Submesh> submeshes(scene->mNumMeshes);
+		for (u32 i = 0; i < scene->mNumMeshes; ++i)
+		{
+			ConvertAssimpMesh(app->threadPool, scene->mMeshes[i], &submeshes[i]);
+			vertexCount += scene->mMeshes[i]->mNumVertices;
+			triangleCount += scene->mMeshes[i]->mNumFaces;
+		}
+		aiReleaseImport(scene);
+
+		f64 seconds = GetTimestamp() - startTime;
+
+		BENCHMARK_LOG(app, "  Assimp:             %8.2f ms, %8.2f MB/s, %u submeshes, %u vertices, %u triangles",
+			seconds * 1000.0, megabytes / seconds, (u32)submeshes.size(), vertexCount, triangleCount);
+	}
+}
+
+void BenchmarkEntityCount(App* app)
+{
+	if (app->entities.empty())
+	{
+		BENCHMARK_LOG(app, "Entity count: no entities in the scene");
+		return;
+	}
+
+	const u32 entityCounts[] = { 100, 1000, 10000, 100000 };
+	const u32 frameCount = 8;
+
+	std::vector<Entity> sceneEntities = app->entities;
+	Mode sceneMode = app->mode;
+	bool sceneIndirect = app->indirectDraws;
+	app->mode = Mode_Mesh;
+	app->indirectDraws = false;
+
+	BENCHMARK_LOG(app, "Entity count: %u frames each, copies of the first entity", frameCount);
+
+	for (u32 entityCount : entityCounts)
+	{
+		// Square grid around the origin, one unit apart
+		u32 side = (u32)ceilf(sqrtf((f32)entityCount));
+		app->entities.assign(entityCount, sceneEntities[0]);
+		for (u32 i = 0; i < entityCount; ++i)
+		{
+			vec3 offset = vec3((f32)(i % side) - side * 0.5f, 0.0f, (f32)(i / side) - side * 0.5f);
+			SetEntityWorldMatrix(app, i, glm::translate(offset) * sceneEntities[0].worldMatrix);
+		}
+		InvalidateTransforms(app);
+
+		// Static entities only upload their matrices in the first frame, dynamic ones every frame
+		for (u32 dynamic = 0; dynamic < 2; ++dynamic)
+		{
+			for (u32 i = 0; i < entityCount; ++i)
+				SetEntityDynamic(app, i, dynamic != 0);
+
+			Update(app);
+			Render(app);
+			glFinish();
+
+			f64 updateSeconds = 0.0;
+			f64 renderSeconds = 0.0;
+			u64 uploadedBytes = 0;
+			f64 startTime = GetTimestamp();
+			for (u32 frame = 0; frame < frameCount; ++frame)
+			{
+				f64 updateStart = GetTimestamp();
+				Update(app);
+				f64 renderStart = GetTimestamp();
+				Render(app);
+				f64 renderEnd = GetTimestamp();
+
+				updateSeconds += renderStart - updateStart;
+				renderSeconds += renderEnd - renderStart;
+
+				const FrameUploadStats& uploads = app->uploadStats;
+				uploadedBytes += uploads.globalParamsBytes + uploads.transformBytes + uploads.drawDataBytes;
+			}
+			glFinish();
+			f64 frameSeconds = GetTimestamp() - startTime;
+
+			BENCHMARK_LOG(app, "  %6u %-8s entities: update %8.3f ms, render %8.3f ms, with the GPU %8.3f ms per frame, %.1f KB uploaded per frame",
+				entityCount, dynamic ? "dynamic" : "static", updateSeconds * 1000.0 / frameCount, renderSeconds * 1000.0 / frameCount,
+				frameSeconds * 1000.0 / frameCount, uploadedBytes / 1024.0 / frameCount);
+		}
+	}
+
+	app->entities = sceneEntities;
+	InvalidateTransforms(app);
+	app->mode = sceneMode;
+	app->indirectDraws = sceneIndirect;
+}
+
+void BenchmarkDrawSubmission(App* app)
+{
+	if (app->entities.empty())
+	{
+		BENCHMARK_LOG(app, "Draw submission: no entities in the scene");
+		return;
+	}
+
+	const u32 targetDraws = 10000;
+	const u32 frameCount = 16;
+
+	std::vector<Entity> sceneEntities = app->entities;
+	Mode sceneMode = app->mode;
+	bool sceneIndirect = app->indirectDraws;
+	bool sceneFrustumCulling = app->meshletFrustumCulling;
+	bool sceneConeCulling = app->meshletConeCulling;
+	bool sceneLods = app->lodSettings.enabled;
+	bool sceneInstancing = app->instancing;
+	bool sceneEntityCulling = app->entityFrustumCulling;
+	bool sceneOcclusion = app->occlusionSettings.enabled;
+
+	// Every submesh of every entity is drawn, each one its own draw
+	app->mode = Mode_Mesh;
+	app->instancing = false;
+	app->entityFrustumCulling = false;
+	app->occlusionSettings.enabled = false;
+	app->meshletFrustumCulling = false;
+	app->meshletConeCulling = false;
+	app->lodSettings.enabled = false;
+
+	const Model& model = app->models[sceneEntities[0].modelIndex];
+	u32 submeshCount = glm::max((u32)app->meshes[model.meshIdx].submeshes.size(), 1u);
+	u32 entityCount = (targetDraws + submeshCount - 1) / submeshCount;
+	u32 side = (u32)ceilf(sqrtf((f32)entityCount));
+
+	app->entities.assign(entityCount, sceneEntities[0]);
+	for (u32 i = 0; i < entityCount; ++i)
+	{
+		vec3 offset = vec3((f32)(i % side) - side * 0.5f, 0.0f, (f32)(i / side) - side * 0.5f);
+		SetEntityWorldMatrix(app, i, glm::translate(offset) * sceneEntities[0].worldMatrix);
+	}
+	InvalidateTransforms(app);
+
+	BENCHMARK_LOG(app, "Draw submission: %u entities of %u submeshes, %u frames each", entityCount, submeshCount, frameCount);
+
+	for (u32 indirect = 0; indirect < 2; ++indirect)
+	{
+		app->indirectDraws = indirect != 0;
+
+		// A first frame creates the vertex arrays and the pages of the rings
+		Update(app);
+		Render(app);
+		glFinish();
+
+		f64 submissionMs = 0.0;
+		f64 startTime = GetTimestamp();
+		for (u32 frame = 0; frame < frameCount; ++frame)
+		{
+			Update(app);
+			Render(app);
+			submissionMs += app->meshSubmissionMs;
+		}
+		glFinish();
+		f64 frameSeconds = GetTimestamp() - startTime;
+
+		const MeshletCullingStats& stats = app->meshletStats;
+		BENCHMARK_LOG(app, "  %-22s submission %8.3f ms, with the GPU %8.3f ms per frame, %u draw calls, %u vertex array binds",
+			indirect ? "indirect buckets:" : "one call per submesh:", submissionMs / frameCount, frameSeconds * 1000.0 / frameCount, stats.drawCalls, stats.vertexArrayBinds);
+	}
+
+	app->entities = sceneEntities;
+	InvalidateTransforms(app);
+	app->mode = sceneMode;
+	app->indirectDraws = sceneIndirect;
+	app->meshletFrustumCulling = sceneFrustumCulling;
+	app->meshletConeCulling = sceneConeCulling;
+	app->lodSettings.enabled = sceneLods;
+	app->instancing = sceneInstancing;
+	app->entityFrustumCulling = sceneEntityCulling;
+	app->occlusionSettings.enabled = sceneOcclusion;
+}
+
+void BenchmarkInstancing(App* app)
+{
+	if (app->entities.empty())
+	{
+		BENCHMARK_LOG(app, "Instancing: no entities in the scene");
+		return;
+	}
+
+	const u32 entityCount = 50000;
+	const u32 frameCount = 16;
+
+	std::vector<Entity> sceneEntities = app->entities;
+	Mode sceneMode = app->mode;
+	bool sceneIndirect = app->indirectDraws;
+	bool sceneInstancing = app->instancing;
+	bool sceneLods = app->lodSettings.enabled;
+
+	// A single level, so the whole crowd is one group
+	app->mode = Mode_Mesh;
+	app->indirectDraws = true;
+	app->lodSettings.enabled = false;
+
+	u32 side = (u32)ceilf(sqrtf((f32)entityCount));
+	app->entities.assign(entityCount, sceneEntities[0]);
+	for (u32 i = 0; i < entityCount; ++i)
+	{
+		vec3 offset = vec3((f32)(i % side) - side * 0.5f, 0.0f, (f32)(i / side) - side * 0.5f);
+		SetEntityWorldMatrix(app, i, glm::translate(offset) * sceneEntities[0].worldMatrix);
+	}
+	InvalidateTransforms(app);
+
+	BENCHMARK_LOG(app, "Instancing: %u entities, %u frames each", entityCount, frameCount);
+
+	for (u32 instancing = 0; instancing < 2; ++instancing)
+	{
+		app->instancing = instancing != 0;
+
+		Update(app);
+		Render(app);
+		glFinish();
+
+		f64 submissionMs = 0.0;
+		f64 startTime = GetTimestamp();
+		for (u32 frame = 0; frame < frameCount; ++frame)
+		{
+			Update(app);
+			Render(app);
+			submissionMs += app->meshSubmissionMs;
+		}
+		glFinish();
+		f64 frameSeconds = GetTimestamp() - startTime;
+
+		IndirectDrawStats stats = GetIndirectDrawStats(app->indirectRenderer);
+		BENCHMARK_LOG(app, "  %-14s submission %8.3f ms, with the GPU %8.3f ms per frame, %u commands, %u draw calls",
+			instancing ? "instanced:" : "per entity:", submissionMs / frameCount, frameSeconds * 1000.0 / frameCount, stats.commands, stats.calls);
+	}
+
+	app->entities = sceneEntities;
+	InvalidateTransforms(app);
+	app->mode = sceneMode;
+	app->indirectDraws = sceneIndirect;
+	app->instancing = sceneInstancing;
+	app->lodSettings.enabled = sceneLods;
+}
+
+void BenchmarkGpuCulling(App* app)
+{
+	if (app->entities.empty())
+	{
+		BENCHMARK_LOG(app, "GPU culling: no entities in the scene");
+		return;
+	}
+
+	const u32 entityCounts[] = { 1000, 10000, 100000 };
+	const u32 frameCount = 8;
+
+	std::vector<Entity> sceneEntities = app->entities;
+	Mode sceneMode = app->mode;
+	bool sceneIndirect = app->indirectDraws;
+	bool sceneGpuCulling = app->gpuCulling;
+	bool sceneVerify = app->gpuCullingVerify;
+	app->mode = Mode_Mesh;
+	app->indirectDraws = true;
+
+	BENCHMARK_LOG(app, "GPU culling: %u frames each, copies of the first entity", frameCount);
+
+	for (u32 entityCount : entityCounts)
+	{
+		u32 side = (u32)ceilf(sqrtf((f32)entityCount));
+		app->entities.assign(entityCount, sceneEntities[0]);
+		for (u32 i = 0; i < entityCount; ++i)
+		{
+			vec3 offset = vec3((f32)(i % side) - side * 0.5f, 0.0f, (f32)(i / side) - side * 0.5f);
+			SetEntityWorldMatrix(app, i, glm::translate(offset) * sceneEntities[0].worldMatrix);
+		}
+		InvalidateTransforms(app);
+
+		for (u32 gpu = 0; gpu < 2; ++gpu)
+		{
+			app->gpuCulling = gpu != 0;
+
+			// The first frame builds the batches, and is the one verified
+			app->gpuCullingVerify = app->gpuCulling;
+			GpuCullingStats before = GetGpuCullingStats(app->gpuCuller);
+			Update(app);
+			Render(app);
+			glFinish();
+			GpuCullingStats after = GetGpuCullingStats(app->gpuCuller);
+			app->gpuCullingVerify = false;
+
+			// Update is the per entity CPU work, the static entities are not visited on the GPU path
+			f64 updateMs = 0.0;
+			f64 submissionMs = 0.0;
+			f64 startTime = GetTimestamp();
+			for (u32 frame = 0; frame < frameCount; ++frame)
+			{
+				f64 updateStart = GetTimestamp();
+				Update(app);
+				updateMs += (GetTimestamp() - updateStart) * 1000.0;
+				Render(app);
+				submissionMs += app->meshSubmissionMs;
+			}
+			glFinish();
+			f64 frameSeconds = GetTimestamp() - startTime;
+
+			BENCHMARK_LOG(app, "  %6u entities, %-12s update %8.3f ms, submission %8.3f ms, with the GPU %8.3f ms per frame, %u draw calls",
+				entityCount, gpu ? "GPU culled:" : "CPU culled:", updateMs / frameCount, submissionMs / frameCount, frameSeconds * 1000.0 / frameCount, app->meshletStats.drawCalls);
+			if (gpu)
+			{
+				u32 mismatches = after.mismatches - before.mismatches;
+				u32 borderline = after.borderline - before.borderline;
+				BENCHMARK_LOG(app, "    verified: %u visible instances, %u mismatches, %u of them borderline", after.visibleInstances, mismatches, borderline);
+			}
+		}
+	}
+
+	app->entities = sceneEntities;
+	InvalidateTransforms(app);
+	app->mode = sceneMode;
+	app->indirectDraws = sceneIndirect;
+	app->gpuCulling = sceneGpuCulling;
+	app->gpuCullingVerify = sceneVerify;
+}
+
+void BenchmarkFrustumCulling(App* app)
+{
+	const u32 boxCount = 1000000;
+	const u32 repetitions = 16;
+
+	// Boxes of random size, rotation and scale around a camera at the origin looking down -z,
+	// with a far plane that leaves about a twentieth of them visible
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<f32> position(-100.0f, 100.0f);
+	std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+	std::vector<glm::mat4> worldMatrices(boxCount);
+	std::vector<vec3> extents(boxCount);
+	for (u32 i = 0; i < boxCount; ++i)
+	{
+		vec3 axis = glm::normalize(vec3(unit(random), unit(random), unit(random)) + vec3(0.01f));
+		worldMatrices[i] = glm::translate(vec3(position(random), position(random), position(random))) *
+			glm::rotate(unit(random) * 6.2831853f, axis) * glm::scale(vec3(0.5f + unit(random) * 1.5f));
+		extents[i] = vec3(0.1f) + vec3(unit(random), unit(random), unit(random));
+	}
+
+	CullingBoxes boxes = {};
+	ResizeCullingBoxes(boxes, boxCount);
+	f64 setStart = GetTimestamp();
+	for (u32 i = 0; i < boxCount; ++i)
+		SetCullingBox(boxes, i, -extents[i], extents[i], worldMatrices[i]);
+	f64 setSeconds = GetTimestamp() - setStart;
+
+	glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f) * glm::lookAt(vec3(0.0f), vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = MakeFrustum(viewProjection);
+
+	BENCHMARK_LOG(app, "Frustum culling: %u boxes, %u culls each, boxes transformed in %.3f ms (%.2f ns per box)",
+		boxCount, repetitions, setSeconds * 1000.0, setSeconds * 1e9 / boxCount);
+
+	const CullingKernel kernels[] = { CullingKernel_Scalar, CullingKernel_SSE, CullingKernel_AVX };
+	const char* kernelNames[] = { "scalar:", "SSE:", "AVX:" };
+
+	std::vector<u32> reference(boxCount);
+	std::vector<u32> visible(boxCount);
+	u32 referenceCount = 0;
+	for (u32 k = 0; k < 3; ++k)
+	{
+		if (kernels[k] == CullingKernel_AVX && !FrustumCullingUsesAVX())
+		{
+			BENCHMARK_LOG(app, "  %-8s not supported by this CPU", kernelNames[k]);
+			continue;
+		}
+
+		// A first pass brings the boxes into the cache as far as they fit
+		u32 visibleCount = CullBoxes(boxes, frustum.planes, visible.data(), kernels[k]);
+
+		f64 startTime = GetTimestamp();
+		for (u32 i = 0; i < repetitions; ++i)
+			visibleCount = CullBoxes(boxes, frustum.planes, visible.data(), kernels[k]);
+		f64 seconds = GetTimestamp() - startTime;
+
+		// The scalar kernel is the reference the others are compared with
+		bool same = true;
+		if (k == 0)
+		{
+			reference.swap(visible);
+			referenceCount = visibleCount;
+		}
+		else
+		{
+			same = visibleCount == referenceCount && std::equal(visible.begin(), visible.begin() + visibleCount, reference.begin());
+		}
+
+		BENCHMARK_LOG(app, "  %-8s %6.3f ns per box, %8.3f ms per cull, %u visible%s", kernelNames[k], seconds * 1e9 / ((f64)repetitions * boxCount),
+			seconds * 1000.0 / repetitions, visibleCount, same ? "" : ", DIFFERENT from the scalar kernel");
+	}
+}
+
+void BenchmarkOcclusionCulling(App* app)
+{
+	const u32 boxCount = 100000;
+	const u32 repetitions = 16;
+
+	// A wall of 20 by 20 quads, 2 triangles each, 20 units in front of a camera at the origin
+	// looking down -z
+	const u32 wallQuads = 20;
+	const f32 wallHalfSize = 10.0f;
+	const f32 wallDistance = 20.0f;
+	std::vector<vec3> wall;
+	for (u32 y = 0; y < wallQuads; ++y)
+	{
+		for (u32 x = 0; x < wallQuads; ++x)
+		{
+			f32 x0 = -wallHalfSize + 2.0f * wallHalfSize * x / wallQuads, x1 = -wallHalfSize + 2.0f * wallHalfSize * (x + 1) / wallQuads;
+			f32 y0 = -wallHalfSize + 2.0f * wallHalfSize * y / wallQuads, y1 = -wallHalfSize + 2.0f * wallHalfSize * (y + 1) / wallQuads;
+			vec3 quad[6] = { vec3(x0, y0, -wallDistance), vec3(x1, y0, -wallDistance), vec3(x1, y1, -wallDistance),
+				vec3(x0, y0, -wallDistance), vec3(x1, y1, -wallDistance), vec3(x0, y1, -wallDistance) };
+			wall.insert(wall.end(), quad, quad + 6);
+		}
+	}
+
+	glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 2.0f, 0.1f, 100.0f) * glm::lookAt(vec3(0.0f), vec3(0.0f, 0.0f, -1.0f), vec3(0.0f, 1.0f, 0.0f));
+
+	// Small boxes inside the frustum, half of them in front of the wall and half behind it
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+	std::vector<vec3> boxMin(boxCount);
+	std::vector<vec3> boxMax(boxCount);
+	for (u32 i = 0; i < boxCount; ++i)
+	{
+		f32 distance = i % 2 == 0 ? 2.0f + unit(random) * (wallDistance - 3.0f) : wallDistance + 1.0f + unit(random) * 60.0f;
+		f32 halfWidth = distance * tanf(glm::radians(30.0f)) * 2.0f;
+		f32 halfHeight = distance * tanf(glm::radians(30.0f));
+		vec3 center = vec3((unit(random) * 2.0f - 1.0f) * halfWidth, (unit(random) * 2.0f - 1.0f) * halfHeight, -distance);
+		vec3 extent = vec3(0.05f + unit(random) * 0.5f);
+		boxMin[i] = center - extent;
+		boxMax[i] = center + extent;
+	}
+
+	OcclusionBuffer buffer;
+	f64 rasterSeconds = 0.0;
+	for (u32 i = 0; i < repetitions; ++i)
+	{
+		f64 startTime = GetTimestamp();
+		ClearOcclusionBuffer(buffer);
+		AddOccluder(buffer, wall.data(), (u32)wall.size() / 3, viewProjection);
+		RasterizeOccluders(buffer, app->threadPool);
+		rasterSeconds += GetTimestamp() - startTime;
+	}
+
+	std::vector<u8> occluded(boxCount, 0);
+	f64 testStart = GetTimestamp();
+	for (u32 i = 0; i < repetitions; ++i)
+	{
+		ParallelFor(app->threadPool, boxCount, 4096, [&](u32 begin, u32 end)
+			{
+				for (u32 box = begin; box < end; ++box)
+					occluded[box] = IsBoxOccluded(buffer, boxMin[box], boxMax[box], viewProjection) ? 1 : 0;
+			});
+	}
+	f64 testSeconds = GetTimestamp() - testStart;
+
+	// Boxes behind the wall whose rectangle is a pixel inside the one of the wall must be culled
+	f32 wallScreen = wallHalfSize / (wallDistance * tanf(glm::radians(30.0f)));
+	u32 culledInFront = 0;
+	u32 culledBehind = 0;
+	u32 shadowed = 0;
+	u32 missedInShadow = 0;
+	for (u32 i = 0; i < boxCount; ++i)
+	{
+		if (i % 2 == 0)
+		{
+			culledInFront += occluded[i];
+			continue;
+		}
+
+		culledBehind += occluded[i];
+
+		bool inShadow = true;
+		for (u32 corner = 0; corner < 8; ++corner)
+		{
+			vec3 p = vec3(corner & 1 ? boxMax[i].x : boxMin[i].x, corner & 2 ? boxMax[i].y : boxMin[i].y, corner & 4 ? boxMax[i].z : boxMin[i].z);
+			vec4 clip = viewProjection * vec4(p, 1.0f);
+			f32 marginX = 2.0f / OCCLUSION_WIDTH;
+			f32 marginY = 2.0f / OCCLUSION_HEIGHT;
+			inShadow = inShadow && fabsf(clip.x / clip.w) < wallScreen / 2.0f - marginX && fabsf(clip.y / clip.w) < wallScreen - marginY;
+		}
+		shadowed += inShadow ? 1 : 0;
+		missedInShadow += inShadow && !occluded[i] ? 1 : 0;
+	}
+
+	BENCHMARK_LOG(app, "Occlusion culling: %ux%u buffer, %u occluder triangles, %u boxes, %u repetitions", OCCLUSION_WIDTH, OCCLUSION_HEIGHT, (u32)wall.size() / 3, boxCount, repetitions);
+	BENCHMARK_LOG(app, "  rasterization: %8.3f ms, tests: %8.3f ms (%.1f ns per box)", rasterSeconds * 1000.0 / repetitions, testSeconds * 1000.0 / repetitions,
+		testSeconds * 1e9 / ((f64)repetitions * boxCount));
+	BENCHMARK_LOG(app, "  culled %u of %u boxes behind the wall, %u of the %u fully in its shadow", culledBehind, boxCount / 2, shadowed - missedInShadow, shadowed);
+	BENCHMARK_LOG(app, "  %s: %u boxes in front of the wall culled, %u in its shadow missed", culledInFront == 0 && missedInShadow == 0 ? "passed" : "FAILED", culledInFront, missedInShadow);
+}
+
+void BenchmarkHiZCulling(App* app)
+{
+	if (app->entities.empty())
+	{
+		BENCHMARK_LOG(app, "Hi-Z culling: no entities in the scene");
+		return;
+	}
+
+	const u32 entityCount = 20000;
+	const u32 frameCount = 32;
+
+	std::vector<Entity> sceneEntities = app->entities;
+	Mode sceneMode = app->mode;
+	bool sceneGpuCulling = app->gpuCulling;
+	bool sceneVerify = app->gpuCullingVerify;
+	bool sceneHiZ = app->hiZCulling;
+	app->mode = Mode_Deferred;
+	app->gpuCulling = true;
+	app->gpuCullingVerify = false;
+
+	// A grid on the ground seen from low, where the nearer rows hide most of the others
+	u32 side = (u32)ceilf(sqrtf((f32)entityCount));
+	app->entities.assign(entityCount, sceneEntities[0]);
+	for (u32 i = 0; i < entityCount; ++i)
+	{
+		vec3 offset = vec3((f32)(i % side) - side * 0.5f, 0.0f, (f32)(i / side) - side * 0.5f);
+		SetEntityWorldMatrix(app, i, glm::translate(offset) * sceneEntities[0].worldMatrix);
+	}
+	InvalidateTransforms(app);
+
+	BENCHMARK_LOG(app, "Hi-Z culling: %u entities into the G-buffer, %u frames each", entityCount, frameCount);
+
+	HiZStats results[2] = {};
+	for (u32 hiZ = 0; hiZ < 2; ++hiZ)
+	{
+		app->hiZCulling = hiZ != 0;
+
+		// Until the first frames measured are read back, and the visibility of the entities settles
+		for (u32 frame = 0; frame <= GPU_TIMELINE_LATENCY; ++frame)
+		{
+			Update(app);
+			Render(app);
+		}
+		glFinish();
+
+		app->hiZStats = {};
+		f64 startTime = GetTimestamp();
+		for (u32 frame = 0; frame < frameCount; ++frame)
+		{
+			Update(app);
+			Render(app);
+		}
+		glFinish();
+		f64 frameSeconds = GetTimestamp() - startTime;
+		results[hiZ] = app->hiZStats;
+
+		const HiZStats& stats = results[hiZ];
+		u32 frames = glm::max(hiZ ? stats.frames : stats.framesWithoutHiZ, 1u);
+		f64 geometryMs = (hiZ ? stats.geometryMs : stats.geometryMsWithoutHiZ) / frames;
+		BENCHMARK_LOG(app, "  %-12s geometry %8.3f ms on the GPU, pyramid %8.3f ms, culling %8.3f ms, frame %8.3f ms, %u frames measured",
+			hiZ ? "Hi-Z:" : "frustum only:", geometryMs, stats.pyramidMs / frames, stats.cullMs / frames, frameSeconds * 1000.0 / frameCount, frames);
+	}
+
+	if (results[0].framesWithoutHiZ > 0 && results[1].frames > 0)
+	{
+		f64 withoutMs = results[0].geometryMsWithoutHiZ / results[0].framesWithoutHiZ;
+		f64 withMs = results[1].geometryMs / results[1].frames;
+		BENCHMARK_LOG(app, "  G-buffer time saved: %8.3f ms (%.1f%%)", withoutMs - withMs, withoutMs > 0.0 ? 100.0 * (withoutMs - withMs) / withoutMs : 0.0);
+	}
+	else
+	{
+		BENCHMARK_LOG(app, "  no GPU times were read back, timestamp queries may be unsupported");
+	}
+
+	app->entities = sceneEntities;
+	InvalidateTransforms(app);
+	app->mode = sceneMode;
+	app->gpuCulling = sceneGpuCulling;
+	app->gpuCullingVerify = sceneVerify;
+	app->hiZCulling = sceneHiZ;
+	app->hiZStats = {};
+}
+
+// Average and longest frame, rendering until done returns true or maxFrames
+static void MeasureFrames(App* app, u32 maxFrames, const std::function<bool()>& done, f64& averageMs, f64& maxMs, u32& frames)
+{
+	f64 totalSeconds = 0.0;
+	f64 maxSeconds = 0.0;
+	for (frames = 0; frames < maxFrames && !done(); ++frames)
+	{
+		f64 frameStart = GetTimestamp();
+		Update(app);
+		Render(app);
+		glFinish();
+		f64 seconds = GetTimestamp() - frameStart;
+		totalSeconds += seconds;
+		maxSeconds = glm::max(maxSeconds, seconds);
+	}
+	averageMs = frames > 0 ? totalSeconds * 1000.0 / frames : 0.0;
+	maxMs = maxSeconds * 1000.0;
+}
+
+void BenchmarkStreamingFrames(App* app)
+{
+	if (app->entities.empty())
+	{
+		BENCHMARK_LOG(app, "Streaming frames: no entities in the scene");
+		return;
+	}
+
+	const u32 entityCount = 10000;
+	const u32 frameCount = 64;
+	const u32 loadCount = GetWorkerCount(app->threadPool) + 1;
+	const f64 loadSeconds = 0.25;
+
+	std::vector<Entity> sceneEntities = app->entities;
+	Mode sceneMode = app->mode;
+	bool sceneGpuCulling = app->gpuCulling;
+	bool sceneOcclusion = app->occlusionSettings.enabled;
+	app->mode = Mode_Mesh;
+	app->gpuCulling = false;
+	app->occlusionSettings.enabled = true;
+
+	// The occlusion culling of these frames runs its loops in the pool of the loads
+	u32 side = (u32)ceilf(sqrtf((f32)entityCount));
+	app->entities.assign(entityCount, sceneEntities[0]);
+	for (u32 i = 0; i < entityCount; ++i)
+	{
+		vec3 offset = vec3((f32)(i % side) - side * 0.5f, 0.0f, (f32)(i / side) - side * 0.5f);
+		SetEntityWorldMatrix(app, i, glm::translate(offset) * sceneEntities[0].worldMatrix);
+	}
+	InvalidateTransforms(app);
+
+	BENCHMARK_LOG(app, "Streaming frames: %u entities, %u loads of %.0f ms of CPU work each on %u workers", entityCount, loadCount, loadSeconds * 1000.0, GetWorkerCount(app->threadPool));
+
+	f64 averageMs, maxMs;
+	u32 frames;
+	MeasureFrames(app, 4, [] { return false; }, averageMs, maxMs, frames);
+	MeasureFrames(app, frameCount, [] { return false; }, averageMs, maxMs, frames);
+	BENCHMARK_LOG(app, "  idle:      %8.3f ms per frame, longest %8.3f ms, %u frames", averageMs, maxMs, frames);
+
+	// Loads that keep every worker busy for a while, as parsing a large model does
+	// Uploads run in the main thread, and the frames below run until all of them did
+	u32 uploaded = 0;
+	u32* uploadedPtr = &uploaded;
+	for (u32 i = 0; i < loadCount; ++i)
+	{
+		SubmitAsyncLoad(app, [loadSeconds]
+			{
+				f64 start = GetTimestamp();
+				volatile u64 work = 0;
+				while (GetTimestamp() - start < loadSeconds)
+					work = work + 1;
+				return (u64)0;
+			}, [uploadedPtr] { (*uploadedPtr)++; });
+	}
+
+	MeasureFrames(app, 100000, [&uploaded, loadCount] { return uploaded == loadCount; }, averageMs, maxMs, frames);
+	BENCHMARK_LOG(app, "  streaming: %8.3f ms per frame, longest %8.3f ms, %u frames", averageMs, maxMs, frames);
+	BENCHMARK_LOG(app, "  %s: a frame %s as long as a load", maxMs < loadSeconds * 1000.0 * 0.5 ? "passed" : "FAILED", maxMs < loadSeconds * 1000.0 * 0.5 ? "never took half" : "took over half");
+
+	app->entities = sceneEntities;
+	InvalidateTransforms(app);
+	app->mode = sceneMode;
+	app->gpuCulling = sceneGpuCulling;
+	app->occlusionSettings.enabled = sceneOcclusion;
+}
+
+// The answers of the BVH queries, found by testing every box as the tree does
+static u32 RaycastBoxes(const CullingBoxes& boxes, vec3 origin, vec3 direction, f32 maxDistance, f32& distance)
+{
+	u32 nearest = BVH_INVALID;
+	distance = maxDistance;
+	vec3 inverseDirection = 1.0f / direction;
+	for (u32 i = 0; i < boxes.count; ++i)
+	{
+		vec3 center = vec3(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+		vec3 extent = vec3(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+		vec3 t0 = (center - extent - origin) * inverseDirection;
+		vec3 t1 = (center + extent - origin) * inverseDirection;
+		vec3 tMin = glm::min(t0, t1);
+		vec3 tMax = glm::max(t0, t1);
+		f32 entry = glm::max(tMin.x, glm::max(tMin.y, tMin.z));
+		f32 exit = glm::min(tMax.x, glm::min(tMax.y, tMax.z));
+		if (entry <= exit && entry >= 0.0f && entry <= distance)
+		{
+			nearest = i;
+			distance = entry;
+		}
+	}
+	return nearest;
+}
+
+static u32 CountBoxesInSphere(const CullingBoxes& boxes, vec3 center, f32 radius)
+{
+	u32 count = 0;
+	for (u32 i = 0; i < boxes.count; ++i)
+	{
+		vec3 boxCenter = vec3(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+		vec3 extent = vec3(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+		vec3 outside = glm::max(glm::abs(center - boxCenter) - extent, vec3(0.0f));
+		count += glm::dot(outside, outside) <= radius * radius ? 1 : 0;
+	}
+	return count;
+}
+
+void BenchmarkBvh(App* app)
+{
+	const u32 boxCounts[] = { 100000, 1000000 };
+	const u32 frustumCount = 16;
+	const u32 rayCount = 100000;
+	const u32 sphereCount = 100000;
+	const u32 verifiedQueries = 64; // rays and spheres compared with testing every box
+
+	BENCHMARK_LOG(app, "BVH: random boxes, %u frustums, %u rays and %u spheres each, queries on %u threads", frustumCount, rayCount, sphereCount,
+		GetWorkerCount(app->threadPool));
+
+	for (u32 boxCount : boxCounts)
+	{
+		// Boxes of 0.2 to 2 units in a cube holding about one every 8 cubic units
+		std::mt19937 random(1234);
+		const f32 side = 2.0f * cbrtf((f32)boxCount);
+		std::uniform_real_distribution<f32> position(0.0f, side);
+		std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+		auto randomDirection = [&]() { return glm::normalize(vec3(unit(random), unit(random), unit(random)) - vec3(0.5f) + vec3(1e-3f)); };
+
+		CullingBoxes boxes = {};
+		ResizeCullingBoxes(boxes, boxCount);
+		for (u32 i = 0; i < boxCount; ++i)
+		{
+			boxes.centerX[i] = position(random);
+			boxes.centerY[i] = position(random);
+			boxes.centerZ[i] = position(random);
+			boxes.extentX[i] = 0.1f + 0.9f * unit(random);
+			boxes.extentY[i] = 0.1f + 0.9f * unit(random);
+			boxes.extentZ[i] = 0.1f + 0.9f * unit(random);
+		}
+
+		Bvh bvh = {};
+		f64 startTime = GetTimestamp();
+		BuildBvh(bvh, boxes);
+		f64 buildSeconds = GetTimestamp() - startTime;
+		BENCHMARK_LOG(app, "  %7u boxes: build %8.2f ms (%.2f M boxes/s), %u nodes, cost %.1f", boxCount, buildSeconds * 1000.0, boxCount / buildSeconds / 1e6,
+			(u32)bvh.nodes.size(), GetBvhCost(bvh));
+
+		// Cameras inside the cube looking anywhere, seeing half of it deep
+		std::vector<vec4> planes(frustumCount * 6);
+		for (u32 f = 0; f < frustumCount; ++f)
+		{
+			vec3 eye = vec3(position(random), position(random), position(random));
+			glm::mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, side * 0.5f) * glm::lookAt(eye, eye + randomDirection(), vec3(0.0f, 1.0f, 0.0f));
+			Frustum frustum = MakeFrustum(viewProjection);
+			std::copy(frustum.planes, frustum.planes + 6, planes.begin() + f * 6);
+		}
+
+		std::vector<u32> visible[frustumCount];
+		startTime = GetTimestamp();
+		for (u32 f = 0; f < frustumCount; ++f)
+			QueryBvhFrustums(bvh, &planes[f * 6], 1, &visible[f]);
+		f64 aloneSeconds = GetTimestamp() - startTime;
+
+		startTime = GetTimestamp();
+		QueryBvhFrustums(bvh, planes.data(), frustumCount, visible);
+		f64 batchedSeconds = GetTimestamp() - startTime;
+
+		std::vector<u32> reference(boxCount);
+		f64 cullSeconds = 0.0;
+		u64 visibleTotal = 0;
+		u32 frustumMismatches = 0;
+		for (u32 f = 0; f < frustumCount; ++f)
+		{
+			startTime = GetTimestamp();
+			u32 referenceCount = CullBoxes(boxes, &planes[f * 6], reference.data());
+			cullSeconds += GetTimestamp() - startTime;
+
+			std::sort(visible[f].begin(), visible[f].end());
+			bool same = visible[f].size() == referenceCount && std::equal(visible[f].begin(), visible[f].end(), reference.begin());
+			frustumMismatches += same ? 0 : 1;
+			visibleTotal += referenceCount;
+		}
+		BENCHMARK_LOG(app, "    frustums: %8.3f ms each alone, %8.3f ms each batched, %8.3f ms with CullBoxes, %.1f%% visible",
+			aloneSeconds * 1000.0 / frustumCount, batchedSeconds * 1000.0 / frustumCount, cullSeconds * 1000.0 / frustumCount, 100.0 * visibleTotal / ((f64)frustumCount * boxCount));
+
+		// Every box moved a little, refitted, then the cost of a tree built again for them
+		for (u32 i = 0; i < boxCount; ++i)
+		{
+			boxes.centerX[i] += unit(random) - 0.5f;
+			boxes.centerY[i] += unit(random) - 0.5f;
+			boxes.centerZ[i] += unit(random) - 0.5f;
+		}
+		startTime = GetTimestamp();
+		RefitBvh(bvh, boxes);
+		f64 refitSeconds = GetTimestamp() - startTime;
+
+		Bvh rebuilt = {};
+		BuildBvh(rebuilt, boxes);
+		BENCHMARK_LOG(app, "    refit: %8.2f ms (%.2f M boxes/s), cost %.1f, %.1f when built again", refitSeconds * 1000.0, boxCount / refitSeconds / 1e6,
+			GetBvhCost(bvh), GetBvhCost(rebuilt));
+
+		// One box in a hundred moved far, then removed and inserted again
+		const u32 changedCount = boxCount / 100;
+		startTime = GetTimestamp();
+		for (u32 k = 0; k < changedCount; ++k)
+		{
+			u32 i = k * 100;
+			boxes.centerX[i] = position(random);
+			boxes.centerZ[i] = position(random);
+			UpdateBvhItem(bvh, boxes, i);
+		}
+		f64 updateSeconds = GetTimestamp() - startTime;
+
+		startTime = GetTimestamp();
+		for (u32 k = 0; k < changedCount; ++k)
+			RemoveBvhItem(bvh, k * 100);
+		f64 removeSeconds = GetTimestamp() - startTime;
+
+		startTime = GetTimestamp();
+		for (u32 k = 0; k < changedCount; ++k)
+			InsertBvhItem(bvh, boxes, k * 100);
+		f64 insertSeconds = GetTimestamp() - startTime;
+
+		BENCHMARK_LOG(app, "    %u boxes one by one: %.3f us per move, %.3f us per remove, %.3f us per insert, cost %.1f", changedCount,
+			updateSeconds * 1e6 / changedCount, removeSeconds * 1e6 / changedCount, insertSeconds * 1e6 / changedCount, GetBvhCost(bvh));
+
+		// Rays from inside the cube, as far as its side, and spheres of 1 to 4 units
+		std::vector<vec3> rayOrigins(rayCount);
+		std::vector<vec3> rayDirections(rayCount);
+		for (u32 i = 0; i < rayCount; ++i)
+		{
+			rayOrigins[i] = vec3(position(random), position(random), position(random));
+			rayDirections[i] = randomDirection();
+		}
+		std::vector<vec3> sphereCenters(sphereCount);
+		std::vector<f32> sphereRadii(sphereCount);
+		for (u32 i = 0; i < sphereCount; ++i)
+		{
+			sphereCenters[i] = vec3(position(random), position(random), position(random));
+			sphereRadii[i] = 1.0f + 3.0f * unit(random);
+		}
+
+		std::vector<BvhRayHit> hits(rayCount);
+		startTime = GetTimestamp();
+		ParallelFor(app->threadPool, rayCount, 1024, [&](u32 begin, u32 end)
+			{
+				for (u32 i = begin; i < end; ++i)
+					RaycastBvh(bvh, rayOrigins[i], rayDirections[i], side, hits[i]);
+			});
+		f64 raySeconds = GetTimestamp() - startTime;
+
+		std::vector<u32> sphereItems(sphereCount);
+		startTime = GetTimestamp();
+		ParallelFor(app->threadPool, sphereCount, 1024, [&](u32 begin, u32 end)
+			{
+				std::vector<u32> items;
+				for (u32 i = begin; i < end; ++i)
+				{
+					QueryBvhSphere(bvh, sphereCenters[i], sphereRadii[i], items);
+					sphereItems[i] = (u32)items.size();
+				}
+			});
+		f64 sphereSeconds = GetTimestamp() - startTime;
+
+		u64 rayHits = 0, nodesVisited = 0, itemsInSpheres = 0;
+		for (const BvhRayHit& hit : hits)
+		{
+			rayHits += hit.item != BVH_INVALID ? 1 : 0;
+			nodesVisited += hit.nodesVisited;
+		}
+		for (u32 count : sphereItems)
+			itemsInSpheres += count;
+
+		u32 rayMismatches = 0, sphereMismatches = 0;
+		for (u32 i = 0; i < verifiedQueries; ++i)
+		{
+			f32 distance;
+			u32 nearest = RaycastBoxes(boxes, rayOrigins[i], rayDirections[i], side, distance);
+			bool sameRay = (nearest != BVH_INVALID) == (hits[i].item != BVH_INVALID) && (nearest == BVH_INVALID || fabsf(distance - hits[i].distance) <= 1e-4f * side);
+			rayMismatches += sameRay ? 0 : 1;
+			sphereMismatches += CountBoxesInSphere(boxes, sphereCenters[i], sphereRadii[i]) == sphereItems[i] ? 0 : 1;
+		}
+
+		BENCHMARK_LOG(app, "    rays: %8.2f M rays/s, %.1f%% hit a box, %.1f nodes visited per ray", rayCount / raySeconds / 1e6, 100.0 * rayHits / rayCount, (f64)nodesVisited / rayCount);
+		BENCHMARK_LOG(app, "    spheres: %8.2f M queries/s, %.1f boxes per query", sphereCount / sphereSeconds / 1e6, (f64)itemsInSpheres / sphereCount);
+		BENCHMARK_LOG(app, "    %s: %u of %u frustums, %u of %u rays and %u of %u spheres differ from testing every box",
+			frustumMismatches + rayMismatches + sphereMismatches == 0 ? "passed" : "FAILED", frustumMismatches, frustumCount, rayMismatches, verifiedQueries, sphereMismatches, verifiedQueries);
+	}
+}
@@ -0,0 +1,98 @@
+//
+// benchmarks.h: Micro-benchmarks that can be run from the Benchmarks window. Every benchmark
+// appends its results to app->benchmarkLog and to the log output.
+//
+
+#pragma once
+
+#include "engine.h"
+
+/**
+ * Loads the same model without its mesh cache, which imports it and writes the cache, and then
+ * again from the cache, a few times, and reports the cold and warm load times.
+ */
+void BenchmarkModelCache(App* app);
+
+/**
+ * Decodes every loaded texture file several times with an increasing number of threads
+ * and reports the decode throughput in MB/s of decoded pixels.
+ */
+void BenchmarkTextureDecode(App* app);
+
+/**
+ * Generates the mip chains of every loaded texture with the CPU filters and compares them
+ * with uploading the first level and calling glGenerateMipmap.
+ */
+void BenchmarkMipGeneration(App* app);
+
+/**
+ * Converts synthetic Assimp meshes with every vertex attribute set, with the old per vertex
+ * push_back loop and with the mesh conversion kernels, and reports vertices per second.
+ */
+void BenchmarkVertexConversion(App* app);
+
+/**
+ * Imports a synthetic OBJ file of a few hundred MB, generated on the first run, with the
+ * native parser at an increasing number of threads and with Assimp, and reports MB/s.
+ */
+void BenchmarkObjImport(App* app);
+
+/**
+ * Replaces the scene with growing grids of copies of its first entity, up to 100k, static and
+ * then dynamic, and times Update and Render and the bytes uploaded per frame.
+ */
+void BenchmarkEntityCount(App* app);
+
+/**
+ * Draws about 10k submeshes, copies of the first entity with culling and levels of detail
+ * disabled, with one call per submesh and with the indirect buckets, and compares the time
+ * the CPU takes to submit them.
+ */
+void BenchmarkDrawSubmission(App* app);
+
+/**
+ * Draws a crowd of 50k copies of the first entity through the indirect buckets, without and with
+ * automatic instancing, and compares the commands, calls and submission time.
+ */
+void BenchmarkInstancing(App* app);
+
+/**
+ * Replaces the scene with growing grids of copies of its first entity, up to 100k, and compares
+ * the submission time of the CPU culled indirect draws with the culling shader. One frame of
+ * each grid is verified against the CPU.
+ */
+void BenchmarkGpuCulling(App* app);
+
+/**
+ * Culls 1M random boxes against a camera frustum with the scalar, SSE and AVX kernels, reports
+ * the nanoseconds per box and checks that every kernel finds the same visible boxes.
+ */
+void BenchmarkFrustumCulling(App* app);
+
+/**
+ * Rasterizes a wall of occluders into an occlusion buffer of its own and tests 100k random
+ * boxes in front of and behind it, without the GPU. Reports the cost of both steps and checks
+ * that no box in front of the wall, and every box well inside its shadow, gets the right answer.
+ */
+void BenchmarkOcclusionCulling(App* app);
+
+/**
+ * Draws a grid of 20k copies of the first entity into the G-buffer with the culling shader,
+ * without and with Hi-Z, and reports the GPU time of the geometry pass, of building the depth
+ * pyramid and of culling, and the G-buffer time saved.
+ */
+void BenchmarkHiZCulling(App* app);
+
+/**
+ * Renders a grid of 10k copies of the first entity with occlusion culling, idle and while loads
+ * keep every worker busy, and reports the average and longest frame of each. Frames must not
+ * wait for the loads that share the thread pool with their parallel loops.
+ */
+void BenchmarkStreamingFrames(App* app);
+
+/**
+ * Builds a BVH over 100k and then 1M random boxes and reports the build, refit, move, remove and
+ * insert times, and the throughput of frustum queries, alone and batched, next to CullBoxes, of
+ * rays and of sphere queries. A few answers of each query are checked against every box.
+ */
+void BenchmarkBvh(App* app);
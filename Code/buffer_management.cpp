@@ -34,12 +34,216 @@ void MapBuffer(Buffer& buffer, GLenum access)
 	glBindBuffer(buffer.type, buffer.handle);
 	buffer.data = (u8*)glMapBuffer(buffer.type, access);
 	buffer.head = 0;
+	buffer.mappedOffset = 0;
+	buffer.mappedSize = buffer.size;
 }
 
 void UnmapBuffer(Buffer& buffer)
 {
 	glUnmapBuffer(buffer.type);
 	glBindBuffer(buffer.type, 0);
+	buffer.data = NULL;
+}
+
+static PFNGLBUFFERSTORAGEPROC BufferStorage = NULL;
+
+void LoadBufferStorage(GLADloadproc load)
+{
+	bool supported = GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4);
+
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (GLint i = 0; i < extensionCount && !supported; ++i)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+		if (extension && strcmp(extension, "GL_ARB_buffer_storage") == 0)
+			supported = true;
+	}
+
+	BufferStorage = supported ? (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage") : NULL;
+}
+
+bool SupportsBufferStorage()
+{
+	return BufferStorage != NULL;
+}
+
+static void AddRingPage(RingBuffer& ring)
+{
+	const Buffer& buffer = ring.buffer;
+	u32 size = ring.pageSize * RING_BUFFER_REGIONS;
+
+	RingPage page = {};
+	glGenBuffers(1, &page.handle);
+	glBindBuffer(buffer.type, page.handle);
+	if (ring.persistent)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		BufferStorage(buffer.type, size, NULL, flags);
+		page.persistentData = (u8*)glMapBufferRange(buffer.type, 0, size, flags);
+	}
+	else
+	{
+		glBufferData(buffer.type, size, NULL, GL_DYNAMIC_DRAW);
+	}
+	glBindBuffer(buffer.type, 0);
+
+	ring.pages.push_back(page);
+}
+
+static void MapRingPage(RingBuffer& ring, u32 pageIdx)
+{
+	const RingPage& page = ring.pages[pageIdx];
+	ring.page = pageIdx;
+
+	Buffer& buffer = ring.buffer;
+	buffer.handle = page.handle;
+	buffer.mappedOffset = ring.region * ring.pageSize;
+	buffer.mappedSize = ring.pageSize;
+	buffer.head = buffer.mappedOffset;
+
+	if (ring.persistent)
+	{
+		buffer.data = page.persistentData + buffer.mappedOffset;
+	}
+	else
+	{
+		glBindBuffer(buffer.type, buffer.handle);
+		GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+		buffer.data = glMapBufferRange(buffer.type, buffer.mappedOffset, buffer.mappedSize, access);
+		glBindBuffer(buffer.type, 0);
+	}
+}
+
+static void UnmapRingPage(RingBuffer& ring)
+{
+	Buffer& buffer = ring.buffer;
+	ring.stats.lastBytesUsed += buffer.head - buffer.mappedOffset;
+
+	// Coherent mappings make the writes visible to the GPU without flushing
+	if (!ring.persistent)
+	{
+		glBindBuffer(buffer.type, buffer.handle);
+		glUnmapBuffer(buffer.type);
+		glBindBuffer(buffer.type, 0);
+	}
+	buffer.data = NULL;
+}
+
+RingBuffer CreateRingBuffer(u32 pageSize, GLenum type)
+{
+	RingBuffer ring = {};
+	ring.pageSize = pageSize;
+	ring.region = RING_BUFFER_REGIONS - 1; // the first BeginRingRegion moves to region 0
+	ring.persistent = SupportsBufferStorage();
+	ring.buffer.size = pageSize * RING_BUFFER_REGIONS;
+	ring.buffer.type = type;
+
+	AddRingPage(ring);
+	ring.buffer.handle = ring.pages[0].handle;
+
+	return ring;
+}
+
+void DestroyRingBuffer(RingBuffer& ring)
+{
+	for (u32 i = 0; i < RING_BUFFER_REGIONS; ++i)
+		if (ring.fences[i])
+			glDeleteSync(ring.fences[i]);
+
+	for (RingPage& page : ring.pages)
+	{
+		if (page.persistentData)
+		{
+			glBindBuffer(ring.buffer.type, page.handle);
+			glUnmapBuffer(ring.buffer.type);
+			glBindBuffer(ring.buffer.type, 0);
+		}
+		glDeleteBuffers(1, &page.handle);
+	}
+
+	ring = {};
+}
+
+// Returns the time spent blocked, in milliseconds
+static f32 WaitForFence(GLsync fence)
+{
+	// Cheap check first, most of the time the GPU is frames ahead of the wrap around
+	GLenum result = glClientWaitSync(fence, 0, 0);
+	if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED)
+		return 0.0f;
+
+	f64 startTime = GetTimestamp();
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	do
+	{
+		result = glClientWaitSync(fence, flags, 1000000); // 1 ms
+		flags = 0;
+	} while (result == GL_TIMEOUT_EXPIRED);
+
+	return (f32)((GetTimestamp() - startTime) * 1000.0);
+}
+
+void BeginRingRegion(RingBuffer& ring)
+{
+	ring.region = (ring.region + 1) % RING_BUFFER_REGIONS;
+
+	RingBufferStats& stats = ring.stats;
+	stats.frames++;
+	stats.lastStallMs = 0.0f;
+	stats.lastBytesUsed = 0;
+
+	GLsync& fence = ring.fences[ring.region];
+	if (fence)
+	{
+		stats.lastStallMs = WaitForFence(fence);
+		glDeleteSync(fence);
+		fence = NULL;
+	}
+
+	if (stats.lastStallMs > 0.0f)
+	{
+		stats.stalledFrames++;
+		stats.maxStallMs = glm::max(stats.maxStallMs, stats.lastStallMs);
+		stats.totalStallMs += stats.lastStallMs;
+	}
+
+	MapRingPage(ring, 0);
+}
+
+void ReserveRingBlock(RingBuffer& ring, u32 size, u32 alignment)
+{
+	ASSERT(size <= ring.pageSize, "The block does not fit in a page of the ring buffer");
+
+	Buffer& buffer = ring.buffer;
+	AlignHead(buffer, alignment);
+	if (buffer.head + size <= buffer.mappedOffset + buffer.mappedSize)
+		return;
+
+	UnmapRingPage(ring);
+
+	u32 nextPage = ring.page + 1;
+	if (nextPage == ring.pages.size())
+	{
+		AddRingPage(ring);
+		ring.stats.pageAllocations++;
+	}
+
+	MapRingPage(ring, nextPage);
+}
+
+void EndRingRegion(RingBuffer& ring)
+{
+	UnmapRingPage(ring);
+	ring.stats.lastPagesUsed = ring.page + 1;
+}
+
+void FenceRingRegion(RingBuffer& ring)
+{
+	GLsync& fence = ring.fences[ring.region];
+	if (fence)
+		glDeleteSync(fence);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
 void AlignHead(Buffer& buffer, u32 alignment)
@@ -52,6 +256,7 @@ void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment)
 {
 	ASSERT(buffer.data != NULL, "The buffer must be mapped first");
 	AlignHead(buffer, alignment);
-	memcpy((u8*)buffer.data + buffer.head, data, size);
+	ASSERT(buffer.head + size <= buffer.mappedOffset + buffer.mappedSize, "The mapped range of the buffer is full");
+	memcpy((u8*)buffer.data + (buffer.head - buffer.mappedOffset), data, size);
 	buffer.head += size;
 }
@@ -8,6 +8,10 @@ struct Buffer
 	u32 size;
 	u32 head;
 	void* data; // mapped data
+
+	// Range of the buffer that data points to, head is always relative to the start of the buffer
+	u32 mappedOffset;
+	u32 mappedSize;
 };
 
 bool IsPowerOf2(u32 value);
@@ -26,6 +30,97 @@ void MapBuffer(Buffer& buffer, GLenum access);
 
 void UnmapBuffer(Buffer& buffer);
 
+// OpenGL 4.4 / ARB_buffer_storage, which the loader is not generated for
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT   0x0080
+#endif
+
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+/**
+ * Loads glBufferStorage when the context is OpenGL 4.4 or exposes ARB_buffer_storage. Call once
+ * the OpenGL functions are loaded, ring buffers fall back to unsynchronized mapping without it.
+ */
+void LoadBufferStorage(GLADloadproc load);
+
+bool SupportsBufferStorage();
+
+#define RING_BUFFER_REGIONS 3
+
+// Time the CPU spent waiting for the GPU to release regions of a ring buffer, and its usage
+struct RingBufferStats
+{
+	u32 frames;
+	u32 stalledFrames;   // the fence of the region was not signaled yet when it was reused
+	f32 lastStallMs;
+	f32 maxStallMs;
+	f64 totalStallMs;
+
+	u32 lastPagesUsed;
+	u64 lastBytesUsed;
+	u32 pageAllocations; // after the first page, when a frame did not fit in the pages so far
+};
+
+// Buffer object of a ring buffer, split in RING_BUFFER_REGIONS regions of the page size
+struct RingPage
+{
+	GLuint handle;
+	u8* persistentData;
+};
+
+/**
+ * Buffer split in regions that are written by the CPU in turns, so the CPU writes a frame while
+ * the GPU still reads the previous ones. Each region is guarded by a fence placed after the
+ * draws that read it, which is only waited for when the ring wraps around to that region.
+ * With buffer storage the whole buffer stays mapped (persistent and coherent), otherwise each
+ * region is mapped unsynchronized, which is safe as the fence has been waited for.
+ *
+ * A frame that does not fit in one page continues in the next one, and pages are allocated the
+ * first time a frame needs them, so the data of a frame is only limited by memory. Blocks are
+ * bound with glBindBufferRange windows of the page they were pushed to.
+ */
+struct RingBuffer
+{
+	Buffer buffer;       // current page, mapped over its region between BeginRingRegion and EndRingRegion
+	std::vector<RingPage> pages;
+	u32 pageSize;        // of each region of a page
+	u32 page;
+	u32 region;
+	bool persistent;
+	GLsync fences[RING_BUFFER_REGIONS]; // cover the region in every page
+
+	RingBufferStats stats;
+};
+
+/**
+ * The page size must be a multiple of the alignment of the blocks pushed to the ring.
+ */
+RingBuffer CreateRingBuffer(u32 pageSize, GLenum type);
+
+void DestroyRingBuffer(RingBuffer& ring);
+
+/**
+ * Moves to the next region and maps it for writing, waiting first for the GPU to be done with it.
+ */
+void BeginRingRegion(RingBuffer& ring);
+
+/**
+ * Aligns the head and makes room for a block of the given size, moving on to the next page
+ * (allocated if needed) when the current one is full. The block is then pushed to ring.buffer.
+ */
+void ReserveRingBlock(RingBuffer& ring, u32 size, u32 alignment);
+
+/**
+ * Ends the writes of the CPU to the region.
+ */
+void EndRingRegion(RingBuffer& ring);
+
+/**
+ * Fences the region, call once every draw reading from it has been submitted.
+ */
+void FenceRingRegion(RingBuffer& ring);
+
 void AlignHead(Buffer& buffer, u32 alignment);
 
 void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
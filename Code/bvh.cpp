@@ -0,0 +1,619 @@
+#include "bvh.h"
+#include <float.h>
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+struct BvhBounds
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+static const BvhBounds EmptyBounds = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX) };
+
+static inline BvhBounds GetItemBounds(const CullingBoxes& boxes, u32 item)
+{
+	glm::vec3 center = glm::vec3(boxes.centerX[item], boxes.centerY[item], boxes.centerZ[item]);
+	glm::vec3 extent = glm::vec3(boxes.extentX[item], boxes.extentY[item], boxes.extentZ[item]);
+	BvhBounds bounds = { center - extent, center + extent };
+	return bounds;
+}
+
+static inline BvhBounds GetNodeBounds(const BvhNode& node)
+{
+	BvhBounds bounds = { node.center - node.extent, node.center + node.extent };
+	return bounds;
+}
+
+static inline void SetNodeBounds(BvhNode& node, const BvhBounds& bounds)
+{
+	node.center = (bounds.min + bounds.max) * 0.5f;
+	node.extent = (bounds.max - bounds.min) * 0.5f;
+}
+
+static inline BvhBounds Union(const BvhBounds& a, const BvhBounds& b)
+{
+	BvhBounds bounds = { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+	return bounds;
+}
+
+// Half the surface area, the constant does not change any decision
+static inline f32 Area(const BvhBounds& bounds)
+{
+	glm::vec3 size = bounds.max - bounds.min;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static inline u32 CountTrailingZeros(u32 mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (u32)index;
+#else
+	return (u32)__builtin_ctz(mask);
+#endif
+}
+
+static inline bool IsLeaf(const BvhNode& node)
+{
+	return node.item != BVH_INVALID;
+}
+
+static inline bool IsFree(const BvhNode& node)
+{
+	return node.item == BVH_INVALID && node.children[0] == BVH_INVALID;
+}
+
+static u32 AllocateNode(Bvh& bvh, u32 parent)
+{
+	u32 nodeIdx;
+	if (!bvh.freeNodes.empty())
+	{
+		nodeIdx = bvh.freeNodes.back();
+		bvh.freeNodes.pop_back();
+	}
+	else
+	{
+		nodeIdx = (u32)bvh.nodes.size();
+		bvh.nodes.push_back(BvhNode());
+	}
+
+	BvhNode& node = bvh.nodes[nodeIdx];
+	node.center = glm::vec3(0.0f);
+	node.extent = glm::vec3(0.0f);
+	node.parent = parent;
+	node.item = BVH_INVALID;
+	node.children[0] = BVH_INVALID;
+	node.children[1] = BVH_INVALID;
+	return nodeIdx;
+}
+
+static void FreeNode(Bvh& bvh, u32 nodeIdx)
+{
+	BvhNode& node = bvh.nodes[nodeIdx];
+	node.parent = BVH_INVALID;
+	node.item = BVH_INVALID;
+	node.children[0] = BVH_INVALID;
+	node.children[1] = BVH_INVALID;
+	bvh.freeNodes.push_back(nodeIdx);
+}
+
+static void MakeLeaf(Bvh& bvh, u32 nodeIdx, const CullingBoxes& boxes, u32 item)
+{
+	// The same floats as the boxes, so leaves test exactly as CullBoxes
+	BvhNode& node = bvh.nodes[nodeIdx];
+	node.center = glm::vec3(boxes.centerX[item], boxes.centerY[item], boxes.centerZ[item]);
+	node.extent = glm::vec3(boxes.extentX[item], boxes.extentY[item], boxes.extentZ[item]);
+	node.item = item;
+	bvh.itemLeaves[item] = nodeIdx;
+}
+
+static void RefitNode(Bvh& bvh, u32 nodeIdx)
+{
+	BvhNode& node = bvh.nodes[nodeIdx];
+	SetNodeBounds(node, Union(GetNodeBounds(bvh.nodes[node.children[0]]), GetNodeBounds(bvh.nodes[node.children[1]])));
+}
+
+static void RefitAncestors(Bvh& bvh, u32 nodeIdx)
+{
+	while (nodeIdx != BVH_INVALID)
+	{
+		RefitNode(bvh, nodeIdx);
+		nodeIdx = bvh.nodes[nodeIdx].parent;
+	}
+}
+
+// Boxes and centers of the items during a build, side by side for the passes over each range
+struct BvhBuildItem
+{
+	BvhBounds bounds;
+	glm::vec3 center;
+	u32 item;
+};
+
+// Sorts the items of the range in two by the split of lowest cost over the bins of every axis,
+// and returns where the second part begins
+static u32 PartitionSah(BvhBuildItem* items, u32 begin, u32 end, const BvhBounds& centers)
+{
+	struct Bin
+	{
+		BvhBounds bounds;
+		u32 count;
+	};
+
+	f32 bestCost = FLT_MAX;
+	u32 bestAxis = BVH_INVALID;
+	u32 bestSplit = 0;
+
+	for (u32 axis = 0; axis < 3; ++axis)
+	{
+		f32 centerMin = centers.min[axis];
+		f32 centerExtent = centers.max[axis] - centerMin;
+		if (centerExtent <= 0.0f)
+			continue;
+
+		Bin bins[BVH_SAH_BINS];
+		for (Bin& bin : bins)
+		{
+			bin.bounds = EmptyBounds;
+			bin.count = 0;
+		}
+
+		const f32 scale = BVH_SAH_BINS / centerExtent;
+		for (u32 i = begin; i < end; ++i)
+		{
+			u32 binIdx = glm::min((u32)((items[i].center[axis] - centerMin) * scale), (u32)BVH_SAH_BINS - 1);
+			bins[binIdx].bounds = Union(bins[binIdx].bounds, items[i].bounds);
+			bins[binIdx].count++;
+		}
+
+		// Area and count on the left of every split, then the cost with the right side
+		f32 leftArea[BVH_SAH_BINS - 1];
+		u32 leftCount[BVH_SAH_BINS - 1];
+		BvhBounds left = EmptyBounds;
+		u32 count = 0;
+		for (u32 split = 0; split < BVH_SAH_BINS - 1; ++split)
+		{
+			left = Union(left, bins[split].bounds);
+			count += bins[split].count;
+			leftArea[split] = count > 0 ? Area(left) : 0.0f;
+			leftCount[split] = count;
+		}
+
+		BvhBounds right = EmptyBounds;
+		count = 0;
+		for (u32 split = BVH_SAH_BINS - 1; split > 0; --split)
+		{
+			right = Union(right, bins[split].bounds);
+			count += bins[split].count;
+			if (count == 0 || leftCount[split - 1] == 0)
+				continue;
+
+			f32 cost = leftArea[split - 1] * leftCount[split - 1] + Area(right) * count;
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	// Every center in the same place, any split is as good
+	const u32 middle = begin + (end - begin) / 2;
+	if (bestAxis == BVH_INVALID)
+		return middle;
+
+	const f32 centerMin = centers.min[bestAxis];
+	const f32 scale = BVH_SAH_BINS / (centers.max[bestAxis] - centerMin);
+	BvhBuildItem* split = std::partition(items + begin, items + end, [&](const BvhBuildItem& item)
+		{
+			return glm::min((u32)((item.center[bestAxis] - centerMin) * scale), (u32)BVH_SAH_BINS - 1) < bestSplit;
+		});
+
+	u32 mid = (u32)(split - items);
+	return mid == begin || mid == end ? middle : mid;
+}
+
+void BuildBvh(Bvh& bvh, const CullingBoxes& boxes)
+{
+	const u32 count = boxes.count;
+	bvh.nodes.clear();
+	bvh.freeNodes.clear();
+	bvh.itemLeaves.assign(count, BVH_INVALID);
+	bvh.root = BVH_INVALID;
+	bvh.itemCount = count;
+	bvh.childrenAfterParents = true;
+	if (count == 0)
+		return;
+
+	bvh.nodes.reserve(2 * count - 1);
+	std::vector<BvhBuildItem> items(count);
+	for (u32 i = 0; i < count; ++i)
+	{
+		items[i].bounds = GetItemBounds(boxes, i);
+		items[i].center = glm::vec3(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+		items[i].item = i;
+	}
+
+	struct Range
+	{
+		u32 node;
+		u32 begin;
+		u32 end;
+	};
+
+	// Children are allocated after their parent, which refits rely on
+	bvh.root = AllocateNode(bvh, BVH_INVALID);
+	std::vector<Range> stack;
+	stack.push_back({ bvh.root, 0, count });
+	while (!stack.empty())
+	{
+		Range range = stack.back();
+		stack.pop_back();
+
+		if (range.end - range.begin == 1)
+		{
+			MakeLeaf(bvh, range.node, boxes, items[range.begin].item);
+			continue;
+		}
+
+		BvhBounds bounds = EmptyBounds;
+		BvhBounds centers = EmptyBounds;
+		for (u32 i = range.begin; i < range.end; ++i)
+		{
+			bounds = Union(bounds, items[i].bounds);
+			centers.min = glm::min(centers.min, items[i].center);
+			centers.max = glm::max(centers.max, items[i].center);
+		}
+		SetNodeBounds(bvh.nodes[range.node], bounds);
+
+		u32 mid = PartitionSah(items.data(), range.begin, range.end, centers);
+		u32 left = AllocateNode(bvh, range.node);
+		u32 right = AllocateNode(bvh, range.node);
+		bvh.nodes[range.node].children[0] = left;
+		bvh.nodes[range.node].children[1] = right;
+		stack.push_back({ right, mid, range.end });
+		stack.push_back({ left, range.begin, mid });
+	}
+}
+
+void InsertBvhItem(Bvh& bvh, const CullingBoxes& boxes, u32 item)
+{
+	if (item >= bvh.itemLeaves.size())
+		bvh.itemLeaves.resize(item + 1, BVH_INVALID);
+	if (bvh.itemLeaves[item] != BVH_INVALID)
+	{
+		UpdateBvhItem(bvh, boxes, item);
+		return;
+	}
+
+	u32 leaf = AllocateNode(bvh, BVH_INVALID);
+	MakeLeaf(bvh, leaf, boxes, item);
+	bvh.itemCount++;
+	if (bvh.root == BVH_INVALID)
+	{
+		bvh.root = leaf;
+		return;
+	}
+
+	// Down the tree while a child is a cheaper sibling than the node itself. Making a node the
+	// sibling costs the area of the new parent, and every node above grows by the same amount.
+	const BvhBounds bounds = GetNodeBounds(bvh.nodes[leaf]);
+	u32 sibling = bvh.root;
+	while (!IsLeaf(bvh.nodes[sibling]))
+	{
+		const BvhNode& node = bvh.nodes[sibling];
+		f32 area = Area(GetNodeBounds(node));
+		f32 combinedArea = Area(Union(GetNodeBounds(node), bounds));
+		f32 cost = combinedArea;
+		f32 inheritedCost = combinedArea - area;
+
+		f32 childCosts[2];
+		for (u32 c = 0; c < 2; ++c)
+		{
+			const BvhNode& child = bvh.nodes[node.children[c]];
+			f32 childCombinedArea = Area(Union(GetNodeBounds(child), bounds));
+			childCosts[c] = (IsLeaf(child) ? childCombinedArea : childCombinedArea - Area(GetNodeBounds(child))) + inheritedCost;
+		}
+
+		if (cost < childCosts[0] && cost < childCosts[1])
+			break;
+		sibling = childCosts[0] <= childCosts[1] ? node.children[0] : node.children[1];
+	}
+
+	u32 oldParent = bvh.nodes[sibling].parent;
+	u32 parent = AllocateNode(bvh, oldParent);
+	bvh.nodes[parent].children[0] = sibling;
+	bvh.nodes[parent].children[1] = leaf;
+	bvh.nodes[sibling].parent = parent;
+	bvh.nodes[leaf].parent = parent;
+
+	if (oldParent == BVH_INVALID)
+		bvh.root = parent;
+	else
+	{
+		BvhNode& old = bvh.nodes[oldParent];
+		old.children[old.children[0] == sibling ? 0 : 1] = parent;
+	}
+
+	RefitAncestors(bvh, parent);
+	bvh.childrenAfterParents = false;
+}
+
+void RemoveBvhItem(Bvh& bvh, u32 item)
+{
+	if (item >= bvh.itemLeaves.size() || bvh.itemLeaves[item] == BVH_INVALID)
+		return;
+
+	u32 leaf = bvh.itemLeaves[item];
+	u32 parent = bvh.nodes[leaf].parent;
+	bvh.itemLeaves[item] = BVH_INVALID;
+	bvh.itemCount--;
+	FreeNode(bvh, leaf);
+
+	if (parent == BVH_INVALID)
+	{
+		bvh.root = BVH_INVALID;
+		return;
+	}
+
+	// The sibling takes the place of the parent, which keeps children after their parents
+	const BvhNode& parentNode = bvh.nodes[parent];
+	u32 sibling = parentNode.children[0] == leaf ? parentNode.children[1] : parentNode.children[0];
+	u32 grandparent = parentNode.parent;
+	bvh.nodes[sibling].parent = grandparent;
+	FreeNode(bvh, parent);
+
+	if (grandparent == BVH_INVALID)
+	{
+		bvh.root = sibling;
+		return;
+	}
+
+	BvhNode& grandparentNode = bvh.nodes[grandparent];
+	grandparentNode.children[grandparentNode.children[0] == parent ? 0 : 1] = sibling;
+	RefitAncestors(bvh, grandparent);
+}
+
+void UpdateBvhItem(Bvh& bvh, const CullingBoxes& boxes, u32 item)
+{
+	if (item >= bvh.itemLeaves.size() || bvh.itemLeaves[item] == BVH_INVALID)
+		return;
+
+	u32 leaf = bvh.itemLeaves[item];
+	MakeLeaf(bvh, leaf, boxes, item);
+	RefitAncestors(bvh, bvh.nodes[leaf].parent);
+}
+
+void RefitBvh(Bvh& bvh, const CullingBoxes& boxes)
+{
+	if (bvh.root == BVH_INVALID)
+		return;
+
+	for (u32 item = 0; item < bvh.itemLeaves.size(); ++item)
+		if (bvh.itemLeaves[item] != BVH_INVALID)
+			MakeLeaf(bvh, bvh.itemLeaves[item], boxes, item);
+
+	if (bvh.childrenAfterParents)
+	{
+		for (u32 nodeIdx = (u32)bvh.nodes.size(); nodeIdx-- > 0;)
+		{
+			const BvhNode& node = bvh.nodes[nodeIdx];
+			if (!IsLeaf(node) && !IsFree(node))
+				RefitNode(bvh, nodeIdx);
+		}
+		return;
+	}
+
+	// After inserts, in post order: a node is refitted when it is seen the second time
+	std::vector<u32> stack;
+	stack.push_back(bvh.root);
+	std::vector<u8> expanded(bvh.nodes.size(), 0);
+	while (!stack.empty())
+	{
+		u32 nodeIdx = stack.back();
+		const BvhNode& node = bvh.nodes[nodeIdx];
+		if (IsLeaf(node))
+		{
+			stack.pop_back();
+			continue;
+		}
+
+		if (expanded[nodeIdx])
+		{
+			RefitNode(bvh, nodeIdx);
+			stack.pop_back();
+			continue;
+		}
+
+		expanded[nodeIdx] = 1;
+		stack.push_back(node.children[0]);
+		stack.push_back(node.children[1]);
+	}
+}
+
+void QueryBvhFrustums(const Bvh& bvh, const glm::vec4* planes, u32 frustumCount, std::vector<u32>* visible)
+{
+	frustumCount = glm::min(frustumCount, (u32)BVH_MAX_FRUSTUMS);
+	for (u32 f = 0; f < frustumCount; ++f)
+		visible[f].clear();
+	if (bvh.root == BVH_INVALID || frustumCount == 0)
+		return;
+
+	// Frustums still crossing the node, and the ones holding it whole, whose subtree is taken
+	// without more tests
+	struct Entry
+	{
+		u32 node;
+		u32 crossing;
+		u32 inside;
+	};
+
+	std::vector<Entry> stack;
+	stack.reserve(64);
+	stack.push_back({ bvh.root, frustumCount == 32 ? 0xffffffffu : (1u << frustumCount) - 1, 0 });
+	while (!stack.empty())
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		const BvhNode& node = bvh.nodes[entry.node];
+
+		u32 crossing = entry.crossing;
+		u32 inside = entry.inside;
+		for (u32 mask = entry.crossing; mask != 0; mask &= mask - 1)
+		{
+			u32 f = CountTrailingZeros(mask);
+			const glm::vec4* frustum = planes + f * 6;
+			bool outside = false;
+			bool contained = true;
+			for (u32 p = 0; p < 6; ++p)
+			{
+				const glm::vec4& plane = frustum[p];
+				f32 distance = plane.x * node.center.x + plane.y * node.center.y + plane.z * node.center.z + plane.w;
+				f32 radius = fabsf(plane.x) * node.extent.x + fabsf(plane.y) * node.extent.y + fabsf(plane.z) * node.extent.z;
+				outside = outside || distance + radius < 0.0f;
+				contained = contained && distance - radius >= 0.0f;
+			}
+
+			if (outside || contained)
+				crossing &= ~(1u << f);
+			if (!outside && contained)
+				inside |= 1u << f;
+		}
+
+		u32 hits = crossing | inside;
+		if (hits == 0)
+			continue;
+
+		if (IsLeaf(node))
+		{
+			for (u32 mask = hits; mask != 0; mask &= mask - 1)
+				visible[CountTrailingZeros(mask)].push_back(node.item);
+			continue;
+		}
+
+		stack.push_back({ node.children[1], crossing, inside });
+		stack.push_back({ node.children[0], crossing, inside });
+	}
+}
+
+void QueryBvhSphere(const Bvh& bvh, glm::vec3 center, f32 radius, std::vector<u32>& items)
+{
+	items.clear();
+	if (bvh.root == BVH_INVALID)
+		return;
+
+	std::vector<u32> stack;
+	stack.reserve(64);
+	stack.push_back(bvh.root);
+	while (!stack.empty())
+	{
+		const BvhNode& node = bvh.nodes[stack.back()];
+		stack.pop_back();
+
+		// Distance from the center to the nearest point of the box
+		glm::vec3 outside = glm::max(glm::abs(center - node.center) - node.extent, glm::vec3(0.0f));
+		if (glm::dot(outside, outside) > radius * radius)
+			continue;
+
+		if (IsLeaf(node))
+			items.push_back(node.item);
+		else
+		{
+			stack.push_back(node.children[1]);
+			stack.push_back(node.children[0]);
+		}
+	}
+}
+
+// Distances along the ray where it enters and leaves the box, with the slab test
+static inline bool IntersectRay(const BvhNode& node, glm::vec3 origin, glm::vec3 inverseDirection, f32& entry, f32& exit)
+{
+	glm::vec3 t0 = (node.center - node.extent - origin) * inverseDirection;
+	glm::vec3 t1 = (node.center + node.extent - origin) * inverseDirection;
+	glm::vec3 tMin = glm::min(t0, t1);
+	glm::vec3 tMax = glm::max(t0, t1);
+	entry = glm::max(tMin.x, glm::max(tMin.y, tMin.z));
+	exit = glm::min(tMax.x, glm::min(tMax.y, tMax.z));
+	return entry <= exit && exit >= 0.0f;
+}
+
+bool RaycastBvh(const Bvh& bvh, glm::vec3 origin, glm::vec3 direction, f32 maxDistance, BvhRayHit& hit)
+{
+	hit.item = BVH_INVALID;
+	hit.distance = maxDistance;
+	hit.nodesVisited = 0;
+	if (bvh.root == BVH_INVALID)
+		return false;
+
+	const glm::vec3 inverseDirection = 1.0f / direction;
+
+	struct Entry
+	{
+		u32 node;
+		f32 entry;
+	};
+
+	// Nearer children are visited first, and nodes entered beyond the nearest hit are skipped
+	std::vector<Entry> stack;
+	stack.reserve(64);
+	f32 entry, exit;
+	hit.nodesVisited++;
+	if (!IntersectRay(bvh.nodes[bvh.root], origin, inverseDirection, entry, exit))
+		return false;
+	stack.push_back({ bvh.root, entry });
+
+	while (!stack.empty())
+	{
+		Entry current = stack.back();
+		stack.pop_back();
+		if (current.entry > hit.distance)
+			continue;
+
+		const BvhNode& node = bvh.nodes[current.node];
+		if (IsLeaf(node))
+		{
+			if (current.entry >= 0.0f && current.entry <= hit.distance)
+			{
+				hit.item = node.item;
+				hit.distance = current.entry;
+			}
+			continue;
+		}
+
+		Entry children[2];
+		u32 childCount = 0;
+		for (u32 c = 0; c < 2; ++c)
+		{
+			hit.nodesVisited++;
+			if (IntersectRay(bvh.nodes[node.children[c]], origin, inverseDirection, entry, exit) && entry <= hit.distance)
+				children[childCount++] = { node.children[c], entry };
+		}
+
+		if (childCount == 2 && children[0].entry < children[1].entry)
+			std::swap(children[0], children[1]);
+		for (u32 c = 0; c < childCount; ++c)
+			stack.push_back(children[c]);
+	}
+
+	return hit.item != BVH_INVALID;
+}
+
+f32 GetBvhCost(const Bvh& bvh)
+{
+	if (bvh.root == BVH_INVALID)
+		return 0.0f;
+
+	f64 area = 0.0;
+	for (const BvhNode& node : bvh.nodes)
+		if (!IsFree(node))
+			area += Area(GetNodeBounds(node));
+
+	f32 rootArea = Area(GetNodeBounds(bvh.nodes[bvh.root]));
+	return rootArea > 0.0f ? (f32)(area / rootArea) : 0.0f;
+}
@@ -0,0 +1,88 @@
+//
+// bvh.h: Bounding volume hierarchy over the world boxes of the entities, kept in CullingBoxes.
+// Built top down with the surface area heuristic, refitted when boxes move, and changed one
+// item at a time with inserts and removes. Every leaf holds one item, so the tree answers
+// frustum, ray and sphere queries by visiting the few nodes near the answer instead of every box.
+// Nothing here touches OpenGL, and queries only read the tree, so threads may share it.
+//
+
+#pragma once
+
+#include "frustum_culling.h"
+
+#define BVH_INVALID       0xffffffffu
+#define BVH_SAH_BINS      16
+#define BVH_MAX_FRUSTUMS  32 // per batched query
+
+struct BvhNode
+{
+	glm::vec3 center;
+	u32 parent;
+	glm::vec3 extent;
+	u32 item;        // of leaves, BVH_INVALID for inner nodes and free ones
+	u32 children[2]; // of inner nodes
+};
+
+struct Bvh
+{
+	std::vector<BvhNode> nodes;
+	std::vector<u32> freeNodes;
+	std::vector<u32> itemLeaves; // node of every item, BVH_INVALID when it is not in the tree
+	u32 root;
+	u32 itemCount;
+	bool childrenAfterParents;   // true after a build, lets a refit walk the nodes backwards
+};
+
+struct BvhRayHit
+{
+	u32 item;
+	f32 distance;     // along the direction, where the ray enters the box
+	u32 nodesVisited;
+};
+
+/**
+ * Replaces the tree with one holding every box, splitting the items where the surface area
+ * heuristic of 16 bins per axis is lowest.
+ */
+void BuildBvh(Bvh& bvh, const CullingBoxes& boxes);
+
+/**
+ * Adds one item, next to the node that makes the tree grow the least.
+ */
+void InsertBvhItem(Bvh& bvh, const CullingBoxes& boxes, u32 item);
+
+void RemoveBvhItem(Bvh& bvh, u32 item);
+
+/**
+ * Takes the box of one item again and refits the nodes above it.
+ */
+void UpdateBvhItem(Bvh& bvh, const CullingBoxes& boxes, u32 item);
+
+/**
+ * Takes the box of every item again and refits every node, keeping the shape of the tree.
+ * Cheaper than a build, but the tree gets worse as items move far from where it was built.
+ */
+void RefitBvh(Bvh& bvh, const CullingBoxes& boxes);
+
+/**
+ * Collects the items inside or crossing each frustum, 6 planes each as in CullBoxes, in one
+ * walk of the tree, into visible[frustum]. Leaves give the same answer as CullBoxes.
+ */
+void QueryBvhFrustums(const Bvh& bvh, const glm::vec4* planes, u32 frustumCount, std::vector<u32>* visible);
+
+/**
+ * Collects the items whose box overlaps the sphere.
+ */
+void QueryBvhSphere(const Bvh& bvh, glm::vec3 center, f32 radius, std::vector<u32>& items);
+
+/**
+ * Finds the nearest box the ray enters within the distance. Boxes holding the origin are not
+ * hits, so the ones around the camera do not hide everything else.
+ */
+bool RaycastBvh(const Bvh& bvh, glm::vec3 origin, glm::vec3 direction, f32 maxDistance, BvhRayHit& hit);
+
+/**
+ * Expected cost of a query with the surface area heuristic, the area of every node relative to
+ * the root. Lower is better, it grows as refits stretch the nodes.
+ */
+f32 GetBvhCost(const Bvh& bvh);
@@ -0,0 +1,85 @@
+#include "depth_pyramid.h"
+
+void ResizeDepthPyramid(DepthPyramid& pyramid, i32 width, i32 height)
+{
+	width = glm::max(width, 1);
+	height = glm::max(height, 1);
+	if (pyramid.texture != 0 && pyramid.width == width && pyramid.height == height)
+		return;
+
+	// Storage is immutable, a new size needs a new texture
+	DestroyDepthPyramid(pyramid);
+
+	pyramid.width = width;
+	pyramid.height = height;
+	pyramid.levelCount = (u32)floorf(log2f((f32)glm::max(width, height))) + 1;
+
+	glGenTextures(1, &pyramid.texture);
+	glBindTexture(GL_TEXTURE_2D, pyramid.texture);
+	glTexStorage2D(GL_TEXTURE_2D, (GLsizei)pyramid.levelCount, GL_R32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void DestroyDepthPyramid(DepthPyramid& pyramid)
+{
+	if (pyramid.texture != 0)
+		glDeleteTextures(1, &pyramid.texture);
+	pyramid.texture = 0;
+	pyramid.width = 0;
+	pyramid.height = 0;
+	pyramid.levelCount = 0;
+}
+
+void BuildDepthPyramid(DepthPyramid& pyramid, GLuint reductionProgram, GLuint depthTexture)
+{
+	if (pyramid.texture == 0)
+		return;
+
+	if (pyramid.program != reductionProgram)
+	{
+		pyramid.program = reductionProgram;
+		pyramid.uFromDepth = glGetUniformLocation(reductionProgram, "uFromDepth");
+		pyramid.uSourceSize = glGetUniformLocation(reductionProgram, "uSourceSize");
+		pyramid.uDestinationSize = glGetUniformLocation(reductionProgram, "uDestinationSize");
+	}
+
+	glUseProgram(reductionProgram);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+
+	i32 sourceWidth = pyramid.width;
+	i32 sourceHeight = pyramid.height;
+	for (u32 level = 0; level < pyramid.levelCount; ++level)
+	{
+		i32 width = glm::max(pyramid.width >> level, 1);
+		i32 height = glm::max(pyramid.height >> level, 1);
+
+		if (level > 0)
+			glBindImageTexture(0, pyramid.texture, (GLint)level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, pyramid.texture, (GLint)level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+		glUniform1i(pyramid.uFromDepth, level == 0 ? 1 : 0);
+		glUniform2i(pyramid.uSourceSize, sourceWidth, sourceHeight);
+		glUniform2i(pyramid.uDestinationSize, width, height);
+		glDispatchCompute((width + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, (height + DEPTH_PYRAMID_GROUP_SIZE - 1) / DEPTH_PYRAMID_GROUP_SIZE, 1);
+
+		// The next level reads this one
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+		sourceWidth = width;
+		sourceHeight = height;
+	}
+
+	// The culling shader fetches the levels as a texture
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+	glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glUseProgram(0);
+}
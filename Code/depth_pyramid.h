@@ -0,0 +1,39 @@
+//
+// depth_pyramid.h: Mip chain of the farthest depth of the depth buffer (Hi-Z), built with a
+// compute shader. Any rectangle of the screen is covered by at most 2x2 texels of some level,
+// so testing a bounding box against it takes four fetches.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+#define DEPTH_PYRAMID_GROUP_SIZE 8 // in x and y
+
+struct DepthPyramid
+{
+	GLuint texture; // R32F with every level
+	i32 width;      // of level 0, the size of the depth buffer
+	i32 height;
+	u32 levelCount;
+
+	// Uniforms of the reduction program, looked up again when it is reloaded
+	GLuint program;
+	GLint uFromDepth;
+	GLint uSourceSize;
+	GLint uDestinationSize;
+};
+
+/**
+ * Makes room for the pyramid of a depth buffer of the given size, when it changed.
+ */
+void ResizeDepthPyramid(DepthPyramid& pyramid, i32 width, i32 height);
+
+void DestroyDepthPyramid(DepthPyramid& pyramid);
+
+/**
+ * Copies the depth texture to level 0 and reduces every level into the next with the maximum,
+ * including the last row and column of odd sizes, so every texel covers its whole footprint.
+ */
+void BuildDepthPyramid(DepthPyramid& pyramid, GLuint reductionProgram, GLuint depthTexture);
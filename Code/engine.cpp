@@ -7,9 +7,26 @@
 
 #include "engine.h"
 #include "colors.h"
+#include "mesh_cache.h"
+#include "texture_compression.h"
+#include "mipmap.h"
+#include "mesh_conversion.h"
+#include "vertex_quantization.h"
+#include "meshlets.h"
+#include "indirect_draws.h"
+#include "gpu_culling.h"
+#include "mesh_simplification.h"
+#include "mesh_optimization.h"
+#include "obj_loader.h"
+#include "async_loading.h"
+#include "benchmarks.h"
 #include <imgui.h>
+#include <assimp/cfileio.h>
 #include <stb_image.h>
 #include <stb_image_write.h>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 
 // Open GL functions
 GLuint CreateProgramFromSource(String programSource, const char* shaderName)
@@ -91,12 +108,89 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 	return programHandle;
 }
 
+GLuint CreateComputeProgramFromSource(String programSource, const char* shaderName)
+{
+	GLchar  infoLogBuffer[1024] = {};
+	GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+	GLsizei infoLogSize;
+	GLint   success;
+
+	char versionString[] = "#version 430\n";
+	char shaderNameDefine[128];
+	sprintf(shaderNameDefine, "#define %s\n", shaderName);
+	char computeShaderDefine[] = "#define COMPUTE\n";
+
+	const GLchar* computeShaderSource[] = {
+		versionString,
+		shaderNameDefine,
+		computeShaderDefine,
+		programSource.str
+	};
+	const GLint computeShaderLengths[] = {
+		(GLint)strlen(versionString),
+		(GLint)strlen(shaderNameDefine),
+		(GLint)strlen(computeShaderDefine),
+		(GLint)programSource.len
+	};
+
+	GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+	glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+	glCompileShader(cshader);
+	glGetShaderiv(cshader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+		ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+	}
+
+	GLuint programHandle = glCreateProgram();
+	glAttachShader(programHandle, cshader);
+	glLinkProgram(programHandle);
+	glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+		ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+	}
+
+	glDetachShader(programHandle, cshader);
+	glDeleteShader(cshader);
+
+	return programHandle;
+}
+
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+{
+	AssetFile file;
+	if (!ReadAssetFile(filepath, file))
+		ELOG("Could not open file %s", filepath);
+
+	String programSource = { (char*)file.data, (u32)file.size };
+
+	Program program = {};
+	program.handle = CreateComputeProgramFromSource(programSource, programName);
+	FreeAssetFile(file);
+	program.filepath = filepath;
+	program.programName = programName;
+	program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+	program.compute = true;
+
+	app->programs.push_back(program);
+
+	return app->programs.size() - 1;
+}
+
 u32 LoadProgram(App* app, const char* filepath, const char* programName)
 {
-	String programSource = ReadTextFile(filepath);
+	AssetFile file;
+	if (!ReadAssetFile(filepath, file))
+		ELOG("Could not open file %s", filepath);
+
+	String programSource = { (char*)file.data, (u32)file.size };
 
 	Program program = {};
 	program.handle = CreateProgramFromSource(programSource, programName);
+	FreeAssetFile(file);
 	program.filepath = filepath;
 	program.programName = programName;
 	// To check later whether or not the file was modified since it was loaded
@@ -132,8 +226,14 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
 Image LoadImage(const char* filename)
 {
 	Image img = {};
-	stbi_set_flip_vertically_on_load(true);
-	img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
+	stbi_set_flip_vertically_on_load_thread(true); // images may be decoded from worker threads
+	AssetFile file;
+	if (ReadAssetFile(filename, file))
+	{
+		img.pixels = stbi_load_from_memory(file.data, (int)file.size, &img.size.x, &img.size.y, &img.nchannels, 0);
+		FreeAssetFile(file);
+	}
+
 	if (img.pixels)
 	{
 		img.stride = img.size.x * img.nchannels;
@@ -150,57 +250,293 @@ void FreeImage(Image image)
 	stbi_image_free(image.pixels);
 }
 
-GLuint CreateTexture2DFromImage(Image image)
+// Result of loading a texture in a worker thread, either compressed blocks or a mip chain
+struct DecodedTexture
+{
+	CompressedTexture compressed;
+	MipChain          mips;
+	i32               nchannels;
+	bool              isCompressed;
+	bool              isValid;
+	u64               contentHash; // of what would be uploaded, to share identical textures
+};
+
+static u64 HashCompressedTexture(const CompressedTexture& compressed)
+{
+	u64 seed = HashBytes(&compressed.size, sizeof(compressed.size), (u64)compressed.format);
+	return HashBytes(compressed.data.data(), compressed.data.size(), seed);
+}
+
+// Settings of the decode, copied from the app when it is submitted since the GUI may change them
+// while a worker runs it
+struct TextureDecodeSettings
+{
+	ThreadPool* pool;
+	MipFilter   mipFilter;
+	bool        compress;
+	bool        supportsS3TC;
+};
+
+static TextureDecodeSettings GetTextureDecodeSettings(const App* app)
+{
+	TextureDecodeSettings settings = {};
+	settings.pool = app->threadPool;
+	settings.mipFilter = app->mipFilter;
+	settings.compress = app->compressTextures;
+	settings.supportsS3TC = app->supportsS3TC;
+	return settings;
+}
+
+static void DecodeTexture(const TextureDecodeSettings& settings, const char* filepath, TextureUsage usage, DecodedTexture* decoded)
+{
+	decoded->isCompressed = false;
+	decoded->isValid = false;
+
+	// Colors are filtered in linear space, other data as is
+	bool srgb = usage == TextureUsage_Color;
+
+	if (settings.compress && LoadCompressedTexture(filepath, usage, settings.mipFilter, settings.supportsS3TC, &decoded->compressed))
+	{
+		decoded->isCompressed = true;
+		decoded->isValid = true;
+		decoded->contentHash = HashCompressedTexture(decoded->compressed);
+		return;
+	}
+
+	Image image = LoadImage(filepath);
+	if (!image.pixels)
+		return;
+
+	decoded->isValid = true;
+	decoded->nchannels = image.nchannels;
+
+	if (settings.compress)
+	{
+		BlockFormat format = ChooseBlockFormat(usage, image.nchannels, settings.supportsS3TC);
+		if (CompressImage(settings.pool, image, format, settings.mipFilter, srgb, &decoded->compressed))
+		{
+			SaveCompressedTexture(filepath, usage, settings.supportsS3TC, decoded->compressed);
+			decoded->isCompressed = true;
+			decoded->contentHash = HashCompressedTexture(decoded->compressed);
+			FreeImage(image);
+			return;
+		}
+	}
+
+	std::vector<u8> rgba = ConvertImageToRGBA8(image);
+	GenerateMipChain(settings.pool, rgba.data(), image.size, settings.mipFilter, srgb, &decoded->mips);
+	FreeImage(image);
+
+	u64 seed = HashBytes(&image.size, sizeof(image.size), (u64)image.nchannels);
+	decoded->contentHash = HashBytes(decoded->mips.data.data(), decoded->mips.data.size(), seed);
+}
+
+static Texture CreateDecodedTexture(const std::string& filepath, const DecodedTexture& decoded)
 {
-	GLenum internalFormat = GL_RGB8;
-	GLenum dataFormat = GL_RGB;
-	GLenum dataType = GL_UNSIGNED_BYTE;
+	Texture tex = {};
+	tex.filepath = filepath;
 
-	switch (image.nchannels)
+	if (decoded.isCompressed)
+	{
+		const CompressedTexture& compressed = decoded.compressed;
+		tex.handle = CreateTexture2DFromCompressed(compressed);
+		tex.formatName = GetBlockFormatName(compressed.format);
+		tex.gpuSize = (u32)compressed.data.size();
+		tex.psnr = compressed.psnr;
+		ILOG("Texture %s: %s, %u KB, PSNR %.2f dB", filepath.c_str(), tex.formatName, tex.gpuSize / 1024, tex.psnr);
+	}
+	else
 	{
-	case 3: dataFormat = GL_RGB; internalFormat = GL_RGB8; break;
-	case 4: dataFormat = GL_RGBA; internalFormat = GL_RGBA8; break;
-	default: ELOG("LoadTexture2D() - Unsupported number of channels");
+		bool hasAlpha = decoded.nchannels == 2 || decoded.nchannels == 4;
+		tex.handle = CreateTexture2DFromMipChain(decoded.mips, hasAlpha ? GL_RGBA8 : GL_RGB8);
+		tex.formatName = hasAlpha ? "RGBA8" : "RGB8";
+		tex.gpuSize = (u32)decoded.mips.data.size(); // drivers pad RGB8 to four bytes per pixel anyway
 	}
 
-	GLuint texHandle;
-	glGenTextures(1, &texHandle);
-	glBindTexture(GL_TEXTURE_2D, texHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	return tex;
+}
 
-	return texHandle;
+static u32 GetDecodedTextureSize(const DecodedTexture& decoded)
+{
+	return decoded.isCompressed ? (u32)decoded.compressed.data.size() : (u32)decoded.mips.data.size();
 }
 
-u32 LoadTexture2D(App* app, const char* filepath)
+static u32 UploadDecodedTexture(App* app, const std::string& filepath, DecodedTexture& decoded)
 {
-	for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-		if (app->textures[texIdx].filepath == filepath)
-			return texIdx;
+	if (!decoded.isValid)
+		return UINT32_MAX;
 
-	Image image = LoadImage(filepath);
+	AssetRegistry& assets = app->assets;
+	u64 pathHash = HashPath(filepath.c_str());
 
-	if (image.pixels)
+	// Another file with exactly the same contents is already on the GPU
+	u32 existingIdx = FindAsset(assets.textureContents, decoded.contentHash);
+	if (existingIdx != UINT32_MAX)
 	{
-		Texture tex = {};
-		tex.handle = CreateTexture2DFromImage(image);
-		tex.filepath = filepath;
+		u32 savedBytes = GetDecodedTextureSize(decoded);
+		assets.duplicateTextures++;
+		assets.textureBytesSaved += savedBytes;
+		RegisterAsset(assets.texturePaths, pathHash, existingIdx);
+		ILOG("Texture %s is a duplicate of %s, %u KB saved", filepath.c_str(), app->textures[existingIdx].filepath.c_str(), savedBytes / 1024);
+		return existingIdx;
+	}
+
+	u32 texIdx = (u32)app->textures.size();
+	app->textures.push_back(CreateDecodedTexture(filepath, decoded));
+	RegisterAsset(assets.texturePaths, pathHash, texIdx);
+	RegisterAsset(assets.textureContents, decoded.contentHash, texIdx);
+	return texIdx;
+}
+
+u32 LoadTexture2D(App* app, const char* filepath, TextureUsage usage)
+{
+	u32 texIdx = FindAsset(app->assets.texturePaths, HashPath(filepath));
+	if (texIdx != UINT32_MAX)
+		return texIdx;
+
+	DecodedTexture decoded;
+	DecodeTexture(GetTextureDecodeSettings(app), filepath, usage, &decoded);
+	return UploadDecodedTexture(app, filepath, decoded);
+}
 
-		u32 texIdx = app->textures.size();
-		app->textures.push_back(tex);
+u32 LoadTexture2DAsync(App* app, const char* filepath, TextureUsage usage)
+{
+	AssetRegistry& assets = app->assets;
+	u64 pathHash = HashPath(filepath);
 
-		FreeImage(image);
+	u32 texIdx = FindAsset(assets.texturePaths, pathHash);
+	if (texIdx != UINT32_MAX)
 		return texIdx;
+
+	// The slot shares the magenta texture until the file is uploaded into it, so the materials
+	// can point to it right away
+	Texture placeholder = app->magentaTexIdx < app->textures.size() ? app->textures[app->magentaTexIdx] : Texture{};
+	placeholder.filepath = filepath;
+	placeholder.gpuSize = 0;
+	placeholder.psnr = 0.0f;
+
+	texIdx = (u32)app->textures.size();
+	app->textures.push_back(placeholder);
+	RegisterAsset(assets.texturePaths, pathHash, texIdx);
+
+	// The settings are taken now, the GUI may change them while the load runs
+	std::string path = filepath;
+	TextureDecodeSettings settings = GetTextureDecodeSettings(app);
+	std::shared_ptr<DecodedTexture> decoded = std::make_shared<DecodedTexture>();
+
+	SubmitAsyncLoad(app,
+		[path, usage, settings, decoded]() -> u64
+		{
+			DecodeTexture(settings, path.c_str(), usage, decoded.get());
+			return decoded->isValid ? GetDecodedTextureSize(*decoded) : 0;
+		},
+		[app, path, texIdx, decoded]
+		{
+			if (!decoded->isValid)
+			{
+				ELOG("Texture %s could not be loaded, it stays magenta", path.c_str());
+				return;
+			}
+
+			AssetRegistry& assets = app->assets;
+
+			// Another file with exactly the same contents is already on the GPU, share its handle
+			u32 existingIdx = FindAsset(assets.textureContents, decoded->contentHash);
+			if (existingIdx != UINT32_MAX)
+			{
+				u32 savedBytes = GetDecodedTextureSize(*decoded);
+				assets.duplicateTextures++;
+				assets.textureBytesSaved += savedBytes;
+
+				Texture& texture = app->textures[texIdx];
+				texture = app->textures[existingIdx];
+				texture.filepath = path;
+				texture.gpuSize = 0;
+				ILOG("Texture %s is a duplicate of %s, %u KB saved", path.c_str(), app->textures[existingIdx].filepath.c_str(), savedBytes / 1024);
+				return;
+			}
+
+			app->textures[texIdx] = CreateDecodedTexture(path, *decoded);
+			RegisterAsset(assets.textureContents, decoded->contentHash, texIdx);
+		});
+
+	return texIdx;
+}
+
+void LoadTextures2D(App* app, const std::vector<TextureRequest>& requests)
+{
+	// Resolve the textures that are already loaded and gather the unique new files
+	std::vector<std::string> files;
+	std::vector<TextureUsage> fileUsages;
+	std::vector<u32> requestTexIdx(requests.size(), UINT32_MAX);
+	std::vector<u32> requestFileIdx(requests.size(), UINT32_MAX);
+	AssetMap batchFiles;
+
+	for (u32 i = 0; i < requests.size(); ++i)
+	{
+		u64 pathHash = HashPath(requests[i].filepath.c_str());
+
+		requestTexIdx[i] = FindAsset(app->assets.texturePaths, pathHash);
+		if (requestTexIdx[i] != UINT32_MAX)
+			continue;
+
+		requestFileIdx[i] = FindAsset(batchFiles, pathHash);
+		if (requestFileIdx[i] == UINT32_MAX)
+		{
+			requestFileIdx[i] = (u32)files.size();
+			RegisterAsset(batchFiles, pathHash, requestFileIdx[i]);
+			files.push_back(requests[i].filepath);
+			fileUsages.push_back(requests[i].usage);
+		}
 	}
-	else
+
+	// Decode (and compress) every new image concurrently in the worker threads
+	std::vector<DecodedTexture> decodedTextures(files.size());
+	std::vector<u32> readyImages;
+	std::mutex readyMutex;
+	std::condition_variable readyCondition;
+	JobCounter decodeJobs;
+	TextureDecodeSettings settings = GetTextureDecodeSettings(app);
+
+	for (u32 fileIdx = 0; fileIdx < files.size(); ++fileIdx)
 	{
-		return UINT32_MAX;
+		SubmitJob(app->threadPool, [&, fileIdx]
+			{
+				DecodeTexture(settings, files[fileIdx].c_str(), fileUsages[fileIdx], &decodedTextures[fileIdx]);
+				{
+					std::lock_guard<std::mutex> lock(readyMutex);
+					readyImages.push_back(fileIdx);
+				}
+				readyCondition.notify_one();
+			}, &decodeJobs);
+	}
+
+	// The main thread only uploads the images to OpenGL as they become ready
+	std::vector<u32> fileTexIdx(files.size(), UINT32_MAX);
+	std::vector<u32> uploadBatch;
+
+	for (u32 uploadedCount = 0; uploadedCount < files.size(); )
+	{
+		{
+			std::unique_lock<std::mutex> lock(readyMutex);
+			readyCondition.wait(lock, [&readyImages] { return !readyImages.empty(); });
+			uploadBatch.swap(readyImages);
+		}
+
+		for (u32 fileIdx : uploadBatch)
+		{
+			fileTexIdx[fileIdx] = UploadDecodedTexture(app, files[fileIdx], decodedTextures[fileIdx]);
+			uploadedCount++;
+		}
+		uploadBatch.clear();
+	}
+
+	WaitForCounter(app->threadPool, &decodeJobs);
+
+	for (u32 i = 0; i < requests.size(); ++i)
+	{
+		u32 texIdx = requestTexIdx[i] != UINT32_MAX ? requestTexIdx[i] : fileTexIdx[requestFileIdx[i]];
+		app->materials[requests[i].materialIdx].*requests[i].textureIdx = texIdx;
 	}
 }
 
@@ -223,6 +559,9 @@ void GetOpenGLContext(App* app)
 		if (extension)
 		{
 			app->openglInfo.extensions.push_back(reinterpret_cast<const char*>(extension));
+
+			if (strcmp((const char*)extension, "GL_EXT_texture_compression_s3tc") == 0)
+				app->supportsS3TC = true;
 		}
 	}
 }
@@ -267,93 +606,102 @@ void OnGlError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei l
 }
 
 // Assimp functions
-void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+
+// Assimp reads the model and the files it references (.mtl...) through the virtual file layer
+struct AssimpAssetFile
 {
-	std::vector<float> vertices;
-	std::vector<u32> indices;
+	AssetFile file;
+	u64 position;
+};
 
-	bool hasTexCoords = false;
-	bool hasTangentSpace = false;
+static size_t AssimpRead(aiFile* handle, char* buffer, size_t size, size_t count)
+{
+	AssimpAssetFile* file = (AssimpAssetFile*)handle->UserData;
+	if (size == 0)
+		return 0;
+
+	count = glm::min(count, (size_t)((file->file.size - file->position) / size));
+	memcpy(buffer, file->file.data + file->position, size * count);
+	file->position += size * count;
+	return count;
+}
 
-	// process vertices
-	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-	{
-		vertices.push_back(mesh->mVertices[i].x);
-		vertices.push_back(mesh->mVertices[i].y);
-		vertices.push_back(mesh->mVertices[i].z);
-		vertices.push_back(mesh->mNormals[i].x);
-		vertices.push_back(mesh->mNormals[i].y);
-		vertices.push_back(mesh->mNormals[i].z);
+static size_t AssimpWrite(aiFile* handle, const char* buffer, size_t size, size_t count)
+{
+	return 0;
+}
 
-		if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
-		{
-			hasTexCoords = true;
-			vertices.push_back(mesh->mTextureCoords[0][i].x);
-			vertices.push_back(mesh->mTextureCoords[0][i].y);
-		}
+static size_t AssimpTell(aiFile* handle)
+{
+	return (size_t)((AssimpAssetFile*)handle->UserData)->position;
+}
 
-		if (mesh->mTangents != nullptr && mesh->mBitangents)
-		{
-			hasTangentSpace = true;
-			vertices.push_back(mesh->mTangents[i].x);
-			vertices.push_back(mesh->mTangents[i].y);
-			vertices.push_back(mesh->mTangents[i].z);
-
-			// For some reason ASSIMP gives me the bitangents flipped.
-			// Maybe it's my fault, but when I generate my own geometry
-			// in other files (see the generation of standard assets)
-			// and all the bitangents have the orientation I expect,
-			// everything works ok.
-			// I think that (even if the documentation says the opposite)
-			// it returns a left-handed tangent space matrix.
-			// SOLUTION: I invert the components of the bitangent here.
-			vertices.push_back(-mesh->mBitangents[i].x);
-			vertices.push_back(-mesh->mBitangents[i].y);
-			vertices.push_back(-mesh->mBitangents[i].z);
-		}
-	}
+static size_t AssimpFileSize(aiFile* handle)
+{
+	return (size_t)((AssimpAssetFile*)handle->UserData)->file.size;
+}
 
-	// process indices
-	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
-	{
-		aiFace face = mesh->mFaces[i];
-		for (unsigned int j = 0; j < face.mNumIndices; j++)
-		{
-			indices.push_back(face.mIndices[j]);
-		}
-	}
+static aiReturn AssimpSeek(aiFile* handle, size_t offset, aiOrigin origin)
+{
+	AssimpAssetFile* file = (AssimpAssetFile*)handle->UserData;
+	u64 size = file->file.size;
 
-	// store the proper (previously proceessed) material for this mesh
-	submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+	// Like Assimp's own memory streams, the offset counts backwards from the end
+	u64 position = origin == aiOrigin_SET ? offset : origin == aiOrigin_CUR ? file->position + offset : size - offset;
+	if (offset > size || position > size)
+		return aiReturn_FAILURE;
+
+	file->position = position;
+	return aiReturn_SUCCESS;
+}
 
-	// create the vertex format
-	VertexBufferLayout vertexBufferLayout = {};
-	vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 0, 3, 0 }); // 3D positions
-	vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) }); // tex coords
-	vertexBufferLayout.stride = 6 * sizeof(float);
-	if (hasTexCoords)
+static void AssimpFlush(aiFile* handle)
+{
+}
+
+static aiFile* AssimpOpen(aiFileIO* io, const char* filepath, const char* mode)
+{
+	// Read only
+	if (mode[0] != 'r')
+		return NULL;
+
+	AssimpAssetFile* file = new AssimpAssetFile();
+	if (!ReadAssetFile(filepath, file->file))
 	{
-		vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
-		vertexBufferLayout.stride += 2 * sizeof(float);
+		delete file;
+		return NULL;
 	}
-	if (hasTangentSpace)
-	{
-		vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
-		vertexBufferLayout.stride += 3 * sizeof(float);
 
-		vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
-		vertexBufferLayout.stride += 3 * sizeof(float);
-	}
+	aiFile* handle = new aiFile();
+	handle->ReadProc = AssimpRead;
+	handle->WriteProc = AssimpWrite;
+	handle->TellProc = AssimpTell;
+	handle->FileSizeProc = AssimpFileSize;
+	handle->SeekProc = AssimpSeek;
+	handle->FlushProc = AssimpFlush;
+	handle->UserData = (aiUserData)file;
+	return handle;
+}
 
-	// add the submesh into the mesh
-	Submesh submesh = {};
-	submesh.vbLayout = vertexBufferLayout;
-	submesh.vertices.swap(vertices);
-	submesh.indices.swap(indices);
-	myMesh->submeshes.push_back(submesh);
+static void AssimpClose(aiFileIO* io, aiFile* handle)
+{
+	AssimpAssetFile* file = (AssimpAssetFile*)handle->UserData;
+	FreeAssetFile(file->file);
+	delete file;
+	delete handle;
+}
+
+void ProcessAssimpMesh(ThreadPool* pool, const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+{
+	// store the proper (previously proceessed) material for this mesh
+	submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+
+	// add the submesh into the mesh, its vertices and indices are written in place
+	myMesh->submeshes.push_back(Submesh{});
+	ConvertAssimpMesh(pool, mesh, &myMesh->submeshes.back());
 }
 
-void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+void ProcessAssimpMaterial(aiMaterial* material, u32 materialIdx, const std::string& directory, ModelData& data)
 {
 	aiString name;
 	aiColor3D diffuseColor;
@@ -366,195 +714,524 @@ void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial,
 	material->Get(AI_MATKEY_COLOR_SPECULAR, specularColor);
 	material->Get(AI_MATKEY_SHININESS, shininess);
 
+	Material& myMaterial = data.materials[materialIdx];
 	myMaterial.name = name.C_Str();
 	myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
 	myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
 	myMaterial.smoothness = shininess / 256.0f;
 
+	// Textures are only gathered here, they are decoded in parallel once the model is committed
 	aiString aiFilename;
 	if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
 	{
 		material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
+		data.textures.push_back({ directory + aiFilename.C_Str(), TextureUsage_Color, materialIdx, &Material::albedoTextureIdx });
 	}
 	if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
 	{
 		material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
+		data.textures.push_back({ directory + aiFilename.C_Str(), TextureUsage_Color, materialIdx, &Material::emissiveTextureIdx });
 	}
 	if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
 	{
 		material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
+		data.textures.push_back({ directory + aiFilename.C_Str(), TextureUsage_Data, materialIdx, &Material::specularTextureIdx });
 	}
 	if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
 	{
 		material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
+		data.textures.push_back({ directory + aiFilename.C_Str(), TextureUsage_Normal, materialIdx, &Material::normalsTextureIdx });
 	}
 	if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
 	{
 		material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+		data.textures.push_back({ directory + aiFilename.C_Str(), TextureUsage_Data, materialIdx, &Material::bumpTextureIdx });
 	}
 
 	//myMaterial.createNormalFromBump();
 }
 
-void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+void ProcessAssimpNode(ThreadPool* pool, const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
 {
 	// process all the node's meshes (if any)
 	for (unsigned int i = 0; i < node->mNumMeshes; i++)
 	{
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+		ProcessAssimpMesh(pool, scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
 	}
 
 	// then do the same for each of its children
 	for (unsigned int i = 0; i < node->mNumChildren; i++)
 	{
-		ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+		ProcessAssimpNode(pool, scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
 	}
 }
 
-u32 CreateSphereModel(App* app, float radius, u32 xSegments, u32 ySegments)
+static u64 HashMesh(const Mesh& mesh, u64 seed)
 {
-	Mesh mesh = {};
-
-	Submesh submesh = {};
-	submesh.vbLayout.vbAttributes.push_back({ 0, 3, 0 }); // Position
-	submesh.vbLayout.vbAttributes.push_back({ 1, 3, 3 * sizeof(float) }); // Normal
-	submesh.vbLayout.vbAttributes.push_back({ 2, 2, 6 * sizeof(float) }); // TexCoord
-	submesh.vbLayout.stride = 8 * sizeof(float);
-
-	for (u32 y = 0; y <= ySegments; ++y)
+	u64 hash = seed;
+	for (const Submesh& submesh : mesh.submeshes)
 	{
-		for (u32 x = 0; x <= xSegments; ++x)
-		{
-			float xSegment = (float)x / (float)xSegments;
-			float ySegment = (float)y / (float)ySegments;
-			float xPos = radius * cos(xSegment * 2.0f * glm::pi<float>()) * sin(ySegment * glm::pi<float>());
-			float yPos = radius * cos(ySegment * glm::pi<float>());
-			float zPos = radius * sin(xSegment * 2.0f * glm::pi<float>()) * sin(ySegment * glm::pi<float>());
+		hash = HashBytes(&submesh.vbLayout.stride, sizeof(submesh.vbLayout.stride), hash);
+		hash = HashBytes(submesh.vbLayout.vbAttributes.data(), submesh.vbLayout.vbAttributes.size() * sizeof(VertexBufferAttribute), hash);
+		hash = HashBytes(submesh.vertices.data(), submesh.vertices.size() * sizeof(float), hash);
+		hash = HashBytes(submesh.indices.data(), submesh.indices.size() * sizeof(u32), hash);
+	}
+	return hash;
+}
 
-			// Position
-			submesh.vertices.push_back(xPos);
-			submesh.vertices.push_back(yPos);
-			submesh.vertices.push_back(zPos);
+void PrepareMesh(ThreadPool* pool, VertexQuantization quantization, PreparedMesh& prepared)
+{
+	Mesh& mesh = prepared.mesh;
 
-			// Normal
-			glm::vec3 normal = glm::normalize(glm::vec3(xPos, yPos, zPos));
-			submesh.vertices.push_back(normal.x);
-			submesh.vertices.push_back(normal.y);
-			submesh.vertices.push_back(normal.z);
+	u32 floatVertexBytes = 0;
 
-			// TexCoord
-			submesh.vertices.push_back(xSegment);
-			submesh.vertices.push_back(ySegment);
-		}
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		floatVertexBytes += mesh.submeshes[i].vertices.size() * sizeof(float);
 	}
 
-	bool oddRow = false;
-	for (u32 y = 0; y < ySegments; ++y)
-	{
-		for (u32 x = 0; x < xSegments; ++x)
+	// The same vertices quantized differently are a different mesh
+	prepared.contentHash = HashMesh(mesh, quantization);
+
+	// Reorder triangles and vertices for the GPU and cluster them for culling
+	ParallelFor(pool, (u32)mesh.submeshes.size(), 1, [&mesh](u32 begin, u32 end)
 		{
-			u32 i0 = y * (xSegments + 1) + x;
-			u32 i1 = i0 + 1;
-			u32 i2 = (y + 1) * (xSegments + 1) + x;
-			u32 i3 = i2 + 1;
+			for (u32 i = begin; i < end; ++i)
+			{
+				OptimizeSubmesh(mesh.submeshes[i]);
+				ComputeSubmeshBounds(mesh.submeshes[i]);
+			}
+		});
 
-			submesh.indices.push_back(i0);
-			submesh.indices.push_back(i2);
-			submesh.indices.push_back(i1);
+	// Quantize the vertices, submeshes that stay as floats are uploaded from their own vertices
+	std::vector<std::vector<u8>> gpuVertices(mesh.submeshes.size());
+	mesh.quantizationError = {};
 
-			submesh.indices.push_back(i1);
-			submesh.indices.push_back(i2);
-			submesh.indices.push_back(i3);
-		}
+	u32 vertexBufferSize = 0;
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		Submesh& submesh = mesh.submeshes[i];
+		QuantizationError error = QuantizeSubmeshVertices(submesh, quantization, gpuVertices[i]);
+		mesh.quantizationError.position = glm::max(mesh.quantizationError.position, error.position);
+		mesh.quantizationError.normal = glm::max(mesh.quantizationError.normal, error.normal);
+		mesh.quantizationError.texCoord = glm::max(mesh.quantizationError.texCoord, error.texCoord);
+
+		// Quantized strides are multiples of 4 bytes, keep every submesh aligned to it
+		submesh.vertexCount = submesh.vbLayout.stride > 0 ? (u32)(submesh.vertices.size() * sizeof(float) / submesh.vbLayout.stride) : 0;
+		submesh.vertexOffset = vertexBufferSize;
+		vertexBufferSize += Align((u32)(gpuVertices[i].empty() ? submesh.vertices.size() * sizeof(float) : gpuVertices[i].size()), 4);
 	}
 
-	mesh.submeshes.push_back(submesh);
+	// Submeshes with few vertices are drawn with 16 bit indices, every submesh starts 4 byte aligned
+	u32 indexBufferSize = 0;
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		Submesh& submesh = mesh.submeshes[i];
+		submesh.indexType = ChooseIndexType(submesh);
+		submesh.indexCount = (u32)submesh.indices.size();
 
-	// Now upload to OpenGL
+		submesh.indexOffset = indexBufferSize;
+		indexBufferSize += Align(submesh.indexCount * GetIndexTypeSize(submesh.indexType), 4);
+	}
 
-	u32 vertexBufferSize = 0;
-	u32 indexBufferSize = 0;
+	mesh.floatVertexBytes = floatVertexBytes;
+	mesh.gpuVertexBytes = vertexBufferSize;
+	mesh.gpuIndexBytes = indexBufferSize;
+
+	// Lay out the buffer contents, every submesh at its offset
+	prepared.vertexData.assign(vertexBufferSize, 0);
+	prepared.indexData.assign(indexBufferSize, 0);
 
 	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
 	{
-		vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-		indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
+		const Submesh& submesh = mesh.submeshes[i];
+		u8* vertices = prepared.vertexData.data() + submesh.vertexOffset;
+		u8* indices = prepared.indexData.data() + submesh.indexOffset;
+		const u32 indexCount = submesh.indexCount;
+
+		if (gpuVertices[i].empty())
+			memcpy(vertices, submesh.vertices.data(), submesh.vertices.size() * sizeof(float));
+		else
+			memcpy(vertices, gpuVertices[i].data(), gpuVertices[i].size());
+
+		if (submesh.indexType == GL_UNSIGNED_SHORT)
+			ConvertIndicesToU16(submesh.indices.data(), indexCount, (u16*)indices);
+		else
+			memcpy(indices, submesh.indices.data(), indexCount * sizeof(u32));
 	}
+}
+
+static u64 HashVertexLayout(const VertexBufferLayout& layout)
+{
+	u64 hash = HashBytes(&layout.stride, sizeof(layout.stride));
+	return HashBytes(layout.vbAttributes.data(), layout.vbAttributes.size() * sizeof(VertexBufferAttribute), hash);
+}
 
-	glGenBuffers(1, &mesh.vertexBufferHandle);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-	glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+u32 UploadMesh(App* app, PreparedMesh& prepared)
+{
+	AssetRegistry& assets = app->assets;
+	Mesh& mesh = prepared.mesh;
 
-	glGenBuffers(1, &mesh.indexBufferHandle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+	u32 existingIdx = FindAsset(assets.meshContents, prepared.contentHash);
+	if (existingIdx != UINT32_MAX)
+	{
+		assets.duplicateMeshes++;
+		assets.meshBytesSaved += app->meshes[existingIdx].gpuVertexBytes + app->meshes[existingIdx].gpuIndexBytes;
+		return existingIdx;
+	}
 
-	u32 indicesOffset = 0;
-	u32 verticesOffset = 0;
+	// Meshes from the mesh cache are uploaded straight from it
+	const u8* vertexData = prepared.vertexData.empty() ? prepared.cachedVertexData : prepared.vertexData.data();
+	const u8* indexData = prepared.indexData.empty() ? prepared.cachedIndexData : prepared.indexData.data();
 
+	// Now upload to OpenGL, every submesh into the arena of its vertex layout
+	GeometryHeap& heap = app->geometryHeap;
 	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
 	{
-		const void* verticesData = mesh.submeshes[i].vertices.data();
-		const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-		glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-		mesh.submeshes[i].vertexOffset = verticesOffset;
-		verticesOffset += verticesSize;
+		Submesh& submesh = mesh.submeshes[i];
+		const u32 vertexBytes = (i + 1 < mesh.submeshes.size() ? mesh.submeshes[i + 1].vertexOffset : mesh.gpuVertexBytes) - submesh.vertexOffset;
+		const u32 indexBytes = (i + 1 < mesh.submeshes.size() ? mesh.submeshes[i + 1].indexOffset : mesh.gpuIndexBytes) - submesh.indexOffset;
 
-		const void* indicesData = mesh.submeshes[i].indices.data();
-		const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-		mesh.submeshes[i].indexOffset = indicesOffset;
-		indicesOffset += indicesSize;
+		u32 arena = FindVertexArena(heap, HashVertexLayout(submesh.gpuLayout), submesh.gpuLayout.stride);
+		submesh.vertexAllocation = AllocateGeometry(heap, arena, vertexData + submesh.vertexOffset, vertexBytes);
+		submesh.indexAllocation = AllocateGeometry(heap, GEOMETRY_INDEX_ARENA, indexData + submesh.indexOffset, indexBytes);
 	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// The arenas hold the contents now
+	std::vector<u8>().swap(prepared.vertexData);
+	std::vector<u8>().swap(prepared.indexData);
+	prepared.cachedVertexData = nullptr;
+	prepared.cachedIndexData = nullptr;
 
-	// Add the mesh
-	app->meshes.push_back(mesh);
-	u32 meshIdx = (u32)app->meshes.size() - 1u;
+	u32 meshIdx = (u32)app->meshes.size();
+	app->meshes.push_back(std::move(mesh));
+	RegisterAsset(assets.meshContents, prepared.contentHash, meshIdx);
+	return meshIdx;
+}
 
-	// Add a dummy material
-	Material material = {};
-	material.albedo = vec3(1.0f, 0.5f, 0.31f);
-	material.smoothness = 0.5f;
+void DefragmentGeometry(App* app)
+{
+	GeometryHeap& heap = app->geometryHeap;
+	DefragmentGeometryHeap(heap);
+
+	for (Mesh& mesh : app->meshes)
+	{
+		for (Submesh& submesh : mesh.submeshes)
+		{
+			RefreshGeometryAllocation(heap, submesh.vertexAllocation);
+			RefreshGeometryAllocation(heap, submesh.indexAllocation);
+		}
+	}
+}
+
+static u64 HashMaterial(const Material& material)
+{
+	// The name does not change how the material looks
+	f32 parameters[] = { material.albedo.r, material.albedo.g, material.albedo.b, material.emissive.r, material.emissive.g, material.emissive.b, material.smoothness };
+	u32 textures[] = { material.albedoTextureIdx, material.emissiveTextureIdx, material.specularTextureIdx, material.normalsTextureIdx, material.bumpTextureIdx };
+	return HashBytes(textures, sizeof(textures), HashBytes(parameters, sizeof(parameters)));
+}
+
+u32 AddMaterial(App* app, const Material& material)
+{
+	u64 contentHash = HashMaterial(material);
+	u32 existingIdx = FindAsset(app->assets.materialContents, contentHash);
+	if (existingIdx != UINT32_MAX)
+	{
+		app->assets.duplicateMaterials++;
+		return existingIdx;
+	}
+
+	u32 materialIdx = (u32)app->materials.size();
 	app->materials.push_back(material);
-	u32 materialIdx = (u32)app->materials.size() - 1u;
+	RegisterAsset(app->assets.materialContents, contentHash, materialIdx);
+	return materialIdx;
+}
+
+/**
+ * Materials of a model are created in place when it is committed (textures are assigned to
+ * them first). Once complete they are moved through AddMaterial so duplicates are dropped.
+ */
+static void DeduplicateModelMaterials(App* app, u32 modelIdx, u32 baseMaterialIdx)
+{
+	std::vector<Material> newMaterials(app->materials.begin() + baseMaterialIdx, app->materials.end());
+	app->materials.resize(baseMaterialIdx);
+
+	std::vector<u32> remap(newMaterials.size());
+	for (u32 i = 0; i < newMaterials.size(); ++i)
+		remap[i] = AddMaterial(app, newMaterials[i]);
+
+	for (u32& materialIdx : app->models[modelIdx].materialIdx)
+		if (materialIdx >= baseMaterialIdx)
+			materialIdx = remap[materialIdx - baseMaterialIdx];
+}
+
+// Counts from the prepared index counts, meshes from the mesh cache carry no CPU indices
+static u32 CountTriangles(const Mesh& mesh)
+{
+	u32 triangleCount = 0;
+	for (const Submesh& submesh : mesh.submeshes)
+		triangleCount += submesh.indexCount / 3;
+	return triangleCount;
+}
+
+// Levels are counted before PrepareMesh fills their index counts
+static u32 CountSimplifiedTriangles(const Mesh& mesh)
+{
+	u32 triangleCount = 0;
+	for (const Submesh& submesh : mesh.submeshes)
+		triangleCount += (u32)submesh.indices.size() / 3;
+	return triangleCount;
+}
+
+/**
+ * Simplifies the full mesh of the model into the levels of the settings and prepares them.
+ * Every level keeps the submeshes (and so the materials) of the full mesh, OptimizeSubmesh
+ * drops the vertices it no longer uses. Levels that barely remove triangles are not kept.
+ */
+static void BuildLodMeshes(ThreadPool* pool, VertexQuantization quantization, const LodSettings& settings, ModelData& data)
+{
+	const Mesh& fullMesh = data.lods[0].mesh;
+
+	// Bounds of the submeshes, the levels are simplified from them so they stay inside
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	for (const Submesh& submesh : fullMesh.submeshes)
+	{
+		if (submesh.meshlets.empty())
+			continue;
+		boundsMin = glm::min(boundsMin, submesh.aabbMin);
+		boundsMax = glm::max(boundsMax, submesh.aabbMax);
+	}
+	if (boundsMin.x > boundsMax.x)
+		boundsMin = boundsMax = vec3(0.0f);
+
+	data.aabbMin = boundsMin;
+	data.aabbMax = boundsMax;
+	data.boundsCenter = (boundsMin + boundsMax) * 0.5f;
+	data.boundsRadius = glm::length(boundsMax - boundsMin) * 0.5f;
+	data.lodCount = 1;
+	data.lodError[0] = 0.0f;
+
+	const u32 levelCount = glm::min(settings.levelCount, (u32)MAX_MODEL_LODS - 1);
+	const u32 submeshCount = (u32)fullMesh.submeshes.size();
+	if (levelCount == 0 || submeshCount == 0 || data.boundsRadius <= 0.0f)
+		return;
+
+	// Every level is simplified from the full mesh, so all of them run in parallel
+	std::vector<Mesh> levels(levelCount);
+	std::vector<f32> errors(levelCount * submeshCount, 0.0f);
+	for (Mesh& level : levels)
+		level.submeshes.resize(submeshCount);
+
+	ParallelFor(pool, levelCount * submeshCount, 1, [&](u32 begin, u32 end)
+		{
+			for (u32 job = begin; job < end; ++job)
+			{
+				u32 level = job / submeshCount;
+				const Submesh& source = fullMesh.submeshes[job % submeshCount];
+				Submesh& submesh = levels[level].submeshes[job % submeshCount];
+
+				u32 targetIndexCount = (u32)(source.indices.size() * settings.triangleRatio[level]) / 3 * 3;
+				f32 maxError = settings.maxError[level] * data.boundsRadius;
+
+				submesh.vbLayout = source.vbLayout;
+				submesh.vertices = source.vertices;
+				errors[job] = SimplifySubmesh(source, targetIndexCount, maxError, submesh.indices);
+			}
+		});
+
+	u32 previousTriangles = CountTriangles(fullMesh);
+	for (u32 level = 0; level < levelCount; ++level)
+	{
+		u32 triangleCount = CountSimplifiedTriangles(levels[level]);
+		if (triangleCount == 0 || triangleCount > previousTriangles * 0.85f)
+			continue;
+
+		f32 error = 0.0f;
+		for (u32 i = 0; i < submeshCount; ++i)
+			error = glm::max(error, errors[level * submeshCount + i]);
+
+		PreparedMesh& lod = data.lods[data.lodCount];
+		lod.mesh = std::move(levels[level]);
+		PrepareMesh(pool, quantization, lod);
+
+		data.lodError[data.lodCount] = error / data.boundsRadius;
+		data.lodCount++;
+		previousTriangles = triangleCount;
+	}
+}
+
+void PrepareModelData(ThreadPool* pool, VertexQuantization quantization, const LodSettings& lodSettings, ModelData& data)
+{
+	// The mesh cache hands out every level already prepared
+	if (data.fromCache)
+		return;
+
+	data.lods[0].mesh = std::move(data.mesh);
+	data.mesh = Mesh{};
+
+	PrepareMesh(pool, quantization, data.lods[0]);
+	BuildLodMeshes(pool, quantization, lodSettings, data);
+}
+
+void CommitModelData(App* app, ModelData& data, u32 modelIdx, bool asyncTextures)
+{
+	u32 baseMaterialIdx = (u32)app->materials.size();
+	app->materials.insert(app->materials.end(), data.materials.begin(), data.materials.end());
+
+	// Asynchronous textures hand out their slots right away, so the materials are complete
+	// either way before they are deduplicated
+	if (asyncTextures)
+	{
+		for (const TextureRequest& request : data.textures)
+			app->materials[baseMaterialIdx + request.materialIdx].*request.textureIdx = LoadTexture2DAsync(app, request.filepath.c_str(), request.usage);
+	}
+	else
+	{
+		for (TextureRequest& request : data.textures)
+			request.materialIdx += baseMaterialIdx;
+		LoadTextures2D(app, data.textures);
+	}
 
-	// Add the model
 	Model model = {};
-	model.meshIdx = meshIdx;
-	model.materialIdx.push_back(materialIdx);
-	app->models.push_back(model);
-	u32 modelIdx = (u32)app->models.size() - 1u;
+	model.lodCount = data.lodCount;
+	for (u32 lod = 0; lod < data.lodCount; ++lod)
+	{
+		model.lodMeshIdx[lod] = UploadMesh(app, data.lods[lod]);
+		model.lodError[lod] = data.lodError[lod];
+	}
+	model.meshIdx = model.lodMeshIdx[0];
+	FreeAssetFile(data.cacheFile);
+	model.boundsCenter = data.boundsCenter;
+	model.boundsRadius = data.boundsRadius;
+	model.aabbMin = data.aabbMin;
+	model.aabbMax = data.aabbMax;
+
+	for (u32 materialIdx : data.submeshMaterials)
+		model.materialIdx.push_back(baseMaterialIdx + materialIdx);
+
+	app->models[modelIdx] = model;
+
+	DeduplicateModelMaterials(app, modelIdx, baseMaterialIdx);
+}
+
+static u64 HashProceduralModel(const char* kind, f32 size, u32 xSegments, u32 ySegments)
+{
+	u32 segments[] = { xSegments, ySegments };
+	return HashBytes(segments, sizeof(segments), HashBytes(&size, sizeof(size), HashPath(kind)));
+}
+
+// Procedural models go through the same preparation as the loaded ones, right away
+static u32 AddProceduralModel(App* app, u64 modelKey, Mesh& mesh, const Material& material)
+{
+	ModelData data = {};
+	data.mesh = std::move(mesh);
+	data.submeshMaterials.assign(data.mesh.submeshes.size(), 0);
+	data.materials.push_back(material);
+
+	PrepareModelData(app->threadPool, app->vertexQuantization, app->lodSettings, data);
 
+	u32 modelIdx = (u32)app->models.size();
+	app->models.push_back(Model{});
+	CommitModelData(app, data, modelIdx, false);
+
+	RegisterAsset(app->assets.modelPaths, modelKey, modelIdx);
 	return modelIdx;
 }
 
+u32 CreateSphereModel(App* app, float radius, u32 xSegments, u32 ySegments)
+{
+	u64 modelKey = HashProceduralModel("#sphere", radius, xSegments, ySegments);
+	u32 existingIdx = FindAsset(app->assets.modelPaths, modelKey);
+	if (existingIdx != UINT32_MAX)
+	{
+		app->assets.duplicateModels++;
+		return existingIdx;
+	}
+
+	Mesh mesh = {};
+
+	Submesh submesh = {};
+	submesh.vbLayout.vbAttributes.push_back({ 0, 3, 0, VertexFormat_Float32, 0 }); // Position
+	submesh.vbLayout.vbAttributes.push_back({ 1, 3, 3 * sizeof(float), VertexFormat_Float32, 0 }); // Normal
+	submesh.vbLayout.vbAttributes.push_back({ 2, 2, 6 * sizeof(float), VertexFormat_Float32, 0 }); // TexCoord
+	submesh.vbLayout.stride = 8 * sizeof(float);
+
+	for (u32 y = 0; y <= ySegments; ++y)
+	{
+		for (u32 x = 0; x <= xSegments; ++x)
+		{
+			float xSegment = (float)x / (float)xSegments;
+			float ySegment = (float)y / (float)ySegments;
+			float xPos = radius * cos(xSegment * 2.0f * glm::pi<float>()) * sin(ySegment * glm::pi<float>());
+			float yPos = radius * cos(ySegment * glm::pi<float>());
+			float zPos = radius * sin(xSegment * 2.0f * glm::pi<float>()) * sin(ySegment * glm::pi<float>());
+
+			// Position
+			submesh.vertices.push_back(xPos);
+			submesh.vertices.push_back(yPos);
+			submesh.vertices.push_back(zPos);
+
+			// Normal
+			glm::vec3 normal = glm::normalize(glm::vec3(xPos, yPos, zPos));
+			submesh.vertices.push_back(normal.x);
+			submesh.vertices.push_back(normal.y);
+			submesh.vertices.push_back(normal.z);
+
+			// TexCoord
+			submesh.vertices.push_back(xSegment);
+			submesh.vertices.push_back(ySegment);
+		}
+	}
+
+	bool oddRow = false;
+	for (u32 y = 0; y < ySegments; ++y)
+	{
+		for (u32 x = 0; x < xSegments; ++x)
+		{
+			u32 i0 = y * (xSegments + 1) + x;
+			u32 i1 = i0 + 1;
+			u32 i2 = (y + 1) * (xSegments + 1) + x;
+			u32 i3 = i2 + 1;
+
+			submesh.indices.push_back(i0);
+			submesh.indices.push_back(i2);
+			submesh.indices.push_back(i1);
+
+			submesh.indices.push_back(i1);
+			submesh.indices.push_back(i2);
+			submesh.indices.push_back(i3);
+		}
+	}
+
+	mesh.submeshes.push_back(submesh);
+
+	// Add a dummy material
+	Material material = {};
+	material.albedo = vec3(1.0f, 0.5f, 0.31f);
+	material.smoothness = 0.5f;
+
+	return AddProceduralModel(app, modelKey, mesh, material);
+}
+
 u32 CreatePlaneModel(App* app, float size, u32 xSegments, u32 ySegments)
 {
+	u64 modelKey = HashProceduralModel("#plane", size, xSegments, ySegments);
+	u32 existingIdx = FindAsset(app->assets.modelPaths, modelKey);
+	if (existingIdx != UINT32_MAX)
+	{
+		app->assets.duplicateModels++;
+		return existingIdx;
+	}
+
 	Mesh mesh = {};
 
 	Submesh submesh = {};
-	submesh.vbLayout.vbAttributes.push_back({ 0, 3, 0 }); // Position
-	submesh.vbLayout.vbAttributes.push_back({ 1, 3, 3 * sizeof(float) }); // Normal
-	submesh.vbLayout.vbAttributes.push_back({ 2, 2, 6 * sizeof(float) }); // TexCoord
+	submesh.vbLayout.vbAttributes.push_back({ 0, 3, 0, VertexFormat_Float32, 0 }); // Position
+	submesh.vbLayout.vbAttributes.push_back({ 1, 3, 3 * sizeof(float), VertexFormat_Float32, 0 }); // Normal
+	submesh.vbLayout.vbAttributes.push_back({ 2, 2, 6 * sizeof(float), VertexFormat_Float32, 0 }); // TexCoord
 	submesh.vbLayout.stride = 8 * sizeof(float);
 
 	float halfSize = size * 0.5f;
@@ -606,184 +1283,315 @@ u32 CreatePlaneModel(App* app, float size, u32 xSegments, u32 ySegments)
 
 	mesh.submeshes.push_back(submesh);
 
-	// Upload to GPU
-	u32 vertexBufferSize = 0;
-	u32 indexBufferSize = 0;
+	// Add a dummy material
+	Material material = {};
+	material.albedo = vec3(0.8f, 0.8f, 0.8f); // Light gray
+	material.smoothness = 0.5f;
 
-	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	return AddProceduralModel(app, modelKey, mesh, material);
+}
+
+u32 CreateBoxModel(App* app, float size)
+{
+	u64 modelKey = HashProceduralModel("#box", size, 1, 1);
+	u32 existingIdx = FindAsset(app->assets.modelPaths, modelKey);
+	if (existingIdx != UINT32_MAX)
 	{
-		vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-		indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
+		app->assets.duplicateModels++;
+		return existingIdx;
 	}
 
-	glGenBuffers(1, &mesh.vertexBufferHandle);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-	glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+	Mesh mesh = {};
 
-	glGenBuffers(1, &mesh.indexBufferHandle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+	Submesh submesh = {};
+	submesh.vbLayout.vbAttributes.push_back({ 0, 3, 0, VertexFormat_Float32, 0 }); // Position
+	submesh.vbLayout.vbAttributes.push_back({ 1, 3, 3 * sizeof(float), VertexFormat_Float32, 0 }); // Normal
+	submesh.vbLayout.vbAttributes.push_back({ 2, 2, 6 * sizeof(float), VertexFormat_Float32, 0 }); // TexCoord
+	submesh.vbLayout.stride = 8 * sizeof(float);
 
-	u32 indicesOffset = 0;
-	u32 verticesOffset = 0;
+	float halfSize = size * 0.5f;
 
-	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	// Four vertices per face so every face has its own normal
+	for (u32 face = 0; face < 6; ++face)
 	{
-		const void* verticesData = mesh.submeshes[i].vertices.data();
-		const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-		glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-		mesh.submeshes[i].vertexOffset = verticesOffset;
-		verticesOffset += verticesSize;
+		u32 axis = face / 2;
+		float sign = face % 2 == 0 ? 1.0f : -1.0f;
 
-		const void* indicesData = mesh.submeshes[i].indices.data();
-		const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-		mesh.submeshes[i].indexOffset = indicesOffset;
-		indicesOffset += indicesSize;
-	}
+		vec3 normal = vec3(0.0f);
+		normal[axis] = sign;
+		vec3 tangent = vec3(0.0f);
+		tangent[(axis + 1) % 3] = 1.0f;
+		vec3 bitangent = glm::cross(normal, tangent);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+		u32 baseVertex = (u32)submesh.vertices.size() / 8;
+		for (u32 corner = 0; corner < 4; ++corner)
+		{
+			float u = corner == 1 || corner == 2 ? 1.0f : 0.0f;
+			float v = corner >= 2 ? 1.0f : 0.0f;
+			vec3 position = (normal + tangent * (u * 2.0f - 1.0f) + bitangent * (v * 2.0f - 1.0f)) * halfSize;
 
-	// Add the mesh
-	app->meshes.push_back(mesh);
-	u32 meshIdx = (u32)app->meshes.size() - 1u;
+			// Position
+			submesh.vertices.push_back(position.x);
+			submesh.vertices.push_back(position.y);
+			submesh.vertices.push_back(position.z);
 
-	// Add a dummy material
+			// Normal
+			submesh.vertices.push_back(normal.x);
+			submesh.vertices.push_back(normal.y);
+			submesh.vertices.push_back(normal.z);
+
+			// TexCoord
+			submesh.vertices.push_back(u);
+			submesh.vertices.push_back(v);
+		}
+
+		submesh.indices.push_back(baseVertex + 0);
+		submesh.indices.push_back(baseVertex + 1);
+		submesh.indices.push_back(baseVertex + 2);
+
+		submesh.indices.push_back(baseVertex + 0);
+		submesh.indices.push_back(baseVertex + 2);
+		submesh.indices.push_back(baseVertex + 3);
+	}
+
+	mesh.submeshes.push_back(submesh);
+
+	// Magenta, like the textures that are still loading
 	Material material = {};
-	material.albedo = vec3(0.8f, 0.8f, 0.8f); // Light gray
+	material.albedo = vec3(1.0f);
+	material.albedoTextureIdx = app->magentaTexIdx;
 	material.smoothness = 0.5f;
-	app->materials.push_back(material);
-	u32 materialIdx = (u32)app->materials.size() - 1u;
-
-	// Add the model
-	Model model = {};
-	model.meshIdx = meshIdx;
-	model.materialIdx.push_back(materialIdx);
-	app->models.push_back(model);
-	u32 modelIdx = (u32)app->models.size() - 1u;
 
-	return modelIdx;
+	return AddProceduralModel(app, modelKey, mesh, material);
 }
 
-u32 LoadModel(App* app, const char* filename)
+bool ImportModel(ThreadPool* pool, const char* filename, ModelData& data)
 {
-	const aiScene* scene = aiImportFile(filename,
-		aiProcess_Triangulate |
-		aiProcess_GenSmoothNormals |
-		aiProcess_CalcTangentSpace |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_PreTransformVertices |
-		aiProcess_ImproveCacheLocality |
-		aiProcess_OptimizeMeshes |
-		aiProcess_SortByPType);
+	aiFileIO fileIO = { AssimpOpen, AssimpClose, NULL };
+	const aiScene* scene = aiImportFileEx(filename, LOAD_MODEL_POSTPROCESS_FLAGS, &fileIO);
 
 	if (!scene)
 	{
 		ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-		return UINT32_MAX;
+		return false;
 	}
 
-	app->meshes.push_back(Mesh{});
-	Mesh& mesh = app->meshes.back();
-	u32 meshIdx = (u32)app->meshes.size() - 1u;
-
-	app->models.push_back(Model{});
-	Model& model = app->models.back();
-	model.meshIdx = meshIdx;
-	u32 modelIdx = (u32)app->models.size() - 1u;
-
-	String directory = GetDirectoryPart(MakeString(filename));
+	std::string directory = GetDirectoryPrefix(filename);
 
 	// Create a list of materials
-	u32 baseMeshMaterialIndex = (u32)app->materials.size();
+	data.materials.resize(scene->mNumMaterials);
 	for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
 	{
-		app->materials.push_back(Material{});
-		Material& material = app->materials.back();
-		ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+		ProcessAssimpMaterial(scene->mMaterials[i], i, directory, data);
 	}
 
-	ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+	ProcessAssimpNode(pool, scene, scene->mRootNode, &data.mesh, 0, data.submeshMaterials);
 
 	aiReleaseImport(scene);
 
-	u32 vertexBufferSize = 0;
-	u32 indexBufferSize = 0;
+	data.importFlags = LOAD_MODEL_POSTPROCESS_FLAGS;
+	return true;
+}
 
-	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+static bool ReadModelData(ThreadPool* pool, const char* filename, VertexQuantization quantization, const LodSettings& lodSettings, ModelData& data)
+{
+	// OBJ files go through the native parser, its caches are told apart by the flags
+	bool objFile = IsObjFile(filename);
+	u32 importFlags = objFile ? OBJ_IMPORT_CACHE_FLAGS : LOAD_MODEL_POSTPROCESS_FLAGS;
+
+	// Warm start: bypass the importers if there is an up to date baked cache
+	if (ReadModelFromCache(filename, importFlags, quantization, lodSettings, data))
+		return true;
+
+	if (objFile && ImportObjModel(pool, filename, data))
+		return true;
+
+	// Assimp handles every other format and the OBJ files the native parser rejects
+	return ImportModel(pool, filename, data);
+}
+
+static const char* GetModelSourceName(const ModelData& data)
+{
+	if (data.fromCache)
+		return "warm, mesh cache";
+	return data.importFlags == OBJ_IMPORT_CACHE_FLAGS ? "cold, OBJ import" : "cold, Assimp import";
+}
+
+bool LoadModelData(ThreadPool* pool, const char* filename, VertexQuantization quantization, const LodSettings& lodSettings, ModelData& data)
+{
+	if (!ReadModelData(pool, filename, quantization, lodSettings, data))
+		return false;
+
+	PrepareModelData(pool, quantization, lodSettings, data);
+
+	// The cache stores every level as uploaded, so warm loads skip their preparation too
+	if (!data.fromCache)
+		SaveModelToCache(filename, quantization, lodSettings, data);
+
+	return true;
+}
+
+u32 LoadModel(App* app, const char* filename)
+{
+	u64 pathHash = HashPath(filename);
+	u32 existingIdx = FindAsset(app->assets.modelPaths, pathHash);
+	if (existingIdx != UINT32_MAX)
 	{
-		vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-		indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
+		app->assets.duplicateModels++;
+		return existingIdx;
 	}
 
-	glGenBuffers(1, &mesh.vertexBufferHandle);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-	glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+	f64 startTime = GetTimestamp();
 
-	glGenBuffers(1, &mesh.indexBufferHandle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+	ModelData data = {};
+	u32 modelIdx = UINT32_MAX;
 
-	u32 indicesOffset = 0;
-	u32 verticesOffset = 0;
-
-	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	if (LoadModelData(app->threadPool, filename, app->vertexQuantization, app->lodSettings, data))
 	{
-		const void* verticesData = mesh.submeshes[i].vertices.data();
-		const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-		glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-		mesh.submeshes[i].vertexOffset = verticesOffset;
-		verticesOffset += verticesSize;
+		modelIdx = (u32)app->models.size();
+		app->models.push_back(Model{});
+		CommitModelData(app, data, modelIdx, false);
+		RegisterAsset(app->assets.modelPaths, pathHash, modelIdx);
+	}
+
+	ModelLoadTiming timing = {};
+	timing.filepath = filename;
+	timing.milliseconds = (GetTimestamp() - startTime) * 1000.0;
+	timing.cacheHit = data.fromCache;
+	app->modelLoadTimings.push_back(timing);
 
-		const void* indicesData = mesh.submeshes[i].indices.data();
-		const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-		mesh.submeshes[i].indexOffset = indicesOffset;
-		indicesOffset += indicesSize;
+	ILOG("LoadModel(%s): %.2f ms (%s)", filename, timing.milliseconds, GetModelSourceName(data));
+
+	return modelIdx;
+}
+
+u32 LoadModelAsync(App* app, const char* filename)
+{
+	u64 pathHash = HashPath(filename);
+	u32 existingIdx = FindAsset(app->assets.modelPaths, pathHash);
+	if (existingIdx != UINT32_MAX)
+	{
+		app->assets.duplicateModels++;
+		return existingIdx;
 	}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	// The slot draws the proxy until the model is uploaded into it
+	Model proxy = app->models[app->proxyModel];
+	u32 modelIdx = (u32)app->models.size();
+	app->models.push_back(proxy);
+	RegisterAsset(app->assets.modelPaths, pathHash, modelIdx);
+
+	// The settings are taken now, the GUI may change them while the load runs
+	std::string path = filename;
+	ThreadPool* pool = app->threadPool;
+	VertexQuantization quantization = app->vertexQuantization;
+	LodSettings lodSettings = app->lodSettings;
+	std::shared_ptr<ModelData> data = std::make_shared<ModelData>();
+	f64 startTime = GetTimestamp();
+
+	SubmitAsyncLoad(app,
+		[path, pool, quantization, lodSettings, data]() -> u64
+		{
+			if (!LoadModelData(pool, path.c_str(), quantization, lodSettings, *data))
+				return 0;
+
+			u64 uploadBytes = 0;
+			for (u32 lod = 0; lod < data->lodCount; ++lod)
+				uploadBytes += data->lods[lod].mesh.gpuVertexBytes + data->lods[lod].mesh.gpuIndexBytes;
+			return uploadBytes;
+		},
+		[app, path, modelIdx, data, startTime]
+		{
+			// A prepared model has at least its full mesh
+			if (data->lodCount > 0)
+				CommitModelData(app, *data, modelIdx, true);
+			else
+				ELOG("LoadModelAsync(%s) failed, the proxy is drawn instead", path.c_str());
+
+			ModelLoadTiming timing = {};
+			timing.filepath = path;
+			timing.milliseconds = (GetTimestamp() - startTime) * 1000.0;
+			timing.cacheHit = data->fromCache;
+			timing.async = true;
+			app->modelLoadTimings.push_back(timing);
+
+			ILOG("LoadModelAsync(%s): %.2f ms (%s)", path.c_str(), timing.milliseconds, GetModelSourceName(*data));
+		});
 
 	return modelIdx;
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+static GLenum GetVertexFormatGLType(VertexFormat format)
+{
+	switch (format)
+	{
+	case VertexFormat_Float16: return GL_HALF_FLOAT;
+	case VertexFormat_SNorm16: return GL_SHORT;
+	case VertexFormat_UNorm16: return GL_UNSIGNED_SHORT;
+	default:                   return GL_FLOAT;
+	}
+}
+
+GLuint FindVAO(App* app, const Submesh& submesh, const Program& program)
 {
-	Submesh& submesh = mesh.submeshes[submeshIndex];
+	GeometryHeap& heap = app->geometryHeap;
+	GeometryArena& arena = heap.vertexArenas[submesh.vertexAllocation.arena];
 
-	// Try finding a vao for this submesh/program
-	for (u32 i = 0; i < (u32)submesh.vaos.size(); i++)
+	// Try finding a vao for this arena/program, every submesh in the arena shares it
+	for (u32 i = 0; i < (u32)arena.vaos.size(); i++)
 	{
-		if (submesh.vaos[i].programHandle == program.handle)
-			return submesh.vaos[i].handle;
+		if (arena.vaos[i].programHandle == program.handle)
+			return arena.vaos[i].handle;
 	}
 
 	GLuint vaoHandle = 0;
 
-	// Create a new vao for this submesh/program
+	// Create a new vao for this arena/program
 	{
 		glGenVertexArrays(1, &vaoHandle);
 		glBindVertexArray(vaoHandle);
 
-		glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+		glBindBuffer(GL_ARRAY_BUFFER, arena.handle);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, heap.indices.handle);
 
 		// We have to link all vertex inputs attributes to attributes in the vertex buffer
 		for (u32 i = 0; i < program.vertexInputLayout.vsAttributes.size(); i++)
 		{
+			// The draw index of the indirect draws comes from an instanced buffer instead
+			if (program.vertexInputLayout.vsAttributes[i].location == INDIRECT_DRAW_ID_LOCATION)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, GetIndirectDrawIdBuffer(app->indirectRenderer));
+				glVertexAttribIPointer(INDIRECT_DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+				glVertexAttribDivisor(INDIRECT_DRAW_ID_LOCATION, 1);
+				glEnableVertexAttribArray(INDIRECT_DRAW_ID_LOCATION);
+				glBindBuffer(GL_ARRAY_BUFFER, arena.handle);
+				continue;
+			}
+
+			// So do the entity and batch of the draws culled on the GPU
+			if (program.vertexInputLayout.vsAttributes[i].location == GPU_CULLING_INSTANCE_LOCATION)
+			{
+				glBindBuffer(GL_ARRAY_BUFFER, GetGpuCullingInstanceBuffer(app->gpuCuller));
+				glVertexAttribIPointer(GPU_CULLING_INSTANCE_LOCATION, 2, GL_UNSIGNED_INT, 2 * sizeof(u32), (void*)0);
+				glVertexAttribDivisor(GPU_CULLING_INSTANCE_LOCATION, 1);
+				glEnableVertexAttribArray(GPU_CULLING_INSTANCE_LOCATION);
+				glBindBuffer(GL_ARRAY_BUFFER, arena.handle);
+				continue;
+			}
+
 			bool attributeWasLinked = false;
 
-			for (u32 j = 0; j < submesh.vbLayout.vbAttributes.size(); j++)
+			for (u32 j = 0; j < submesh.gpuLayout.vbAttributes.size(); j++)
 			{
-				if (program.vertexInputLayout.vsAttributes[i].location == submesh.vbLayout.vbAttributes[j].location)
+				if (program.vertexInputLayout.vsAttributes[i].location == submesh.gpuLayout.vbAttributes[j].location)
 				{
-					const u32 index = submesh.vbLayout.vbAttributes[j].location;
-					const u32 ncomp = submesh.vbLayout.vbAttributes[j].componentCount;
-					const u32 offset = submesh.vbLayout.vbAttributes[j].offset + submesh.vertexOffset; // attribute offset + vertex offset
-					const u32 stride = submesh.vbLayout.stride;
-					glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
+					const VertexBufferAttribute& attribute = submesh.gpuLayout.vbAttributes[j];
+					const u32 index = attribute.location;
+					const u32 ncomp = attribute.componentCount;
+					const u32 offset = attribute.offset; // the base vertex of the draws finds the submesh
+					const u32 stride = submesh.gpuLayout.stride;
+					const GLenum type = GetVertexFormatGLType((VertexFormat)attribute.format);
+					glVertexAttribPointer(index, ncomp, type, attribute.normalized ? GL_TRUE : GL_FALSE, stride, (void*)(u64)offset);
 					glEnableVertexAttribArray(index);
 
 					attributeWasLinked = true;
@@ -797,9 +1605,9 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 		glBindVertexArray(0);
 	}
 
-	// Store it in the list for this submesh
+	// Store it in the list for this arena
 	Vao vao = { vaoHandle, program.handle };
-	submesh.vaos.push_back(vao);
+	arena.vaos.push_back(vao);
 
 	return vaoHandle;
 }
@@ -870,10 +1678,11 @@ void InitLoadTextures(App* app)
 		// ignore?
 		ELOG("OpenGL Error: %x", err);
 	}
-	app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
-	app->blackTexIdx = LoadTexture2D(app, "color_black.png");
-	app->normalTexIdx = LoadTexture2D(app, "color_normal.png");
+	// Magenta is the placeholder of every asynchronous texture, it is needed right away
 	app->magentaTexIdx = LoadTexture2D(app, "color_magenta.png");
+	app->whiteTexIdx = LoadTexture2DAsync(app, "color_white.png");
+	app->blackTexIdx = LoadTexture2DAsync(app, "color_black.png");
+	app->normalTexIdx = LoadTexture2DAsync(app, "color_normal.png", TextureUsage_Normal);
 
 }
 
@@ -914,7 +1723,8 @@ void InitQuadMode(App* app)
 
 void InitMeshMode(App* app)
 {
-	app->patrickModel = LoadModel(app, "Patrick/Patrick.obj");
+	app->proxyModel = CreateBoxModel(app, 2.0f);
+	app->patrickModel = LoadModelAsync(app, "Patrick/Patrick.obj");
 	app->sphere = CreateSphereModel(app, 1.0f, 64, 64);
 	app->plane = CreatePlaneModel(app, 10.0f, 10, 10);
 
@@ -925,31 +1735,46 @@ void InitMeshMode(App* app)
 	app->texturedMeshProgram_uTexture = glGetUniformLocation(texturedMeshProgram.handle, "uTexture"); // 0
 	app->texturedMeshProgram_uNormal = glGetUniformLocation(texturedMeshProgram.handle, "uNormal"); // 1
 	app->texturedMeshProgram_uPosition = glGetUniformLocation(texturedMeshProgram.handle, "uPosition"); // 2
+	app->texturedMeshProgram_uPositionScale = glGetUniformLocation(texturedMeshProgram.handle, "uPositionScale");
+	app->texturedMeshProgram_uPositionOffset = glGetUniformLocation(texturedMeshProgram.handle, "uPositionOffset");
+	app->texturedMeshProgram_uTexCoordTransform = glGetUniformLocation(texturedMeshProgram.handle, "uTexCoordTransform");
+	app->texturedMeshProgram_uOctahedralNormals = glGetUniformLocation(texturedMeshProgram.handle, "uOctahedralNormals");
+	app->texturedMeshProgram_uTransformIdx = glGetUniformLocation(texturedMeshProgram.handle, "uTransformIdx");
+
+	// Same shader, with the per draw data in a storage buffer
+	app->indirectMeshProgramIdx = LoadProgram(app, "shaders.glsl", "INDIRECT_TEXTURED_MESH");
+	app->indirectMeshProgram_uTexture = glGetUniformLocation(app->programs[app->indirectMeshProgramIdx].handle, "uTexture");
+
+	// And with the instances written by the culling shader
+	app->culledMeshProgramIdx = LoadProgram(app, "shaders.glsl", "CULLED_TEXTURED_MESH");
+	app->culledMeshProgram_uTexture = glGetUniformLocation(app->programs[app->culledMeshProgramIdx].handle, "uTexture");
+	app->gpuCullingProgramIdx = LoadComputeProgram(app, "shaders.glsl", "GPU_FRUSTUM_CULLING");
+	app->depthPyramidProgramIdx = LoadComputeProgram(app, "shaders.glsl", "DEPTH_PYRAMID");
 
 	vec3 sphereSize = vec3{ 0.15f };
 	vec3 planeSize = vec3{ 5.0f };
 
 	// Pattricks
-	Entity en1 = { TransformPositionScale(vec3(-12.3f, 1.55f,  17.8f), vec3(0.45f)), app->patrickModel };
-	Entity en2 = { TransformPositionScale(vec3(8.5f, 1.55f,  -5.6f), vec3(0.45f)), app->patrickModel };
-	Entity en3 = { TransformPositionScale(vec3(-18.9f, 1.55f,  13.2f), vec3(0.45f)), app->patrickModel };
-	Entity en4 = { TransformPositionScale(vec3(15.4f, 1.55f, -19.7f), vec3(0.45f)), app->patrickModel };
-	Entity en5 = { TransformPositionScale(vec3(-7.1f, 1.55f,  -2.5f), vec3(0.45f)), app->patrickModel };
-	Entity en6 = { TransformPositionScale(vec3(19.0f, 1.55f,  10.4f), vec3(0.45f)), app->patrickModel };
-	Entity en7 = { TransformPositionScale(vec3(4.6f, 1.55f, -17.3f), vec3(0.45f)), app->patrickModel };
-	Entity en8 = { TransformPositionScale(vec3(-15.2f, 1.55f,   3.7f), vec3(0.45f)), app->patrickModel };
-	Entity en9 = { TransformPositionScale(vec3(2.8f, 1.55f,  19.9f), vec3(0.45f)), app->patrickModel };
-	Entity en10 = { TransformPositionScale(vec3(-19.5f, 1.55f,  -8.1f), vec3(0.45f)), app->patrickModel };
-	Entity en11 = { TransformPositionScale(vec3(13.7f, 1.55f,   0.2f), vec3(0.45f)), app->patrickModel };
-	Entity en12 = { TransformPositionScale(vec3(-3.3f, 1.55f, -12.8f), vec3(0.45f)), app->patrickModel };
+	Entity en1 = { TransformPositionScale(vec3(-12.3f, 1.55f,  17.8f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en2 = { TransformPositionScale(vec3(8.5f, 1.55f,  -5.6f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en3 = { TransformPositionScale(vec3(-18.9f, 1.55f,  13.2f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en4 = { TransformPositionScale(vec3(15.4f, 1.55f, -19.7f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en5 = { TransformPositionScale(vec3(-7.1f, 1.55f,  -2.5f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en6 = { TransformPositionScale(vec3(19.0f, 1.55f,  10.4f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en7 = { TransformPositionScale(vec3(4.6f, 1.55f, -17.3f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en8 = { TransformPositionScale(vec3(-15.2f, 1.55f,   3.7f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en9 = { TransformPositionScale(vec3(2.8f, 1.55f,  19.9f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en10 = { TransformPositionScale(vec3(-19.5f, 1.55f,  -8.1f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en11 = { TransformPositionScale(vec3(13.7f, 1.55f,   0.2f), vec3(0.45f)), app->patrickModel, 0, false, false };
+	Entity en12 = { TransformPositionScale(vec3(-3.3f, 1.55f, -12.8f), vec3(0.45f)), app->patrickModel, 0, false, false };
 
 	// Spheres (point lights)
-	Entity sphere1 = { TransformPositionScale(vec3(12.6f, 0.5f,  -8.9f), sphereSize), app->sphere };
-	Entity sphere2 = { TransformPositionScale(vec3(-15.2f, 1.5f,  13.4f), sphereSize), app->sphere };
-	Entity sphere3 = { TransformPositionScale(vec3(7.3f, 1.5f,  -2.1f), sphereSize), app->sphere };
-	Entity sphere4 = { TransformPositionScale(vec3(-3.7f, 1.5f,  17.8f), sphereSize), app->sphere };
-	Entity sphere5 = { TransformPositionScale(vec3(19.0f, 1.5f,  -5.6f), sphereSize), app->sphere };
-	Entity sphere6 = { TransformPositionScale(vec3(-9.4f, 1.5f, -17.3f), sphereSize), app->sphere };
+	Entity sphere1 = { TransformPositionScale(vec3(12.6f, 0.5f,  -8.9f), sphereSize), app->sphere, 0, false, false };
+	Entity sphere2 = { TransformPositionScale(vec3(-15.2f, 1.5f,  13.4f), sphereSize), app->sphere, 0, false, false };
+	Entity sphere3 = { TransformPositionScale(vec3(7.3f, 1.5f,  -2.1f), sphereSize), app->sphere, 0, false, false };
+	Entity sphere4 = { TransformPositionScale(vec3(-3.7f, 1.5f,  17.8f), sphereSize), app->sphere, 0, false, false };
+	Entity sphere5 = { TransformPositionScale(vec3(19.0f, 1.5f,  -5.6f), sphereSize), app->sphere, 0, false, false };
+	Entity sphere6 = { TransformPositionScale(vec3(-9.4f, 1.5f, -17.3f), sphereSize), app->sphere, 0, false, false };
 	Light li1 = { LightType_Point, Colors::White, vec3(1.0), vec3(12.6f, 0.5f,  -8.9f) };
 	Light li2 = { LightType_Point, Colors::White, vec3(1.0), vec3(-15.2f, 1.5f,  13.4f) };
 	Light li3 = { LightType_Point, Colors::White, vec3(1.0), vec3(7.3f, 1.5f,  -2.1f) };
@@ -958,13 +1783,13 @@ void InitMeshMode(App* app)
 	Light li6 = { LightType_Point, Colors::White, vec3(1.0), vec3(-9.4f, 1.5f, -17.3f) };
 
 	// Planes (directional lights)
-	Entity plane1 = { TransformPositionScale(vec3(0.0f, 3.0f, 0.0f),  sphereSize), app->plane };
+	Entity plane1 = { TransformPositionScale(vec3(0.0f, 3.0f, 0.0f),  sphereSize), app->plane, 0, false, false };
 	Light li7 = { LightType_Point, Colors::White, vec3(1.0), vec3(0.0f, 3.0f, 0.0f) };
-	Entity plane2 = { TransformPositionScale(vec3(8.5f, 3.0f,  -5.6f),  sphereSize), app->plane };
+	Entity plane2 = { TransformPositionScale(vec3(8.5f, 3.0f,  -5.6f),  sphereSize), app->plane, 0, false, false };
 	Light li8 = { LightType_Point, Colors::White, vec3(1.0), vec3(8.5f, 3.0f,  -5.6f) };
 
 	// Scene plane
-	Entity plane = { TransformPositionScale(vec3(0.0f, 0.0f, 0.0f),  planeSize), app->plane };
+	Entity plane = { TransformPositionScale(vec3(0.0f, 0.0f, 0.0f),  planeSize), app->plane, 0, false, false };
 
 #pragma region Lights & Entities push
 
@@ -1141,10 +1966,79 @@ void Init(App* app)
 
 	glEnable(GL_DEPTH_TEST);
 
+	app->streamingStats.initStartTime = GetTimestamp();
+
+	// Without a pack every asset is read from its loose file
+	MountAssetPack(ASSET_PACK_FILENAME);
+
+	app->threadPool = CreateThreadPool(0);
+	app->asyncLoader = CreateAsyncLoader();
+	app->streamingSettings.uploadBudgetBytes = 8 * 1024 * 1024;
+	app->streamingSettings.uploadBudgetMs = 2.0f;
+	app->compressTextures = true;
+	app->mipFilter = MipFilter_Kaiser;
+	app->vertexQuantization = VertexQuantization_SNorm16;
+	app->meshletFrustumCulling = true;
+	app->meshletConeCulling = false;
+
+	LodSettings& lodSettings = app->lodSettings;
+	lodSettings.levelCount = 3;
+	lodSettings.triangleRatio[0] = 0.5f;
+	lodSettings.triangleRatio[1] = 0.25f;
+	lodSettings.triangleRatio[2] = 0.1f;
+	lodSettings.maxError[0] = 0.005f;
+	lodSettings.maxError[1] = 0.01f;
+	lodSettings.maxError[2] = 0.03f;
+	lodSettings.enabled = true;
+	lodSettings.pixelError = 1.0f;
+	lodSettings.hysteresis = 0.25f;
+
 	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
 	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBlockAlignment);
 
-	app->uniformBuffer = CreateConstantBuffer(app->maxUniformBufferSize);
+	// Pages are much larger than a uniform block, blocks are bound as windows of them. Block
+	// offsets of every region have to stay aligned.
+	app->uniformRing = CreateRingBuffer(Align(glm::max((u32)app->maxUniformBufferSize, UNIFORM_PAGE_SIZE), app->uniformBlockAlignment), GL_UNIFORM_BUFFER);
+
+	// Arenas grow when they are full, these fit the default scene
+	InitGeometryHeap(app->geometryHeap, MB(16), MB(8));
+
+	// Sized when the first entities are uploaded
+	glGenBuffers(1, &app->transformBuffer);
+
+	app->indirectRenderer = CreateIndirectRenderer();
+	app->indirectDraws = true;
+	app->instancing = true;
+	app->minInstances = 4;
+
+	app->gpuCuller = CreateGpuCuller();
+	app->gpuCulling = false;
+	app->gpuCullingVerify = false;
+
+	app->hiZCulling = true;
+	app->depthPyramid = {};
+	InitGpuTimeline(app->gbufferTimeline, GBufferTime_Count);
+
+	app->entityFrustumCulling = true;
+	app->entityBvhCulling = false;
+	app->pickedEntity = BVH_INVALID;
+	app->neighbourRadius = 5.0f;
+
+	OcclusionSettings& occlusionSettings = app->occlusionSettings;
+	occlusionSettings.enabled = true;
+	occlusionSettings.maxOccluders = 16;
+	occlusionSettings.minOccluderSize = 0.1f;
+	occlusionSettings.maxOccluderTriangles = 2048;
+	ClearOcclusionBuffer(app->occlusionBuffer);
+
+	glGenTextures(1, &app->occlusionDebugTexture);
+	glBindTexture(GL_TEXTURE_2D, app->occlusionDebugTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, OCCLUSION_WIDTH, OCCLUSION_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
 	// Camera init
 	app->camera = {};
@@ -1157,129 +2051,1075 @@ void Init(App* app)
 
 	CameraMovement(app);
 
-	GetOpenGLContext(app);
+	GetOpenGLContext(app);
+
+	InitLoadTextures(app);
+	InitQuadMode(app);
+
+	InitMeshMode(app);
+
+	InitFramebuffer(app);
+
+	app->mode = Mode_Mesh; // default mode
+}
+
+void Shutdown(App* app)
+{
+	DestroyAsyncLoader(app->threadPool, app->asyncLoader);
+	app->asyncLoader = NULL;
+
+	DestroyThreadPool(app->threadPool);
+	app->threadPool = NULL;
+
+	DestroyRingBuffer(app->uniformRing);
+	glDeleteBuffers(1, &app->transformBuffer);
+	DestroyIndirectRenderer(app->indirectRenderer);
+	app->indirectRenderer = NULL;
+	DestroyGpuCuller(app->gpuCuller);
+	app->gpuCuller = NULL;
+	DestroyDepthPyramid(app->depthPyramid);
+	DestroyGpuTimeline(app->gbufferTimeline);
+	DestroyGeometryHeap(app->geometryHeap);
+
+	// The workers may have been reading entries of the pack in place
+	UnmountAssetPack();
+}
+
+// GUI functions
+
+// Shows the occlusion buffer in grey, nearer is brighter and black is empty
+static void UpdateOcclusionDebugTexture(App* app)
+{
+	const OcclusionBuffer& buffer = app->occlusionBuffer;
+	std::vector<u32> pixels(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 0xff000000);
+	for (u32 i = 0; i < buffer.depth.size(); ++i)
+	{
+		if (buffer.depth[i] <= 0.0f)
+			continue;
+		f32 distance = 1.0f / buffer.depth[i];
+		u32 grey = (u32)(glm::clamp(1.0f - distance / app->camera.zfar, 0.0f, 1.0f) * 255.0f);
+		pixels[i] = 0xff000000 | (grey << 16) | (grey << 8) | grey;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, app->occlusionDebugTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, OCCLUSION_WIDTH, OCCLUSION_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void InfoWindow(App* app)
+{
+	ImGui::Begin("Info");
+	ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
+	ImGui::Text("Version: %s", app->openglInfo.version);
+	ImGui::Text("Renderer: %s", app->openglInfo.renderer);
+	ImGui::Text("Vendor: %s", app->openglInfo.vendor);
+	ImGui::Text("Shading Language Version: %s", app->openglInfo.shading_language_version);
+
+	if (ImGui::CollapsingHeader("Extensions", ImGuiTreeNodeFlags_None))
+	{
+		ImGui::BeginChild("ExtensionsList", ImVec2(0, 150), true, ImGuiWindowFlags_HorizontalScrollbar); // rea de scroll con 150px de alto
+
+		for (const auto& extension : app->openglInfo.extensions)
+		{
+			ImGui::Text("%s", extension.c_str());
+		}
+
+		ImGui::EndChild();
+	}
+
+	if (ImGui::CollapsingHeader("Model loading", ImGuiTreeNodeFlags_None))
+	{
+		for (const ModelLoadTiming& timing : app->modelLoadTimings)
+		{
+			ImGui::Text("%s: %.2f ms (%s%s)", timing.filepath.c_str(), timing.milliseconds, timing.cacheHit ? "warm" : "cold", timing.async ? ", async" : "");
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Streaming", ImGuiTreeNodeFlags_None))
+	{
+		StreamingSettings& settings = app->streamingSettings;
+		int budgetKB = (int)(settings.uploadBudgetBytes / 1024);
+		if (ImGui::SliderInt("Upload budget (KB)", &budgetKB, 64, 64 * 1024))
+		{
+			settings.uploadBudgetBytes = (u32)budgetKB * 1024;
+		}
+		ImGui::SliderFloat("Upload budget (ms)", &settings.uploadBudgetMs, 0.25f, 16.0f);
+
+		const StreamingStats& stats = app->streamingStats;
+		ImGui::Text("Time to first frame: %.2f ms", stats.timeToFirstFrameMs);
+		if (stats.timeToResidentMs > 0.0)
+			ImGui::Text("Time to fully resident: %.2f ms", stats.timeToResidentMs);
+		else
+			ImGui::Text("Time to fully resident: still loading");
+		ImGui::Text("Loads: %u pending (%u waiting for upload), %u uploaded, %.2f MB", stats.pendingLoads, stats.completedLoads, stats.uploadedLoads, stats.uploadedBytes / (1024.0 * 1024.0));
+		ImGui::Text("Worst frame while streaming: %.2f ms, worst upload: %.2f ms", stats.maxStreamingFrameMs, stats.maxUploadMs);
+
+		u32 historyOffset = stats.frameCount % STREAMING_FRAME_HISTORY;
+		ImGui::PlotLines("Frame (ms)", stats.frameMs, STREAMING_FRAME_HISTORY, historyOffset, NULL, 0.0f, FLT_MAX, ImVec2(0, 60));
+		ImGui::PlotLines("Upload (ms)", stats.uploadMs, STREAMING_FRAME_HISTORY, historyOffset, NULL, 0.0f, FLT_MAX, ImVec2(0, 60));
+	}
+
+	if (ImGui::CollapsingHeader("Uniforms", ImGuiTreeNodeFlags_None))
+	{
+		const RingBuffer& ring = app->uniformRing;
+		const RingBufferStats& stats = ring.stats;
+		ImGui::Text("Ring: %u regions, %s", RING_BUFFER_REGIONS, ring.persistent ? "persistent coherent mapping" : "unsynchronized mapping per frame");
+		ImGui::Text("Pages: %u of %u KB, %u allocated while running", (u32)ring.pages.size(), ring.pageSize / 1024, stats.pageAllocations);
+		ImGui::Text("Used this frame: %u pages, %.1f KB", stats.lastPagesUsed, stats.lastBytesUsed / 1024.0);
+		ImGui::Text("Fence stalls: %u of %u frames", stats.stalledFrames, stats.frames);
+		ImGui::Text("Stall: %.3f ms last frame, %.3f ms worst, %.2f ms total", stats.lastStallMs, stats.maxStallMs, stats.totalStallMs);
+	}
+
+	if (ImGui::CollapsingHeader("Uploads", ImGuiTreeNodeFlags_None))
+	{
+		const FrameUploadStats& stats = app->uploadStats;
+		u32 dynamicEntities = (u32)app->dynamicEntities.size();
+
+		ImGui::Text("Entities: %u static, %u dynamic", (u32)app->entities.size() - dynamicEntities, dynamicEntities);
+		ImGui::Text("Global params: %u B", stats.globalParamsBytes);
+		ImGui::Text("Transforms: %u B in %u ranges, %u KB on the GPU", stats.transformBytes, stats.transformRanges, (u32)(app->transformCapacity * sizeof(glm::mat4) / 1024));
+		ImGui::Text("Draw data: %u B", stats.drawDataBytes);
+		ImGui::Text("Total: %.2f KB per frame", (stats.globalParamsBytes + stats.transformBytes + stats.drawDataBytes) / 1024.0);
+	}
+
+	if (ImGui::CollapsingHeader("Asset I/O", ImGuiTreeNodeFlags_None))
+	{
+		AssetIoStats io = GetAssetIoStats();
+		if (io.packMounted)
+		{
+			ImGui::Text("%s: %u entries, %.2f MB, mounted in %.2f ms", ASSET_PACK_FILENAME, io.packEntries, io.packSize / (1024.0 * 1024.0), io.mountMs);
+		}
+		else
+		{
+			ImGui::Text("No asset pack, reading loose files");
+			u32 looseCount = GetLooseAssetCount();
+			if (ImGui::Button("Build asset pack") && looseCount > 0)
+			{
+				BuildAssetPack(app->threadPool, ASSET_PACK_FILENAME);
+			}
+			ImGui::SameLine();
+			ImGui::Text("%u files read so far, used from the next start", looseCount);
+		}
+
+		if (app->startupIoCaptured)
+		{
+			const AssetIoStats& startup = app->startupIoStats;
+			ImGui::Text("Startup: %u packed + %u loose files, %u file system calls, %.2f ms", startup.packReads, startup.looseReads, startup.fileSystemCalls, startup.ioMs);
+		}
+		ImGui::Text("Total: %u packed + %u loose files (%u failed), %u file system calls, %.2f ms", io.packReads, io.looseReads, io.failedReads, io.fileSystemCalls, io.ioMs);
+		ImGui::Text("Read: %.2f MB, %.2f MB stored", io.bytesRead / (1024.0 * 1024.0), io.bytesStored / (1024.0 * 1024.0));
+	}
+
+	if (ImGui::CollapsingHeader("Assets", ImGuiTreeNodeFlags_None))
+	{
+		const AssetRegistry& assets = app->assets;
+		ImGui::Text("Textures: %u (%u duplicates, %.2f MB saved)", (u32)app->textures.size(), assets.duplicateTextures, assets.textureBytesSaved / (1024.0 * 1024.0));
+		ImGui::Text("Meshes: %u (%u duplicates, %.2f MB saved)", (u32)app->meshes.size(), assets.duplicateMeshes, assets.meshBytesSaved / (1024.0 * 1024.0));
+		ImGui::Text("Materials: %u (%u duplicates)", (u32)app->materials.size(), assets.duplicateMaterials);
+		ImGui::Text("Models: %u (%u duplicates)", (u32)app->models.size(), assets.duplicateModels);
+	}
+
+	if (ImGui::CollapsingHeader("Meshes", ImGuiTreeNodeFlags_None))
+	{
+		// Only affects the meshes loaded from now on
+		const char* quantizationNames[VertexQuantization_Count] = { GetVertexQuantizationName(VertexQuantization_None), GetVertexQuantizationName(VertexQuantization_Half), GetVertexQuantizationName(VertexQuantization_SNorm16) };
+		int vertexQuantization = app->vertexQuantization;
+		if (ImGui::Combo("Vertex format", &vertexQuantization, quantizationNames, VertexQuantization_Count))
+		{
+			app->vertexQuantization = (VertexQuantization)vertexQuantization;
+		}
+
+		ImGui::Text("ACMR / ATVR / overdraw, before -> after the vertex cache and overdraw optimization");
+
+		u64 floatSize = 0;
+		u64 gpuSize = 0;
+		u64 indexSize = 0;
+		u32 narrowSubmeshes = 0;
+		u32 submeshCount = 0;
+		for (u32 i = 0; i < app->meshes.size(); ++i)
+		{
+			const Mesh& mesh = app->meshes[i];
+			floatSize += mesh.floatVertexBytes;
+			gpuSize += mesh.gpuVertexBytes;
+			indexSize += mesh.gpuIndexBytes;
+			for (const Submesh& submesh : mesh.submeshes)
+				narrowSubmeshes += submesh.indexType == GL_UNSIGNED_SHORT ? 1 : 0;
+			submeshCount += (u32)mesh.submeshes.size();
+
+			u32 floatStride = mesh.submeshes.empty() ? 0 : mesh.submeshes[0].vbLayout.stride;
+			u32 gpuStride = mesh.submeshes.empty() ? 0 : mesh.submeshes[0].gpuLayout.stride;
+			const QuantizationError& error = mesh.quantizationError;
+			ImGui::Text("Mesh %u: %u -> %u bytes/vertex, %u KB, error %.5f pos, %.3f deg, %.6f uv", i, floatStride, gpuStride, mesh.gpuVertexBytes / 1024, error.position, error.normal, error.texCoord);
+
+			// Submeshes weighted by their triangles
+			VertexCacheStats before = {};
+			VertexCacheStats after = {};
+			f32 triangles = 0.0f;
+			for (const Submesh& submesh : mesh.submeshes)
+			{
+				f32 weight = submesh.indexCount / 3.0f;
+				before.acmr += submesh.statsBefore.acmr * weight;
+				before.atvr += submesh.statsBefore.atvr * weight;
+				before.overdraw += submesh.statsBefore.overdraw * weight;
+				after.acmr += submesh.statsAfter.acmr * weight;
+				after.atvr += submesh.statsAfter.atvr * weight;
+				after.overdraw += submesh.statsAfter.overdraw * weight;
+				triangles += weight;
+			}
+			if (triangles > 0.0f)
+			{
+				ImGui::Text("    %.3f / %.3f / %.3f -> %.3f / %.3f / %.3f", before.acmr / triangles, before.atvr / triangles, before.overdraw / triangles,
+					after.acmr / triangles, after.atvr / triangles, after.overdraw / triangles);
+			}
+		}
+		ImGui::Text("Vertex memory: %.2f MB (%.2f MB as floats)", gpuSize / (1024.0 * 1024.0), floatSize / (1024.0 * 1024.0));
+		ImGui::Text("Index memory: %.2f MB (%u of %u submeshes with 16 bit indices)", indexSize / (1024.0 * 1024.0), narrowSubmeshes, submeshCount);
+
+		GeometryHeap& heap = app->geometryHeap;
+		ImGui::Text("Geometry heap: %u vertex arenas, grown %u times, defragmented %u times, %.2f MB moved", (u32)heap.vertexArenas.size(), heap.stats.grows, heap.stats.defragmentations, heap.stats.bytesMoved / (1024.0 * 1024.0));
+		for (u32 i = 0; i <= (u32)heap.vertexArenas.size(); ++i)
+		{
+			const bool indexArena = i == heap.vertexArenas.size();
+			const GeometryArena& arena = indexArena ? heap.indices : heap.vertexArenas[i];
+			GeometryArenaStats arenaStats = GetGeometryArenaStats(arena);
+
+			char arenaName[32];
+			if (indexArena)
+				sprintf(arenaName, "Indices");
+			else
+				sprintf(arenaName, "Vertices of %u B", arena.unitSize);
+			ImGui::Text("    %s: %.2f of %.2f MB, %u allocations, %u free blocks (largest %.2f MB)", arenaName, arenaStats.usedBytes / (1024.0 * 1024.0),
+				arenaStats.capacityBytes / (1024.0 * 1024.0), arenaStats.allocations, arenaStats.freeBlocks, arenaStats.largestFreeBytes / (1024.0 * 1024.0));
+		}
+
+		if (ImGui::Button("Defragment geometry"))
+		{
+			DefragmentGeometry(app);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Meshlets", ImGuiTreeNodeFlags_None))
+	{
+		ImGui::Checkbox("Frustum culling", &app->meshletFrustumCulling);
+		ImGui::Checkbox("Cone culling", &app->meshletConeCulling);
+		ImGui::Checkbox("Indirect draws", &app->indirectDraws);
+		if (app->indirectDraws)
+		{
+			IndirectDrawStats indirectStats = GetIndirectDrawStats(app->indirectRenderer);
+			ImGui::Text("Indirect: %u draws, %u commands in %u buckets, %u calls", indirectStats.draws, indirectStats.commands, indirectStats.buckets, indirectStats.calls);
+		}
+
+		const MeshletCullingStats& stats = app->meshletStats;
+		f32 culledPercent = stats.triangles > 0 ? 100.0f * (stats.frustumCulledTriangles + stats.coneCulledTriangles) / stats.triangles : 0.0f;
+		ImGui::Text("Meshlets: %u of %u visible in %u draws, %u vertex array binds", stats.visibleMeshlets, stats.meshlets, stats.drawCalls, stats.vertexArrayBinds);
+		ImGui::Text("Submission: %.3f ms on the CPU", app->meshSubmissionMs);
+		ImGui::Text("Triangles: %u", stats.triangles);
+		ImGui::Text("Frustum culled: %u", stats.frustumCulledTriangles);
+		ImGui::Text("Cone culled: %u", stats.coneCulledTriangles);
+		ImGui::Text("Culled: %.1f%%", culledPercent);
+	}
+
+	if (ImGui::CollapsingHeader("Entity culling", ImGuiTreeNodeFlags_None))
+	{
+		ImGui::Checkbox("Frustum culling of the boxes", &app->entityFrustumCulling);
+		ImGui::Checkbox("Cull with the BVH", &app->entityBvhCulling);
+
+		const EntityCullingStats& stats = app->entityCullingStats;
+		const char* kernel = app->entityBvhCulling ? "the BVH" : stats.avx ? "AVX" : "SSE";
+		ImGui::Text("Visible: %u of %u entities", stats.visible, stats.entities);
+		ImGui::Text("Culling: %.3f ms with %s, %u boxes updated", stats.cullMs, kernel, stats.boxUpdates);
+		if (app->gpuCulling)
+		{
+			ImGui::Text("The GPU culling tests every entity itself");
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Entity BVH", ImGuiTreeNodeFlags_None))
+	{
+		const EntityBvhStats& stats = app->entityBvhStats;
+		ImGui::Text("Tree: %u entities, %u nodes, cost %.1f", stats.items, stats.nodes, stats.cost);
+		ImGui::Text("Built %u times, the last one in %.3f ms", stats.builds, stats.buildMs);
+		ImGui::Text("Update: %.3f ms, %u entities %s", stats.updateMs, stats.updatedItems, stats.fullRefit ? "with a full refit" : "refitted one by one");
+
+		ImGui::SliderFloat("Neighbour radius", &app->neighbourRadius, 0.1f, 50.0f);
+		if (app->pickedEntity != BVH_INVALID)
+		{
+			const Entity& e = app->entities[app->pickedEntity];
+			ImGui::Text("Picked: entity %u, model %u, %.2f units away", app->pickedEntity, e.modelIndex, app->pickedDistance);
+			ImGui::Text("Neighbours: %u entities within %.1f units", (u32)app->neighbourEntities.size(), app->neighbourRadius);
+		}
+		else
+		{
+			ImGui::Text("Left click an entity to pick it");
+		}
+		ImGui::Text("Pick: %.3f ms", stats.pickMs);
+	}
+
+	if (ImGui::CollapsingHeader("Occlusion culling", ImGuiTreeNodeFlags_None))
+	{
+		OcclusionSettings& settings = app->occlusionSettings;
+		ImGui::Checkbox("Cull occluded entities", &settings.enabled);
+		int maxOccluders = (int)settings.maxOccluders;
+		if (ImGui::SliderInt("Maximum occluders", &maxOccluders, 1, 64))
+		{
+			settings.maxOccluders = (u32)maxOccluders;
+		}
+		ImGui::SliderFloat("Minimum occluder size", &settings.minOccluderSize, 0.01f, 1.0f);
+		int maxOccluderTriangles = (int)settings.maxOccluderTriangles;
+		if (ImGui::SliderInt("Maximum occluder triangles", &maxOccluderTriangles, 12, 16384))
+		{
+			settings.maxOccluderTriangles = (u32)maxOccluderTriangles;
+		}
+
+		const OcclusionCullingStats& stats = app->occlusionStats;
+		ImGui::Text("Occluders: %u with %u triangles", stats.occluders, stats.occluderTriangles);
+		ImGui::Text("Culled: %u of %u entities", stats.culled, stats.tested);
+		ImGui::Text("Cost: %.3f ms rasterizing, %.3f ms testing", stats.rasterMs, stats.testMs);
+
+		ImGui::Checkbox("Show the occlusion buffer", &app->occlusionDebugView);
+		if (app->occlusionDebugView)
+		{
+			UpdateOcclusionDebugTexture(app);
+			ImGui::Image((ImTextureID)(intptr_t)app->occlusionDebugTexture, ImVec2(OCCLUSION_WIDTH * 2, OCCLUSION_HEIGHT * 2));
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Instancing", ImGuiTreeNodeFlags_None))
+	{
+		ImGui::Checkbox("Group entities", &app->instancing);
+		int minInstances = (int)app->minInstances;
+		if (ImGui::SliderInt("Minimum instances", &minInstances, 1, 64))
+		{
+			app->minInstances = (u32)minInstances;
+		}
+
+		if (!app->indirectDraws)
+		{
+			ImGui::Text("Instancing needs the indirect draws");
+		}
+		else
+		{
+			const InstancingStats& stats = app->instancingStats;
+			IndirectDrawStats indirectStats = GetIndirectDrawStats(app->indirectRenderer);
+			f32 instancedPercent = stats.entities > 0 ? 100.0f * stats.instancedEntities / stats.entities : 0.0f;
+			f32 instancesPerCommand = indirectStats.commands > 0 ? (f32)indirectStats.instances / indirectStats.commands : 0.0f;
+			ImGui::Text("Instanced: %u of %u entities (%.1f%%) in %u groups", stats.instancedEntities, stats.entities, instancedPercent, stats.groups);
+			ImGui::Text("Culled instances: %u", stats.culledEntities);
+			ImGui::Text("Instances per command: %.2f", instancesPerCommand);
+			ImGui::Text("Draw calls: %u for %u submesh instances", indirectStats.calls, indirectStats.instances);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("GPU culling", ImGuiTreeNodeFlags_None))
+	{
+		ImGui::Checkbox("Cull on the GPU", &app->gpuCulling);
+		ImGui::Checkbox("Verify against the CPU", &app->gpuCullingVerify);
+
+		GpuCullingStats stats = GetGpuCullingStats(app->gpuCuller);
+		ImGui::Text("Scene: %u entities, %u batches in %u buckets, built %u times", stats.entities, stats.batches, stats.buckets, stats.sceneBuilds);
+		if (app->gpuCulling)
+		{
+			ImGui::Text("Submission: %.3f ms on the CPU, %u draw calls", app->meshSubmissionMs, app->meshletStats.drawCalls);
+		}
+		if (stats.verifiedFrames > 0)
+		{
+			ImGui::Text("Verified: %u frames, %u failed", stats.verifiedFrames, stats.failedFrames);
+			ImGui::Text("Visible instances: %u in the last one", stats.visibleInstances);
+			ImGui::Text("Mismatches: %u, %u of them borderline", stats.mismatches, stats.borderline);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Hi-Z culling", ImGuiTreeNodeFlags_None))
+	{
+		ImGui::Checkbox("Cull against the depth pyramid", &app->hiZCulling);
+		if (!app->gpuCulling)
+		{
+			ImGui::Text("Hi-Z culling needs the GPU culling and a G-buffer mode");
+		}
+
+		const HiZStats& stats = app->hiZStats;
+		const DepthPyramid& pyramid = app->depthPyramid;
+		ImGui::Text("Pyramid: %dx%d, %u levels", pyramid.width, pyramid.height, pyramid.levelCount);
+		if (stats.frames > 0)
+		{
+			ImGui::Text("GPU: %.3f ms building the pyramid, %.3f ms culling", stats.pyramidMs / stats.frames, stats.cullMs / stats.frames);
+			ImGui::Text("Geometry: %.3f ms with Hi-Z over %u frames", stats.geometryMs / stats.frames, stats.frames);
+		}
+		if (stats.framesWithoutHiZ > 0)
+		{
+			ImGui::Text("Geometry: %.3f ms without over %u frames", stats.geometryMsWithoutHiZ / stats.framesWithoutHiZ, stats.framesWithoutHiZ);
+		}
+		if (stats.frames > 0 && stats.framesWithoutHiZ > 0)
+		{
+			ImGui::Text("Saved: %.3f ms of G-buffer time", stats.geometryMsWithoutHiZ / stats.framesWithoutHiZ - stats.geometryMs / stats.frames);
+		}
+		if (ImGui::Button("Reset times"))
+		{
+			app->hiZStats = {};
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Levels of detail", ImGuiTreeNodeFlags_None))
+	{
+		LodSettings& settings = app->lodSettings;
+		ImGui::Checkbox("Enabled", &settings.enabled);
+		ImGui::SliderFloat("Pixel error", &settings.pixelError, 0.25f, 8.0f);
+		ImGui::SliderFloat("Hysteresis", &settings.hysteresis, 0.0f, 0.75f);
+
+		const LodStats& stats = app->lodStats;
+		ImGui::Text("Triangles: %u drawn of %u (%u saved)", stats.drawnTriangles, stats.fullTriangles, stats.fullTriangles - stats.drawnTriangles);
+		for (u32 i = 0; i < MAX_MODEL_LODS; ++i)
+			if (stats.entitiesPerLevel[i] > 0)
+				ImGui::Text("LOD %u: %u entities", i, stats.entitiesPerLevel[i]);
+	}
+
+	if (ImGui::CollapsingHeader("Textures", ImGuiTreeNodeFlags_None))
+	{
+		// Only affects the textures loaded from now on
+		const char* mipFilterNames[MipFilter_Count] = { GetMipFilterName(MipFilter_Box), GetMipFilterName(MipFilter_Kaiser) };
+		int mipFilter = app->mipFilter;
+		if (ImGui::Combo("Mip filter", &mipFilter, mipFilterNames, MipFilter_Count))
+		{
+			app->mipFilter = (MipFilter)mipFilter;
+		}
+
+		u64 totalSize = 0;
+		for (const Texture& texture : app->textures)
+		{
+			totalSize += texture.gpuSize;
+			if (texture.psnr > 0.0f)
+				ImGui::Text("%s: %s, %u KB, PSNR %.2f dB", texture.filepath.c_str(), texture.formatName, texture.gpuSize / 1024, texture.psnr);
+			else
+				ImGui::Text("%s: %s, %u KB", texture.filepath.c_str(), texture.formatName, texture.gpuSize / 1024);
+		}
+		ImGui::Text("Total texture memory: %.2f MB", totalSize / (1024.0 * 1024.0));
+	}
+
+	ImGui::End();
+}
+
+void RenderModeWindow(App* app)
+{
+	ImGui::Begin("Render Mode");
+
+	if (ImGui::Button("Textured Quad"))
+	{
+		ChangeAppMode(app, Mode_TexturedQuad);
+	}
+
+	if (ImGui::Button("Mesh"))
+	{
+		ChangeAppMode(app, Mode_Mesh);
+	}
+
+	if (ImGui::Button("Framebuffer"))
+	{
+		ChangeAppMode(app, Mode_Framebuffer);
+	}
+
+	ImGui::Separator();
+
+	if (ImGui::Button("Albedo"))
+	{
+		ChangeAppMode(app, Mode_Albedo);
+	}
+
+	if (ImGui::Button("Normal"))
+	{
+		ChangeAppMode(app, Mode_Normal);
+	}
+
+	if (ImGui::Button("Position"))
+	{
+		ChangeAppMode(app, Mode_Position);
+	}
+
+	if (ImGui::Button("Depth"))
+	{
+		ChangeAppMode(app, Mode_Depth);
+	}
+
+	if (ImGui::Button("Lighting"))
+	{
+		ChangeAppMode(app, Mode_Lighting);
+	}
+
+	if (ImGui::Button("Deferred"))
+	{
+		ChangeAppMode(app, Mode_Deferred);
+	}
+
+	ImGui::End();
+}
+
+void BenchmarkWindow(App* app)
+{
+	ImGui::Begin("Benchmarks");
+
+	if (ImGui::Button("Model cache"))
+	{
+		BenchmarkModelCache(app);
+	}
+
+	if (ImGui::Button("Texture decode"))
+	{
+		BenchmarkTextureDecode(app);
+	}
+
+	if (ImGui::Button("Mip generation"))
+	{
+		BenchmarkMipGeneration(app);
+	}
+
+	if (ImGui::Button("Vertex conversion"))
+	{
+		BenchmarkVertexConversion(app);
+	}
+
+	if (ImGui::Button("OBJ import"))
+	{
+		BenchmarkObjImport(app);
+	}
+
+	if (ImGui::Button("Entity count"))
+	{
+		BenchmarkEntityCount(app);
+	}
+
+	if (ImGui::Button("Draw submission"))
+	{
+		BenchmarkDrawSubmission(app);
+	}
+
+	if (ImGui::Button("Instancing"))
+	{
+		BenchmarkInstancing(app);
+	}
+
+	if (ImGui::Button("GPU culling"))
+	{
+		BenchmarkGpuCulling(app);
+	}
+
+	if (ImGui::Button("Frustum culling"))
+	{
+		BenchmarkFrustumCulling(app);
+	}
+
+	if (ImGui::Button("Occlusion culling"))
+	{
+		BenchmarkOcclusionCulling(app);
+	}
+
+	if (ImGui::Button("Hi-Z culling"))
+	{
+		BenchmarkHiZCulling(app);
+	}
+
+	if (ImGui::Button("BVH"))
+	{
+		BenchmarkBvh(app);
+	}
+
+	if (ImGui::Button("Streaming frames"))
+	{
+		BenchmarkStreamingFrames(app);
+	}
+
+	ImGui::Separator();
+
+	if (ImGui::Button("Clear"))
+	{
+		app->benchmarkLog.clear();
+	}
+
+	for (const std::string& line : app->benchmarkLog)
+	{
+		ImGui::TextUnformatted(line.c_str());
+	}
+
+	ImGui::End();
+}
+
+// Gui -- where ImGui windows draw stuff
+void Gui(App* app)
+{
+	InfoWindow(app);
+	RenderModeWindow(app);
+	BenchmarkWindow(app);
+}
+
+// Hot reload only watches the loose files: the pack holds the contents the app started with, so
+// the edited shaders are read from disk directly and not through ReadAssetFile
+void HotReload(App* app)
+{
+	// Check timestamp / reload
+	for (u64 i = 0; i < app->programs.size(); i++)
+	{
+		Program& program = app->programs[i];
+		u64 currentTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
+		if (currentTimestamp > program.lastWriteTimestamp)
+		{
+			glDeleteProgram(program.handle);
+			String progSource = ReadTextFile(program.filepath.c_str());
+			const char* progName = program.programName.c_str();
+
+			program.handle = program.compute ? CreateComputeProgramFromSource(progSource, progName) : CreateProgramFromSource(progSource, progName);
+			program.lastWriteTimestamp = currentTimestamp;
+		}
+	}
+}
+
+// Update -- where input, hot reload, and buffer ordering are
+void InvalidateTransforms(App* app)
+{
+	app->transformCount = 0;
+	app->sceneVersion++;
+}
+
+void SetEntityWorldMatrix(App* app, u32 entityIdx, const glm::mat4& worldMatrix)
+{
+	Entity& e = app->entities[entityIdx];
+	e.worldMatrix = worldMatrix;
+	if (!e.dynamic && !e.dirty)
+	{
+		e.dirty = true;
+		app->dirtyEntities.push_back(entityIdx);
+	}
+}
+
+void SetEntityDynamic(App* app, u32 entityIdx, bool dynamic)
+{
+	Entity& e = app->entities[entityIdx];
+	if (e.dynamic == dynamic)
+		return;
+
+	// Entities not uploaded yet are found when they are
+	e.dynamic = dynamic;
+	if (entityIdx >= app->transformCount)
+		return;
+
+	std::vector<u32>& list = app->dynamicEntities;
+	if (dynamic)
+	{
+		list.push_back(entityIdx);
+		return;
+	}
+
+	// A matrix set while it was dynamic this frame skipped the dirty list, upload it once more
+	list.erase(std::remove(list.begin(), list.end(), entityIdx), list.end());
+	if (!e.dirty)
+	{
+		e.dirty = true;
+		app->dirtyEntities.push_back(entityIdx);
+	}
+}
+
+static void SetEntityBox(App* app, u32 entityIdx)
+{
+	const Entity& e = app->entities[entityIdx];
+	const Model& model = app->models[e.modelIndex];
+	SetCullingBox(app->entityBoxes, entityIdx, model.aabbMin, model.aabbMax, e.worldMatrix);
+}
+
+// Writes the matrices of new, dirty and dynamic entities to the transform buffer. Static scenes
+// write nothing, so glBufferSubData rarely has to wait for draws still reading the buffer. The
+// world boxes of the same entities are computed again for the culling. Only the new entities
+// and the lists of dirty and dynamic ones are visited, not every entity.
+static void UploadTransforms(App* app)
+{
+	FrameUploadStats& stats = app->uploadStats;
+	std::vector<Entity>& entities = app->entities;
+	const u32 count = (u32)entities.size();
+
+	// Boxes also follow the bounds of the models, which change when loads finish
+	CullingBoxes& boxes = app->entityBoxes;
+	u64 boxesKey[] = { app->models.size(), app->streamingStats.uploadedLoads };
+	u64 boxesHash = HashBytes(boxesKey, sizeof(boxesKey));
+	bool allBoxes = boxesHash != app->entityBoxesKey || boxes.count != count;
+	if (allBoxes)
+	{
+		ResizeCullingBoxes(boxes, count);
+		app->entityBoxesKey = boxesHash;
+	}
+	app->movedEntities.clear();
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, app->transformBuffer);
+
+	// A new buffer has nothing in it, every matrix goes up again
+	if (count > app->transformCapacity)
+	{
+		app->transformCapacity = glm::max(count, app->transformCapacity + app->transformCapacity / 2);
+		glBufferData(GL_COPY_WRITE_BUFFER, app->transformCapacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+		app->transformCount = 0;
+	}
+
+	// Entities uploaded before that moved or move every frame, then the new ones, which also
+	// fill the dynamic list again when every entity is new
+	const u32 firstNew = glm::min(app->transformCount, count);
+	std::vector<u32>& uploads = app->transformUploads;
+	uploads.clear();
+
+	for (u32 entityIdx : app->dirtyEntities)
+	{
+		if (entityIdx >= count)
+			continue;
+		Entity& e = entities[entityIdx];
+		if (e.dirty && !e.dynamic && entityIdx < firstNew)
+			uploads.push_back(entityIdx);
+		e.dirty = false;
+	}
+	app->dirtyEntities.clear();
+
+	// Entities dropped at the end leave the list
+	std::vector<u32>& dynamicEntities = app->dynamicEntities;
+	if (firstNew == 0)
+		dynamicEntities.clear();
+	else if (app->transformCount > count)
+		dynamicEntities.erase(std::remove_if(dynamicEntities.begin(), dynamicEntities.end(), [count](u32 entityIdx) { return entityIdx >= count; }), dynamicEntities.end());
+	uploads.insert(uploads.end(), dynamicEntities.begin(), dynamicEntities.end());
+	std::sort(uploads.begin(), uploads.end());
+
+	for (u32 i = firstNew; i < count; ++i)
+	{
+		Entity& e = entities[i];
+		e.dirty = false;
+		if (e.dynamic)
+			dynamicEntities.push_back(i);
+		uploads.push_back(i);
+	}
+
+	// Runs of consecutive matrices to write are staged and written with one call
+	std::vector<glm::mat4>& staging = app->transformStaging;
+	staging.clear();
+	for (u32 i = 0; i < uploads.size(); ++i)
+	{
+		staging.push_back(entities[uploads[i]].worldMatrix);
+		if (i + 1 < uploads.size() && uploads[i + 1] == uploads[i] + 1)
+			continue;
 
-	InitLoadTextures(app);
-	InitQuadMode(app);
+		u32 first = uploads[i] + 1 - (u32)staging.size();
+		u32 bytes = (u32)(staging.size() * sizeof(glm::mat4));
+		glBufferSubData(GL_COPY_WRITE_BUFFER, first * sizeof(glm::mat4), bytes, staging.data());
+		staging.clear();
 
-	InitMeshMode(app);
+		stats.transformBytes += bytes;
+		stats.transformRanges++;
+	}
 
-	InitFramebuffer(app);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	app->transformCount = count;
 
-	app->mode = Mode_Mesh; // default mode
+	// Every box when the bounds changed, otherwise the ones of the entities written
+	if (allBoxes)
+	{
+		for (u32 i = 0; i < count; ++i)
+		{
+			SetEntityBox(app, i);
+			app->movedEntities.push_back(i);
+		}
+	}
+	else
+	{
+		for (u32 entityIdx : uploads)
+		{
+			SetEntityBox(app, entityIdx);
+			app->movedEntities.push_back(entityIdx);
+		}
+	}
+	app->entityCullingStats.boxUpdates = (u32)app->movedEntities.size();
 }
 
-// GUI functions
-void InfoWindow(App* app)
+// Keeps the hierarchy over the entity boxes. It is built again when the entities are replaced or
+// the bounds of the models change, entities added or dropped at the end are inserted or removed,
+// and moved ones are refitted, one by one when they are few.
+static void UpdateEntityBvh(App* app)
 {
-	ImGui::Begin("Info");
-	ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
-	ImGui::Text("Version: %s", app->openglInfo.version);
-	ImGui::Text("Renderer: %s", app->openglInfo.renderer);
-	ImGui::Text("Vendor: %s", app->openglInfo.vendor);
-	ImGui::Text("Shading Language Version: %s", app->openglInfo.shading_language_version);
+	EntityBvhStats& stats = app->entityBvhStats;
+	Bvh& bvh = app->entityBvh;
+	const CullingBoxes& boxes = app->entityBoxes;
+	f64 start = GetTimestamp();
 
-	if (ImGui::CollapsingHeader("Extensions", ImGuiTreeNodeFlags_None))
-	{
-		ImGui::BeginChild("ExtensionsList", ImVec2(0, 150), true, ImGuiWindowFlags_HorizontalScrollbar); // rea de scroll con 150px de alto
+	stats.updatedItems = 0;
+	stats.fullRefit = false;
 
-		for (const auto& extension : app->openglInfo.extensions)
+	u64 key[] = { app->sceneVersion, app->entityBoxesKey };
+	u64 hash = HashBytes(key, sizeof(key));
+	if (hash != app->entityBvhKey)
+	{
+		BuildBvh(bvh, boxes);
+		app->entityBvhKey = hash;
+		stats.builds++;
+		stats.cost = GetBvhCost(bvh);
+		stats.buildMs = (f32)((GetTimestamp() - start) * 1000.0);
+	}
+	else
+	{
+		const u32 treeCount = bvh.itemCount;
+		for (u32 i = treeCount; i-- > boxes.count;)
+			RemoveBvhItem(bvh, i);
+		for (u32 i = treeCount; i < boxes.count; ++i)
+			InsertBvhItem(bvh, boxes, i);
+
+		const std::vector<u32>& moved = app->movedEntities;
+		if (moved.size() > boxes.count / 4)
 		{
-			ImGui::Text("%s", extension.c_str());
+			RefitBvh(bvh, boxes);
+			stats.fullRefit = true;
 		}
-
-		ImGui::EndChild();
+		else
+		{
+			for (u32 entityIdx : moved)
+				if (entityIdx < treeCount)
+					UpdateBvhItem(bvh, boxes, entityIdx);
+		}
+		stats.updatedItems = (u32)moved.size();
 	}
 
-	ImGui::End();
+	stats.items = bvh.itemCount;
+	stats.nodes = (u32)(bvh.nodes.size() - bvh.freeNodes.size());
+	stats.updateMs = (f32)((GetTimestamp() - start) * 1000.0);
+
+	if (app->pickedEntity >= boxes.count)
+		app->pickedEntity = BVH_INVALID;
 }
 
-void RenderModeWindow(App* app)
+// Fills the list of entities the render loop draws with the ones whose box is inside or crossing
+// the frustum. With GPU culling every entity goes to the compute shader instead, and the list is
+// left empty as nothing reads it.
+static void CullEntities(App* app)
 {
-	ImGui::Begin("Render Mode");
+	EntityCullingStats& stats = app->entityCullingStats;
+	const u32 count = (u32)app->entities.size();
+	std::vector<u32>& visible = app->visibleEntities;
 
-	if (ImGui::Button("Textured Quad"))
+	stats.entities = count;
+	stats.avx = FrustumCullingUsesAVX();
+	stats.cullMs = 0.0f;
+
+	if (app->gpuCulling)
 	{
-		ChangeAppMode(app, Mode_TexturedQuad);
+		visible.clear();
+		stats.visible = count;
+		return;
 	}
 
-	if (ImGui::Button("Mesh"))
+	visible.resize(count);
+	if (!app->entityFrustumCulling)
 	{
-		ChangeAppMode(app, Mode_Mesh);
+		for (u32 i = 0; i < count; ++i)
+			visible[i] = i;
+		stats.visible = count;
+		return;
 	}
 
-	if (ImGui::Button("Framebuffer"))
+	f64 start = GetTimestamp();
+	Frustum frustum = MakeFrustum(app->viewProjectionMatrix);
+	if (app->entityBvhCulling)
 	{
-		ChangeAppMode(app, Mode_Framebuffer);
+		// In the order of the entities, as the render loop expects
+		QueryBvhFrustums(app->entityBvh, frustum.planes, 1, &visible);
+		std::sort(visible.begin(), visible.end());
+		stats.visible = (u32)visible.size();
 	}
-
-	ImGui::Separator();
-
-	if (ImGui::Button("Albedo"))
+	else
 	{
-		ChangeAppMode(app, Mode_Albedo);
+		stats.visible = CullBoxes(app->entityBoxes, frustum.planes, visible.data());
+		visible.resize(stats.visible);
 	}
+	stats.cullMs = (f32)((GetTimestamp() - start) * 1000.0);
+}
 
-	if (ImGui::Button("Normal"))
+// Casts a ray from the camera through the mouse on a left click, the entity whose box it enters
+// first is picked, and the entities around it are found with a sphere query
+static void PickEntity(App* app)
+{
+	if (app->input.mouseButtons[MouseButton::LEFT] != BUTTON_PRESS)
+		return;
+
+	// Not kept up to date while culling on the GPU
+	if (app->gpuCulling)
+		UpdateEntityBvh(app);
+
+	f64 start = GetTimestamp();
+	vec2 ndc = vec2(2.0f * app->input.mousePos.x / app->displaySize.x - 1.0f, 1.0f - 2.0f * app->input.mousePos.y / app->displaySize.y);
+	glm::mat4 inverseViewProjection = glm::inverse(app->viewProjectionMatrix);
+	vec4 nearPoint = inverseViewProjection * vec4(ndc, -1.0f, 1.0f);
+	vec4 farPoint = inverseViewProjection * vec4(ndc, 1.0f, 1.0f);
+	vec3 origin = vec3(nearPoint) / nearPoint.w;
+	vec3 ray = vec3(farPoint) / farPoint.w - origin;
+
+	BvhRayHit hit;
+	app->pickedEntity = RaycastBvh(app->entityBvh, origin, glm::normalize(ray), glm::length(ray), hit) ? hit.item : BVH_INVALID;
+	app->pickedDistance = hit.distance;
+	app->neighbourEntities.clear();
+	if (app->pickedEntity != BVH_INVALID)
 	{
-		ChangeAppMode(app, Mode_Normal);
+		const CullingBoxes& boxes = app->entityBoxes;
+		u32 e = app->pickedEntity;
+		QueryBvhSphere(app->entityBvh, vec3(boxes.centerX[e], boxes.centerY[e], boxes.centerZ[e]), app->neighbourRadius, app->neighbourEntities);
 	}
+	app->entityBvhStats.pickMs = (f32)((GetTimestamp() - start) * 1000.0);
+}
 
-	if (ImGui::Button("Position"))
+// Positions of the triangles of a submesh without float vertices, read back from the geometry
+// heap once: the meshes from the mesh cache are uploaded straight from it
+static void ReadOccluderTriangles(App* app, const Submesh& submesh, std::vector<vec3>& triangles)
+{
+	std::vector<u8> vertices((size_t)submesh.vertexCount * submesh.gpuLayout.stride);
+	std::vector<u8> indices((size_t)submesh.indexCount * GetIndexTypeSize(submesh.indexType));
+	ReadGeometry(app->geometryHeap, submesh.vertexAllocation, vertices.data(), (u32)vertices.size());
+	ReadGeometry(app->geometryHeap, submesh.indexAllocation, indices.data(), (u32)indices.size());
+
+	std::vector<vec3> positions;
+	DecodeSubmeshPositions(submesh, vertices.data(), positions);
+	if (positions.empty())
+		return;
+
+	for (u32 i = 0; i < submesh.indexCount; ++i)
 	{
-		ChangeAppMode(app, Mode_Position);
+		u32 index = submesh.indexType == GL_UNSIGNED_SHORT ? ((const u16*)indices.data())[i] : ((const u32*)indices.data())[i];
+		triangles.push_back(positions[index]);
 	}
+}
 
-	if (ImGui::Button("Depth"))
+// Positions of the triangles of the mesh, three per triangle, read from its float vertices when
+// it kept them
+static const std::vector<vec3>& GetOccluderTriangles(App* app, u32 meshIdx)
+{
+	if (app->occluderTriangles.size() < app->meshes.size())
+		app->occluderTriangles.resize(app->meshes.size());
+
+	std::vector<vec3>& triangles = app->occluderTriangles[meshIdx];
+	if (!triangles.empty())
+		return triangles;
+
+	for (const Submesh& submesh : app->meshes[meshIdx].submeshes)
 	{
-		ChangeAppMode(app, Mode_Depth);
+		if (submesh.vertices.empty())
+		{
+			ReadOccluderTriangles(app, submesh, triangles);
+			continue;
+		}
+
+		const VertexBufferAttribute* position = NULL;
+		for (const VertexBufferAttribute& attribute : submesh.vbLayout.vbAttributes)
+			if (attribute.location == 0 && attribute.componentCount >= 3)
+				position = &attribute;
+		if (!position)
+			continue;
+
+		const u32 floatsPerVertex = submesh.vbLayout.stride / sizeof(float);
+		for (u32 index : submesh.indices)
+		{
+			const float* p = submesh.vertices.data() + (size_t)index * floatsPerVertex + position->offset / sizeof(float);
+			triangles.push_back(vec3(p[0], p[1], p[2]));
+		}
 	}
+	return triangles;
+}
 
-	if (ImGui::Button("Lighting"))
+// Rasterizes the largest visible entities into the occlusion buffer and removes the entities
+// hidden behind them from the visible list. Occluders must never cover more than the real
+// surface. A simplified level can grow the silhouette, even by less than a pixel, and edge
+// collapses move vertices onto chords that stand in front of concave regions, so occluders are
+// always drawn with their full mesh.
+static void CullOccludedEntities(App* app)
+{
+	OcclusionCullingStats& stats = app->occlusionStats;
+	const OcclusionSettings& settings = app->occlusionSettings;
+	OcclusionBuffer& buffer = app->occlusionBuffer;
+	std::vector<u32>& visible = app->visibleEntities;
+
+	stats = {};
+	ClearOcclusionBuffer(buffer);
+	if (!settings.enabled || app->gpuCulling)
+		return;
+
+	f64 rasterStart = GetTimestamp();
+
+	// Candidates by the height of their bounding sphere on screen, the largest first
+	const f32 screenHeight = tanf(glm::radians(app->camera.fov) * 0.5f);
+	std::vector<std::pair<f32, u32>> candidates;
+	for (u32 entityIdx : visible)
 	{
-		ChangeAppMode(app, Mode_Lighting);
+		const Entity& e = app->entities[entityIdx];
+		const Model& model = app->models[e.modelIndex];
+		vec3 scale = vec3(glm::length(vec3(e.worldMatrix[0])), glm::length(vec3(e.worldMatrix[1])), glm::length(vec3(e.worldMatrix[2])));
+		f32 radius = model.boundsRadius * glm::max(scale.x, glm::max(scale.y, scale.z));
+		f32 distance = glm::length(vec3(e.worldMatrix * vec4(model.boundsCenter, 1.0f)) - app->camera.position);
+		f32 size = distance > radius ? radius / (distance * screenHeight) : 1.0f;
+		if (size >= settings.minOccluderSize)
+			candidates.push_back(std::make_pair(size, entityIdx));
 	}
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<f32, u32>& a, const std::pair<f32, u32>& b) { return a.first > b.first; });
 
-	if (ImGui::Button("Deferred"))
+	for (const std::pair<f32, u32>& candidate : candidates)
 	{
-		ChangeAppMode(app, Mode_Deferred);
+		if (stats.occluders == settings.maxOccluders)
+			break;
+
+		const Entity& e = app->entities[candidate.second];
+		const Model& model = app->models[e.modelIndex];
+		const std::vector<vec3>& triangles = GetOccluderTriangles(app, model.meshIdx);
+		u32 triangleCount = (u32)triangles.size() / 3;
+		if (triangleCount == 0 || triangleCount > settings.maxOccluderTriangles)
+			continue;
+
+		AddOccluder(buffer, triangles.data(), triangleCount, app->viewProjectionMatrix * e.worldMatrix);
+		stats.occluders++;
 	}
+	stats.occluderTriangles = (u32)buffer.triangles.size();
 
-	ImGui::End();
-}
+	if (stats.occluderTriangles == 0)
+		return;
 
-// Gui -- where ImGui windows draw stuff
-void Gui(App* app)
-{
-	InfoWindow(app);
-	RenderModeWindow(app);
-}
+	RasterizeOccluders(buffer, app->threadPool);
+	stats.rasterMs = (f32)((GetTimestamp() - rasterStart) * 1000.0);
 
-void HotReload(App* app)
-{
-	// Check timestamp / reload
-	for (u64 i = 0; i < app->programs.size(); i++)
-	{
-		Program& program = app->programs[i];
-		u64 currentTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
-		if (currentTimestamp > program.lastWriteTimestamp)
+	// Occluders are tested too, their boxes hold them so they never hide themselves
+	f64 testStart = GetTimestamp();
+	const CullingBoxes& boxes = app->entityBoxes;
+	std::vector<u8> occluded(visible.size(), 0);
+	ParallelFor(app->threadPool, (u32)visible.size(), 4096, [&](u32 begin, u32 end)
 		{
-			glDeleteProgram(program.handle);
-			String progSource = ReadTextFile(program.filepath.c_str());
-			const char* progName = program.programName.c_str();
+			for (u32 i = begin; i < end; ++i)
+			{
+				u32 entityIdx = visible[i];
+				vec3 center = vec3(boxes.centerX[entityIdx], boxes.centerY[entityIdx], boxes.centerZ[entityIdx]);
+				vec3 extent = vec3(boxes.extentX[entityIdx], boxes.extentY[entityIdx], boxes.extentZ[entityIdx]);
+				occluded[i] = IsBoxOccluded(buffer, center - extent, center + extent, app->viewProjectionMatrix) ? 1 : 0;
+			}
+		});
 
-			program.handle = CreateProgramFromSource(progSource, progName);
-			program.lastWriteTimestamp = currentTimestamp;
-		}
-	}
+	u32 visibleCount = 0;
+	for (u32 i = 0; i < visible.size(); ++i)
+		if (!occluded[i])
+			visible[visibleCount++] = visible[i];
+
+	stats.tested = (u32)visible.size();
+	stats.culled = stats.tested - visibleCount;
+	visible.resize(visibleCount);
+	stats.testMs = (f32)((GetTimestamp() - testStart) * 1000.0);
 }
 
-// Update -- where input, hot reload, and buffer ordering are
+
 void Update(App* app)
 {
 	// You can handle app->input keyboard/mouse here
 	if (app->input.keys[K_ESCAPE]) app->isRunning = false;
 
+	// Finished loads replace their placeholders before anything is drawn
+	ProcessAsyncLoads(app);
+
+	if (!app->startupIoCaptured && app->streamingStats.timeToResidentMs > 0.0)
+	{
+		AssetIoStats& io = app->startupIoStats;
+		io = GetAssetIoStats();
+		app->startupIoCaptured = true;
+		ILOG("Startup I/O: %u packed and %u loose files, %.2f MB, %u file system calls, %.2f ms", io.packReads, io.looseReads, io.bytesRead / (1024.0 * 1024.0), io.fileSystemCalls, io.ioMs);
+	}
+
 	HotReload(app);
 
 	CameraMovement(app);
@@ -1288,41 +3128,49 @@ void Update(App* app)
 	vec3 up = vec3{ 0.0f, 1.0f, 0.0f };
 	glm::mat4 projection = glm::perspective(glm::radians(app->camera.fov), aspectRatio, app->camera.znear, app->camera.zfar);
 	glm::mat4 view = glm::lookAt(app->camera.position, app->camera.target, up); // eye, center, up
+	app->viewProjectionMatrix = projection * view;
 
-	// Push data into the buffer ordered according to the uniform block
-	MapBuffer(app->uniformBuffer, GL_WRITE_ONLY);
+	// Push data into the buffer ordered according to the uniform block. The region written now
+	// was last read three frames ago, so this rarely waits for the GPU.
+	RingBuffer& uniformRing = app->uniformRing;
+	Buffer& uniformBuffer = uniformRing.buffer;
+	BeginRingRegion(uniformRing);
 
-	app->globalParamsOffset = app->uniformBuffer.head;
-	PushVec3(app->uniformBuffer, app->camera.position);
-	PushUInt(app->uniformBuffer, app->lights.size());
+	// World view projections are formed in the shaders, a camera move only uploads this one
+	app->globalParamsBuffer = uniformBuffer.handle;
+	app->globalParamsOffset = uniformBuffer.head;
+	PushMat4(uniformBuffer, app->viewProjectionMatrix);
+	PushVec3(uniformBuffer, app->camera.position);
+	PushUInt(uniformBuffer, app->lights.size());
 
 	for (Light& l : app->lights)
 	{
-		AlignHead(app->uniformBuffer, sizeof(vec4));
+		AlignHead(uniformBuffer, sizeof(vec4));
 
-		PushUInt(app->uniformBuffer, l.type);
-		PushVec3(app->uniformBuffer, l.color);
-		PushVec3(app->uniformBuffer, l.direction);
-		PushVec3(app->uniformBuffer, l.position);
+		PushUInt(uniformBuffer, l.type);
+		PushVec3(uniformBuffer, l.color);
+		PushVec3(uniformBuffer, l.direction);
+		PushVec3(uniformBuffer, l.position);
 	}
 
-	app->globalParamsSize = app->uniformBuffer.head - app->globalParamsOffset; // It's doing -0
+	app->globalParamsSize = uniformBuffer.head - app->globalParamsOffset;
 
-	for (Entity& e : app->entities)
-	{
-		AlignHead(app->uniformBuffer, app->uniformBlockAlignment);
-		app->worldViewProjectionMatrix = projection * view * e.worldMatrix;
-
-		e.head = app->uniformBuffer.head;
+	EndRingRegion(uniformRing);
 
-		PushMat4(app->uniformBuffer, e.worldMatrix);
-		PushMat4(app->uniformBuffer, app->worldViewProjectionMatrix);
+	// The draw data of the indirect draws is counted when they are submitted
+	app->uploadStats = {};
+	app->uploadStats.globalParamsBytes = app->globalParamsSize;
+	UploadTransforms(app);
 
-		e.size = app->uniformBuffer.head - e.head;
-
-	}
+	// The GPU culling tests the entities itself, the hierarchy is built again when picking needs it
+	if (app->gpuCulling)
+		app->entityBvhKey = 0;
+	else
+		UpdateEntityBvh(app);
 
-	UnmapBuffer(app->uniformBuffer);
+	CullEntities(app);
+	CullOccludedEntities(app);
+	PickEntity(app);
 }
 
 // Render functions
@@ -1349,44 +3197,425 @@ void RenderQuadMode(App* app)
 	glUseProgram(0);
 }
 
-void RenderMeshMode(App* app)
+/**
+ * Coarsest level whose error, projected on the screen, stays under the pixel error. Going to
+ * a coarser level needs a margin given by the hysteresis so entities do not flicker between
+ * two levels when they sit at the switching distance.
+ */
+static u32 SelectLod(const App* app, const Model& model, const Entity& entity)
 {
-	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
-	glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+	const LodSettings& settings = app->lodSettings;
+	if (!settings.enabled || model.lodCount <= 1)
+		return 0;
 
-	Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
+	vec3 scale = vec3(glm::length(vec3(entity.worldMatrix[0])), glm::length(vec3(entity.worldMatrix[1])), glm::length(vec3(entity.worldMatrix[2])));
+	f32 radius = model.boundsRadius * glm::max(scale.x, glm::max(scale.y, scale.z));
+	f32 distance = glm::length(vec3(entity.worldMatrix * vec4(model.boundsCenter, 1.0f)) - app->camera.position);
+	if (distance <= radius)
+		return 0;
+
+	// Size of the bounding sphere on screen, in pixels
+	f32 pixelsPerUnit = app->displaySize.y / (2.0f * tanf(glm::radians(app->camera.fov) * 0.5f));
+	f32 projectedRadius = radius / distance * pixelsPerUnit;
+
+	u32 lod = 0;
+	for (u32 i = 1; i < model.lodCount; ++i)
+		if (model.lodError[i] * projectedRadius <= settings.pixelError)
+			lod = i;
+
+	while (lod > entity.lod && model.lodError[lod] * projectedRadius > settings.pixelError * (1.0f - settings.hysteresis))
+		lod--;
+
+	return lod;
+}
+
+static IndirectDrawData MakeIndirectDrawData(u32 entityIdx, const Submesh& submesh, u32 materialIdx)
+{
+	const VertexDecode& decode = submesh.decode;
+	IndirectDrawData data = {};
+	data.positionScale = vec4(decode.positionScale, decode.octahedralNormals ? 1.0f : 0.0f);
+	data.positionOffset = vec4(decode.positionOffset, 0.0f);
+	data.texCoordTransform = vec4(decode.texCoordScale, decode.texCoordOffset);
+	data.materialIdx = materialIdx;
+	data.transformIdx = entityIdx;
+	return data;
+}
+
+// Culls the meshlets of every submesh of the entity and draws the visible ones, or queues them
+// as indirect draws
+static void DrawEntityMeshlets(App* app, u32 entityIdx, Program& program, const Frustum& frustum, MeshletDrawList& drawList, GLuint& boundVao)
+{
+	const bool indirect = app->indirectDraws;
+	const Entity& e = app->entities[entityIdx];
+	Model& model = app->models[e.modelIndex];
+	Mesh& mesh = app->meshes[model.lodCount > 0 ? model.lodMeshIdx[e.lod] : model.meshIdx];
+
+	if (!indirect)
+		glUniform1ui(app->texturedMeshProgram_uTransformIdx, entityIdx);
+
+	for (u32 i = 0; i < mesh.submeshes.size(); i++)
+	{
+		Submesh& submesh = mesh.submeshes[i];
+		CullMeshlets(submesh, e.worldMatrix, frustum, app->camera.position, app->meshletFrustumCulling, app->meshletConeCulling, drawList, app->meshletStats);
+		if (drawList.counts.empty())
+			continue;
+
+		// Submeshes in the same arena draw from the same buffers
+		GLuint vao = FindVAO(app, submesh, program);
+
+		u32 subMeshMaterialIdx = model.materialIdx[i];
+		Material& submeshMaterial = app->materials[subMeshMaterialIdx];
+		GLuint texture = app->textures[submeshMaterial.albedoTextureIdx].handle;
+
+		if (indirect)
+		{
+			AddIndirectDraw(app->indirectRenderer, vao, texture, submesh, drawList, MakeIndirectDrawData(entityIdx, submesh, subMeshMaterialIdx));
+			continue;
+		}
+
+		if (vao != boundVao)
+		{
+			glBindVertexArray(vao);
+			boundVao = vao;
+			app->meshletStats.vertexArrayBinds++;
+		}
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		const VertexDecode& decode = submesh.decode;
+		glUniform3fv(app->texturedMeshProgram_uPositionScale, 1, glm::value_ptr(decode.positionScale));
+		glUniform3fv(app->texturedMeshProgram_uPositionOffset, 1, glm::value_ptr(decode.positionOffset));
+		glUniform4f(app->texturedMeshProgram_uTexCoordTransform, decode.texCoordScale.x, decode.texCoordScale.y, decode.texCoordOffset.x, decode.texCoordOffset.y);
+		glUniform1i(app->texturedMeshProgram_uOctahedralNormals, decode.octahedralNormals ? 1 : 0);
+
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawList.counts.data(), submesh.indexType, drawList.offsets.data(), (GLsizei)drawList.counts.size(), drawList.baseVertices.data());
+		app->meshletStats.drawCalls++;
+	}
+}
+
+// Queues every submesh of a group of entities showing the same mesh as one instanced draw. The
+// instances are tested against the frustum with the bounds of the model, unless their boxes
+// already were, and draw all their meshlets. Keys hold the entity index in their low 32 bits.
+static void DrawEntityInstances(App* app, const u64* keys, u32 count, Program& program, const Frustum& frustum, MeshletDrawList& drawList,
+	std::vector<u32>& visible, std::vector<IndirectDrawData>& data)
+{
+	const Entity& first = app->entities[(u32)keys[0]];
+	Model& model = app->models[first.modelIndex];
+	Mesh& mesh = app->meshes[model.lodCount > 0 ? model.lodMeshIdx[first.lod] : model.meshIdx];
+
+	visible.clear();
+	for (u32 i = 0; i < count; ++i)
+	{
+		const Entity& e = app->entities[(u32)keys[i]];
+		if (app->meshletFrustumCulling && !app->entityFrustumCulling)
+		{
+			vec3 scale = vec3(glm::length(vec3(e.worldMatrix[0])), glm::length(vec3(e.worldMatrix[1])), glm::length(vec3(e.worldMatrix[2])));
+			f32 radius = model.boundsRadius * glm::max(scale.x, glm::max(scale.y, scale.z));
+			if (!IsSphereInFrustum(frustum, vec3(e.worldMatrix * vec4(model.boundsCenter, 1.0f)), radius))
+				continue;
+		}
+		visible.push_back((u32)keys[i]);
+	}
+
+	InstancingStats& stats = app->instancingStats;
+	stats.groups++;
+	stats.instancedEntities += count;
+	stats.culledEntities += count - (u32)visible.size();
+
+	for (u32 i = 0; i < mesh.submeshes.size(); i++)
+	{
+		// Every meshlet, in a single range, counted once per instance
+		Submesh& submesh = mesh.submeshes[i];
+		MeshletCullingStats submeshStats = {};
+		CullMeshlets(submesh, glm::mat4(1.0f), frustum, app->camera.position, false, false, drawList, submeshStats);
+
+		MeshletCullingStats& meshletStats = app->meshletStats;
+		meshletStats.meshlets += submeshStats.meshlets * count;
+		meshletStats.visibleMeshlets += submeshStats.meshlets * (u32)visible.size();
+		meshletStats.triangles += submeshStats.triangles * count;
+		meshletStats.frustumCulledTriangles += submeshStats.triangles * (count - (u32)visible.size());
+
+		if (visible.empty() || drawList.counts.empty())
+			continue;
+
+		GLuint vao = FindVAO(app, submesh, program);
+
+		u32 subMeshMaterialIdx = model.materialIdx[i];
+		Material& submeshMaterial = app->materials[subMeshMaterialIdx];
+		GLuint texture = app->textures[submeshMaterial.albedoTextureIdx].handle;
+
+		data.clear();
+		for (u32 entityIdx : visible)
+			data.push_back(MakeIndirectDrawData(entityIdx, submesh, subMeshMaterialIdx));
+
+		AddIndirectInstances(app->indirectRenderer, vao, texture, submesh, drawList, data.data(), (u32)data.size());
+	}
+}
+
+// Culls the meshlets of the entities on the CPU and draws them, or queues them as indirect draws
+static void DrawMeshes(App* app)
+{
+	const bool indirect = app->indirectDraws;
+	Program& texturedMeshProgram = app->programs[indirect ? app->indirectMeshProgramIdx : app->texturedMeshProgramIdx];
 	glUseProgram(texturedMeshProgram.handle);
+	glUniform1i(indirect ? app->indirectMeshProgram_uTexture : app->texturedMeshProgram_uTexture, 0);
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->globalParamsBuffer, app->globalParamsOffset, app->globalParamsSize);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, app->transformBuffer);
+
+	Frustum frustum = MakeFrustum(app->viewProjectionMatrix);
+	MeshletDrawList drawList;
+	GLuint boundVao = 0;
 
-	glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->uniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	// Only the entities left by the frustum culling in Update
+	const std::vector<u32>& visibleEntities = app->visibleEntities;
+	app->instancingStats.entities = (u32)visibleEntities.size();
 
-	for (const Entity& e : app->entities)
+	// Levels first, entities are grouped by the mesh they end up showing
+	for (u32 entityIdx : visibleEntities)
 	{
+		Entity& e = app->entities[entityIdx];
 		Model& model = app->models[e.modelIndex];
-		Mesh& mesh = app->meshes[model.meshIdx];
+		e.lod = SelectLod(app, model, e);
+		Mesh& mesh = app->meshes[model.lodCount > 0 ? model.lodMeshIdx[e.lod] : model.meshIdx];
 
-		// Binding 1
-		glBindBufferRange(GL_UNIFORM_BUFFER, 1, app->uniformBuffer.handle, e.head, e.size);
+		app->lodStats.fullTriangles += CountTriangles(app->meshes[model.meshIdx]);
+		app->lodStats.drawnTriangles += CountTriangles(mesh);
+		app->lodStats.entitiesPerLevel[e.lod]++;
+	}
 
-		for (u32 i = 0; i < mesh.submeshes.size(); i++)
+	if (indirect && app->instancing)
+	{
+		// Model and level in the high bits, sorting puts the entities of a group together
+		std::vector<u64> keys(visibleEntities.size());
+		for (u32 i = 0; i < keys.size(); ++i)
 		{
-			GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
-			glBindVertexArray(vao);
+			const Entity& e = app->entities[visibleEntities[i]];
+			keys[i] = ((u64)(e.modelIndex * MAX_MODEL_LODS + e.lod) << 32) | visibleEntities[i];
+		}
+		std::sort(keys.begin(), keys.end());
+
+		std::vector<u32> visible;
+		std::vector<IndirectDrawData> instanceData;
+		for (u32 begin = 0, end = 0; begin < keys.size(); begin = end)
+		{
+			end = begin + 1;
+			while (end < keys.size() && (keys[end] >> 32) == (keys[begin] >> 32))
+				end++;
+
+			if (end - begin >= app->minInstances)
+			{
+				DrawEntityInstances(app, &keys[begin], end - begin, texturedMeshProgram, frustum, drawList, visible, instanceData);
+				continue;
+			}
+
+			for (u32 i = begin; i < end; ++i)
+				DrawEntityMeshlets(app, (u32)keys[i], texturedMeshProgram, frustum, drawList, boundVao);
+		}
+	}
+	else
+	{
+		for (u32 entityIdx : visibleEntities)
+			DrawEntityMeshlets(app, entityIdx, texturedMeshProgram, frustum, drawList, boundVao);
+	}
+
+	// Buckets of draws sharing their buffers and texture, one call each
+	if (indirect)
+	{
+		SubmitIndirectDraws(app->indirectRenderer, app->meshletStats);
+		app->uploadStats.drawDataBytes += GetIndirectDrawStats(app->indirectRenderer).uploadedBytes;
+	}
+}
+
+// What the culling batches are built from: the entities, the meshes and where they are, the
+// textures, and the vertex arrays of the program
+static u64 GetGpuCullingSceneKey(App* app)
+{
+	const Program& program = app->programs[app->culledMeshProgramIdx];
+	const GeometryHeapStats& heapStats = app->geometryHeap.stats;
+	u64 key[] = { app->entities.size(), app->models.size(), app->meshes.size(), app->textures.size(), heapStats.grows, heapStats.defragmentations,
+		app->streamingStats.uploadedLoads, app->sceneVersion, program.handle };
+	return HashBytes(key, sizeof(key));
+}
+
+// One batch per submesh of each level of the models that entities show
+static void BuildGpuCullingScene(App* app, const Program& program)
+{
+	std::vector<u32> entityModels(app->entities.size());
+	std::vector<u32> entityCounts(app->models.size(), 0);
+	for (u32 i = 0; i < app->entities.size(); ++i)
+	{
+		entityModels[i] = app->entities[i].modelIndex;
+		entityCounts[entityModels[i]]++;
+	}
 
-			u32 subMeshMaterialIdx = model.materialIdx[i];
-			Material& submeshMaterial = app->materials[subMeshMaterialIdx];
+	std::vector<GpuCullingModel> models(app->models.size());
+	std::vector<GpuCullingBatch> batches;
+	for (u32 modelIdx = 0; modelIdx < app->models.size(); ++modelIdx)
+	{
+		const Model& model = app->models[modelIdx];
+		GpuCullingModel& cullingModel = models[modelIdx];
+		cullingModel.bounds = vec4(model.boundsCenter, model.boundsRadius);
+		cullingModel.lodCount = glm::max(model.lodCount, 1u);
 
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-			glUniform1i(app->texturedMeshProgram_uTexture, 0);
+		for (u32 lod = 0; lod < cullingModel.lodCount; ++lod)
+		{
+			cullingModel.lodError[lod] = model.lodCount > 0 ? model.lodError[lod] : 0.0f;
+			if (entityCounts[modelIdx] == 0)
+				continue;
 
-			Submesh& submesh = mesh.submeshes[i];
-			glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+			const Mesh& mesh = app->meshes[model.lodCount > 0 ? model.lodMeshIdx[lod] : model.meshIdx];
+			for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+			{
+				const Submesh& submesh = mesh.submeshes[i];
+				u32 materialIdx = model.materialIdx[i];
+
+				GpuCullingBatch batch = {};
+				batch.vao = FindVAO(app, submesh, program);
+				batch.texture = app->textures[app->materials[materialIdx].albedoTextureIdx].handle;
+				batch.indexType = submesh.indexType;
+				batch.count = submesh.indexCount;
+				batch.firstIndex = submesh.indexAllocation.offset / GetIndexTypeSize(submesh.indexType);
+				batch.baseVertex = (i32)submesh.vertexAllocation.offset;
+				batch.model = modelIdx;
+				batch.lod = lod;
+				batch.capacity = entityCounts[modelIdx];
+				batch.data = MakeIndirectDrawData(0, submesh, materialIdx);
+				batches.push_back(batch);
+			}
 		}
+	}
+
+	SetGpuCullingScene(app->gpuCuller, batches, models, entityModels);
+}
+
+// Adds the G-buffer times of the frame read back this frame, if any, to the Hi-Z statistics
+static void ReadGBufferTimes(App* app)
+{
+	GpuTimeline& timeline = app->gbufferTimeline;
+	if (!BeginGpuTimelineFrame(timeline))
+		return;
+
+	HiZStats& stats = app->hiZStats;
+	f64 geometryMs = GetGpuTimelineMs(timeline, GBufferTime_Start, GBufferTime_LateDrawn);
+	if (app->gbufferTimelineHiZ[timeline.frame % GPU_TIMELINE_LATENCY])
+	{
+		stats.frames++;
+		stats.pyramidMs += GetGpuTimelineMs(timeline, GBufferTime_EarlyDrawn, GBufferTime_PyramidBuilt);
+		stats.cullMs += GetGpuTimelineMs(timeline, GBufferTime_Start, GBufferTime_EarlyCulled) + GetGpuTimelineMs(timeline, GBufferTime_PyramidBuilt, GBufferTime_LateCulled);
+		stats.geometryMs += geometryMs;
+	}
+	else
+	{
+		stats.framesWithoutHiZ++;
+		stats.geometryMsWithoutHiZ += geometryMs;
+	}
+}
+
+static void BindCulledMeshProgram(App* app, const Program& culledMeshProgram)
+{
+	glUseProgram(culledMeshProgram.handle);
+	glUniform1i(app->culledMeshProgram_uTexture, 0);
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, app->globalParamsBuffer, app->globalParamsOffset, app->globalParamsSize);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, app->transformBuffer);
+}
+
+// Culls the entities and selects their levels in a compute shader, which writes the commands
+// drawn right after. Per frame the CPU only visits the entities that move (UploadTransforms),
+// the batches are built again when the scene changes. Into the G-buffer, the entities visible
+// last frame are drawn first and the others are tested against the depth pyramid built from
+// them, all in the same frame, so nothing appears a frame late.
+static void DrawGpuCulledMeshes(App* app)
+{
+	Program& culledMeshProgram = app->programs[app->culledMeshProgramIdx];
+	Program& cullingProgram = app->programs[app->gpuCullingProgramIdx];
 
+	GLint drawFramebuffer = 0;
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &drawFramebuffer);
+	const bool hiZ = app->hiZCulling && (GLuint)drawFramebuffer == app->framebufferHandle;
+
+	GpuTimeline& timeline = app->gbufferTimeline;
+	ReadGBufferTimes(app);
+	app->gbufferTimelineHiZ[timeline.frame % GPU_TIMELINE_LATENCY] = hiZ;
+	MarkGpuTimeline(timeline, GBufferTime_Start);
+
+	u64 sceneKey = GetGpuCullingSceneKey(app);
+	if (sceneKey != app->gpuCullingSceneKey)
+	{
+		BuildGpuCullingScene(app, culledMeshProgram);
+		app->gpuCullingSceneKey = sceneKey;
+	}
+
+	GpuCullingParams params = {};
+	params.frustum = MakeFrustum(app->viewProjectionMatrix);
+	params.cameraPosition = app->camera.position;
+	params.pixelsPerUnit = app->displaySize.y / (2.0f * tanf(glm::radians(app->camera.fov) * 0.5f));
+	params.pixelError = app->lodSettings.pixelError;
+	params.hysteresis = app->lodSettings.hysteresis;
+	params.frustumCulling = app->meshletFrustumCulling;
+	params.lods = app->lodSettings.enabled;
+	params.transformBuffer = app->transformBuffer;
+	params.phase = hiZ ? GpuCullingPhase_Early : GpuCullingPhase_All;
+	params.viewProjection = app->viewProjectionMatrix;
+	DispatchGpuCulling(app->gpuCuller, cullingProgram.handle, params);
+	MarkGpuTimeline(timeline, GBufferTime_EarlyCulled);
+
+	BindCulledMeshProgram(app, culledMeshProgram);
+	DrawGpuCulledBatches(app->gpuCuller, app->meshletStats, params.phase);
+	MarkGpuTimeline(timeline, GBufferTime_EarlyDrawn);
+
+	if (hiZ)
+	{
+		DepthPyramid& pyramid = app->depthPyramid;
+		ResizeDepthPyramid(pyramid, app->displaySize.x, app->displaySize.y);
+		BuildDepthPyramid(pyramid, app->programs[app->depthPyramidProgramIdx].handle, app->depthAttachmentHandle);
+		MarkGpuTimeline(timeline, GBufferTime_PyramidBuilt);
+
+		params.phase = GpuCullingPhase_Late;
+		params.depthPyramid = pyramid.texture;
+		params.pyramidSize = ivec2(pyramid.width, pyramid.height);
+		params.pyramidLevels = pyramid.levelCount;
+		DispatchGpuCulling(app->gpuCuller, cullingProgram.handle, params);
+		MarkGpuTimeline(timeline, GBufferTime_LateCulled);
+
+		BindCulledMeshProgram(app, culledMeshProgram);
+		DrawGpuCulledBatches(app->gpuCuller, app->meshletStats, params.phase);
+		MarkGpuTimeline(timeline, GBufferTime_LateDrawn);
+	}
+	else
+	{
+		MarkGpuTimeline(timeline, GBufferTime_PyramidBuilt);
+		MarkGpuTimeline(timeline, GBufferTime_LateCulled);
+		MarkGpuTimeline(timeline, GBufferTime_LateDrawn);
 	}
 
+	// The verification repeats the tests without the depth pyramid
+	if (app->gpuCullingVerify && !hiZ)
+		VerifyGpuCulling(app->gpuCuller, params, app->entities);
+}
+
+void RenderMeshMode(App* app)
+{
+	glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+
+	f64 submissionStart = GetTimestamp();
+
+	// Culling on the GPU leaves the statistics of the CPU culling empty
+	app->meshletStats = {};
+	app->lodStats = {};
+	app->instancingStats = {};
+
+	if (app->gpuCulling)
+		DrawGpuCulledMeshes(app);
+	else
+		DrawMeshes(app);
+
+	app->meshSubmissionMs = (f32)((GetTimestamp() - submissionStart) * 1000.0);
+
 	glBindVertexArray(0);
 	glUseProgram(0);
 }
@@ -1668,6 +3897,9 @@ void Render(App* app)
 		break;
 	}
 
+	// Every draw reading the uniforms of this frame has been submitted
+	FenceRingRegion(app->uniformRing);
+
 	glBindVertexArray(0);
 	glUseProgram(0);
 }
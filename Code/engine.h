@@ -6,6 +6,15 @@
 
 #include "platform.h"
 #include "buffer_management.h"
+#include "geometry_heap.h"
+#include "frustum_culling.h"
+#include "bvh.h"
+#include "occlusion_culling.h"
+#include "depth_pyramid.h"
+#include "gpu_timers.h"
+#include "job_system.h"
+#include "asset_registry.h"
+#include "asset_pack.h"
 #include <glad/glad.h>
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
@@ -26,10 +35,29 @@ struct Image
 	i32   stride;
 };
 
+// What a texture is sampled for, decides how it can be compressed
+enum TextureUsage
+{
+	TextureUsage_Color,
+	TextureUsage_Normal,
+	TextureUsage_Data
+};
+
+// How the mip chains of the textures are generated
+enum MipFilter
+{
+	MipFilter_Box,    // 2x2 average
+	MipFilter_Kaiser, // 8 tap Kaiser windowed sinc, sharper than the box filter
+	MipFilter_Count
+};
+
 struct Texture
 {
 	GLuint      handle;
 	std::string filepath;
+	const char* formatName;
+	u32         gpuSize; // in bytes, including mips
+	f32         psnr;    // of the block compression, 0 if uncompressed
 };
 
 struct OpenGL_Info
@@ -71,11 +99,21 @@ const VertexV3V2 vertices[] =
 
 const u16 indices[] = { 0,1,2,0,2,3 };
 
+enum VertexFormat
+{
+	VertexFormat_Float32,
+	VertexFormat_Float16,
+	VertexFormat_SNorm16,
+	VertexFormat_UNorm16
+};
+
 struct VertexBufferAttribute
 {
 	u8 location;
 	u8 componentCount;
 	u8 offset;
+	u8 format;     // VertexFormat
+	u8 normalized; // integer formats are read as [-1, 1] or [0, 1] floats
 };
 
 struct VertexBufferLayout
@@ -95,10 +133,57 @@ struct VertexShaderLayout
 	std::vector<VertexShaderAttribute> vsAttributes;
 };
 
-struct Vao
+// How the vertex shader turns quantized vertices back into the original values
+struct VertexDecode
+{
+	vec3 positionScale;
+	vec3 positionOffset;
+	vec2 texCoordScale;
+	vec2 texCoordOffset;
+	bool octahedralNormals; // normals are 2D octahedral coordinates
+};
+
+// Largest difference between the original and the decoded vertices
+struct QuantizationError
 {
-	GLuint handle;
-	GLuint programHandle;
+	f32 position;  // in model units
+	f32 normal;    // in degrees
+	f32 texCoord;
+};
+
+enum VertexQuantization
+{
+	VertexQuantization_None,    // 32 bit floats
+	VertexQuantization_Half,    // half float positions
+	VertexQuantization_SNorm16, // 16 bit positions inside the submesh bounds
+	VertexQuantization_Count
+};
+
+// Cluster of at most 64 vertices and 124 triangles, culled as a whole
+struct Meshlet
+{
+	u32 indexOffset;   // first index of its triangles in Submesh::indices
+	u32 triangleCount;
+	u32 vertexCount;
+
+	// Bounds in model space
+	vec3 center;
+	f32 radius;
+	vec3 aabbMin;
+	vec3 aabbMax;
+
+	// Every triangle faces away from a camera inside the cone behind the apex
+	vec3 coneApex;
+	vec3 coneAxis;
+	f32 coneCutoff;    // above 1 when the normals spread too much to cull
+};
+
+// How well an index order uses the post-transform vertex cache, and how much it overdraws
+struct VertexCacheStats
+{
+	f32 acmr;     // vertices transformed per triangle
+	f32 atvr;     // vertices transformed per unique vertex
+	f32 overdraw; // fragments shaded per covered pixel
 };
 
 struct Submesh
@@ -106,23 +191,56 @@ struct Submesh
 	// where we store attributes
 	VertexBufferLayout vbLayout;
 
-	// will be merged in the VBO (Vertex Buffer Object) and IBO (Index Buffer Object) in the Mesh
+	// layout of the vertices in the VBO, which may be quantized
+	VertexBufferLayout gpuLayout;
+	VertexDecode decode;
+
+	// will be uploaded to the VBO (Vertex Buffer Object) and IBO (Index Buffer Object) arenas of the geometry heap
 	std::vector<float> vertices;
 	std::vector<u32> indices;
 
-	// to find the data for the submesh on the VBO and IBO buffers
+	// to find the data for the submesh in the buffers of its PreparedMesh
 	u32 vertexOffset;
 	u32 indexOffset;
 
-	// Vertex Attribute Object
-	std::vector<Vao> vaos;
+	// as uploaded, meshes from the mesh cache come without their float vertices and indices
+	u32 vertexCount;
+	u32 indexCount;
+
+	// where it was uploaded in the geometry heap: the offset of the vertices is the base vertex
+	// of its draws, the one of the indices is in bytes
+	GeometryAllocation vertexAllocation;
+	GeometryAllocation indexAllocation;
+
+	// GL_UNSIGNED_SHORT when the vertices fit, GL_UNSIGNED_INT otherwise
+	GLenum indexType;
+
+	// indices are ordered so each meshlet owns a contiguous range of them
+	std::vector<Meshlet> meshlets;
+
+	// Bounds in model space, from the meshlets
+	vec3 aabbMin;
+	vec3 aabbMax;
+	vec3 boundsCenter;
+	f32 boundsRadius;
+
+	// measured when the submesh was optimized for the vertex cache and overdraw
+	VertexCacheStats statsBefore;
+	VertexCacheStats statsAfter;
+
 };
 
 struct Mesh
 {
 	std::vector<Submesh> submeshes;
-	GLuint vertexBufferHandle;
-	GLuint indexBufferHandle;
+
+	// Vertex memory with floats and as uploaded
+	u32 floatVertexBytes;
+	u32 gpuVertexBytes;
+	QuantizationError quantizationError;
+
+	// Index memory as uploaded
+	u32 gpuIndexBytes;
 };
 
 struct Material
@@ -138,10 +256,62 @@ struct Material
 	u32 bumpTextureIdx;
 };
 
+// A texture that has to be loaded into one of the texture slots of a material
+struct TextureRequest
+{
+	std::string filepath;
+	TextureUsage usage;
+	u32 materialIdx;
+	u32 Material::* textureIdx;
+};
+
+#define MAX_MODEL_LODS 5
+
 struct Model
 {
 	u32 meshIdx;
 	std::vector<u32> materialIdx;
+
+	// Simplified versions of the mesh with the same submeshes, lodMeshIdx[0] is meshIdx
+	u32 lodCount;
+	u32 lodMeshIdx[MAX_MODEL_LODS];
+	f32 lodError[MAX_MODEL_LODS]; // relative to boundsRadius
+	vec3 boundsCenter;
+	f32 boundsRadius;
+	vec3 aabbMin;
+	vec3 aabbMax;
+};
+
+// Vertex and index buffer contents of a mesh, laid out off the main thread and uploaded later
+struct PreparedMesh
+{
+	Mesh mesh;                  // optimized, with the layouts, offsets and index types of the buffers
+	std::vector<u8> vertexData;
+	std::vector<u8> indexData;
+	const u8* cachedVertexData; // buffer contents in the mesh cache, used when the vectors are empty
+	const u8* cachedIndexData;
+	u64 contentHash;            // of the mesh as it was given, to share identical meshes
+};
+
+// A model read from disk and processed in any thread, before anything is added to the app
+struct ModelData
+{
+	Mesh mesh;                            // as imported, moved to lods[0] when prepared
+	std::vector<u32> submeshMaterials;    // index in materials of each submesh
+	std::vector<Material> materials;      // without their textures
+	std::vector<TextureRequest> textures; // materialIdx is an index in materials
+	u32 importFlags;                      // stored in the mesh cache
+	bool fromCache;
+	AssetFile cacheFile;                  // holds the cached buffer contents until committed
+
+	// Filled by PrepareModelData or read from the mesh cache, lods[0] is the full mesh
+	u32 lodCount;
+	PreparedMesh lods[MAX_MODEL_LODS];
+	f32 lodError[MAX_MODEL_LODS];
+	vec3 boundsCenter;
+	f32 boundsRadius;
+	vec3 aabbMin;
+	vec3 aabbMax;
 };
 
 struct Camera
@@ -161,14 +331,16 @@ struct Program
 	std::string        programName;
 	u64                lastWriteTimestamp;
 	VertexShaderLayout vertexInputLayout;
+	bool               compute; // a single compute shader, with no vertex inputs
 };
 
 struct Entity
 {
 	glm::mat4 worldMatrix;
 	u32 modelIndex;
-	u32 head;
-	u32 size;
+	u32 lod;      // level of detail drawn last frame
+	bool dynamic; // moves every frame, its matrix is uploaded every frame, see SetEntityDynamic
+	bool dirty;   // set by SetEntityWorldMatrix on static entities, the matrix is uploaded once
 };
 
 enum LightType
@@ -185,6 +357,161 @@ struct Light
 	vec3 position;
 };
 
+struct ModelLoadTiming
+{
+	std::string filepath;
+	f64 milliseconds;
+	bool cacheHit; // loaded from the baked mesh cache instead of Assimp
+	bool async;    // from the request until it was uploaded, while the app kept running
+};
+
+struct MeshletCullingStats
+{
+	u32 meshlets;
+	u32 visibleMeshlets;
+	u32 triangles;
+	u32 frustumCulledTriangles;
+	u32 coneCulledTriangles;
+	u32 drawCalls;
+	u32 vertexArrayBinds; // only when consecutive draws read different geometry arenas
+};
+
+// Bytes written to GPU buffers by the CPU this frame
+struct FrameUploadStats
+{
+	u32 globalParamsBytes; // view projection, camera and lights
+	u32 transformBytes;
+	u32 transformRanges;   // consecutive changed matrices are written at once
+	u32 drawDataBytes;     // indirect draw data and commands
+};
+
+struct EntityCullingStats
+{
+	u32 entities;
+	u32 visible;
+	u32 boxUpdates; // entities whose world box was computed again this frame
+	f32 cullMs;
+	bool avx;       // 8 boxes per instruction instead of 4
+};
+
+struct EntityBvhStats
+{
+	u32 items;
+	u32 nodes;
+	u32 builds;
+	u32 updatedItems; // refitted this frame, one by one or with the whole tree
+	bool fullRefit;
+	f32 cost;         // surface area heuristic after the last build
+	f32 buildMs;      // of the last build
+	f32 updateMs;     // this frame
+	f32 pickMs;       // of the last pick
+};
+
+struct OcclusionSettings
+{
+	bool enabled;
+	u32 maxOccluders;
+	f32 minOccluderSize;      // height of the bounding sphere on screen, as a fraction of the screen
+	u32 maxOccluderTriangles; // of the full mesh, occluders needing more are skipped
+};
+
+struct OcclusionCullingStats
+{
+	u32 occluders;
+	u32 occluderTriangles; // queued, without the ones crossing the near plane
+	u32 tested;
+	u32 culled;
+	f32 rasterMs;          // choosing, binning and rasterizing the occluders
+	f32 testMs;
+};
+
+// Points of the G-buffer geometry pass measured on the GPU. Without Hi-Z the late ones are
+// marked right after the early draws.
+enum GBufferTimePoint
+{
+	GBufferTime_Start,
+	GBufferTime_EarlyCulled,
+	GBufferTime_EarlyDrawn,
+	GBufferTime_PyramidBuilt,
+	GBufferTime_LateCulled,
+	GBufferTime_LateDrawn,
+	GBufferTime_Count
+};
+
+// Sums over the measured frames of the G-buffer geometry pass with GPU culling
+struct HiZStats
+{
+	u32 frames;               // with Hi-Z
+	u32 framesWithoutHiZ;
+	f64 pyramidMs;
+	f64 cullMs;               // both phases
+	f64 geometryMs;           // culling, pyramid and draws
+	f64 geometryMsWithoutHiZ;
+};
+
+struct InstancingStats
+{
+	u32 entities;
+	u32 groups;            // entities showing the same level of a model, drawn as instances
+	u32 instancedEntities;
+	u32 culledEntities;    // instances are culled as a whole, not per meshlet
+};
+
+struct LodSettings
+{
+	// Levels built at import besides the full mesh
+	u32 levelCount;
+	f32 triangleRatio[MAX_MODEL_LODS - 1]; // fraction of the triangles to keep
+	f32 maxError[MAX_MODEL_LODS - 1];      // relative to the model radius
+
+	// Selection
+	bool enabled;
+	f32 pixelError; // largest error allowed on screen
+	f32 hysteresis; // a coarser level is only taken below (1 - hysteresis) * pixelError
+};
+
+struct LodStats
+{
+	u32 fullTriangles;
+	u32 drawnTriangles;
+	u32 entitiesPerLevel[MAX_MODEL_LODS];
+};
+
+// Size of each page of the uniform ring
+#define UNIFORM_PAGE_SIZE (u32)MB(1)
+
+struct AsyncLoader;
+struct IndirectRenderer;
+struct GpuCuller;
+
+struct StreamingSettings
+{
+	// What the main thread may upload per frame, at least one load goes through every frame
+	u32 uploadBudgetBytes;
+	f32 uploadBudgetMs;
+};
+
+#define STREAMING_FRAME_HISTORY 256
+
+struct StreamingStats
+{
+	f64 initStartTime;
+	f64 timeToFirstFrameMs; // from the start of Init to the first Update
+	f64 timeToResidentMs;   // from the start of Init until the last pending load was uploaded
+
+	u32 pendingLoads;       // requested and not uploaded yet
+	u32 completedLoads;     // waiting for upload budget
+	u32 uploadedLoads;
+	u64 uploadedBytes;
+
+	// Per frame, to spot the spikes while streaming
+	u32 frameCount;
+	f32 frameMs[STREAMING_FRAME_HISTORY];
+	f32 uploadMs[STREAMING_FRAME_HISTORY];
+	f32 maxStreamingFrameMs;
+	f32 maxUploadMs;
+};
+
 struct App
 {
 	// Loop
@@ -207,9 +534,45 @@ struct App
 	std::vector<Entity>   entities;
 	std::vector<Light>    lights;
 
+	// Worker threads for loading and processing
+	ThreadPool* threadPool;
+
+	// Asynchronous loads and their upload budget
+	AsyncLoader* asyncLoader;
+	StreamingSettings streamingSettings;
+	StreamingStats streamingStats;
+
+	// File I/O from the start of Init until everything it requested was resident
+	AssetIoStats startupIoStats;
+	bool startupIoCaptured;
+
+	// Vertices and indices of every mesh, in a few buffers shared by all of them
+	GeometryHeap geometryHeap;
+
+	// Vertices of the meshes added from now on are quantized in the VBO
+	VertexQuantization vertexQuantization;
+
+	// Textures are block compressed at import time
+	bool compressTextures;
+	bool supportsS3TC;
+	MipFilter mipFilter;
+
+	// Loaded assets by path and by contents
+	AssetRegistry assets;
+
+	// Loading statistics
+	std::vector<ModelLoadTiming> modelLoadTimings;
+
+	// Results of the last benchmarks run from the Benchmarks window
+	std::vector<std::string> benchmarkLog;
+
 	// program indices
 	u32 texturedGeometryProgramIdx;
 	u32 texturedMeshProgramIdx;
+	u32 indirectMeshProgramIdx;
+	u32 culledMeshProgramIdx;
+	u32 gpuCullingProgramIdx;
+	u32 depthPyramidProgramIdx;
 	u32 deferredProgramIdx;
 
 	// texture indices
@@ -221,6 +584,7 @@ struct App
 	u32 patrickTexIdx;
 
 	// model indices
+	u32 proxyModel; // drawn in place of the models that are still loading
 	u32 patrickModel;
 	u32 sphere;
 	u32 plane;
@@ -236,8 +600,15 @@ struct App
 	// Location of the texture uniform in the textured quad shader
 	GLuint programUniformTexture;
 	GLuint texturedMeshProgram_uTexture;
+	GLuint indirectMeshProgram_uTexture;
+	GLuint culledMeshProgram_uTexture;
 	GLuint texturedMeshProgram_uNormal;
 	GLuint texturedMeshProgram_uPosition;
+	GLuint texturedMeshProgram_uPositionScale;
+	GLuint texturedMeshProgram_uPositionOffset;
+	GLuint texturedMeshProgram_uTexCoordTransform;
+	GLuint texturedMeshProgram_uOctahedralNormals;
+	GLuint texturedMeshProgram_uTransformIdx;
 	GLuint deferredProgram_uTexture;
 	GLuint deferredProgram_uNormal;
 	GLuint deferredProgram_uAlbedo;
@@ -247,16 +618,96 @@ struct App
 	GLuint vao;
 
 	Camera camera;
-	glm::mat4 worldViewProjectionMatrix;
+	glm::mat4 viewProjectionMatrix;
+
+	// Meshlets outside the frustum or facing away from the camera are skipped when drawing. The
+	// cone test assumes one-sided surfaces, and there is no face culling to hide the back faces,
+	// so it is off by default and only for scenes known to have no double-sided geometry.
+	bool meshletFrustumCulling;
+	bool meshletConeCulling;
+	MeshletCullingStats meshletStats;
+
+	// Meshes are drawn with glMultiDrawElementsIndirect in buckets, or one call per submesh
+	IndirectRenderer* indirectRenderer;
+	bool indirectDraws;
+	f32 meshSubmissionMs; // culling and issuing the draws of the meshes
+
+	// With indirect draws, entities sharing a model and level of detail are grouped each frame
+	// and every submesh of a group is one instanced command
+	bool instancing;
+	u32 minInstances; // smaller groups keep the culling of their meshlets
+	InstancingStats instancingStats;
+
+	// Entities culled and given their level of detail by a compute shader, which writes the draw
+	// commands. The batches it fills are built again when the scene changes.
+	GpuCuller* gpuCuller;
+	bool gpuCulling;
+	bool gpuCullingVerify;
+	u64 gpuCullingSceneKey;
+	u32 sceneVersion; // changed when the entities are replaced
+
+	// In the G-buffer modes, the culling shader also drops the entities behind a pyramid of the
+	// farthest depth (Hi-Z) of the ones visible last frame, drawn first (see GpuCullingPhase)
+	bool hiZCulling;
+	DepthPyramid depthPyramid;
+	GpuTimeline gbufferTimeline;
+	bool gbufferTimelineHiZ[GPU_TIMELINE_LATENCY]; // of each frame in flight
+	HiZStats hiZStats;
+
+	// Entities outside the frustum are dropped in Update with SIMD tests of their world boxes,
+	// kept as a structure of arrays, and the render loop only walks the visible list
+	bool entityFrustumCulling;
+	CullingBoxes entityBoxes;
+	u64 entityBoxesKey; // the models their bounds were taken from
+	std::vector<u32> visibleEntities;
+	EntityCullingStats entityCullingStats;
+	std::vector<u32> movedEntities; // whose box was computed again this frame
+
+	// Hierarchy over the same boxes, built when the entities are replaced and refitted as they
+	// move. It can do the frustum culling, and picks the entity under the mouse on a left click.
+	// With GPU culling it is not kept up to date, only built again when a click needs it.
+	Bvh entityBvh;
+	u64 entityBvhKey;
+	bool entityBvhCulling;
+	EntityBvhStats entityBvhStats;
+	u32 pickedEntity; // BVH_INVALID for none
+	f32 pickedDistance;
+	f32 neighbourRadius;
+	std::vector<u32> neighbourEntities; // whose box overlaps a sphere around the picked one
+
+	// The largest visible entities are rasterized on the CPU with the coarsest level of their
+	// model that stays within a pixel of the full mesh, and the entities whose box is behind
+	// them are dropped from the visible list too
+	OcclusionSettings occlusionSettings;
+	OcclusionBuffer occlusionBuffer;
+	OcclusionCullingStats occlusionStats;
+	std::vector<std::vector<vec3>> occluderTriangles; // of each mesh, built the first time it occludes
+	bool occlusionDebugView;
+	GLuint occlusionDebugTexture;
+
+	LodSettings lodSettings;
+	LodStats lodStats;
 
 	// buffers
-	Buffer uniformBuffer;
+	RingBuffer uniformRing;
 	GLint uniformBlockAlignment;
 	GLint maxUniformBufferSize;
 
+	GLuint globalParamsBuffer;
 	u32 globalParamsOffset;
 	u32 globalParamsSize;
 
+	// World matrices of the entities, in their order, kept on the GPU. Only the matrices of new,
+	// dirty and dynamic entities are written, shaders multiply them by the view projection.
+	GLuint transformBuffer;
+	u32 transformCapacity; // matrices
+	u32 transformCount;    // entities with their matrix uploaded
+	std::vector<glm::mat4> transformStaging;
+	std::vector<u32> transformUploads; // entities written this frame, in order
+	std::vector<u32> dirtyEntities;    // static entities moved since the last update
+	std::vector<u32> dynamicEntities;  // written every frame
+	FrameUploadStats uploadStats;
+
 	// framebuffers
 	GLuint scene_attachmentHandle;
 	GLuint albedoAO_attachmentHandle;
@@ -269,8 +720,104 @@ struct App
 
 };
 
+Image LoadImage(const char* filename);
+
+void FreeImage(Image image);
+
+u32 LoadTexture2D(App* app, const char* filepath, TextureUsage usage = TextureUsage_Color);
+
+/**
+ * Returns a texture right away, which is a copy of the magenta texture until the file has been
+ * decoded in a worker thread and uploaded within the streaming budget.
+ */
+u32 LoadTexture2DAsync(App* app, const char* filepath, TextureUsage usage = TextureUsage_Color);
+
+/**
+ * Loads a batch of textures into material slots. The images are decoded (and compressed if
+ * they have no up to date compressed container) in parallel in the worker threads, and
+ * uploaded to OpenGL by the calling thread as soon as each one is ready.
+ */
+void LoadTextures2D(App* app, const std::vector<TextureRequest>& requests);
+
+// Assimp post processing of the imported models
+#define LOAD_MODEL_POSTPROCESS_FLAGS   \
+	(aiProcess_Triangulate |            \
+	aiProcess_GenSmoothNormals |        \
+	aiProcess_CalcTangentSpace |        \
+	aiProcess_JoinIdenticalVertices |   \
+	aiProcess_PreTransformVertices |    \
+	aiProcess_OptimizeMeshes |          \
+	aiProcess_SortByPType)
+
+/**
+ * CPU half of adding a mesh, safe in any thread: optimizes the submeshes that have no meshlets
+ * yet, quantizes the vertices and lays out the contents of the vertex and index buffers.
+ */
+void PrepareMesh(ThreadPool* pool, VertexQuantization quantization, PreparedMesh& prepared);
+
+/**
+ * Uploads a prepared mesh and adds it to the app, unless an identical mesh is already loaded,
+ * in which case its index is returned. The buffer contents are released.
+ */
+u32 UploadMesh(App* app, PreparedMesh& prepared);
+
+/**
+ * Compacts the geometry heap and updates where every submesh is in it.
+ */
+void DefragmentGeometry(App* app);
+
+/**
+ * Uploads the matrix of every entity again on the next update, after the entities are replaced.
+ */
+void InvalidateTransforms(App* app);
+
+/**
+ * Moves an entity. Static entities are marked dirty so the next update uploads the matrix and
+ * refits their culling box, writing worldMatrix directly never reaches the GPU.
+ */
+void SetEntityWorldMatrix(App* app, u32 entityIdx, const glm::mat4& worldMatrix);
+
+/**
+ * Makes an entity dynamic, uploaded every frame, or static again. Updates only visit the
+ * dynamic and dirty entities, so the flag must not be written directly once uploaded.
+ */
+void SetEntityDynamic(App* app, u32 entityIdx, bool dynamic);
+
+/**
+ * Prepares the full mesh of the model and builds its levels of detail, models read from the
+ * mesh cache already are. Safe in any thread.
+ */
+void PrepareModelData(ThreadPool* pool, VertexQuantization quantization, const LodSettings& lodSettings, ModelData& data);
+
+/**
+ * Reads the model from its mesh cache, or imports it (native OBJ parser, then Assimp) and
+ * bakes the cache, and prepares it. Safe in any thread, returns false if it cannot be read.
+ */
+bool LoadModelData(ThreadPool* pool, const char* filename, VertexQuantization quantization, const LodSettings& lodSettings, ModelData& data);
+
+/**
+ * Moves a prepared model into app->models[modelIdx]: adds its materials, loads their textures
+ * (asynchronously or right away) and uploads its meshes.
+ */
+void CommitModelData(App* app, ModelData& data, u32 modelIdx, bool asyncTextures);
+
+u32 LoadModel(App* app, const char* filename);
+
+/**
+ * Returns a model right away, drawn as app->proxyModel until the file has been loaded in a
+ * worker thread and uploaded within the streaming budget.
+ */
+u32 LoadModelAsync(App* app, const char* filename);
+
+/**
+ * Adds the material to the app, or returns an identical material that is already loaded.
+ */
+u32 AddMaterial(App* app, const Material& material);
+
 void Init(App* app);
 
+void Shutdown(App* app);
+
 void Gui(App* app);
 
 void Update(App* app);
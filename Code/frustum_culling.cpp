@@ -0,0 +1,213 @@
+#include "frustum_culling.h"
+#include "buffer_management.h"
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <limits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX
+#else
+#define TARGET_AVX __attribute__((target("avx")))
+#endif
+
+static bool DetectAVX()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+
+	// The OS has to save the AVX registers on context switches
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx") != 0;
+#endif
+}
+
+static const bool UseAVX = DetectAVX();
+
+bool FrustumCullingUsesAVX()
+{
+	return UseAVX;
+}
+
+static inline u32 CountTrailingZeros(u32 mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (u32)index;
+#else
+	return (u32)__builtin_ctz(mask);
+#endif
+}
+
+void ResizeCullingBoxes(CullingBoxes& boxes, u32 count)
+{
+	u32 capacity = Align(count, CULLING_BOX_PADDING);
+	boxes.count = count;
+	boxes.centerX.resize(capacity, 0.0f);
+	boxes.centerY.resize(capacity, 0.0f);
+	boxes.centerZ.resize(capacity, 0.0f);
+	boxes.extentX.resize(capacity, 0.0f);
+	boxes.extentY.resize(capacity, 0.0f);
+	boxes.extentZ.resize(capacity, 0.0f);
+
+	// Padding boxes have a NaN center, which fails the ordered comparisons of every kernel.
+	// Written again on every resize, as a shrink leaves real boxes past the count.
+	const f32 nan = std::numeric_limits<f32>::quiet_NaN();
+	for (u32 i = count; i < capacity; ++i)
+	{
+		boxes.centerX[i] = nan;
+		boxes.centerY[i] = nan;
+		boxes.centerZ[i] = nan;
+		boxes.extentX[i] = 0.0f;
+		boxes.extentY[i] = 0.0f;
+		boxes.extentZ[i] = 0.0f;
+	}
+}
+
+void SetCullingBox(CullingBoxes& boxes, u32 index, glm::vec3 aabbMin, glm::vec3 aabbMax, const glm::mat4& worldMatrix)
+{
+	// The extent along each world axis is the sum of the model extents projected on it (Arvo)
+	glm::vec3 center = glm::vec3(worldMatrix * glm::vec4((aabbMin + aabbMax) * 0.5f, 1.0f));
+	glm::vec3 extent = (aabbMax - aabbMin) * 0.5f;
+	glm::mat3 absolute = glm::mat3(glm::abs(glm::vec3(worldMatrix[0])), glm::abs(glm::vec3(worldMatrix[1])), glm::abs(glm::vec3(worldMatrix[2])));
+	glm::vec3 worldExtent = absolute * extent;
+
+	boxes.centerX[index] = center.x;
+	boxes.centerY[index] = center.y;
+	boxes.centerZ[index] = center.z;
+	boxes.extentX[index] = worldExtent.x;
+	boxes.extentY[index] = worldExtent.y;
+	boxes.extentZ[index] = worldExtent.z;
+}
+
+// A box is outside when it is fully behind a plane: the distance of its center is below minus
+// its extent projected on the normal. The kernels compute both in the same order.
+static u32 CullBoxesScalar(const CullingBoxes& boxes, const glm::vec4* planes, u32* visible)
+{
+	u32 visibleCount = 0;
+	for (u32 i = 0; i < boxes.count; ++i)
+	{
+		bool inside = true;
+		for (u32 p = 0; p < 6; ++p)
+		{
+			const glm::vec4& plane = planes[p];
+			f32 distance = plane.x * boxes.centerX[i] + plane.y * boxes.centerY[i] + plane.z * boxes.centerZ[i] + plane.w;
+			f32 radius = fabsf(plane.x) * boxes.extentX[i] + fabsf(plane.y) * boxes.extentY[i] + fabsf(plane.z) * boxes.extentZ[i];
+			inside = inside && distance + radius >= 0.0f;
+		}
+		if (inside)
+			visible[visibleCount++] = i;
+	}
+	return visibleCount;
+}
+
+// Lanes with a set bit go to the visible list, in order
+static inline u32 AppendVisible(u32 mask, u32 base, u32* visible, u32 visibleCount)
+{
+	while (mask)
+	{
+		visible[visibleCount++] = base + CountTrailingZeros(mask);
+		mask &= mask - 1;
+	}
+	return visibleCount;
+}
+
+static u32 CullBoxesSSE(const CullingBoxes& boxes, const glm::vec4* planes, u32* visible)
+{
+	__m128 normalX[6], normalY[6], normalZ[6], distance[6], absX[6], absY[6], absZ[6];
+	for (u32 p = 0; p < 6; ++p)
+	{
+		normalX[p] = _mm_set1_ps(planes[p].x);
+		normalY[p] = _mm_set1_ps(planes[p].y);
+		normalZ[p] = _mm_set1_ps(planes[p].z);
+		distance[p] = _mm_set1_ps(planes[p].w);
+		absX[p] = _mm_set1_ps(fabsf(planes[p].x));
+		absY[p] = _mm_set1_ps(fabsf(planes[p].y));
+		absZ[p] = _mm_set1_ps(fabsf(planes[p].z));
+	}
+	const __m128 zero = _mm_setzero_ps();
+
+	// The last group may run into the padding
+	u32 visibleCount = 0;
+	const u32 end = Align(boxes.count, 4);
+	for (u32 i = 0; i < end; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&boxes.centerX[i]);
+		__m128 cy = _mm_loadu_ps(&boxes.centerY[i]);
+		__m128 cz = _mm_loadu_ps(&boxes.centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&boxes.extentX[i]);
+		__m128 ey = _mm_loadu_ps(&boxes.extentY[i]);
+		__m128 ez = _mm_loadu_ps(&boxes.extentZ[i]);
+
+		__m128 inside = _mm_cmpeq_ps(zero, zero);
+		for (u32 p = 0; p < 6; ++p)
+		{
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX[p], cx), _mm_mul_ps(normalY[p], cy)), _mm_mul_ps(normalZ[p], cz)), distance[p]);
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absX[p], ex), _mm_mul_ps(absY[p], ey)), _mm_mul_ps(absZ[p], ez));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), zero));
+		}
+
+		visibleCount = AppendVisible((u32)_mm_movemask_ps(inside), i, visible, visibleCount);
+	}
+	return visibleCount;
+}
+
+TARGET_AVX
+static u32 CullBoxesAVX(const CullingBoxes& boxes, const glm::vec4* planes, u32* visible)
+{
+	__m256 normalX[6], normalY[6], normalZ[6], distance[6], absX[6], absY[6], absZ[6];
+	for (u32 p = 0; p < 6; ++p)
+	{
+		normalX[p] = _mm256_set1_ps(planes[p].x);
+		normalY[p] = _mm256_set1_ps(planes[p].y);
+		normalZ[p] = _mm256_set1_ps(planes[p].z);
+		distance[p] = _mm256_set1_ps(planes[p].w);
+		absX[p] = _mm256_set1_ps(fabsf(planes[p].x));
+		absY[p] = _mm256_set1_ps(fabsf(planes[p].y));
+		absZ[p] = _mm256_set1_ps(fabsf(planes[p].z));
+	}
+	const __m256 zero = _mm256_setzero_ps();
+
+	u32 visibleCount = 0;
+	const u32 end = Align(boxes.count, 8);
+	for (u32 i = 0; i < end; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(&boxes.centerX[i]);
+		__m256 cy = _mm256_loadu_ps(&boxes.centerY[i]);
+		__m256 cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+		__m256 ex = _mm256_loadu_ps(&boxes.extentX[i]);
+		__m256 ey = _mm256_loadu_ps(&boxes.extentY[i]);
+		__m256 ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (u32 p = 0; p < 6; ++p)
+		{
+			__m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(normalX[p], cx), _mm256_mul_ps(normalY[p], cy)), _mm256_mul_ps(normalZ[p], cz)), distance[p]);
+			__m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absX[p], ex), _mm256_mul_ps(absY[p], ey)), _mm256_mul_ps(absZ[p], ez));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), zero, _CMP_GE_OQ));
+		}
+
+		visibleCount = AppendVisible((u32)_mm256_movemask_ps(inside), i, visible, visibleCount);
+	}
+	return visibleCount;
+}
+
+u32 CullBoxes(const CullingBoxes& boxes, const glm::vec4* planes, u32* visible, CullingKernel kernel)
+{
+	if (kernel == CullingKernel_Best)
+		kernel = UseAVX ? CullingKernel_AVX : CullingKernel_SSE;
+	if (kernel == CullingKernel_AVX && !UseAVX)
+		kernel = CullingKernel_SSE;
+
+	if (kernel == CullingKernel_AVX)
+		return CullBoxesAVX(boxes, planes, visible);
+	if (kernel == CullingKernel_SSE)
+		return CullBoxesSSE(boxes, planes, visible);
+	return CullBoxesScalar(boxes, planes, visible);
+}
@@ -0,0 +1,49 @@
+//
+// frustum_culling.h: Culling of the entities against the frustum on the CPU. The world space
+// boxes of the entities are kept as a structure of arrays, so they are tested 4 at a time with
+// SSE or 8 at a time with AVX, and the visible ones come out as a compact list of indices.
+//
+
+#pragma once
+
+#include "platform.h"
+
+// Every array has room for a multiple of this many boxes, so the SIMD kernels read whole groups
+// and need no scalar tail. The boxes past the count are padding that is never visible.
+#define CULLING_BOX_PADDING 8
+
+enum CullingKernel
+{
+	CullingKernel_Scalar,
+	CullingKernel_SSE,
+	CullingKernel_AVX,
+	CullingKernel_Best // AVX when the CPU has it, SSE otherwise
+};
+
+// Axis aligned boxes in world space, by center and half extent
+struct CullingBoxes
+{
+	u32 count;
+	std::vector<f32> centerX;
+	std::vector<f32> centerY;
+	std::vector<f32> centerZ;
+	std::vector<f32> extentX;
+	std::vector<f32> extentY;
+	std::vector<f32> extentZ;
+};
+
+void ResizeCullingBoxes(CullingBoxes& boxes, u32 count);
+
+/**
+ * Stores the smallest axis aligned box holding the model space box transformed by the matrix.
+ */
+void SetCullingBox(CullingBoxes& boxes, u32 index, glm::vec3 aabbMin, glm::vec3 aabbMax, const glm::mat4& worldMatrix);
+
+/**
+ * Writes the indices of the boxes inside or crossing the 6 planes (xyz normal pointing inside,
+ * w distance) to visible, which needs room for every box, and returns how many there are. Every
+ * kernel gives the same result.
+ */
+u32 CullBoxes(const CullingBoxes& boxes, const glm::vec4* planes, u32* visible, CullingKernel kernel = CullingKernel_Best);
+
+bool FrustumCullingUsesAVX();
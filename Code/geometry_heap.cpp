@@ -0,0 +1,525 @@
+#include "geometry_heap.h"
+#include <algorithm>
+
+static u32 HighestBit(u32 value)
+{
+	u32 bit = 0;
+	while (value >>= 1)
+		bit++;
+	return bit;
+}
+
+static u32 LowestBit(u64 value)
+{
+	u32 bit = 0;
+	while (!(value & 1))
+	{
+		value >>= 1;
+		bit++;
+	}
+	return bit;
+}
+
+// Sizes below the second level count have a bin each, larger ones share 8 bins per power of 2.
+// Free blocks go to the bin of their size rounded down, allocations look from the bin of their
+// size rounded up so any block found is large enough.
+static u32 GetBin(u32 size, bool roundUp)
+{
+	if (size < OFFSET_ALLOCATOR_SL_COUNT)
+		return size;
+
+	u32 shift = HighestBit(size) - OFFSET_ALLOCATOR_SL_BITS;
+	u32 bin = ((shift + 1) << OFFSET_ALLOCATOR_SL_BITS) | ((size >> shift) & (OFFSET_ALLOCATOR_SL_COUNT - 1));
+	if (roundUp && (size & ((1u << shift) - 1)))
+		bin++;
+	return bin;
+}
+
+static u32 FindFreeBin(const OffsetAllocator& allocator, u32 bin)
+{
+	for (u32 word = bin / 64; word < OFFSET_ALLOCATOR_BINS / 64; ++word)
+	{
+		u64 mask = allocator.binMask[word];
+		if (word == bin / 64)
+			mask &= ~0ull << (bin % 64);
+		if (mask)
+			return word * 64 + LowestBit(mask);
+	}
+	return OFFSET_ALLOCATOR_NONE;
+}
+
+static u32 NewNode(OffsetAllocator& allocator, u32 offset, u32 size)
+{
+	u32 nodeIdx;
+	if (!allocator.unusedNodes.empty())
+	{
+		nodeIdx = allocator.unusedNodes.back();
+		allocator.unusedNodes.pop_back();
+	}
+	else
+	{
+		nodeIdx = (u32)allocator.nodes.size();
+		allocator.nodes.emplace_back();
+	}
+
+	OffsetAllocatorNode& node = allocator.nodes[nodeIdx];
+	node.offset = offset;
+	node.size = size;
+	node.prevPhysical = OFFSET_ALLOCATOR_NONE;
+	node.nextPhysical = OFFSET_ALLOCATOR_NONE;
+	node.prevFree = OFFSET_ALLOCATOR_NONE;
+	node.nextFree = OFFSET_ALLOCATOR_NONE;
+	node.used = false;
+	return nodeIdx;
+}
+
+static void InsertFree(OffsetAllocator& allocator, u32 nodeIdx)
+{
+	OffsetAllocatorNode& node = allocator.nodes[nodeIdx];
+	u32 bin = GetBin(node.size, false);
+
+	node.used = false;
+	node.prevFree = OFFSET_ALLOCATOR_NONE;
+	node.nextFree = allocator.binHeads[bin];
+	if (node.nextFree != OFFSET_ALLOCATOR_NONE)
+		allocator.nodes[node.nextFree].prevFree = nodeIdx;
+
+	allocator.binHeads[bin] = nodeIdx;
+	allocator.binMask[bin / 64] |= 1ull << (bin % 64);
+}
+
+static void RemoveFree(OffsetAllocator& allocator, u32 nodeIdx)
+{
+	OffsetAllocatorNode& node = allocator.nodes[nodeIdx];
+	u32 bin = GetBin(node.size, false);
+
+	if (node.prevFree != OFFSET_ALLOCATOR_NONE)
+		allocator.nodes[node.prevFree].nextFree = node.nextFree;
+	else
+		allocator.binHeads[bin] = node.nextFree;
+
+	if (node.nextFree != OFFSET_ALLOCATOR_NONE)
+		allocator.nodes[node.nextFree].prevFree = node.prevFree;
+
+	if (allocator.binHeads[bin] == OFFSET_ALLOCATOR_NONE)
+		allocator.binMask[bin / 64] &= ~(1ull << (bin % 64));
+}
+
+void InitOffsetAllocator(OffsetAllocator& allocator, u32 capacity)
+{
+	allocator.capacity = capacity;
+	allocator.freeSize = capacity;
+	allocator.nodes.clear();
+	allocator.unusedNodes.clear();
+	for (u32 i = 0; i < OFFSET_ALLOCATOR_BINS; ++i)
+		allocator.binHeads[i] = OFFSET_ALLOCATOR_NONE;
+	for (u32 i = 0; i < OFFSET_ALLOCATOR_BINS / 64; ++i)
+		allocator.binMask[i] = 0;
+
+	allocator.lastNode = NewNode(allocator, 0, capacity);
+	InsertFree(allocator, allocator.lastNode);
+}
+
+u32 AllocateOffset(OffsetAllocator& allocator, u32 size)
+{
+	size = glm::max(size, 1u);
+
+	u32 bin = GetBin(size, true);
+	if (bin >= OFFSET_ALLOCATOR_BINS)
+		return OFFSET_ALLOCATOR_NONE;
+
+	u32 nodeIdx = OFFSET_ALLOCATOR_NONE;
+	u32 freeBin = FindFreeBin(allocator, bin);
+	if (freeBin != OFFSET_ALLOCATOR_NONE)
+	{
+		nodeIdx = allocator.binHeads[freeBin];
+	}
+	else
+	{
+		// Blocks in the bin of the size itself may still be large enough, as when the free space
+		// at the end was just grown to fit the allocation
+		u32 sizeBin = GetBin(size, false);
+		for (u32 i = allocator.binHeads[sizeBin]; i != OFFSET_ALLOCATOR_NONE; i = allocator.nodes[i].nextFree)
+		{
+			if (allocator.nodes[i].size >= size)
+			{
+				nodeIdx = i;
+				break;
+			}
+		}
+	}
+
+	if (nodeIdx == OFFSET_ALLOCATOR_NONE)
+		return OFFSET_ALLOCATOR_NONE;
+
+	RemoveFree(allocator, nodeIdx);
+
+	// The rest of the block stays free, right after the allocation
+	u32 remainder = allocator.nodes[nodeIdx].size - size;
+	if (remainder > 0)
+	{
+		u32 restIdx = NewNode(allocator, allocator.nodes[nodeIdx].offset + size, remainder);
+		OffsetAllocatorNode& node = allocator.nodes[nodeIdx];
+		OffsetAllocatorNode& rest = allocator.nodes[restIdx];
+
+		rest.prevPhysical = nodeIdx;
+		rest.nextPhysical = node.nextPhysical;
+		if (node.nextPhysical != OFFSET_ALLOCATOR_NONE)
+			allocator.nodes[node.nextPhysical].prevPhysical = restIdx;
+		else
+			allocator.lastNode = restIdx;
+		node.nextPhysical = restIdx;
+		node.size = size;
+
+		InsertFree(allocator, restIdx);
+	}
+
+	allocator.nodes[nodeIdx].used = true;
+	allocator.freeSize -= size;
+	return nodeIdx;
+}
+
+void FreeOffset(OffsetAllocator& allocator, u32 nodeIdx)
+{
+	ASSERT(allocator.nodes[nodeIdx].used, "The block was already freed");
+	allocator.freeSize += allocator.nodes[nodeIdx].size;
+
+	// Merge with the free neighbours, the merged block keeps the id of the freed one
+	u32 prevIdx = allocator.nodes[nodeIdx].prevPhysical;
+	if (prevIdx != OFFSET_ALLOCATOR_NONE && !allocator.nodes[prevIdx].used)
+	{
+		RemoveFree(allocator, prevIdx);
+		OffsetAllocatorNode& prev = allocator.nodes[prevIdx];
+		OffsetAllocatorNode& node = allocator.nodes[nodeIdx];
+
+		node.offset = prev.offset;
+		node.size += prev.size;
+		node.prevPhysical = prev.prevPhysical;
+		if (prev.prevPhysical != OFFSET_ALLOCATOR_NONE)
+			allocator.nodes[prev.prevPhysical].nextPhysical = nodeIdx;
+		allocator.unusedNodes.push_back(prevIdx);
+	}
+
+	u32 nextIdx = allocator.nodes[nodeIdx].nextPhysical;
+	if (nextIdx != OFFSET_ALLOCATOR_NONE && !allocator.nodes[nextIdx].used)
+	{
+		RemoveFree(allocator, nextIdx);
+		OffsetAllocatorNode& next = allocator.nodes[nextIdx];
+		OffsetAllocatorNode& node = allocator.nodes[nodeIdx];
+
+		node.size += next.size;
+		node.nextPhysical = next.nextPhysical;
+		if (next.nextPhysical != OFFSET_ALLOCATOR_NONE)
+			allocator.nodes[next.nextPhysical].prevPhysical = nodeIdx;
+		else
+			allocator.lastNode = nodeIdx;
+		allocator.unusedNodes.push_back(nextIdx);
+	}
+
+	InsertFree(allocator, nodeIdx);
+}
+
+void GrowOffsetAllocator(OffsetAllocator& allocator, u32 newCapacity)
+{
+	ASSERT(newCapacity >= allocator.capacity, "Allocators only grow");
+	u32 extra = newCapacity - allocator.capacity;
+	if (extra == 0)
+		return;
+
+	u32 lastIdx = allocator.lastNode;
+	if (!allocator.nodes[lastIdx].used)
+	{
+		RemoveFree(allocator, lastIdx);
+		allocator.nodes[lastIdx].size += extra;
+		InsertFree(allocator, lastIdx);
+	}
+	else
+	{
+		u32 tailIdx = NewNode(allocator, allocator.capacity, extra);
+		allocator.nodes[tailIdx].prevPhysical = lastIdx;
+		allocator.nodes[lastIdx].nextPhysical = tailIdx;
+		allocator.lastNode = tailIdx;
+		InsertFree(allocator, tailIdx);
+	}
+
+	allocator.capacity = newCapacity;
+	allocator.freeSize += extra;
+}
+
+void CompactOffsetAllocator(OffsetAllocator& allocator, std::vector<OffsetMove>& moves)
+{
+	moves.clear();
+
+	// Used blocks in offset order, walking back from the last one
+	std::vector<u32> used;
+	for (u32 nodeIdx = allocator.lastNode; nodeIdx != OFFSET_ALLOCATOR_NONE; nodeIdx = allocator.nodes[nodeIdx].prevPhysical)
+	{
+		if (allocator.nodes[nodeIdx].used)
+			used.push_back(nodeIdx);
+		else
+			allocator.unusedNodes.push_back(nodeIdx);
+	}
+	std::reverse(used.begin(), used.end());
+
+	for (u32 i = 0; i < OFFSET_ALLOCATOR_BINS; ++i)
+		allocator.binHeads[i] = OFFSET_ALLOCATOR_NONE;
+	for (u32 i = 0; i < OFFSET_ALLOCATOR_BINS / 64; ++i)
+		allocator.binMask[i] = 0;
+
+	u32 offset = 0;
+	u32 prevIdx = OFFSET_ALLOCATOR_NONE;
+	for (u32 nodeIdx : used)
+	{
+		OffsetAllocatorNode& node = allocator.nodes[nodeIdx];
+		if (node.offset != offset)
+			moves.push_back({ node.offset, offset, node.size });
+
+		node.offset = offset;
+		node.prevPhysical = prevIdx;
+		node.nextPhysical = OFFSET_ALLOCATOR_NONE;
+		if (prevIdx != OFFSET_ALLOCATOR_NONE)
+			allocator.nodes[prevIdx].nextPhysical = nodeIdx;
+
+		offset += node.size;
+		prevIdx = nodeIdx;
+	}
+
+	allocator.lastNode = prevIdx;
+	if (offset < allocator.capacity)
+	{
+		u32 tailIdx = NewNode(allocator, offset, allocator.capacity - offset);
+		allocator.nodes[tailIdx].prevPhysical = prevIdx;
+		if (prevIdx != OFFSET_ALLOCATOR_NONE)
+			allocator.nodes[prevIdx].nextPhysical = tailIdx;
+		allocator.lastNode = tailIdx;
+		InsertFree(allocator, tailIdx);
+	}
+}
+
+// Arena buffers are only bound to the copy targets, which no vertex array keeps
+static GLuint CreateArenaBuffer(u64 size)
+{
+	GLuint handle = 0;
+	glGenBuffers(1, &handle);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, handle);
+	glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return handle;
+}
+
+static void InitArena(GeometryArena& arena, u32 unitSize, u64 layoutKey, u32 capacityBytes)
+{
+	arena.unitSize = unitSize;
+	arena.layoutKey = layoutKey;
+	InitOffsetAllocator(arena.allocator, glm::max(capacityBytes / unitSize, 1u));
+	arena.handle = CreateArenaBuffer((u64)arena.allocator.capacity * unitSize);
+}
+
+static void DeleteArenaVaos(GeometryArena& arena)
+{
+	for (const Vao& vao : arena.vaos)
+		glDeleteVertexArrays(1, &vao.handle);
+	arena.vaos.clear();
+}
+
+// The buffer of the arena is replaced, the vertex arrays that point to it have to go
+static void InvalidateArenaVaos(GeometryHeap& heap, u32 arenaIdx)
+{
+	if (arenaIdx != GEOMETRY_INDEX_ARENA)
+	{
+		DeleteArenaVaos(heap.vertexArenas[arenaIdx]);
+		return;
+	}
+
+	// Every vertex array reads the index arena
+	for (GeometryArena& arena : heap.vertexArenas)
+		DeleteArenaVaos(arena);
+}
+
+static void GrowArena(GeometryHeap& heap, u32 arenaIdx, u32 minExtraUnits)
+{
+	GeometryArena& arena = GetGeometryArena(heap, arenaIdx);
+	OffsetAllocator& allocator = arena.allocator;
+
+	u64 newCapacity = glm::max((u64)allocator.capacity * 2, (u64)allocator.capacity + minExtraUnits);
+	newCapacity = glm::min(newCapacity, (u64)UINT32_MAX / arena.unitSize);
+	ASSERT(newCapacity - allocator.capacity >= minExtraUnits, "The geometry arena cannot grow any more");
+
+	u64 oldBytes = (u64)allocator.capacity * arena.unitSize;
+	GLuint handle = CreateArenaBuffer(newCapacity * arena.unitSize);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, arena.handle);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, handle);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldBytes);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &arena.handle);
+
+	arena.handle = handle;
+	GrowOffsetAllocator(allocator, (u32)newCapacity);
+	InvalidateArenaVaos(heap, arenaIdx);
+
+	heap.stats.grows++;
+	heap.stats.bytesMoved += oldBytes;
+}
+
+static void DefragmentArena(GeometryHeap& heap, u32 arenaIdx)
+{
+	GeometryArena& arena = GetGeometryArena(heap, arenaIdx);
+
+	std::vector<OffsetMove> moves;
+	CompactOffsetAllocator(arena.allocator, moves);
+	if (moves.empty())
+		return;
+
+	// Blocks only move down, but ranges in the same buffer may overlap, so copy to a new one
+	GLuint handle = CreateArenaBuffer((u64)arena.allocator.capacity * arena.unitSize);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, arena.handle);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, handle);
+
+	u32 end = 0; // units already in place before the first move
+	for (const OffsetMove& move : moves)
+	{
+		if (move.to > end)
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (u64)end * arena.unitSize, (u64)end * arena.unitSize, (u64)(move.to - end) * arena.unitSize);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (u64)move.from * arena.unitSize, (u64)move.to * arena.unitSize, (u64)move.size * arena.unitSize);
+		heap.stats.bytesMoved += (u64)move.size * arena.unitSize;
+		end = move.to + move.size;
+	}
+
+	// Blocks after the last move did not move either, they may follow it
+	u32 usedEnd = arena.allocator.capacity - arena.allocator.freeSize;
+	if (usedEnd > end)
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (u64)end * arena.unitSize, (u64)end * arena.unitSize, (u64)(usedEnd - end) * arena.unitSize);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	glDeleteBuffers(1, &arena.handle);
+
+	arena.handle = handle;
+	InvalidateArenaVaos(heap, arenaIdx);
+}
+
+void InitGeometryHeap(GeometryHeap& heap, u32 vertexArenaBytes, u32 indexArenaBytes)
+{
+	heap.vertexArenaBytes = vertexArenaBytes;
+	heap.vertexArenas.clear();
+	heap.stats = {};
+	InitArena(heap.indices, 1, 0, (indexArenaBytes + GEOMETRY_INDEX_ALIGNMENT - 1) & ~(GEOMETRY_INDEX_ALIGNMENT - 1));
+}
+
+void DestroyGeometryHeap(GeometryHeap& heap)
+{
+	for (GeometryArena& arena : heap.vertexArenas)
+	{
+		DeleteArenaVaos(arena);
+		glDeleteBuffers(1, &arena.handle);
+	}
+	glDeleteBuffers(1, &heap.indices.handle);
+
+	heap.vertexArenas.clear();
+	heap.indices = {};
+}
+
+u32 FindVertexArena(GeometryHeap& heap, u64 layoutKey, u32 stride)
+{
+	for (u32 i = 0; i < (u32)heap.vertexArenas.size(); ++i)
+		if (heap.vertexArenas[i].layoutKey == layoutKey)
+			return i;
+
+	heap.vertexArenas.emplace_back();
+	InitArena(heap.vertexArenas.back(), stride, layoutKey, heap.vertexArenaBytes);
+	return (u32)heap.vertexArenas.size() - 1;
+}
+
+GeometryArena& GetGeometryArena(GeometryHeap& heap, u32 arena)
+{
+	return arena == GEOMETRY_INDEX_ARENA ? heap.indices : heap.vertexArenas[arena];
+}
+
+GeometryAllocation AllocateGeometry(GeometryHeap& heap, u32 arenaIdx, const void* data, u32 size)
+{
+	u32 unitSize = GetGeometryArena(heap, arenaIdx).unitSize;
+	ASSERT(arenaIdx != GEOMETRY_INDEX_ARENA || size % GEOMETRY_INDEX_ALIGNMENT == 0, "Index ranges keep every allocation aligned");
+
+	GeometryAllocation allocation = {};
+	allocation.arena = arenaIdx;
+	allocation.size = (size + unitSize - 1) / unitSize;
+
+	allocation.node = AllocateOffset(GetGeometryArena(heap, arenaIdx).allocator, allocation.size);
+	if (allocation.node == OFFSET_ALLOCATOR_NONE)
+	{
+		GrowArena(heap, arenaIdx, allocation.size);
+		allocation.node = AllocateOffset(GetGeometryArena(heap, arenaIdx).allocator, allocation.size);
+	}
+
+	GeometryArena& arena = GetGeometryArena(heap, arenaIdx);
+	allocation.offset = arena.allocator.nodes[allocation.node].offset;
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, arena.handle);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, (u64)allocation.offset * unitSize, size, data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	return allocation;
+}
+
+void FreeGeometry(GeometryHeap& heap, GeometryAllocation& allocation)
+{
+	if (allocation.node == OFFSET_ALLOCATOR_NONE)
+		return;
+
+	FreeOffset(GetGeometryArena(heap, allocation.arena).allocator, allocation.node);
+	allocation.node = OFFSET_ALLOCATOR_NONE;
+	allocation.size = 0;
+}
+
+void DefragmentGeometryHeap(GeometryHeap& heap)
+{
+	DefragmentArena(heap, GEOMETRY_INDEX_ARENA);
+	for (u32 i = 0; i < (u32)heap.vertexArenas.size(); ++i)
+		DefragmentArena(heap, i);
+
+	heap.stats.defragmentations++;
+}
+
+void RefreshGeometryAllocation(GeometryHeap& heap, GeometryAllocation& allocation)
+{
+	if (allocation.node != OFFSET_ALLOCATOR_NONE)
+		allocation.offset = GetGeometryArena(heap, allocation.arena).allocator.nodes[allocation.node].offset;
+}
+
+void ReadGeometry(GeometryHeap& heap, const GeometryAllocation& allocation, void* data, u32 size)
+{
+	GeometryArena& arena = GetGeometryArena(heap, allocation.arena);
+	ASSERT(size <= (u64)allocation.size * arena.unitSize, "Reads stay inside the allocation");
+
+	glBindBuffer(GL_COPY_READ_BUFFER, arena.handle);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, (u64)allocation.offset * arena.unitSize, size, data);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+GeometryArenaStats GetGeometryArenaStats(const GeometryArena& arena)
+{
+	const OffsetAllocator& allocator = arena.allocator;
+
+	GeometryArenaStats stats = {};
+	stats.capacityBytes = (u64)allocator.capacity * arena.unitSize;
+	stats.usedBytes = (u64)(allocator.capacity - allocator.freeSize) * arena.unitSize;
+
+	for (u32 nodeIdx = allocator.lastNode; nodeIdx != OFFSET_ALLOCATOR_NONE; nodeIdx = allocator.nodes[nodeIdx].prevPhysical)
+	{
+		const OffsetAllocatorNode& node = allocator.nodes[nodeIdx];
+		if (node.used)
+		{
+			stats.allocations++;
+		}
+		else
+		{
+			stats.freeBlocks++;
+			stats.largestFreeBytes = glm::max(stats.largestFreeBytes, (u64)node.size * arena.unitSize);
+		}
+	}
+
+	return stats;
+}
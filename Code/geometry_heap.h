@@ -0,0 +1,160 @@
+//
+// geometry_heap.h: Vertex and index memory of every mesh, sub-allocated from a few large buffers
+// so meshes are drawn without switching buffers. Vertices go to one arena per vertex layout and
+// are addressed with a base vertex, indices of every layout share one arena.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+#define OFFSET_ALLOCATOR_SL_BITS  3 // 8 bins between two powers of 2
+#define OFFSET_ALLOCATOR_SL_COUNT (1 << OFFSET_ALLOCATOR_SL_BITS)
+#define OFFSET_ALLOCATOR_BINS     256
+#define OFFSET_ALLOCATOR_NONE     UINT32_MAX
+
+struct OffsetAllocatorNode
+{
+	u32 offset;
+	u32 size;
+	u32 prevPhysical; // neighbouring blocks, to merge free ones
+	u32 nextPhysical;
+	u32 prevFree;     // in the list of its bin, while free
+	u32 nextFree;
+	bool used;
+};
+
+/**
+ * Two level segregated fit (TLSF) allocator of ranges in [0, capacity). Free blocks are kept in
+ * bins of sizes spaced like small floats, the first bin with blocks large enough is found with a
+ * bitmask, so allocating and freeing take constant time. Freed blocks merge with their free
+ * neighbours. The allocator only manages offsets, the memory lives elsewhere.
+ */
+struct OffsetAllocator
+{
+	u32 capacity;
+	u32 freeSize;
+	std::vector<OffsetAllocatorNode> nodes;
+	std::vector<u32> unusedNodes;
+	u32 lastNode;     // physically, grown when the capacity grows
+	u32 binHeads[OFFSET_ALLOCATOR_BINS];
+	u64 binMask[OFFSET_ALLOCATOR_BINS / 64];
+};
+
+void InitOffsetAllocator(OffsetAllocator& allocator, u32 capacity);
+
+/**
+ * Returns the node of a block of at least size, or OFFSET_ALLOCATOR_NONE when no free block is
+ * large enough. The node id stays valid until the block is freed.
+ */
+u32 AllocateOffset(OffsetAllocator& allocator, u32 size);
+
+void FreeOffset(OffsetAllocator& allocator, u32 node);
+
+/**
+ * Adds [capacity, newCapacity) as free space at the end.
+ */
+void GrowOffsetAllocator(OffsetAllocator& allocator, u32 newCapacity);
+
+struct OffsetMove
+{
+	u32 from;
+	u32 to;
+	u32 size;
+};
+
+/**
+ * Packs the used blocks at the start, in the same order, and leaves a single free block at the
+ * end. Nodes keep their ids, the moves to apply to the memory are returned in offset order.
+ */
+void CompactOffsetAllocator(OffsetAllocator& allocator, std::vector<OffsetMove>& moves);
+
+struct Vao
+{
+	GLuint handle;
+	GLuint programHandle;
+};
+
+#define GEOMETRY_INDEX_ARENA     UINT32_MAX
+#define GEOMETRY_INDEX_ALIGNMENT 4
+
+// Buffer of a geometry heap, allocated in units of a vertex (or of a byte for the indices)
+struct GeometryArena
+{
+	GLuint handle;
+	u32 unitSize;
+	u64 layoutKey; // of the vertices, every vertex arena has a single layout
+	OffsetAllocator allocator;
+
+	// Vertex arrays reading from the arena, per program. The buffers they point to change when
+	// an arena grows or is defragmented, then they are deleted and created again when needed.
+	std::vector<Vao> vaos;
+};
+
+// Where something was uploaded, offset and size are in units of its arena
+struct GeometryAllocation
+{
+	u32 arena;
+	u32 node;
+	u32 offset;
+	u32 size;
+};
+
+struct GeometryArenaStats
+{
+	u64 capacityBytes;
+	u64 usedBytes;
+	u32 allocations;
+	u32 freeBlocks;
+	u64 largestFreeBytes;
+};
+
+struct GeometryHeapStats
+{
+	u32 grows;
+	u32 defragmentations;
+	u64 bytesMoved; // copied by the GPU when growing and defragmenting
+};
+
+struct GeometryHeap
+{
+	GeometryArena indices;
+	std::vector<GeometryArena> vertexArenas;
+	u32 vertexArenaBytes; // initial size of each new vertex arena
+
+	GeometryHeapStats stats;
+};
+
+void InitGeometryHeap(GeometryHeap& heap, u32 vertexArenaBytes, u32 indexArenaBytes);
+
+void DestroyGeometryHeap(GeometryHeap& heap);
+
+/**
+ * Arena of the vertices with the given layout, created the first time.
+ */
+u32 FindVertexArena(GeometryHeap& heap, u64 layoutKey, u32 stride);
+
+GeometryArena& GetGeometryArena(GeometryHeap& heap, u32 arena);
+
+/**
+ * Allocates room for size bytes in the arena, growing it when it is full, and uploads the data.
+ */
+GeometryAllocation AllocateGeometry(GeometryHeap& heap, u32 arena, const void* data, u32 size);
+
+void FreeGeometry(GeometryHeap& heap, GeometryAllocation& allocation);
+
+/**
+ * Compacts the arenas with more than one free block. Allocations move, so their offsets have to
+ * be read again with RefreshGeometryAllocation.
+ */
+void DefragmentGeometryHeap(GeometryHeap& heap);
+
+void RefreshGeometryAllocation(GeometryHeap& heap, GeometryAllocation& allocation);
+
+/**
+ * Reads the first size bytes of an allocation back from the GPU, waiting for it.
+ */
+void ReadGeometry(GeometryHeap& heap, const GeometryAllocation& allocation, void* data, u32 size);
+
+GeometryArenaStats GetGeometryArenaStats(const GeometryArena& arena);
@@ -0,0 +1,471 @@
+#include "gpu_culling.h"
+#include <string.h>
+#include <algorithm>
+#include <iterator>
+
+// Relative distance to a plane or level threshold under which the CPU and the GPU may disagree
+#define GPU_CULLING_TOLERANCE 1e-4f
+
+// Batches drawn with the same vertex array, texture and index type, in one call
+struct GpuCullingBucket
+{
+	GLuint vao;
+	GLuint texture;
+	GLenum indexType;
+	u32 firstBatch;
+	u32 batchCount;
+};
+
+struct GpuCuller
+{
+	// Written when the scene changes
+	GLuint entityModelBuffer;
+	GLuint modelBuffer;
+	GLuint lodBatchBuffer;
+	GLuint batchDataBuffer;
+	GLuint commandTemplateBuffer; // with no instances, copied over the commands every frame
+
+	// Written by the culling shader every frame, the commands and instances of the late phase
+	// follow the ones of the others
+	GLuint commandBuffer;
+	GLuint instanceBuffer;
+	GLuint visibilityBuffer;
+	GLuint lodBuffer;
+
+	u32 instanceCapacity; // of one phase
+	std::vector<GpuCullingBucket> buckets;
+
+	// What the buffers hold, for the verification
+	std::vector<GpuCullingModel> models;
+	std::vector<u32> entityModels;
+	std::vector<u32> lodBatches;
+	std::vector<DrawElementsIndirectCommand> commands;
+
+	// Levels of the entities after the dispatch that was verified last, for the hysteresis
+	std::vector<u32> verifiedLods;
+	u32 dispatchCount;
+	u32 verifiedDispatch;
+
+	// Uniforms of the culling program, looked up again when it is reloaded
+	GLuint program;
+	GLint uFrustumPlanes;
+	GLint uCameraPosition;
+	GLint uEntityCount;
+	GLint uFrustumCulling;
+	GLint uLods;
+	GLint uPixelsPerUnit;
+	GLint uPixelError;
+	GLint uHysteresis;
+	GLint uPhase;
+	GLint uCommandOffset;
+	GLint uViewProjection;
+	GLint uPyramidSize;
+	GLint uPyramidLevels;
+
+	GpuCullingStats stats;
+};
+
+static void UploadBuffer(GLuint buffer, const void* data, u64 size)
+{
+	glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)size, data, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+GpuCuller* CreateGpuCuller()
+{
+	GpuCuller* culler = new GpuCuller();
+
+	glGenBuffers(1, &culler->entityModelBuffer);
+	glGenBuffers(1, &culler->modelBuffer);
+	glGenBuffers(1, &culler->lodBatchBuffer);
+	glGenBuffers(1, &culler->batchDataBuffer);
+	glGenBuffers(1, &culler->commandTemplateBuffer);
+	glGenBuffers(1, &culler->commandBuffer);
+	glGenBuffers(1, &culler->instanceBuffer);
+	glGenBuffers(1, &culler->visibilityBuffer);
+	glGenBuffers(1, &culler->lodBuffer);
+
+	// Vertex arrays may point to the instances before there is a scene
+	u32 emptyInstance[2] = {};
+	UploadBuffer(culler->instanceBuffer, emptyInstance, sizeof(emptyInstance));
+
+	return culler;
+}
+
+void DestroyGpuCuller(GpuCuller* culler)
+{
+	glDeleteBuffers(1, &culler->entityModelBuffer);
+	glDeleteBuffers(1, &culler->modelBuffer);
+	glDeleteBuffers(1, &culler->lodBatchBuffer);
+	glDeleteBuffers(1, &culler->batchDataBuffer);
+	glDeleteBuffers(1, &culler->commandTemplateBuffer);
+	glDeleteBuffers(1, &culler->commandBuffer);
+	glDeleteBuffers(1, &culler->instanceBuffer);
+	glDeleteBuffers(1, &culler->visibilityBuffer);
+	glDeleteBuffers(1, &culler->lodBuffer);
+	delete culler;
+}
+
+GLuint GetGpuCullingInstanceBuffer(const GpuCuller* culler)
+{
+	return culler->instanceBuffer;
+}
+
+static bool IsSameBucket(const GpuCullingBatch& a, const GpuCullingBatch& b)
+{
+	return a.vao == b.vao && a.texture == b.texture && a.indexType == b.indexType;
+}
+
+void SetGpuCullingScene(GpuCuller* culler, std::vector<GpuCullingBatch>& batches, std::vector<GpuCullingModel>& models, const std::vector<u32>& entityModels)
+{
+	std::stable_sort(batches.begin(), batches.end(), [](const GpuCullingBatch& a, const GpuCullingBatch& b)
+		{
+			if (a.vao != b.vao) return a.vao < b.vao;
+			if (a.texture != b.texture) return a.texture < b.texture;
+			return a.indexType < b.indexType;
+		});
+
+	// Batches of each level of each model, in the order of the levels
+	std::vector<u32> order(batches.size());
+	for (u32 i = 0; i < order.size(); ++i)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&batches](u32 a, u32 b)
+		{
+			if (batches[a].model != batches[b].model) return batches[a].model < batches[b].model;
+			return batches[a].lod < batches[b].lod;
+		});
+
+	for (GpuCullingModel& model : models)
+	{
+		memset(model.lodBatchOffset, 0, sizeof(model.lodBatchOffset));
+		memset(model.lodBatchCount, 0, sizeof(model.lodBatchCount));
+	}
+
+	culler->lodBatches.clear();
+	for (u32 batchIdx : order)
+	{
+		const GpuCullingBatch& batch = batches[batchIdx];
+		GpuCullingModel& model = models[batch.model];
+		if (model.lodBatchCount[batch.lod] == 0)
+			model.lodBatchOffset[batch.lod] = (u32)culler->lodBatches.size();
+		model.lodBatchCount[batch.lod]++;
+		culler->lodBatches.push_back(batchIdx);
+	}
+
+	// Every batch has room for all the entities of its model, from its base instance on
+	std::vector<IndirectDrawData> batchData(batches.size());
+	culler->commands.resize(batches.size());
+	culler->buckets.clear();
+	culler->instanceCapacity = 0;
+
+	for (u32 i = 0; i < batches.size(); ++i)
+	{
+		const GpuCullingBatch& batch = batches[i];
+		batchData[i] = batch.data;
+
+		DrawElementsIndirectCommand& command = culler->commands[i];
+		command.count = batch.count;
+		command.instanceCount = 0;
+		command.firstIndex = batch.firstIndex;
+		command.baseVertex = batch.baseVertex;
+		command.baseInstance = culler->instanceCapacity;
+		culler->instanceCapacity += batch.capacity;
+
+		if (i == 0 || !IsSameBucket(batch, batches[i - 1]))
+		{
+			GpuCullingBucket bucket = { batch.vao, batch.texture, batch.indexType, i, 0 };
+			culler->buckets.push_back(bucket);
+		}
+		culler->buckets.back().batchCount++;
+	}
+
+	culler->models = models;
+	culler->entityModels = entityModels;
+
+	UploadBuffer(culler->entityModelBuffer, entityModels.data(), entityModels.size() * sizeof(u32));
+	UploadBuffer(culler->modelBuffer, models.data(), models.size() * sizeof(GpuCullingModel));
+	UploadBuffer(culler->lodBatchBuffer, culler->lodBatches.data(), culler->lodBatches.size() * sizeof(u32));
+	UploadBuffer(culler->batchDataBuffer, batchData.data(), batchData.size() * sizeof(IndirectDrawData));
+
+	// The late phase appends after the instances of the others
+	std::vector<DrawElementsIndirectCommand> phaseCommands = culler->commands;
+	for (const DrawElementsIndirectCommand& command : culler->commands)
+	{
+		phaseCommands.push_back(command);
+		phaseCommands.back().baseInstance += culler->instanceCapacity;
+	}
+	UploadBuffer(culler->commandTemplateBuffer, phaseCommands.data(), phaseCommands.size() * sizeof(DrawElementsIndirectCommand));
+	UploadBuffer(culler->commandBuffer, phaseCommands.data(), phaseCommands.size() * sizeof(DrawElementsIndirectCommand));
+	UploadBuffer(culler->instanceBuffer, NULL, glm::max(culler->instanceCapacity, 1u) * 2 * sizeof(glm::uvec2));
+
+	std::vector<u32> visibility(glm::max((u32)entityModels.size(), 1u), 0);
+	UploadBuffer(culler->visibilityBuffer, visibility.data(), visibility.size() * sizeof(u32));
+	UploadBuffer(culler->lodBuffer, visibility.data(), visibility.size() * sizeof(u32));
+	culler->verifiedLods.assign(entityModels.size(), 0);
+	culler->verifiedDispatch = culler->dispatchCount;
+
+	GpuCullingStats& stats = culler->stats;
+	stats.entities = (u32)entityModels.size();
+	stats.batches = (u32)batches.size();
+	stats.buckets = (u32)culler->buckets.size();
+	stats.sceneBuilds++;
+}
+
+void DispatchGpuCulling(GpuCuller* culler, GLuint cullingProgram, const GpuCullingParams& params)
+{
+	const u32 entityCount = (u32)culler->entityModels.size();
+	if (entityCount == 0 || culler->commands.empty())
+		return;
+
+	// Nothing is visible until the shader says so
+	const u32 commandOffset = params.phase == GpuCullingPhase_Late ? (u32)culler->commands.size() : 0;
+	const u64 commandsOffset = commandOffset * sizeof(DrawElementsIndirectCommand);
+	glBindBuffer(GL_COPY_READ_BUFFER, culler->commandTemplateBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, culler->commandBuffer);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, commandsOffset, commandsOffset, culler->commands.size() * sizeof(DrawElementsIndirectCommand));
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	if (culler->program != cullingProgram)
+	{
+		culler->program = cullingProgram;
+		culler->uFrustumPlanes = glGetUniformLocation(cullingProgram, "uFrustumPlanes");
+		culler->uCameraPosition = glGetUniformLocation(cullingProgram, "uCameraPosition");
+		culler->uEntityCount = glGetUniformLocation(cullingProgram, "uEntityCount");
+		culler->uFrustumCulling = glGetUniformLocation(cullingProgram, "uFrustumCulling");
+		culler->uLods = glGetUniformLocation(cullingProgram, "uLods");
+		culler->uPixelsPerUnit = glGetUniformLocation(cullingProgram, "uPixelsPerUnit");
+		culler->uPixelError = glGetUniformLocation(cullingProgram, "uPixelError");
+		culler->uHysteresis = glGetUniformLocation(cullingProgram, "uHysteresis");
+		culler->uPhase = glGetUniformLocation(cullingProgram, "uPhase");
+		culler->uCommandOffset = glGetUniformLocation(cullingProgram, "uCommandOffset");
+		culler->uViewProjection = glGetUniformLocation(cullingProgram, "uViewProjection");
+		culler->uPyramidSize = glGetUniformLocation(cullingProgram, "uPyramidSize");
+		culler->uPyramidLevels = glGetUniformLocation(cullingProgram, "uPyramidLevels");
+	}
+
+	glUseProgram(cullingProgram);
+	glUniform4fv(culler->uFrustumPlanes, 6, glm::value_ptr(params.frustum.planes[0]));
+	glUniform3fv(culler->uCameraPosition, 1, glm::value_ptr(params.cameraPosition));
+	glUniform1ui(culler->uEntityCount, entityCount);
+	glUniform1i(culler->uFrustumCulling, params.frustumCulling ? 1 : 0);
+	glUniform1i(culler->uLods, params.lods ? 1 : 0);
+	glUniform1f(culler->uPixelsPerUnit, params.pixelsPerUnit);
+	glUniform1f(culler->uPixelError, params.pixelError);
+	glUniform1f(culler->uHysteresis, params.hysteresis);
+	glUniform1ui(culler->uPhase, (GLuint)params.phase);
+	glUniform1ui(culler->uCommandOffset, commandOffset);
+	glUniformMatrix4fv(culler->uViewProjection, 1, GL_FALSE, glm::value_ptr(params.viewProjection));
+	glUniform2i(culler->uPyramidSize, params.pyramidSize.x, params.pyramidSize.y);
+	glUniform1i(culler->uPyramidLevels, (GLint)glm::max(params.pyramidLevels, 1u));
+
+	if (params.phase == GpuCullingPhase_Late)
+	{
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, params.depthPyramid);
+	}
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culler->entityModelBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, params.transformBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, culler->modelBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, culler->lodBatchBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, culler->commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, culler->instanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, culler->visibilityBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, culler->lodBuffer);
+
+	glDispatchCompute((entityCount + GPU_CULLING_GROUP_SIZE - 1) / GPU_CULLING_GROUP_SIZE, 1, 1);
+	culler->dispatchCount++;
+
+	if (params.phase == GpuCullingPhase_Late)
+	{
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// The commands are read as indirect draws, the instances as vertex attributes, and both may
+	// be read back by the verification. The late phase reads the visibility of the early one.
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(0);
+}
+
+void DrawGpuCulledBatches(GpuCuller* culler, MeshletCullingStats& cullingStats, GpuCullingPhase phase)
+{
+	if (culler->entityModels.empty())
+		return;
+
+	const u32 firstCommand = phase == GpuCullingPhase_Late ? (u32)culler->commands.size() : 0;
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, culler->batchDataBuffer);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, culler->commandBuffer);
+	glActiveTexture(GL_TEXTURE0);
+
+	GLuint boundVao = 0;
+	GLuint boundTexture = 0;
+	for (const GpuCullingBucket& bucket : culler->buckets)
+	{
+		if (bucket.vao != boundVao)
+		{
+			glBindVertexArray(bucket.vao);
+			boundVao = bucket.vao;
+			cullingStats.vertexArrayBinds++;
+		}
+		if (bucket.texture != boundTexture)
+		{
+			glBindTexture(GL_TEXTURE_2D, bucket.texture);
+			boundTexture = bucket.texture;
+		}
+
+		const void* offset = (const void*)(u64)((firstCommand + bucket.firstBatch) * sizeof(DrawElementsIndirectCommand));
+		glMultiDrawElementsIndirect(GL_TRIANGLES, bucket.indexType, offset, (GLsizei)bucket.batchCount, 0);
+		cullingStats.drawCalls++;
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+static bool IsNear(f32 a, f32 b, f32 scale)
+{
+	return fabsf(a - b) <= GPU_CULLING_TOLERANCE * glm::max(scale, 1.0f);
+}
+
+// The tests of the culling shader, lod comes in as the level the entity was last visible at.
+// Ambiguous is set when rounding could change the result.
+static bool CullEntity(const GpuCullingModel& model, const glm::mat4& worldMatrix, const GpuCullingParams& params, u32& lod, bool& ambiguous)
+{
+	vec3 scale = vec3(glm::length(vec3(worldMatrix[0])), glm::length(vec3(worldMatrix[1])), glm::length(vec3(worldMatrix[2])));
+	vec3 center = vec3(worldMatrix * vec4(vec3(model.bounds), 1.0f));
+	f32 radius = model.bounds.w * glm::max(scale.x, glm::max(scale.y, scale.z));
+	f32 magnitude = glm::length(center) + radius;
+
+	const u32 previousLod = lod;
+	ambiguous = false;
+	lod = 0;
+
+	if (params.frustumCulling)
+	{
+		bool visible = true;
+		for (const vec4& plane : params.frustum.planes)
+		{
+			f32 distance = glm::dot(vec3(plane), center) + plane.w;
+			ambiguous = ambiguous || IsNear(distance, -radius, magnitude);
+			visible = visible && distance >= -radius;
+		}
+		if (!visible)
+			return false;
+	}
+
+	if (params.lods && model.lodCount > 1)
+	{
+		f32 distance = glm::length(center - params.cameraPosition);
+		ambiguous = ambiguous || IsNear(distance, radius, distance);
+		if (distance > radius)
+		{
+			f32 projectedRadius = radius / distance * params.pixelsPerUnit;
+			for (u32 i = 1; i < model.lodCount; ++i)
+			{
+				ambiguous = ambiguous || IsNear(model.lodError[i] * projectedRadius, params.pixelError, params.pixelError);
+				if (model.lodError[i] * projectedRadius <= params.pixelError)
+					lod = i;
+			}
+
+			const f32 coarserError = params.pixelError * (1.0f - params.hysteresis);
+			while (lod > previousLod)
+			{
+				ambiguous = ambiguous || IsNear(model.lodError[lod] * projectedRadius, coarserError, params.pixelError);
+				if (model.lodError[lod] * projectedRadius <= coarserError)
+					break;
+				lod--;
+			}
+		}
+	}
+
+	return true;
+}
+
+void VerifyGpuCulling(GpuCuller* culler, const GpuCullingParams& params, const std::vector<Entity>& entities)
+{
+	GpuCullingStats& stats = culler->stats;
+	const u32 entityCount = (u32)culler->entityModels.size();
+	if (entityCount == 0 || entityCount != entities.size())
+		return;
+
+	std::vector<DrawElementsIndirectCommand> commands(culler->commands.size());
+	glBindBuffer(GL_COPY_READ_BUFFER, culler->commandBuffer);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+
+	std::vector<u32> instances((size_t)culler->instanceCapacity * 2);
+	glBindBuffer(GL_COPY_READ_BUFFER, culler->instanceBuffer);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, instances.size() * sizeof(u32), instances.data());
+
+	// The levels before this dispatch are only known when the one before was verified
+	std::vector<u32> previousLods(entityCount);
+	previousLods.swap(culler->verifiedLods);
+	glBindBuffer(GL_COPY_READ_BUFFER, culler->lodBuffer);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, entityCount * sizeof(u32), culler->verifiedLods.data());
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	const bool knownLods = culler->verifiedDispatch + 1 == culler->dispatchCount;
+	culler->verifiedDispatch = culler->dispatchCount;
+	if (!knownLods)
+		return;
+
+	// Pairs of (batch, entity), from each side, sorted to compare them
+	std::vector<u64> gpuPairs;
+	for (u32 batch = 0; batch < commands.size(); ++batch)
+	{
+		const DrawElementsIndirectCommand& command = commands[batch];
+		const u32 capacity = (batch + 1 < commands.size() ? commands[batch + 1].baseInstance : culler->instanceCapacity) - command.baseInstance;
+		for (u32 i = 0; i < glm::min(command.instanceCount, capacity); ++i)
+		{
+			const u32* instance = &instances[(size_t)(command.baseInstance + i) * 2];
+			gpuPairs.push_back(((u64)instance[1] << 32) | instance[0]);
+		}
+	}
+
+	std::vector<u64> cpuPairs;
+	std::vector<bool> ambiguousEntities(entityCount);
+	for (u32 entityIdx = 0; entityIdx < entityCount; ++entityIdx)
+	{
+		const GpuCullingModel& model = culler->models[culler->entityModels[entityIdx]];
+		u32 lod = previousLods[entityIdx];
+		bool ambiguous;
+		bool visible = CullEntity(model, entities[entityIdx].worldMatrix, params, lod, ambiguous);
+		ambiguousEntities[entityIdx] = ambiguous;
+		if (!visible)
+			continue;
+
+		for (u32 i = 0; i < model.lodBatchCount[lod]; ++i)
+			cpuPairs.push_back(((u64)culler->lodBatches[model.lodBatchOffset[lod] + i] << 32) | entityIdx);
+	}
+
+	std::sort(gpuPairs.begin(), gpuPairs.end());
+	std::sort(cpuPairs.begin(), cpuPairs.end());
+
+	std::vector<u64> mismatches;
+	std::set_symmetric_difference(gpuPairs.begin(), gpuPairs.end(), cpuPairs.begin(), cpuPairs.end(), std::back_inserter(mismatches));
+
+	u32 borderline = 0;
+	for (u64 pair : mismatches)
+	{
+		u32 entityIdx = (u32)pair;
+		if (entityIdx < entityCount && ambiguousEntities[entityIdx])
+			borderline++;
+	}
+
+	stats.verifiedFrames++;
+	stats.visibleInstances = (u32)gpuPairs.size();
+	stats.mismatches += (u32)mismatches.size();
+	stats.borderline += borderline;
+	if (borderline < mismatches.size())
+	{
+		stats.failedFrames++;
+		ELOG("GPU culling: %u instances differ from the CPU, %u of them borderline", (u32)mismatches.size(), borderline);
+	}
+}
+
+GpuCullingStats GetGpuCullingStats(const GpuCuller* culler)
+{
+	return culler->stats;
+}
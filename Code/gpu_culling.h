@@ -0,0 +1,124 @@
+//
+// gpu_culling.h: Frustum culling and level of detail selection of the entities in a compute
+// shader, which appends the visible ones to indirect draw commands. Every submesh of every level
+// of a model is a batch with one command, whose instanceCount the shader increments atomically.
+// The CPU only dispatches the shader and issues one call per bucket of batches, however many
+// entities there are.
+//
+
+#pragma once
+
+#include "indirect_draws.h"
+
+// Instanced attribute with the entity and batch of each instance, written by the compute shader
+#define GPU_CULLING_INSTANCE_LOCATION 14
+#define GPU_CULLING_GROUP_SIZE        64
+
+// Laid out as the std430 CullModel struct of the compute shader
+struct GpuCullingModel
+{
+	vec4 bounds; // center in xyz, radius in w
+	f32 lodError[MAX_MODEL_LODS];
+	u32 lodCount;
+	u32 lodBatchOffset[MAX_MODEL_LODS]; // filled by SetGpuCullingScene
+	u32 lodBatchCount[MAX_MODEL_LODS];
+};
+
+// A submesh of a level of a model, drawn once per visible entity showing that level
+struct GpuCullingBatch
+{
+	GLuint vao;
+	GLuint texture;
+	GLenum indexType;
+	u32 count;
+	u32 firstIndex;
+	i32 baseVertex;
+	u32 model;
+	u32 lod;
+	u32 capacity;          // instances, the entities of its model
+	IndirectDrawData data; // the transform comes with each instance
+};
+
+// With Hi-Z, the entities visible last frame are drawn first, the depth pyramid is built from
+// them, and the late phase draws the entities that are not behind it and were not drawn yet.
+// Each phase has its own half of the commands.
+enum GpuCullingPhase
+{
+	GpuCullingPhase_All,   // frustum and levels only
+	GpuCullingPhase_Early,
+	GpuCullingPhase_Late
+};
+
+struct GpuCullingParams
+{
+	Frustum frustum;
+	vec3 cameraPosition;
+	f32 pixelsPerUnit; // of a bounding sphere, at a distance of one
+	f32 pixelError;
+	f32 hysteresis;
+	bool frustumCulling;
+	bool lods;
+	GLuint transformBuffer;
+
+	// Hi-Z
+	GpuCullingPhase phase;
+	glm::mat4 viewProjection;
+	GLuint depthPyramid;
+	ivec2 pyramidSize;
+	u32 pyramidLevels;
+};
+
+struct GpuCullingStats
+{
+	u32 entities;
+	u32 batches;
+	u32 buckets; // one call each
+	u32 sceneBuilds;
+
+	// Verification against the CPU
+	u32 verifiedFrames;
+	u32 visibleInstances;  // last verified frame
+	u32 mismatches;        // instances only one side drew
+	u32 borderline;        // of them, entities within rounding of a plane or level threshold
+	u32 failedFrames;      // frames with mismatches that are not borderline
+};
+
+struct GpuCuller;
+
+GpuCuller* CreateGpuCuller();
+
+void DestroyGpuCuller(GpuCuller* culler);
+
+/**
+ * Buffer of the instances read by the GPU_CULLING_INSTANCE_LOCATION attribute. It keeps its name
+ * when it grows, so vertex arrays pointing to it stay valid.
+ */
+GLuint GetGpuCullingInstanceBuffer(const GpuCuller* culler);
+
+/**
+ * Replaces the batches, the models and the model of every entity. Batches are sorted in buckets
+ * and the models get the batches of their levels. Only needed when the scene changes, and makes
+ * every entity hidden for the early phase and at its full level.
+ */
+void SetGpuCullingScene(GpuCuller* culler, std::vector<GpuCullingBatch>& batches, std::vector<GpuCullingModel>& models, const std::vector<u32>& entityModels);
+
+/**
+ * Resets the commands of the phase and runs the culling shader over every entity.
+ */
+void DispatchGpuCulling(GpuCuller* culler, GLuint cullingProgram, const GpuCullingParams& params);
+
+/**
+ * Draws every bucket with the commands of the phase with glMultiDrawElementsIndirect. The program
+ * must be bound, batches that nothing survived in are drawn with no instances.
+ */
+void DrawGpuCulledBatches(GpuCuller* culler, MeshletCullingStats& cullingStats, GpuCullingPhase phase = GpuCullingPhase_All);
+
+/**
+ * Reads back the instances of the last dispatch without Hi-Z and compares them with the same
+ * tests run on the CPU. Slow, meant to check the shader, also with software drivers such as llvmpipe.
+ * The levels the hysteresis starts from are read back too, so only frames right after a verified
+ * one are compared.
+ */
+void VerifyGpuCulling(GpuCuller* culler, const GpuCullingParams& params, const std::vector<Entity>& entities);
+
+GpuCullingStats GetGpuCullingStats(const GpuCuller* culler);
@@ -0,0 +1,54 @@
+#include "gpu_timers.h"
+#include <string.h>
+
+void InitGpuTimeline(GpuTimeline& timeline, u32 pointCount)
+{
+	memset(&timeline, 0, sizeof(timeline));
+	timeline.pointCount = glm::min(pointCount, (u32)GPU_TIMELINE_MAX_POINTS);
+	for (u32 frame = 0; frame < GPU_TIMELINE_LATENCY; ++frame)
+		glGenQueries(timeline.pointCount, timeline.queries[frame]);
+}
+
+void DestroyGpuTimeline(GpuTimeline& timeline)
+{
+	for (u32 frame = 0; frame < GPU_TIMELINE_LATENCY; ++frame)
+		glDeleteQueries(timeline.pointCount, timeline.queries[frame]);
+	timeline.pointCount = 0;
+}
+
+bool BeginGpuTimelineFrame(GpuTimeline& timeline)
+{
+	timeline.frame++;
+	if (timeline.frame <= GPU_TIMELINE_LATENCY || timeline.pointCount == 0)
+		return false;
+
+	// The queries of this slot were marked GPU_TIMELINE_LATENCY frames ago. Results that are not
+	// ready are dropped, the slot is marked again either way.
+	GLuint* queries = timeline.queries[timeline.frame % GPU_TIMELINE_LATENCY];
+	GLint available = 0;
+	glGetQueryObjectiv(queries[timeline.pointCount - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return false;
+
+	for (u32 point = 0; point < timeline.pointCount; ++point)
+	{
+		GLuint64 timestamp = 0;
+		glGetQueryObjectui64v(queries[point], GL_QUERY_RESULT, &timestamp);
+		timeline.timestamps[point] = timestamp;
+	}
+	timeline.resolvedFrames++;
+	return true;
+}
+
+void MarkGpuTimeline(GpuTimeline& timeline, u32 point)
+{
+	if (point < timeline.pointCount)
+		glQueryCounter(timeline.queries[timeline.frame % GPU_TIMELINE_LATENCY][point], GL_TIMESTAMP);
+}
+
+f32 GetGpuTimelineMs(const GpuTimeline& timeline, u32 from, u32 to)
+{
+	if (timeline.resolvedFrames == 0 || timeline.timestamps[to] < timeline.timestamps[from])
+		return 0.0f;
+	return (f32)((timeline.timestamps[to] - timeline.timestamps[from]) / 1e6);
+}
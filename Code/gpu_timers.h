@@ -0,0 +1,43 @@
+//
+// gpu_timers.h: GPU time between points of a frame, measured with timestamp queries. Results
+// are read a few frames later, when they are ready, so measuring never stalls the CPU.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+
+#define GPU_TIMELINE_MAX_POINTS 8
+#define GPU_TIMELINE_LATENCY    4 // frames of queries in flight
+
+struct GpuTimeline
+{
+	GLuint queries[GPU_TIMELINE_LATENCY][GPU_TIMELINE_MAX_POINTS];
+	u32 pointCount;
+	u32 frame;
+
+	// Of the last frame whose results were read, in nanoseconds
+	u64 timestamps[GPU_TIMELINE_MAX_POINTS];
+	u32 resolvedFrames;
+};
+
+void InitGpuTimeline(GpuTimeline& timeline, u32 pointCount);
+
+void DestroyGpuTimeline(GpuTimeline& timeline);
+
+/**
+ * Starts a frame, reading the oldest one in flight if its results are ready. Returns true when
+ * they were, and the timestamps hold them.
+ */
+bool BeginGpuTimelineFrame(GpuTimeline& timeline);
+
+/**
+ * Records the time the GPU reaches this point. Every point is marked once per frame.
+ */
+void MarkGpuTimeline(GpuTimeline& timeline, u32 point);
+
+/**
+ * Milliseconds between two points of the last frame read.
+ */
+f32 GetGpuTimelineMs(const GpuTimeline& timeline, u32 from, u32 to);
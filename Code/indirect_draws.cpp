@@ -0,0 +1,261 @@
+#include "indirect_draws.h"
+#include "mesh_conversion.h"
+#include <algorithm>
+
+struct IndirectDraw
+{
+	GLuint vao;
+	GLuint texture;
+	GLenum indexType;
+	u32 dataIdx;
+	u32 instanceCount;
+	u32 firstCommand;
+	u32 commandCount;
+};
+
+// A part of a bucket that fits in a page of both rings
+struct IndirectCall
+{
+	GLuint vao;
+	GLuint texture;
+	GLenum indexType;
+	GLuint dataBuffer;
+	u32 dataOffset;
+	u32 dataSize;
+	GLuint commandBuffer;
+	u32 commandOffset;
+	u32 commandCount;
+};
+
+struct IndirectRenderer
+{
+	// Written every frame, fenced like the uniforms
+	RingBuffer dataRing;
+	RingBuffer commandRing;
+	GLuint drawIdBuffer;
+	GLint dataAlignment;
+	u32 maxDrawsPerCall; // rows of draw data
+
+	// Queued draws, their data and their commands, with baseInstance relative to the draw
+	std::vector<IndirectDraw> draws;
+	std::vector<IndirectDrawData> data;
+	std::vector<DrawElementsIndirectCommand> commands;
+	std::vector<IndirectCall> calls;
+
+	IndirectDrawStats stats;
+};
+
+IndirectRenderer* CreateIndirectRenderer()
+{
+	IndirectRenderer* renderer = new IndirectRenderer();
+
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &renderer->dataAlignment);
+	renderer->dataRing = CreateRingBuffer(Align(INDIRECT_PAGE_SIZE, renderer->dataAlignment), GL_SHADER_STORAGE_BUFFER);
+	renderer->commandRing = CreateRingBuffer(INDIRECT_PAGE_SIZE, GL_DRAW_INDIRECT_BUFFER);
+
+	// Calls are limited by the pages of the rings and by the draw indices of the attribute
+	renderer->maxDrawsPerCall = glm::min((u32)INDIRECT_MAX_DRAWS_PER_CALL, renderer->dataRing.pageSize / (u32)sizeof(IndirectDrawData));
+
+	std::vector<u32> drawIds(INDIRECT_MAX_DRAWS_PER_CALL);
+	for (u32 i = 0; i < INDIRECT_MAX_DRAWS_PER_CALL; ++i)
+		drawIds[i] = i;
+
+	glGenBuffers(1, &renderer->drawIdBuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, renderer->drawIdBuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, drawIds.size() * sizeof(u32), drawIds.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	return renderer;
+}
+
+void DestroyIndirectRenderer(IndirectRenderer* renderer)
+{
+	DestroyRingBuffer(renderer->dataRing);
+	DestroyRingBuffer(renderer->commandRing);
+	glDeleteBuffers(1, &renderer->drawIdBuffer);
+	delete renderer;
+}
+
+GLuint GetIndirectDrawIdBuffer(const IndirectRenderer* renderer)
+{
+	return renderer->drawIdBuffer;
+}
+
+void AddIndirectDraw(IndirectRenderer* renderer, GLuint vao, GLuint texture, const Submesh& submesh, const MeshletDrawList& drawList, const IndirectDrawData& data)
+{
+	AddIndirectInstances(renderer, vao, texture, submesh, drawList, &data, 1);
+}
+
+void AddIndirectInstances(IndirectRenderer* renderer, GLuint vao, GLuint texture, const Submesh& submesh, const MeshletDrawList& drawList,
+	const IndirectDrawData* data, u32 instanceCount)
+{
+	const u32 indexSize = GetIndexTypeSize(submesh.indexType);
+
+	for (u32 first = 0; first < instanceCount; first += renderer->maxDrawsPerCall)
+	{
+		IndirectDraw draw = {};
+		draw.vao = vao;
+		draw.texture = texture;
+		draw.indexType = submesh.indexType;
+		draw.dataIdx = (u32)renderer->data.size();
+		draw.instanceCount = glm::min(instanceCount - first, renderer->maxDrawsPerCall);
+		draw.firstCommand = (u32)renderer->commands.size();
+		draw.commandCount = (u32)drawList.counts.size();
+		renderer->draws.push_back(draw);
+		renderer->data.insert(renderer->data.end(), data + first, data + first + draw.instanceCount);
+
+		// Offsets of the draw list are in bytes of the index arena
+		for (u32 i = 0; i < drawList.counts.size(); ++i)
+		{
+			DrawElementsIndirectCommand command = {};
+			command.count = (u32)drawList.counts[i];
+			command.instanceCount = draw.instanceCount;
+			command.firstIndex = (u32)((u64)drawList.offsets[i] / indexSize);
+			command.baseVertex = drawList.baseVertices[i];
+			renderer->commands.push_back(command);
+		}
+	}
+}
+
+static bool IsSameBucket(const IndirectDraw& a, const IndirectDraw& b)
+{
+	return a.vao == b.vao && a.texture == b.texture && a.indexType == b.indexType;
+}
+
+// Copies draws [begin, end) of a bucket to the rings as one call
+static void AddIndirectCall(IndirectRenderer* renderer, u32 begin, u32 end, u32 instanceCount, u32 commandCount)
+{
+	const IndirectDraw& first = renderer->draws[begin];
+
+	RingBuffer& dataRing = renderer->dataRing;
+	ReserveRingBlock(dataRing, instanceCount * sizeof(IndirectDrawData), renderer->dataAlignment);
+	Buffer& dataBuffer = dataRing.buffer;
+
+	RingBuffer& commandRing = renderer->commandRing;
+	ReserveRingBlock(commandRing, commandCount * sizeof(DrawElementsIndirectCommand), sizeof(u32));
+	Buffer& commandBuffer = commandRing.buffer;
+
+	IndirectCall call = {};
+	call.vao = first.vao;
+	call.texture = first.texture;
+	call.indexType = first.indexType;
+	call.dataBuffer = dataBuffer.handle;
+	call.dataOffset = dataBuffer.head;
+	call.dataSize = instanceCount * sizeof(IndirectDrawData);
+	call.commandBuffer = commandBuffer.handle;
+	call.commandOffset = commandBuffer.head;
+	call.commandCount = commandCount;
+
+	u32 baseInstance = 0;
+	for (u32 i = begin; i < end; ++i)
+	{
+		const IndirectDraw& draw = renderer->draws[i];
+		PushData(dataBuffer, &renderer->data[draw.dataIdx], draw.instanceCount * sizeof(IndirectDrawData));
+
+		for (u32 c = 0; c < draw.commandCount; ++c)
+		{
+			DrawElementsIndirectCommand command = renderer->commands[draw.firstCommand + c];
+			command.baseInstance = baseInstance;
+			PushData(commandBuffer, &command, sizeof(command));
+		}
+		baseInstance += draw.instanceCount;
+	}
+
+	renderer->stats.uploadedBytes += call.dataSize + commandCount * sizeof(DrawElementsIndirectCommand);
+	renderer->calls.push_back(call);
+}
+
+void SubmitIndirectDraws(IndirectRenderer* renderer, MeshletCullingStats& cullingStats)
+{
+	std::vector<IndirectDraw>& draws = renderer->draws;
+	IndirectDrawStats& stats = renderer->stats;
+	stats = {};
+	stats.draws = (u32)draws.size();
+	stats.instances = (u32)renderer->data.size();
+	stats.commands = (u32)renderer->commands.size();
+
+	std::sort(draws.begin(), draws.end(), [](const IndirectDraw& a, const IndirectDraw& b)
+		{
+			if (a.vao != b.vao) return a.vao < b.vao;
+			if (a.texture != b.texture) return a.texture < b.texture;
+			return a.indexType < b.indexType;
+		});
+
+	const u32 maxCommands = renderer->commandRing.pageSize / (u32)sizeof(DrawElementsIndirectCommand);
+
+	BeginRingRegion(renderer->dataRing);
+	BeginRingRegion(renderer->commandRing);
+	renderer->calls.clear();
+
+	u32 begin = 0;
+	u32 instanceCount = 0;
+	u32 commandCount = 0;
+	for (u32 i = 0; i < draws.size(); ++i)
+	{
+		if (i == 0 || !IsSameBucket(draws[i], draws[i - 1]))
+			stats.buckets++;
+
+		bool full = instanceCount + draws[i].instanceCount > renderer->maxDrawsPerCall || commandCount + draws[i].commandCount > maxCommands;
+		if (i > begin && (!IsSameBucket(draws[i], draws[begin]) || full))
+		{
+			AddIndirectCall(renderer, begin, i, instanceCount, commandCount);
+			begin = i;
+			instanceCount = 0;
+			commandCount = 0;
+		}
+		instanceCount += draws[i].instanceCount;
+		commandCount += draws[i].commandCount;
+	}
+	if (begin < draws.size())
+		AddIndirectCall(renderer, begin, (u32)draws.size(), instanceCount, commandCount);
+
+	// Without persistent mappings the rings have to be unmapped before drawing
+	EndRingRegion(renderer->dataRing);
+	EndRingRegion(renderer->commandRing);
+
+	GLuint boundVao = 0;
+	GLuint boundTexture = 0;
+	GLuint boundCommands = 0;
+	glActiveTexture(GL_TEXTURE0);
+
+	for (const IndirectCall& call : renderer->calls)
+	{
+		if (call.vao != boundVao)
+		{
+			glBindVertexArray(call.vao);
+			boundVao = call.vao;
+			cullingStats.vertexArrayBinds++;
+		}
+		if (call.texture != boundTexture)
+		{
+			glBindTexture(GL_TEXTURE_2D, call.texture);
+			boundTexture = call.texture;
+		}
+		if (call.commandBuffer != boundCommands)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, call.commandBuffer);
+			boundCommands = call.commandBuffer;
+		}
+
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, call.dataBuffer, call.dataOffset, call.dataSize);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, call.indexType, (const void*)(u64)call.commandOffset, (GLsizei)call.commandCount, 0);
+
+		stats.calls++;
+		cullingStats.drawCalls++;
+	}
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	// Every call reading this frame's regions has been submitted
+	FenceRingRegion(renderer->dataRing);
+	FenceRingRegion(renderer->commandRing);
+
+	draws.clear();
+	renderer->data.clear();
+	renderer->commands.clear();
+}
+
+IndirectDrawStats GetIndirectDrawStats(const IndirectRenderer* renderer)
+{
+	return renderer->stats;
+}
@@ -0,0 +1,80 @@
+//
+// indirect_draws.h: Submission of the meshes with glMultiDrawElementsIndirect. Draws are grouped
+// in buckets that read the same vertex arena and albedo texture with the same index type, and
+// each bucket is drawn with a single call. The data of every draw lives in a shader storage
+// buffer, where the vertex shader finds it through the base instance of the draw command.
+// Instanced draws keep the data of their instances contiguous, so instance i reads the row
+// base instance + i.
+//
+
+#pragma once
+
+#include "meshlets.h"
+
+// Instanced attribute holding 0, 1, 2... so the base instance of a command is its draw index.
+// gl_DrawID and gl_BaseInstance need ARB_shader_draw_parameters, this works with plain 4.3.
+#define INDIRECT_DRAW_ID_LOCATION   15
+#define INDIRECT_MAX_DRAWS_PER_CALL 65536
+#define INDIRECT_PAGE_SIZE          (u32)MB(4)
+
+struct DrawElementsIndirectCommand
+{
+	u32 count;
+	u32 instanceCount;
+	u32 firstIndex;
+	i32 baseVertex;
+	u32 baseInstance;
+};
+
+// Per draw data, laid out as the std430 DrawData struct of the shader. The world matrix stays in
+// the transform buffer of the entities.
+struct IndirectDrawData
+{
+	vec4 positionScale;     // w is 1 when normals are octahedral
+	vec4 positionOffset;
+	vec4 texCoordTransform; // scale in xy, offset in zw
+	u32 materialIdx;
+	u32 transformIdx;
+	u32 padding[2];
+};
+
+struct IndirectDrawStats
+{
+	u32 draws;         // entity submeshes, or submeshes of a group of instances
+	u32 instances;     // rows of draw data, one per entity submesh
+	u32 commands;      // one per visible range of meshlets
+	u32 buckets;
+	u32 calls;         // buckets larger than a page of draw data take several
+	u32 uploadedBytes; // draw data and commands
+};
+
+struct IndirectRenderer;
+
+IndirectRenderer* CreateIndirectRenderer();
+
+void DestroyIndirectRenderer(IndirectRenderer* renderer);
+
+/**
+ * Buffer with the draw indices read by the INDIRECT_DRAW_ID_LOCATION attribute.
+ */
+GLuint GetIndirectDrawIdBuffer(const IndirectRenderer* renderer);
+
+/**
+ * Queues the visible ranges of a submesh, drawn with the vertex array, texture and data given.
+ */
+void AddIndirectDraw(IndirectRenderer* renderer, GLuint vao, GLuint texture, const Submesh& submesh, const MeshletDrawList& drawList, const IndirectDrawData& data);
+
+/**
+ * Queues the ranges of a submesh drawn once per instance, each with its own data. Groups larger
+ * than a call can hold are split.
+ */
+void AddIndirectInstances(IndirectRenderer* renderer, GLuint vao, GLuint texture, const Submesh& submesh, const MeshletDrawList& drawList,
+	const IndirectDrawData* data, u32 instanceCount);
+
+/**
+ * Uploads the queued draws, sorted in buckets, and draws every bucket with
+ * glMultiDrawElementsIndirect. The program must be bound, the queue is emptied.
+ */
+void SubmitIndirectDraws(IndirectRenderer* renderer, MeshletCullingStats& cullingStats);
+
+IndirectDrawStats GetIndirectDrawStats(const IndirectRenderer* renderer);
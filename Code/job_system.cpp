@@ -0,0 +1,162 @@
+#include "job_system.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
+
+struct QueuedJob
+{
+	Job         function;
+	JobCounter* counter;
+};
+
+struct ThreadPool
+{
+	std::vector<std::thread> workers;
+	std::deque<QueuedJob>    queue;
+	std::mutex               mutex;
+	std::condition_variable  jobAvailable;
+	std::condition_variable  jobFinished;
+	bool                     quit;
+};
+
+static void RunJob(ThreadPool* pool, QueuedJob& job)
+{
+	job.function();
+
+	if (job.counter)
+	{
+		// Decrement under the lock so a waiter cannot miss the notification
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		job.counter->pending--;
+	}
+	pool->jobFinished.notify_all();
+}
+
+static void WorkerLoop(ThreadPool* pool)
+{
+	for (;;)
+	{
+		QueuedJob job;
+		{
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			pool->jobAvailable.wait(lock, [pool] { return pool->quit || !pool->queue.empty(); });
+
+			if (pool->quit && pool->queue.empty())
+				return;
+
+			job = std::move(pool->queue.front());
+			pool->queue.pop_front();
+		}
+
+		RunJob(pool, job);
+	}
+}
+
+ThreadPool* CreateThreadPool(u32 threadCount)
+{
+	if (threadCount == 0)
+	{
+		u32 hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	ThreadPool* pool = new ThreadPool();
+	pool->quit = false;
+
+	for (u32 i = 0; i < threadCount; ++i)
+		pool->workers.emplace_back(WorkerLoop, pool);
+
+	return pool;
+}
+
+void DestroyThreadPool(ThreadPool* pool)
+{
+	if (!pool)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->quit = true;
+	}
+	pool->jobAvailable.notify_all();
+
+	for (std::thread& worker : pool->workers)
+		worker.join();
+
+	delete pool;
+}
+
+u32 GetWorkerCount(const ThreadPool* pool)
+{
+	return (u32)pool->workers.size();
+}
+
+void SubmitJob(ThreadPool* pool, Job job, JobCounter* counter)
+{
+	if (counter)
+		counter->pending++;
+
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->queue.push_back({ std::move(job), counter });
+	}
+	pool->jobAvailable.notify_one();
+
+	// A thread waiting for the counter may help with the new job
+	if (counter)
+		pool->jobFinished.notify_all();
+}
+
+static std::deque<QueuedJob>::iterator FindJob(ThreadPool* pool, JobCounter* counter)
+{
+	return std::find_if(pool->queue.begin(), pool->queue.end(), [counter](const QueuedJob& job) { return job.counter == counter; });
+}
+
+void WaitForCounter(ThreadPool* pool, JobCounter* counter)
+{
+	for (;;)
+	{
+		QueuedJob job;
+		{
+			// Only the jobs of the counter, so a frame never ends up running a whole asset load
+			std::unique_lock<std::mutex> lock(pool->mutex);
+			std::deque<QueuedJob>::iterator it;
+			pool->jobFinished.wait(lock, [pool, counter, &it] { return counter->pending == 0 || (it = FindJob(pool, counter)) != pool->queue.end(); });
+
+			if (counter->pending == 0)
+				return;
+
+			job = std::move(*it);
+			pool->queue.erase(it);
+		}
+
+		RunJob(pool, job);
+	}
+}
+
+void ParallelFor(ThreadPool* pool, u32 count, u32 batchSize, const std::function<void(u32 begin, u32 end)>& function)
+{
+	if (count == 0)
+		return;
+
+	if (batchSize == 0)
+		batchSize = 1;
+
+	// Small loops are not worth the synchronization
+	if (count <= batchSize)
+	{
+		function(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (u32 begin = 0; begin < count; begin += batchSize)
+	{
+		u32 end = begin + batchSize < count ? begin + batchSize : count;
+		SubmitJob(pool, [&function, begin, end] { function(begin, end); }, &counter);
+	}
+
+	WaitForCounter(pool, &counter);
+}
@@ -0,0 +1,44 @@
+//
+// job_system.h: A small pool of worker threads used to run loading and processing work
+// (image decoding, mesh processing...) in parallel with the main thread.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <functional>
+#include <atomic>
+
+struct ThreadPool;
+
+typedef std::function<void()> Job;
+
+// Tracks a group of jobs so a thread can wait for them without waiting for the whole pool
+struct JobCounter
+{
+	std::atomic<u32> pending{ 0 };
+};
+
+/**
+ * Creates a pool with the given number of worker threads. Passing 0 uses one worker per
+ * hardware thread minus one, leaving a core for the main thread.
+ */
+ThreadPool* CreateThreadPool(u32 threadCount);
+
+void DestroyThreadPool(ThreadPool* pool);
+
+u32 GetWorkerCount(const ThreadPool* pool);
+
+void SubmitJob(ThreadPool* pool, Job job, JobCounter* counter = NULL);
+
+/**
+ * Blocks until every job submitted with this counter has finished. The calling thread
+ * helps running the queued jobs of the counter instead of just sleeping, never the others.
+ */
+void WaitForCounter(ThreadPool* pool, JobCounter* counter);
+
+/**
+ * Splits [0, count) in batches of batchSize elements, runs them in the pool and waits for
+ * all of them. The function receives the [begin, end) range of each batch.
+ */
+void ParallelFor(ThreadPool* pool, u32 count, u32 batchSize, const std::function<void(u32 begin, u32 end)>& function);
@@ -0,0 +1,197 @@
+#include "lz4_codec.h"
+#include <string.h>
+
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5  // the block always ends with literals
+#define LZ4_MATCH_LIMIT   12 // no match may start in the last bytes of the block
+#define LZ4_MAX_OFFSET    65535
+#define LZ4_HASH_BITS     16
+#define LZ4_SKIP_STRENGTH 6  // step faster through data that does not match
+
+static u32 Read32(const u8* p)
+{
+	u32 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static u32 HashSequence(u32 sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Lengths past the 4 bits of the token continue as bytes of 255 plus the remainder
+static u64 GetLengthSize(u64 length)
+{
+	return length >= 15 ? (length - 15) / 255 + 1 : 0;
+}
+
+static u8* WriteLength(u8* op, u64 length)
+{
+	for (length -= 15; length >= 255; length -= 255)
+		*op++ = 255;
+	*op++ = (u8)length;
+	return op;
+}
+
+static bool ReadLength(const u8*& ip, const u8* end, u64& length)
+{
+	u8 byte;
+	do
+	{
+		if (ip >= end)
+			return false;
+		byte = *ip++;
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+// Writes the literals [literals, literals + literalCount) followed by a match, or only the
+// literals when matchLength is 0 (the last sequence of the block)
+static u8* WriteSequence(u8* op, const u8* outputEnd, const u8* literals, u64 literalCount, u32 offset, u64 matchLength)
+{
+	u64 matchCode = matchLength > 0 ? matchLength - LZ4_MIN_MATCH : 0;
+	u64 sequenceSize = 1 + GetLengthSize(literalCount) + literalCount + (matchLength > 0 ? 2 + GetLengthSize(matchCode) : 0);
+	if (sequenceSize > (u64)(outputEnd - op))
+		return NULL;
+
+	u8* token = op++;
+	*token = (u8)((literalCount >= 15 ? 15 : literalCount) << 4);
+	if (literalCount >= 15)
+		op = WriteLength(op, literalCount);
+	if (literalCount > 0)
+		memcpy(op, literals, literalCount);
+	op += literalCount;
+
+	if (matchLength > 0)
+	{
+		*op++ = (u8)offset;
+		*op++ = (u8)(offset >> 8);
+		*token |= (u8)(matchCode >= 15 ? 15 : matchCode);
+		if (matchCode >= 15)
+			op = WriteLength(op, matchCode);
+	}
+
+	return op;
+}
+
+u64 GetLZ4CompressBound(u64 size)
+{
+	return size + size / 255 + 16;
+}
+
+u64 CompressLZ4(const u8* input, u64 size, u8* output, u64 capacity)
+{
+	if (size > 0x7E000000)
+		return 0;
+
+	u8* op = output;
+	const u8* outputEnd = output + capacity;
+	u64 anchor = 0;
+
+	if (size > LZ4_MATCH_LIMIT)
+	{
+		std::vector<u32> table((size_t)1 << LZ4_HASH_BITS, UINT32_MAX);
+		const u64 matchEndLimit = size - LZ4_LAST_LITERALS;
+		const u64 matchStartLimit = size - LZ4_MATCH_LIMIT;
+
+		u64 ip = 0;
+		while (ip <= matchStartLimit)
+		{
+			u32 sequence = Read32(input + ip);
+			u32 hash = HashSequence(sequence);
+			u64 ref = table[hash];
+			table[hash] = (u32)ip;
+
+			if (ref == UINT32_MAX || ip - ref > LZ4_MAX_OFFSET || Read32(input + ref) != sequence)
+			{
+				ip += 1 + ((ip - anchor) >> LZ4_SKIP_STRENGTH);
+				continue;
+			}
+
+			u64 matchLength = LZ4_MIN_MATCH;
+			while (ip + matchLength < matchEndLimit && input[ref + matchLength] == input[ip + matchLength])
+				matchLength++;
+
+			// The literals before the match may be part of it too
+			while (ip > anchor && ref > 0 && input[ip - 1] == input[ref - 1])
+			{
+				ip--;
+				ref--;
+				matchLength++;
+			}
+
+			op = WriteSequence(op, outputEnd, input + anchor, ip - anchor, (u32)(ip - ref), matchLength);
+			if (!op)
+				return 0;
+
+			ip += matchLength;
+			anchor = ip;
+
+			// Keep the table fresh inside the match, it is where the next repetitions usually are
+			if (ip - 2 <= matchStartLimit)
+				table[HashSequence(Read32(input + ip - 2))] = (u32)(ip - 2);
+		}
+	}
+
+	op = WriteSequence(op, outputEnd, input + anchor, size - anchor, 0, 0);
+	return op ? (u64)(op - output) : 0;
+}
+
+bool DecompressLZ4(const u8* input, u64 inputSize, u8* output, u64 outputSize)
+{
+	const u8* ip = input;
+	const u8* inputEnd = input + inputSize;
+	u8* op = output;
+	u8* outputEnd = output + outputSize;
+
+	while (ip < inputEnd)
+	{
+		u8 token = *ip++;
+
+		u64 literalCount = token >> 4;
+		if (literalCount == 15 && !ReadLength(ip, inputEnd, literalCount))
+			return false;
+		if (literalCount > (u64)(inputEnd - ip) || literalCount > (u64)(outputEnd - op))
+			return false;
+
+		if (literalCount > 0)
+			memcpy(op, ip, literalCount);
+		op += literalCount;
+		ip += literalCount;
+
+		// The last sequence has no match
+		if (ip == inputEnd)
+			break;
+
+		if (inputEnd - ip < 2)
+			return false;
+		u32 offset = ip[0] | ((u32)ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (u64)(op - output))
+			return false;
+
+		u64 matchLength = token & 15;
+		if (matchLength == 15 && !ReadLength(ip, inputEnd, matchLength))
+			return false;
+		matchLength += LZ4_MIN_MATCH;
+		if (matchLength > (u64)(outputEnd - op))
+			return false;
+
+		// Overlapping matches repeat the last offset bytes, so they are copied byte by byte
+		const u8* match = op - offset;
+		if (offset >= matchLength)
+		{
+			memcpy(op, match, matchLength);
+			op += matchLength;
+		}
+		else
+		{
+			for (u64 i = 0; i < matchLength; ++i)
+				*op++ = match[i];
+		}
+	}
+
+	return op == outputEnd;
+}
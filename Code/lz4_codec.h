@@ -0,0 +1,26 @@
+//
+// lz4_codec.h: Compressor and decompressor for the LZ4 block format, used for the entries of
+// the asset pack. Blocks are compatible with the reference implementation (LZ4_compress_default
+// / LZ4_decompress_safe), the compressor is the simple greedy single hash table variant.
+//
+
+#pragma once
+
+#include "platform.h"
+
+/**
+ * Worst case size of a compressed block, for incompressible data.
+ */
+u64 GetLZ4CompressBound(u64 size);
+
+/**
+ * Compresses the block into output. Returns the compressed size, or 0 if it does not fit in
+ * capacity (blocks are limited to 2 GB by the format).
+ */
+u64 CompressLZ4(const u8* input, u64 size, u8* output, u64 capacity);
+
+/**
+ * Decompresses a block into exactly outputSize bytes. Malformed or truncated input never reads
+ * or writes out of bounds, it returns false instead.
+ */
+bool DecompressLZ4(const u8* input, u64 inputSize, u8* output, u64 outputSize);
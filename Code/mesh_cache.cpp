@@ -0,0 +1,445 @@
+#include "mesh_cache.h"
+#include "mesh_conversion.h"
+
+static std::string MakeCachePath(const char* filename)
+{
+	return std::string(filename) + MESH_CACHE_EXTENSION;
+}
+
+// A string must end inside the string table, a truncated table would be read past it
+static bool IsCacheStringValid(const u8* base, const MeshCacheHeader* header, u32 offset)
+{
+	if (offset == MESH_CACHE_NO_STRING)
+		return true;
+	return offset < header->stringsSize && memchr(base + header->stringsOffset + offset, 0, header->stringsSize - offset) != NULL;
+}
+
+static const char* GetCacheString(const u8* base, const MeshCacheHeader* header, u32 offset)
+{
+	if (offset == MESH_CACHE_NO_STRING || !IsCacheStringValid(base, header, offset))
+		return NULL;
+	return (const char*)(base + header->stringsOffset + offset);
+}
+
+static void RequestCachedTexture(std::vector<TextureRequest>& requests, const u8* base, const MeshCacheHeader* header, u32 offset, TextureUsage usage, u32 materialIdx, u32 Material::* textureIdx)
+{
+	const char* filepath = GetCacheString(base, header, offset);
+	if (filepath)
+		requests.push_back({ filepath, usage, materialIdx, textureIdx });
+}
+
+static bool AreIndicesInRange(const u8* indices, GLenum indexType, u32 indexCount, u32 vertexCount)
+{
+	if (indexType == GL_UNSIGNED_SHORT)
+	{
+		const u16* narrow = (const u16*)indices;
+		for (u32 i = 0; i < indexCount; ++i)
+			if (narrow[i] >= vertexCount)
+				return false;
+		return true;
+	}
+
+	const u32* wide = (const u32*)indices;
+	for (u32 i = 0; i < indexCount; ++i)
+		if (wide[i] >= vertexCount)
+			return false;
+	return true;
+}
+
+static bool IsCachedSubmeshValid(const u8* base, const MeshCacheHeader* header, const MeshCacheLod& lod, const MeshCacheSubmesh& submesh)
+{
+	if (submesh.indexType != GL_UNSIGNED_SHORT && submesh.indexType != GL_UNSIGNED_INT)
+		return false;
+	if (submesh.gpuStride == 0 || submesh.stride == 0 ||
+		submesh.attributeCount > MESH_CACHE_MAX_ATTRIBUTES || submesh.gpuAttributeCount > MESH_CACHE_MAX_ATTRIBUTES)
+		return false;
+
+	// The buffer contents must lie inside the level, the meshlets inside the table and the
+	// material inside the model
+	const u64 indexBytes = (u64)submesh.indexCount * GetIndexTypeSize(submesh.indexType);
+	if ((u64)submesh.vertexOffset + (u64)submesh.vertexCount * submesh.gpuStride > lod.vertexSize ||
+		(u64)submesh.indexOffset + indexBytes > lod.indexSize ||
+		(u64)submesh.meshletOffset + submesh.meshletCount > header->meshletCount ||
+		submesh.materialIdx >= header->materialCount)
+		return false;
+
+	// Draws and meshlets only reach the vertices and the indices of the submesh
+	const u8* indices = base + header->indexBlobOffset + lod.indexOffset + submesh.indexOffset;
+	if (!AreIndicesInRange(indices, submesh.indexType, submesh.indexCount, submesh.vertexCount))
+		return false;
+
+	const Meshlet* meshlets = (const Meshlet*)(base + header->meshletsOffset) + submesh.meshletOffset;
+	for (u32 i = 0; i < submesh.meshletCount; ++i)
+		if ((u64)meshlets[i].indexOffset + (u64)meshlets[i].triangleCount * 3 > submesh.indexCount)
+			return false;
+
+	return true;
+}
+
+// Only the settings that change how the levels are built, not how they are selected
+static u64 HashLodSettings(const LodSettings& settings)
+{
+	u64 hash = HashBytes(&settings.levelCount, sizeof(settings.levelCount));
+	hash = HashBytes(settings.triangleRatio, sizeof(settings.triangleRatio), hash);
+	return HashBytes(settings.maxError, sizeof(settings.maxError), hash);
+}
+
+static bool IsCacheValid(const AssetFile& file, const char* filename, u32 postProcessFlags, VertexQuantization quantization, const LodSettings& lodSettings)
+{
+	if (file.size < sizeof(MeshCacheHeader))
+		return false;
+
+	const u8* base = (const u8*)file.data;
+	const MeshCacheHeader* header = (const MeshCacheHeader*)base;
+
+	if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION)
+		return false;
+
+	// The GPU vertices were quantized for one format and the levels built with one set of settings
+	if (header->postProcessFlags != postProcessFlags ||
+		header->quantization != (u32)quantization ||
+		header->lodSettingsHash != HashLodSettings(lodSettings) ||
+		header->sourcePathHash != HashPath(filename) ||
+		header->sourceTimestamp != GetAssetTimestamp(filename))
+		return false;
+
+	if (header->lodCount == 0 || header->lodCount > MAX_MODEL_LODS)
+		return false;
+
+	// Make sure every section lies inside the file before trusting any offset
+	const u64 lodsEnd = (u64)header->lodsOffset + (u64)header->lodCount * sizeof(MeshCacheLod);
+	const u64 submeshesEnd = (u64)header->submeshesOffset + (u64)header->lodCount * header->submeshCount * sizeof(MeshCacheSubmesh);
+	const u64 materialsEnd = (u64)header->materialsOffset + (u64)header->materialCount * sizeof(MeshCacheMaterial);
+	const u64 meshletsEnd = (u64)header->meshletsOffset + (u64)header->meshletCount * sizeof(Meshlet);
+	const u64 stringsEnd = (u64)header->stringsOffset + header->stringsSize;
+	const u64 verticesEnd = (u64)header->vertexBlobOffset + header->vertexBlobSize;
+	const u64 indicesEnd = (u64)header->indexBlobOffset + header->indexBlobSize;
+
+	if (lodsEnd > file.size || submeshesEnd > file.size || materialsEnd > file.size || meshletsEnd > file.size ||
+		stringsEnd > file.size || verticesEnd > file.size || indicesEnd > file.size)
+		return false;
+
+	// Every level must lie inside the blobs, and every submesh inside its level
+	const MeshCacheLod* lods = (const MeshCacheLod*)(base + header->lodsOffset);
+	const MeshCacheSubmesh* submeshes = (const MeshCacheSubmesh*)(base + header->submeshesOffset);
+	for (u32 lod = 0; lod < header->lodCount; ++lod)
+	{
+		if ((u64)lods[lod].vertexOffset + lods[lod].vertexSize > header->vertexBlobSize ||
+			(u64)lods[lod].indexOffset + lods[lod].indexSize > header->indexBlobSize)
+			return false;
+
+		for (u32 i = 0; i < header->submeshCount; ++i)
+		{
+			if (!IsCachedSubmeshValid(base, header, lods[lod], submeshes[lod * header->submeshCount + i]))
+				return false;
+		}
+	}
+
+	// And every string of the materials must end inside the string table
+	const MeshCacheMaterial* materials = (const MeshCacheMaterial*)(base + header->materialsOffset);
+	for (u32 i = 0; i < header->materialCount; ++i)
+	{
+		const MeshCacheMaterial& material = materials[i];
+		if (!IsCacheStringValid(base, header, material.nameOffset) ||
+			!IsCacheStringValid(base, header, material.albedoTextureOffset) ||
+			!IsCacheStringValid(base, header, material.emissiveTextureOffset) ||
+			!IsCacheStringValid(base, header, material.specularTextureOffset) ||
+			!IsCacheStringValid(base, header, material.normalsTextureOffset) ||
+			!IsCacheStringValid(base, header, material.bumpTextureOffset))
+			return false;
+	}
+
+	return true;
+}
+
+static VertexBufferLayout ReadCachedLayout(const VertexBufferAttribute* attributes, u8 attributeCount, u8 stride)
+{
+	VertexBufferLayout layout = {};
+	layout.vbAttributes.assign(attributes, attributes + attributeCount);
+	layout.stride = stride;
+	return layout;
+}
+
+bool ReadModelFromCache(const char* filename, u32 postProcessFlags, VertexQuantization quantization, const LodSettings& lodSettings, ModelData& data)
+{
+	std::string cachePath = MakeCachePath(filename);
+
+	AssetFile file;
+	if (!ReadAssetFile(cachePath.c_str(), file))
+		return false;
+
+	if (!IsCacheValid(file, filename, postProcessFlags, quantization, lodSettings))
+	{
+		ILOG("Mesh cache %s is stale, reimporting", cachePath.c_str());
+		FreeAssetFile(file);
+		return false;
+	}
+
+	const u8* base = (const u8*)file.data;
+	const MeshCacheHeader* header = (const MeshCacheHeader*)base;
+	const MeshCacheLod* cachedLods = (const MeshCacheLod*)(base + header->lodsOffset);
+	const MeshCacheSubmesh* cachedSubmeshes = (const MeshCacheSubmesh*)(base + header->submeshesOffset);
+	const MeshCacheMaterial* cachedMaterials = (const MeshCacheMaterial*)(base + header->materialsOffset);
+	const Meshlet* cachedMeshlets = (const Meshlet*)(base + header->meshletsOffset);
+
+	// Materials
+	for (u32 i = 0; i < header->materialCount; ++i)
+	{
+		const MeshCacheMaterial& cached = cachedMaterials[i];
+		const char* name = GetCacheString(base, header, cached.nameOffset);
+
+		Material material = {};
+		material.name = name ? name : "";
+		material.albedo = cached.albedo;
+		material.emissive = cached.emissive;
+		material.smoothness = cached.smoothness;
+		data.materials.push_back(material);
+
+		RequestCachedTexture(data.textures, base, header, cached.albedoTextureOffset, TextureUsage_Color, i, &Material::albedoTextureIdx);
+		RequestCachedTexture(data.textures, base, header, cached.emissiveTextureOffset, TextureUsage_Color, i, &Material::emissiveTextureIdx);
+		RequestCachedTexture(data.textures, base, header, cached.specularTextureOffset, TextureUsage_Data, i, &Material::specularTextureIdx);
+		RequestCachedTexture(data.textures, base, header, cached.normalsTextureOffset, TextureUsage_Normal, i, &Material::normalsTextureIdx);
+		RequestCachedTexture(data.textures, base, header, cached.bumpTextureOffset, TextureUsage_Data, i, &Material::bumpTextureIdx);
+	}
+
+	// Levels, prepared: their buffer contents are uploaded from the mapping
+	for (u32 lod = 0; lod < header->lodCount; ++lod)
+	{
+		const MeshCacheLod& cachedLod = cachedLods[lod];
+		PreparedMesh& prepared = data.lods[lod];
+		prepared.cachedVertexData = base + header->vertexBlobOffset + cachedLod.vertexOffset;
+		prepared.cachedIndexData = base + header->indexBlobOffset + cachedLod.indexOffset;
+		prepared.contentHash = cachedLod.contentHash;
+		data.lodError[lod] = cachedLod.error;
+
+		Mesh& mesh = prepared.mesh;
+		mesh.floatVertexBytes = cachedLod.floatVertexBytes;
+		mesh.gpuVertexBytes = cachedLod.vertexSize;
+		mesh.gpuIndexBytes = cachedLod.indexSize;
+		mesh.quantizationError = cachedLod.quantizationError;
+
+		for (u32 i = 0; i < header->submeshCount; ++i)
+		{
+			const MeshCacheSubmesh& cached = cachedSubmeshes[lod * header->submeshCount + i];
+
+			Submesh submesh = {};
+			submesh.vbLayout = ReadCachedLayout(cached.attributes, cached.attributeCount, cached.stride);
+			submesh.gpuLayout = ReadCachedLayout(cached.gpuAttributes, cached.gpuAttributeCount, cached.gpuStride);
+			submesh.decode = cached.decode;
+			submesh.vertexOffset = cached.vertexOffset;
+			submesh.indexOffset = cached.indexOffset;
+			submesh.vertexCount = cached.vertexCount;
+			submesh.indexCount = cached.indexCount;
+			submesh.indexType = (GLenum)cached.indexType;
+			submesh.meshlets.assign(cachedMeshlets + cached.meshletOffset, cachedMeshlets + cached.meshletOffset + cached.meshletCount);
+			submesh.aabbMin = cached.aabbMin;
+			submesh.aabbMax = cached.aabbMax;
+			submesh.boundsCenter = cached.boundsCenter;
+			submesh.boundsRadius = cached.boundsRadius;
+			submesh.statsBefore = cached.statsBefore;
+			submesh.statsAfter = cached.statsAfter;
+			mesh.submeshes.push_back(submesh);
+		}
+	}
+
+	for (u32 i = 0; i < header->submeshCount; ++i)
+		data.submeshMaterials.push_back(cachedSubmeshes[i].materialIdx);
+
+	// The mapping stays alive until the model is committed
+	data.cacheFile = std::move(file);
+	data.lodCount = header->lodCount;
+	data.boundsCenter = header->boundsCenter;
+	data.boundsRadius = header->boundsRadius;
+	data.aabbMin = header->aabbMin;
+	data.aabbMax = header->aabbMax;
+	data.importFlags = postProcessFlags;
+	data.fromCache = true;
+	return true;
+}
+
+static u32 PushCacheString(std::vector<char>& strings, const std::string& str)
+{
+	u32 offset = (u32)strings.size();
+	strings.insert(strings.end(), str.begin(), str.end());
+	strings.push_back('\0');
+	return offset;
+}
+
+static u32 PushCacheTexture(const ModelData& data, std::vector<char>& strings, u32 materialIdx, u32 Material::* textureIdx)
+{
+	for (const TextureRequest& request : data.textures)
+		if (request.materialIdx == materialIdx && request.textureIdx == textureIdx)
+			return PushCacheString(strings, request.filepath);
+	return MESH_CACHE_NO_STRING;
+}
+
+static void WriteCachedLayout(const VertexBufferLayout& layout, VertexBufferAttribute* attributes, u8& attributeCount, u8& stride)
+{
+	attributeCount = (u8)layout.vbAttributes.size();
+	stride = layout.stride;
+	for (u32 j = 0; j < attributeCount; ++j)
+		attributes[j] = layout.vbAttributes[j];
+}
+
+void SaveModelToCache(const char* filename, VertexQuantization quantization, const LodSettings& lodSettings, const ModelData& data)
+{
+	std::vector<MeshCacheLod> lods;
+	std::vector<MeshCacheSubmesh> submeshes;
+	std::vector<MeshCacheMaterial> materials;
+	std::vector<Meshlet> meshlets;
+	std::vector<char> strings;
+
+	// Every level starts 16 byte aligned in the blobs
+	u32 vertexBlobSize = 0;
+	u32 indexBlobSize = 0;
+
+	for (u32 lod = 0; lod < data.lodCount; ++lod)
+	{
+		// The buffer contents are released once uploaded
+		const PreparedMesh& prepared = data.lods[lod];
+		const Mesh& mesh = prepared.mesh;
+		if (prepared.vertexData.size() != mesh.gpuVertexBytes || prepared.indexData.size() != mesh.gpuIndexBytes)
+			return;
+
+		for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+		{
+			const Submesh& submesh = mesh.submeshes[i];
+
+			if (submesh.vbLayout.vbAttributes.size() > MESH_CACHE_MAX_ATTRIBUTES || submesh.gpuLayout.vbAttributes.size() > MESH_CACHE_MAX_ATTRIBUTES)
+			{
+				ELOG("Mesh cache: too many vertex attributes in %s, skipping cache", filename);
+				return;
+			}
+
+			MeshCacheSubmesh cached = {};
+			cached.vertexOffset = submesh.vertexOffset;
+			cached.vertexCount = submesh.vertexCount;
+			cached.indexOffset = submesh.indexOffset;
+			cached.indexCount = submesh.indexCount;
+			cached.indexType = submesh.indexType;
+			cached.materialIdx = data.submeshMaterials[i];
+			cached.meshletOffset = (u32)meshlets.size();
+			cached.meshletCount = (u32)submesh.meshlets.size();
+			cached.statsBefore = submesh.statsBefore;
+			cached.statsAfter = submesh.statsAfter;
+			cached.decode = submesh.decode;
+			cached.aabbMin = submesh.aabbMin;
+			cached.aabbMax = submesh.aabbMax;
+			cached.boundsCenter = submesh.boundsCenter;
+			cached.boundsRadius = submesh.boundsRadius;
+			WriteCachedLayout(submesh.vbLayout, cached.attributes, cached.attributeCount, cached.stride);
+			WriteCachedLayout(submesh.gpuLayout, cached.gpuAttributes, cached.gpuAttributeCount, cached.gpuStride);
+			submeshes.push_back(cached);
+			meshlets.insert(meshlets.end(), submesh.meshlets.begin(), submesh.meshlets.end());
+		}
+
+		MeshCacheLod cachedLod = {};
+		cachedLod.contentHash = prepared.contentHash;
+		cachedLod.vertexOffset = vertexBlobSize;
+		cachedLod.vertexSize = mesh.gpuVertexBytes;
+		cachedLod.indexOffset = indexBlobSize;
+		cachedLod.indexSize = mesh.gpuIndexBytes;
+		cachedLod.floatVertexBytes = mesh.floatVertexBytes;
+		cachedLod.quantizationError = mesh.quantizationError;
+		cachedLod.error = data.lodError[lod];
+		lods.push_back(cachedLod);
+
+		vertexBlobSize = Align(vertexBlobSize + cachedLod.vertexSize, 16);
+		indexBlobSize = Align(indexBlobSize + cachedLod.indexSize, 16);
+	}
+
+	for (u32 i = 0; i < data.materials.size(); ++i)
+	{
+		const Material& material = data.materials[i];
+
+		MeshCacheMaterial cached = {};
+		cached.nameOffset = PushCacheString(strings, material.name);
+		cached.albedo = material.albedo;
+		cached.emissive = material.emissive;
+		cached.smoothness = material.smoothness;
+		cached.albedoTextureOffset = PushCacheTexture(data, strings, i, &Material::albedoTextureIdx);
+		cached.emissiveTextureOffset = PushCacheTexture(data, strings, i, &Material::emissiveTextureIdx);
+		cached.specularTextureOffset = PushCacheTexture(data, strings, i, &Material::specularTextureIdx);
+		cached.normalsTextureOffset = PushCacheTexture(data, strings, i, &Material::normalsTextureIdx);
+		cached.bumpTextureOffset = PushCacheTexture(data, strings, i, &Material::bumpTextureIdx);
+		materials.push_back(cached);
+	}
+
+	MeshCacheHeader header = {};
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.sourceTimestamp = GetAssetTimestamp(filename);
+	header.sourcePathHash = HashPath(filename);
+	header.lodSettingsHash = HashLodSettings(lodSettings);
+	header.postProcessFlags = data.importFlags;
+	header.quantization = (u32)quantization;
+	header.lodCount = lods.size();
+	header.submeshCount = data.lodCount > 0 ? data.lods[0].mesh.submeshes.size() : 0;
+	header.materialCount = materials.size();
+	header.lodsOffset = sizeof(MeshCacheHeader);
+	header.submeshesOffset = header.lodsOffset + lods.size() * sizeof(MeshCacheLod);
+	header.materialsOffset = header.submeshesOffset + submeshes.size() * sizeof(MeshCacheSubmesh);
+	header.meshletsOffset = header.materialsOffset + materials.size() * sizeof(MeshCacheMaterial);
+	header.meshletCount = meshlets.size();
+	header.stringsOffset = header.meshletsOffset + meshlets.size() * sizeof(Meshlet);
+	header.stringsSize = strings.size();
+	header.vertexBlobOffset = Align(header.stringsOffset + header.stringsSize, 16);
+	header.vertexBlobSize = vertexBlobSize;
+	header.indexBlobOffset = Align(header.vertexBlobOffset + header.vertexBlobSize, 16);
+	header.indexBlobSize = indexBlobSize;
+	header.boundsCenter = data.boundsCenter;
+	header.boundsRadius = data.boundsRadius;
+	header.aabbMin = data.aabbMin;
+	header.aabbMax = data.aabbMax;
+
+	std::string cachePath = MakeCachePath(filename);
+	FILE* file = fopen(cachePath.c_str(), "wb");
+	if (!file)
+	{
+		ELOG("Mesh cache: fopen() failed writing file %s", cachePath.c_str());
+		return;
+	}
+
+	const u8 zeros[16] = {};
+	u64 written = 0;
+	bool writeFailed = false;
+	auto Write = [&](const void* bytes, u64 size)
+	{
+		if (!writeFailed && size > 0 && fwrite(bytes, 1, size, file) != size)
+			writeFailed = true;
+		written += size;
+	};
+	auto PadTo = [&](u64 position)
+	{
+		Write(zeros, position - written);
+	};
+
+	Write(&header, sizeof(header));
+	Write(lods.data(), lods.size() * sizeof(MeshCacheLod));
+	Write(submeshes.data(), submeshes.size() * sizeof(MeshCacheSubmesh));
+	Write(materials.data(), materials.size() * sizeof(MeshCacheMaterial));
+	Write(meshlets.data(), meshlets.size() * sizeof(Meshlet));
+	Write(strings.data(), strings.size());
+
+	// The buffer contents as uploaded, one level after the other
+	for (u32 lod = 0; lod < lods.size(); ++lod)
+	{
+		PadTo(header.vertexBlobOffset + lods[lod].vertexOffset);
+		Write(data.lods[lod].vertexData.data(), lods[lod].vertexSize);
+	}
+	for (u32 lod = 0; lod < lods.size(); ++lod)
+	{
+		PadTo(header.indexBlobOffset + lods[lod].indexOffset);
+		Write(data.lods[lod].indexData.data(), lods[lod].indexSize);
+	}
+	PadTo(header.indexBlobOffset + header.indexBlobSize);
+
+	// Do not leave a truncated cache behind
+	if (fclose(file) != 0)
+		writeFailed = true;
+	if (writeFailed)
+	{
+		ELOG("Mesh cache: fwrite() failed writing file %s", cachePath.c_str());
+		remove(cachePath.c_str());
+	}
+}
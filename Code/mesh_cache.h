@@ -0,0 +1,115 @@
+//
+// mesh_cache.h: Binary baked mesh cache. The first time a model is imported the vertex and
+// index buffer contents of its full mesh and of its levels of detail are written next to the
+// source file exactly as they are uploaded (optimized, quantized and with narrowed indices), with
+// their layouts, meshlets, errors and material references. Later runs upload them straight from
+// the mapped file, without simplifying the levels again.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define MESH_CACHE_MAGIC     0x4853454D // "MESH"
+#define MESH_CACHE_VERSION   6
+#define MESH_CACHE_EXTENSION ".mcache"
+
+#define MESH_CACHE_MAX_ATTRIBUTES 8
+#define MESH_CACHE_NO_STRING      UINT32_MAX
+
+struct MeshCacheHeader
+{
+	u32 magic;
+	u32 version;
+	u64 sourceTimestamp;   // last write time of the source file
+	u64 sourcePathHash;
+	u64 lodSettingsHash;   // of the settings the levels of detail were built with
+	u32 postProcessFlags;  // Assimp flags used for the import, or OBJ_IMPORT_CACHE_FLAGS
+	u32 quantization;      // VertexQuantization of the GPU vertices
+	u32 lodCount;          // levels with GPU buffers, the full mesh first
+	u32 submeshCount;      // in every level
+	u32 materialCount;
+	u32 lodsOffset;
+	u32 submeshesOffset;   // submeshCount of each level, one level after the other
+	u32 materialsOffset;
+	u32 stringsOffset;
+	u32 stringsSize;
+	u32 vertexBlobOffset;  // GPU vertices of every level
+	u32 vertexBlobSize;
+	u32 indexBlobOffset;   // GPU indices of every level
+	u32 indexBlobSize;
+	u32 meshletsOffset;
+	u32 meshletCount;
+
+	// Of the full mesh, as BuildLodMeshes computes them
+	vec3 boundsCenter;
+	f32 boundsRadius;
+	vec3 aabbMin;
+	vec3 aabbMax;
+};
+
+// Buffer contents of a level as PrepareMesh lays them out
+struct MeshCacheLod
+{
+	u64 contentHash;       // PreparedMesh::contentHash
+	u32 vertexOffset;      // in bytes, relative to the vertex blob
+	u32 vertexSize;
+	u32 indexOffset;       // in bytes, relative to the index blob
+	u32 indexSize;
+	u32 floatVertexBytes;
+	QuantizationError quantizationError;
+	f32 error;             // ModelData::lodError
+};
+
+struct MeshCacheSubmesh
+{
+	u32 vertexOffset;      // in bytes, relative to the vertices of its level
+	u32 vertexCount;
+	u32 indexOffset;       // in bytes, relative to the indices of its level
+	u32 indexCount;
+	u32 indexType;         // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	u32 materialIdx;       // relative to the first material of the model
+	u32 meshletOffset;     // in meshlets, relative to the first meshlet
+	u32 meshletCount;
+	VertexCacheStats statsBefore;
+	VertexCacheStats statsAfter;
+	VertexDecode decode;
+	vec3 aabbMin;
+	vec3 aabbMax;
+	vec3 boundsCenter;
+	f32 boundsRadius;
+	u8  stride;            // of the float vertices
+	u8  attributeCount;
+	u8  gpuStride;
+	u8  gpuAttributeCount;
+	VertexBufferAttribute attributes[MESH_CACHE_MAX_ATTRIBUTES];
+	VertexBufferAttribute gpuAttributes[MESH_CACHE_MAX_ATTRIBUTES];
+};
+
+struct MeshCacheMaterial
+{
+	u32 nameOffset;    // offsets in the string table
+	vec3 albedo;
+	vec3 emissive;
+	f32 smoothness;
+	u32 albedoTextureOffset;
+	u32 emissiveTextureOffset;
+	u32 specularTextureOffset;
+	u32 normalsTextureOffset;
+	u32 bumpTextureOffset;
+};
+
+/**
+ * Reads the model from its baked cache into data, which is left untouched and false returned
+ * if there is no cache for this file or if it is stale (different source timestamp, flags,
+ * quantization, level of detail settings or format version). Every level comes back prepared,
+ * with its error and the bounds of the model, its buffer contents pointing into data.cacheFile.
+ * The submeshes have no float vertices or indices. Safe in any thread.
+ */
+bool ReadModelFromCache(const char* filename, u32 postProcessFlags, VertexQuantization quantization, const LodSettings& lodSettings, ModelData& data);
+
+/**
+ * Writes the baked cache of a prepared model, before it is uploaded: the buffer contents of its
+ * levels, its materials and the paths of their textures, with data.importFlags as the flags.
+ */
+void SaveModelToCache(const char* filename, VertexQuantization quantization, const LodSettings& lodSettings, const ModelData& data);
@@ -0,0 +1,187 @@
+#include "mesh_conversion.h"
+#include <emmintrin.h>
+
+VertexBufferLayout MakeAssimpVertexLayout(bool hasTexCoords, bool hasTangentSpace)
+{
+	VertexBufferLayout vertexBufferLayout = {};
+	vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 0, 3, 0, VertexFormat_Float32, 0 }); // 3D positions
+	vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float), VertexFormat_Float32, 0 }); // normals
+	vertexBufferLayout.stride = 6 * sizeof(float);
+	if (hasTexCoords)
+	{
+		vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride, VertexFormat_Float32, 0 });
+		vertexBufferLayout.stride += 2 * sizeof(float);
+	}
+	if (hasTangentSpace)
+	{
+		vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride, VertexFormat_Float32, 0 });
+		vertexBufferLayout.stride += 3 * sizeof(float);
+
+		vertexBufferLayout.vbAttributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride, VertexFormat_Float32, 0 });
+		vertexBufferLayout.stride += 3 * sizeof(float);
+	}
+	return vertexBufferLayout;
+}
+
+/**
+ * Every attribute is moved with one 16 byte load and store. The fourth lane spills into the
+ * next attribute (or the next vertex), which is written afterwards. The last vertex of the
+ * range takes the scalar path so it stays inside the source arrays and the output, and does
+ * not touch the vertices converted by another job.
+ */
+template <bool TexCoords, bool TangentSpace>
+static void ConvertVerticesKernel(const aiMesh* mesh, u32 begin, u32 end, float* vertices)
+{
+	const u32 stride = 6 + (TexCoords ? 2 : 0) + (TangentSpace ? 6 : 0);
+
+	const float* positions = &mesh->mVertices[0].x;
+	const float* normals = &mesh->mNormals[0].x;
+	const float* texCoords = TexCoords ? &mesh->mTextureCoords[0][0].x : NULL;
+	const float* tangents = TangentSpace ? &mesh->mTangents[0].x : NULL;
+	const float* bitangents = TangentSpace ? &mesh->mBitangents[0].x : NULL;
+
+	// For some reason ASSIMP gives me the bitangents flipped (left-handed tangent space), invert them
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+
+	u32 simdEnd = end > begin ? end - 1 : begin;
+	u32 i = begin;
+
+	for (; i < simdEnd; ++i)
+	{
+		float* out = vertices + (size_t)i * stride;
+		u32 offset = 6;
+
+		_mm_storeu_ps(out + 0, _mm_loadu_ps(positions + i * 3));
+		_mm_storeu_ps(out + 3, _mm_loadu_ps(normals + i * 3));
+
+		if (TexCoords)
+		{
+			// Texture coordinates are 3D in Assimp, only xy are kept
+			_mm_storeu_ps(out + offset, _mm_loadu_ps(texCoords + i * 3));
+			offset += 2;
+		}
+
+		if (TangentSpace)
+		{
+			_mm_storeu_ps(out + offset, _mm_loadu_ps(tangents + i * 3));
+			_mm_storeu_ps(out + offset + 3, _mm_xor_ps(_mm_loadu_ps(bitangents + i * 3), signMask));
+		}
+	}
+
+	for (; i < end; ++i)
+	{
+		float* out = vertices + (size_t)i * stride;
+		u32 offset = 6;
+
+		memcpy(out + 0, positions + i * 3, 3 * sizeof(float));
+		memcpy(out + 3, normals + i * 3, 3 * sizeof(float));
+
+		if (TexCoords)
+		{
+			memcpy(out + offset, texCoords + i * 3, 2 * sizeof(float));
+			offset += 2;
+		}
+
+		if (TangentSpace)
+		{
+			memcpy(out + offset, tangents + i * 3, 3 * sizeof(float));
+			out[offset + 3] = -bitangents[i * 3 + 0];
+			out[offset + 4] = -bitangents[i * 3 + 1];
+			out[offset + 5] = -bitangents[i * 3 + 2];
+		}
+	}
+}
+
+void ConvertAssimpVertices(const aiMesh* mesh, bool hasTexCoords, bool hasTangentSpace, u32 begin, u32 end, float* vertices)
+{
+	if (hasTexCoords && hasTangentSpace)
+		ConvertVerticesKernel<true, true>(mesh, begin, end, vertices);
+	else if (hasTexCoords)
+		ConvertVerticesKernel<true, false>(mesh, begin, end, vertices);
+	else if (hasTangentSpace)
+		ConvertVerticesKernel<false, true>(mesh, begin, end, vertices);
+	else
+		ConvertVerticesKernel<false, false>(mesh, begin, end, vertices);
+}
+
+u32 CountAssimpIndices(const aiMesh* mesh)
+{
+	// aiProcess_SortByPType leaves one primitive type per mesh
+	if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE)
+		return mesh->mNumFaces * 3;
+
+	u32 indexCount = 0;
+	for (u32 i = 0; i < mesh->mNumFaces; ++i)
+		indexCount += mesh->mFaces[i].mNumIndices;
+	return indexCount;
+}
+
+void ConvertAssimpFaces(const aiMesh* mesh, u32* indices)
+{
+	const aiFace* faces = mesh->mFaces;
+
+	if (mesh->mPrimitiveTypes == aiPrimitiveType_TRIANGLE)
+	{
+		for (u32 i = 0; i < mesh->mNumFaces; ++i)
+			memcpy(indices + i * 3, faces[i].mIndices, 3 * sizeof(u32));
+		return;
+	}
+
+	for (u32 i = 0; i < mesh->mNumFaces; ++i)
+	{
+		memcpy(indices, faces[i].mIndices, faces[i].mNumIndices * sizeof(u32));
+		indices += faces[i].mNumIndices;
+	}
+}
+
+GLenum ChooseIndexType(const Submesh& submesh)
+{
+	u32 floatsPerVertex = submesh.vbLayout.stride / sizeof(float);
+	u64 vertexCount = floatsPerVertex > 0 ? submesh.vertices.size() / floatsPerVertex : 0;
+	return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+u32 GetIndexTypeSize(GLenum indexType)
+{
+	return indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+}
+
+void ConvertIndicesToU16(const u32* indices, u32 count, u16* output)
+{
+	// _mm_packs_epi32 saturates to signed 16 bits, so the values are biased into its range and back
+	const __m128i bias32 = _mm_set1_epi32(32768);
+	const __m128i bias16 = _mm_set1_epi16(-32768);
+
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i low = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(indices + i)), bias32);
+		__m128i high = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(indices + i + 4)), bias32);
+		_mm_storeu_si128((__m128i*)(output + i), _mm_xor_si128(_mm_packs_epi32(low, high), bias16));
+	}
+
+	for (; i < count; ++i)
+		output[i] = (u16)indices[i];
+}
+
+static const u32 VerticesPerJob = 64 * 1024;
+
+void ConvertAssimpMesh(ThreadPool* pool, const aiMesh* mesh, Submesh* submesh)
+{
+	bool hasTexCoords = mesh->mTextureCoords[0] != NULL;
+	bool hasTangentSpace = mesh->mTangents != NULL && mesh->mBitangents != NULL;
+
+	submesh->vbLayout = MakeAssimpVertexLayout(hasTexCoords, hasTangentSpace);
+
+	u32 floatsPerVertex = submesh->vbLayout.stride / sizeof(float);
+	submesh->vertices.resize((size_t)mesh->mNumVertices * floatsPerVertex);
+	submesh->indices.resize(CountAssimpIndices(mesh));
+
+	float* vertices = submesh->vertices.data();
+	ParallelFor(pool, mesh->mNumVertices, VerticesPerJob, [=](u32 begin, u32 end)
+		{
+			ConvertAssimpVertices(mesh, hasTexCoords, hasTangentSpace, begin, end, vertices);
+		});
+
+	ConvertAssimpFaces(mesh, submesh->indices.data());
+}
@@ -0,0 +1,46 @@
+//
+// mesh_conversion.h: Conversion of the Assimp meshes into the interleaved vertex and index
+// streams of our submeshes. Outputs are sized once and written with SSE kernels specialised
+// for each set of vertex attributes.
+//
+
+#pragma once
+
+#include "engine.h"
+
+/**
+ * Layout of the vertices produced for an Assimp mesh: position, normal and, if present,
+ * texture coordinates and tangent + bitangent.
+ */
+VertexBufferLayout MakeAssimpVertexLayout(bool hasTexCoords, bool hasTangentSpace);
+
+/**
+ * Writes the interleaved vertices [begin, end) of the mesh. The output must have room for
+ * the whole mesh with the layout given by MakeAssimpVertexLayout.
+ */
+void ConvertAssimpVertices(const aiMesh* mesh, bool hasTexCoords, bool hasTangentSpace, u32 begin, u32 end, float* vertices);
+
+/**
+ * Number of indices of all the faces of the mesh.
+ */
+u32 CountAssimpIndices(const aiMesh* mesh);
+
+void ConvertAssimpFaces(const aiMesh* mesh, u32* indices);
+
+/**
+ * Index type to draw the submesh with: 16 bit indices whenever it has at most 65536 vertices.
+ */
+GLenum ChooseIndexType(const Submesh& submesh);
+
+u32 GetIndexTypeSize(GLenum indexType);
+
+/**
+ * Narrows indices to 16 bits. All of them must be below 65536.
+ */
+void ConvertIndicesToU16(const u32* indices, u32 count, u16* output);
+
+/**
+ * Fills the layout, vertices and indices of the submesh from the Assimp mesh. Vertices are
+ * converted in parallel in the thread pool when there are many of them.
+ */
+void ConvertAssimpMesh(ThreadPool* pool, const aiMesh* mesh, Submesh* submesh);
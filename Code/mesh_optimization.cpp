@@ -0,0 +1,390 @@
+#include "mesh_optimization.h"
+#include "meshlets.h"
+#include <algorithm>
+
+static const VertexBufferAttribute* FindPositionAttribute(const VertexBufferLayout& layout)
+{
+	for (const VertexBufferAttribute& attribute : layout.vbAttributes)
+		if (attribute.location == 0 && attribute.componentCount >= 3)
+			return &attribute;
+	return NULL;
+}
+
+static u32 GetVertexCount(const Submesh& submesh)
+{
+	u32 floatsPerVertex = submesh.vbLayout.stride / sizeof(float);
+	return floatsPerVertex > 0 ? (u32)(submesh.vertices.size() / floatsPerVertex) : 0;
+}
+
+static vec3 GetPosition(const Submesh& submesh, u32 positionOffset, u32 vertex)
+{
+	const float* p = submesh.vertices.data() + (size_t)vertex * (submesh.vbLayout.stride / sizeof(float)) + positionOffset;
+	return vec3(p[0], p[1], p[2]);
+}
+
+void OptimizeSubmesh(Submesh& submesh)
+{
+	if (submesh.indices.empty() || !FindPositionAttribute(submesh.vbLayout))
+		return;
+
+	submesh.statsBefore = AnalyzeSubmesh(submesh);
+
+	OptimizeVertexCache(submesh.indices.data(), (u32)submesh.indices.size(), GetVertexCount(submesh));
+
+	// The meshlets are grown from the cache friendly order, then each one is put back in
+	// that order since growing them shuffles their triangles
+	BuildMeshlets(submesh);
+	std::vector<u32> vertexRemap(GetVertexCount(submesh), UINT32_MAX);
+	std::vector<u32> localIndices;
+	for (const Meshlet& meshlet : submesh.meshlets)
+	{
+		u32* indices = submesh.indices.data() + meshlet.indexOffset;
+		u32 indexCount = meshlet.triangleCount * 3;
+
+		std::vector<u32> localVertices;
+		localIndices.resize(indexCount);
+		for (u32 i = 0; i < indexCount; ++i)
+		{
+			if (vertexRemap[indices[i]] == UINT32_MAX)
+			{
+				vertexRemap[indices[i]] = (u32)localVertices.size();
+				localVertices.push_back(indices[i]);
+			}
+			localIndices[i] = vertexRemap[indices[i]];
+		}
+
+		OptimizeVertexCache(localIndices.data(), indexCount, (u32)localVertices.size());
+
+		for (u32 i = 0; i < indexCount; ++i)
+			indices[i] = localVertices[localIndices[i]];
+		for (u32 vertex : localVertices)
+			vertexRemap[vertex] = UINT32_MAX;
+	}
+
+	OptimizeMeshletOverdraw(submesh);
+	OptimizeVertexFetch(submesh);
+
+	submesh.statsAfter = AnalyzeSubmesh(submesh);
+}
+
+// Tipsify ///////////////////////////////////////////////////////////////////////
+
+void OptimizeVertexCache(u32* indices, u32 indexCount, u32 vertexCount)
+{
+	const u32 triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	// Triangles around each vertex and how many of them are still to be emitted
+	std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+	std::vector<u32> liveCounts(vertexCount, 0);
+	for (u32 i = 0; i < triangleCount * 3; ++i)
+		liveCounts[indices[i]]++;
+	for (u32 v = 0; v < vertexCount; ++v)
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveCounts[v];
+
+	std::vector<u32> adjacency(triangleCount * 3);
+	std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (u32 i = 0; i < triangleCount * 3; ++i)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	std::vector<u32> cacheTimestamps(vertexCount, 0);
+	std::vector<u8> emitted(triangleCount, 0);
+	std::vector<u32> deadEnds;
+	std::vector<u32> candidates;
+	std::vector<u32> output;
+	output.reserve(triangleCount * 3);
+
+	const u32 cacheSize = VERTEX_CACHE_SIZE;
+	u32 timestamp = cacheSize + 1;
+	u32 cursor = 0;
+	u32 fanning = indices[0];
+
+	while (fanning != UINT32_MAX)
+	{
+		candidates.clear();
+
+		// Emit every triangle around the fanning vertex
+		for (u32 j = adjacencyOffsets[fanning]; j < adjacencyOffsets[fanning + 1]; ++j)
+		{
+			u32 t = adjacency[j];
+			if (emitted[t])
+				continue;
+
+			for (u32 k = 0; k < 3; ++k)
+			{
+				u32 v = indices[t * 3 + k];
+				output.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveCounts[v]--;
+
+				if (timestamp - cacheTimestamps[v] > cacheSize)
+					cacheTimestamps[v] = timestamp++;
+			}
+			emitted[t] = 1;
+		}
+
+		// Next fanning vertex: the oldest candidate that will still be in the cache after
+		// emitting its remaining triangles
+		fanning = UINT32_MAX;
+		i32 bestPriority = -1;
+		for (u32 v : candidates)
+		{
+			if (liveCounts[v] == 0)
+				continue;
+
+			i32 priority = 0;
+			if (timestamp - cacheTimestamps[v] + 2 * liveCounts[v] <= cacheSize)
+				priority = (i32)(timestamp - cacheTimestamps[v]);
+
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				fanning = v;
+			}
+		}
+
+		// Dead end: go back to a recently used vertex, or to the next one in order
+		while (fanning == UINT32_MAX && !deadEnds.empty())
+		{
+			u32 v = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveCounts[v] > 0)
+				fanning = v;
+		}
+
+		while (fanning == UINT32_MAX && cursor < vertexCount)
+		{
+			if (liveCounts[cursor] > 0)
+				fanning = cursor;
+			cursor++;
+		}
+	}
+
+	memcpy(indices, output.data(), output.size() * sizeof(u32));
+}
+
+// Overdraw //////////////////////////////////////////////////////////////////////
+
+void OptimizeMeshletOverdraw(Submesh& submesh)
+{
+	const VertexBufferAttribute* positionAttribute = FindPositionAttribute(submesh.vbLayout);
+	if (!positionAttribute || submesh.meshlets.size() < 2)
+		return;
+
+	const u32 positionOffset = positionAttribute->offset / sizeof(float);
+	const u32 meshletCount = (u32)submesh.meshlets.size();
+
+	// Area weighted centroid and normal of every meshlet
+	std::vector<vec3> centroids(meshletCount, vec3(0.0f));
+	std::vector<vec3> normals(meshletCount, vec3(0.0f));
+	vec3 meshCentroid = vec3(0.0f);
+	f32 meshArea = 0.0f;
+
+	for (u32 m = 0; m < meshletCount; ++m)
+	{
+		const Meshlet& meshlet = submesh.meshlets[m];
+		f32 meshletArea = 0.0f;
+
+		for (u32 t = 0; t < meshlet.triangleCount; ++t)
+		{
+			const u32* triangle = submesh.indices.data() + meshlet.indexOffset + t * 3;
+			vec3 p0 = GetPosition(submesh, positionOffset, triangle[0]);
+			vec3 p1 = GetPosition(submesh, positionOffset, triangle[1]);
+			vec3 p2 = GetPosition(submesh, positionOffset, triangle[2]);
+
+			vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			f32 area = glm::length(normal);
+
+			centroids[m] += (p0 + p1 + p2) * (area / 3.0f);
+			normals[m] += normal;
+			meshletArea += area;
+		}
+
+		meshCentroid += centroids[m];
+		meshArea += meshletArea;
+		centroids[m] = meshletArea > 0.0f ? centroids[m] / meshletArea : meshlet.center;
+	}
+	meshCentroid = meshArea > 0.0f ? meshCentroid / meshArea : vec3(0.0f);
+
+	std::vector<f32> sortKeys(meshletCount);
+	std::vector<u32> order(meshletCount);
+	for (u32 m = 0; m < meshletCount; ++m)
+	{
+		f32 length = glm::length(normals[m]);
+		sortKeys[m] = length > 0.0f ? glm::dot(centroids[m] - meshCentroid, normals[m] / length) : 0.0f;
+		order[m] = m;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&sortKeys](u32 a, u32 b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<u32> indices;
+	std::vector<Meshlet> meshlets;
+	indices.reserve(submesh.indices.size());
+	meshlets.reserve(meshletCount);
+	for (u32 m : order)
+	{
+		Meshlet meshlet = submesh.meshlets[m];
+		const u32* begin = submesh.indices.data() + meshlet.indexOffset;
+		meshlet.indexOffset = (u32)indices.size();
+		indices.insert(indices.end(), begin, begin + meshlet.triangleCount * 3);
+		meshlets.push_back(meshlet);
+	}
+
+	submesh.indices.swap(indices);
+	submesh.meshlets.swap(meshlets);
+}
+
+// Vertex fetch //////////////////////////////////////////////////////////////////
+
+void OptimizeVertexFetch(Submesh& submesh)
+{
+	const u32 floatsPerVertex = submesh.vbLayout.stride / sizeof(float);
+	if (floatsPerVertex == 0)
+		return;
+
+	std::vector<u32> remap(GetVertexCount(submesh), UINT32_MAX);
+	std::vector<float> vertices;
+	vertices.reserve(submesh.vertices.size());
+
+	u32 usedCount = 0;
+	for (u32& index : submesh.indices)
+	{
+		if (remap[index] == UINT32_MAX)
+		{
+			remap[index] = usedCount++;
+			const float* vertex = submesh.vertices.data() + (size_t)index * floatsPerVertex;
+			vertices.insert(vertices.end(), vertex, vertex + floatsPerVertex);
+		}
+		index = remap[index];
+	}
+
+	submesh.vertices.swap(vertices);
+}
+
+// Analysis //////////////////////////////////////////////////////////////////////
+
+static const u32 OverdrawGridSize = 256;
+
+struct OverdrawCounters
+{
+	u64 shaded;
+	u64 covered;
+};
+
+// Rasterizes the projected triangles in order with a depth test, counting the fragments that pass
+static void RasterizeOverdraw(const std::vector<vec3>& projected, const u32* indices, u32 indexCount, std::vector<f32>& depth, OverdrawCounters& counters)
+{
+	std::fill(depth.begin(), depth.end(), FLT_MAX);
+
+	for (u32 i = 0; i + 2 < indexCount; i += 3)
+	{
+		vec3 a = projected[indices[i + 0]];
+		vec3 b = projected[indices[i + 1]];
+		vec3 c = projected[indices[i + 2]];
+
+		f32 area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+		if (area == 0.0f)
+			continue;
+		if (area < 0.0f)
+		{
+			std::swap(b, c);
+			area = -area;
+		}
+
+		i32 minX = glm::max((i32)floorf(glm::min(a.x, glm::min(b.x, c.x))), 0);
+		i32 minY = glm::max((i32)floorf(glm::min(a.y, glm::min(b.y, c.y))), 0);
+		i32 maxX = glm::min((i32)ceilf(glm::max(a.x, glm::max(b.x, c.x))), (i32)OverdrawGridSize - 1);
+		i32 maxY = glm::min((i32)ceilf(glm::max(a.y, glm::max(b.y, c.y))), (i32)OverdrawGridSize - 1);
+
+		for (i32 y = minY; y <= maxY; ++y)
+		{
+			for (i32 x = minX; x <= maxX; ++x)
+			{
+				f32 px = x + 0.5f;
+				f32 py = y + 0.5f;
+				f32 w0 = (c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x);
+				f32 w1 = (a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x);
+				f32 w2 = (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+				if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+					continue;
+
+				f32 z = (w0 * a.z + w1 * b.z + w2 * c.z) / area;
+				f32& stored = depth[y * OverdrawGridSize + x];
+				if (z < stored)
+				{
+					counters.covered += stored == FLT_MAX ? 1 : 0;
+					counters.shaded++;
+					stored = z;
+				}
+			}
+		}
+	}
+}
+
+VertexCacheStats AnalyzeSubmesh(const Submesh& submesh)
+{
+	VertexCacheStats stats = {};
+
+	const VertexBufferAttribute* positionAttribute = FindPositionAttribute(submesh.vbLayout);
+	const u32 indexCount = (u32)submesh.indices.size();
+	const u32 vertexCount = GetVertexCount(submesh);
+	if (!positionAttribute || indexCount < 3 || vertexCount == 0)
+		return stats;
+
+	// FIFO cache simulation
+	std::vector<u32> cacheTimestamps(vertexCount, 0);
+	std::vector<u8> used(vertexCount, 0);
+	u32 timestamp = VERTEX_CACHE_SIZE + 1;
+	u32 transformed = 0;
+	u32 uniqueVertices = 0;
+
+	for (u32 index : submesh.indices)
+	{
+		if (timestamp - cacheTimestamps[index] > VERTEX_CACHE_SIZE)
+		{
+			cacheTimestamps[index] = timestamp++;
+			transformed++;
+		}
+		uniqueVertices += used[index] ? 0 : 1;
+		used[index] = 1;
+	}
+
+	stats.acmr = (f32)transformed / (indexCount / 3);
+	stats.atvr = (f32)transformed / uniqueVertices;
+
+	// Overdraw from the six axis directions, the mesh fit in the grid keeping its proportions
+	const u32 positionOffset = positionAttribute->offset / sizeof(float);
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	for (u32 v = 0; v < vertexCount; ++v)
+	{
+		vec3 p = GetPosition(submesh, positionOffset, v);
+		boundsMin = glm::min(boundsMin, p);
+		boundsMax = glm::max(boundsMax, p);
+	}
+	vec3 extent = boundsMax - boundsMin;
+	f32 scale = (OverdrawGridSize - 1) / glm::max(glm::max(extent.x, glm::max(extent.y, extent.z)), 1e-8f);
+
+	std::vector<vec3> projected(vertexCount);
+	std::vector<f32> depth(OverdrawGridSize * OverdrawGridSize);
+	OverdrawCounters counters = {};
+
+	for (u32 axis = 0; axis < 3; ++axis)
+	{
+		for (u32 direction = 0; direction < 2; ++direction)
+		{
+			for (u32 v = 0; v < vertexCount; ++v)
+			{
+				vec3 p = (GetPosition(submesh, positionOffset, v) - boundsMin) * scale;
+				f32 z = direction == 0 ? p[axis] : -p[axis];
+				projected[v] = vec3(p[(axis + 1) % 3], p[(axis + 2) % 3], z);
+			}
+			RasterizeOverdraw(projected, submesh.indices.data(), indexCount, depth, counters);
+		}
+	}
+
+	stats.overdraw = counters.covered > 0 ? (f32)counters.shaded / counters.covered : 0.0f;
+	return stats;
+}
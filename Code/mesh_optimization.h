@@ -0,0 +1,40 @@
+//
+// mesh_optimization.h: Reordering of the triangles and vertices of the submeshes for the GPU:
+// post-transform vertex cache (Tipsify), overdraw (outward facing clusters first) and vertex
+// fetch (vertices in order of first use).
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define VERTEX_CACHE_SIZE 16
+
+/**
+ * Runs the whole pipeline on a submesh: vertex cache order, meshlets, overdraw order of the
+ * meshlets and vertex fetch order. Fills statsBefore and statsAfter.
+ */
+void OptimizeSubmesh(Submesh& submesh);
+
+/**
+ * Tipsify (Sander et al. 2007): fans around the vertices still in a FIFO cache of
+ * VERTEX_CACHE_SIZE entries and jumps to the most recent dead end when none is left.
+ */
+void OptimizeVertexCache(u32* indices, u32 indexCount, u32 vertexCount);
+
+/**
+ * Sorts the meshlets so the ones facing away from the center of the submesh go first, as they
+ * tend to occlude the rest from any point of view. Meshlets stay contiguous.
+ */
+void OptimizeMeshletOverdraw(Submesh& submesh);
+
+/**
+ * Renumbers the vertices in order of first use by the indices and drops the unused ones.
+ */
+void OptimizeVertexFetch(Submesh& submesh);
+
+/**
+ * ACMR and ATVR with a FIFO cache of VERTEX_CACHE_SIZE entries, and the overdraw of the
+ * triangles rasterized in order from the six axis directions.
+ */
+VertexCacheStats AnalyzeSubmesh(const Submesh& submesh);
@@ -0,0 +1,242 @@
+#include "mesh_simplification.h"
+#include <algorithm>
+
+// Symmetric 4x4 matrix of the squared distance to a set of planes, weighted by triangle area
+struct Quadric
+{
+	f64 a2, b2, c2, d2;
+	f64 ab, ac, ad;
+	f64 bc, bd;
+	f64 cd;
+	f64 weight;
+};
+
+static void AddPlane(Quadric& q, vec3 n, f32 d, f32 weight)
+{
+	q.a2 += weight * n.x * n.x;
+	q.b2 += weight * n.y * n.y;
+	q.c2 += weight * n.z * n.z;
+	q.d2 += weight * d * d;
+	q.ab += weight * n.x * n.y;
+	q.ac += weight * n.x * n.z;
+	q.ad += weight * n.x * d;
+	q.bc += weight * n.y * n.z;
+	q.bd += weight * n.y * d;
+	q.cd += weight * n.z * d;
+	q.weight += weight;
+}
+
+static void AddQuadric(Quadric& q, const Quadric& r)
+{
+	q.a2 += r.a2; q.b2 += r.b2; q.c2 += r.c2; q.d2 += r.d2;
+	q.ab += r.ab; q.ac += r.ac; q.ad += r.ad;
+	q.bc += r.bc; q.bd += r.bd;
+	q.cd += r.cd;
+	q.weight += r.weight;
+}
+
+// Mean squared distance of p to the planes of the quadric
+static f64 QuadricError(const Quadric& q, vec3 p)
+{
+	f64 x = p.x, y = p.y, z = p.z;
+	f64 error = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z + q.d2 +
+		2.0 * (q.ab * x * y + q.ac * x * z + q.bc * y * z + q.ad * x + q.bd * y + q.cd * z);
+	return q.weight > 0.0 ? fabs(error) / q.weight : 0.0;
+}
+
+struct Collapse
+{
+	u32 from;
+	u32 to;
+	f32 cost; // squared error
+};
+
+static vec3 TriangleNormal(vec3 p0, vec3 p1, vec3 p2)
+{
+	return glm::cross(p1 - p0, p2 - p0);
+}
+
+f32 SimplifySubmesh(const Submesh& submesh, u32 targetIndexCount, f32 maxError, std::vector<u32>& indices)
+{
+	indices = submesh.indices;
+
+	const VertexBufferAttribute* positionAttribute = NULL;
+	for (const VertexBufferAttribute& attribute : submesh.vbLayout.vbAttributes)
+		if (attribute.location == 0)
+			positionAttribute = &attribute;
+
+	const u32 floatsPerVertex = submesh.vbLayout.stride / sizeof(float);
+	if (!positionAttribute || floatsPerVertex == 0 || indices.size() <= targetIndexCount)
+		return 0.0f;
+
+	const u32 vertexCount = (u32)(submesh.vertices.size() / floatsPerVertex);
+	std::vector<vec3> positions(vertexCount);
+	for (u32 v = 0; v < vertexCount; ++v)
+	{
+		const float* p = submesh.vertices.data() + (size_t)v * floatsPerVertex + positionAttribute->offset / sizeof(float);
+		positions[v] = vec3(p[0], p[1], p[2]);
+	}
+
+	// Quadrics of the planes around each vertex
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const u32* t = &indices[i];
+		vec3 n = TriangleNormal(positions[t[0]], positions[t[1]], positions[t[2]]);
+		f32 length = glm::length(n);
+		if (length <= 0.0f)
+			continue;
+
+		n /= length;
+		f32 d = -glm::dot(n, positions[t[0]]);
+		for (u32 k = 0; k < 3; ++k)
+			AddPlane(quadrics[t[k]], n, d, length * 0.5f);
+	}
+
+	// Edges with a single triangle are borders, which include the seams between vertices that
+	// share a position but not the other attributes. Their vertices are never moved.
+	std::vector<u8> locked(vertexCount, 0);
+	{
+		std::unordered_map<u64, u32> edgeCounts;
+		edgeCounts.reserve(indices.size());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (u32 k = 0; k < 3; ++k)
+			{
+				u32 a = indices[i + k];
+				u32 b = indices[i + (k + 1) % 3];
+				edgeCounts[((u64)glm::min(a, b) << 32) | glm::max(a, b)]++;
+			}
+		}
+		for (const auto& edge : edgeCounts)
+		{
+			if (edge.second == 1)
+			{
+				locked[(u32)(edge.first >> 32)] = 1;
+				locked[(u32)edge.first] = 1;
+			}
+		}
+	}
+
+	const f64 maxErrorSquared = (f64)maxError * maxError;
+	f64 resultErrorSquared = 0.0;
+
+	std::vector<u32> triangleOffsets(vertexCount + 1);
+	std::vector<u32> triangles;
+	std::vector<Collapse> collapses;
+	std::vector<u32> remap(vertexCount);
+	std::vector<u8> touched(vertexCount);
+
+	// Each pass performs the cheapest collapses whose neighbourhoods do not overlap
+	while (indices.size() > targetIndexCount)
+	{
+		// Triangles around each vertex
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (u32 index : indices)
+			triangleOffsets[index + 1]++;
+		for (u32 v = 0; v < vertexCount; ++v)
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		triangles.resize(indices.size());
+		std::vector<u32> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (u32 i = 0; i < (u32)indices.size(); ++i)
+			triangles[fill[indices[i]]++] = i / 3;
+
+		collapses.clear();
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			for (u32 k = 0; k < 3; ++k)
+			{
+				u32 a = indices[i + k];
+				u32 b = indices[i + (k + 1) % 3];
+				if (!locked[a])
+				{
+					Quadric q = quadrics[a];
+					AddQuadric(q, quadrics[b]);
+					collapses.push_back({ a, b, (f32)QuadricError(q, positions[b]) });
+				}
+				if (!locked[b])
+				{
+					Quadric q = quadrics[b];
+					AddQuadric(q, quadrics[a]);
+					collapses.push_back({ b, a, (f32)QuadricError(q, positions[a]) });
+				}
+			}
+		}
+
+		if (collapses.empty())
+			break;
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		// An interior collapse removes two triangles
+		const u32 collapseLimit = (u32)((indices.size() - targetIndexCount) / 6 + 1);
+		u32 collapseCount = 0;
+
+		for (u32 v = 0; v < vertexCount; ++v)
+			remap[v] = v;
+		std::fill(touched.begin(), touched.end(), 0);
+
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapse.cost > maxErrorSquared || collapseCount >= collapseLimit)
+				break;
+
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			// Reject the collapse if a remaining triangle around the vertex flips over
+			bool flips = false;
+			for (u32 j = triangleOffsets[collapse.from]; j < triangleOffsets[collapse.from + 1] && !flips; ++j)
+			{
+				const u32* t = &indices[triangles[j] * 3];
+				if (t[0] == collapse.to || t[1] == collapse.to || t[2] == collapse.to)
+					continue;
+
+				vec3 before[3] = { positions[t[0]], positions[t[1]], positions[t[2]] };
+				vec3 after[3] = { before[0], before[1], before[2] };
+				for (u32 k = 0; k < 3; ++k)
+					if (t[k] == collapse.from)
+						after[k] = positions[collapse.to];
+
+				vec3 normalBefore = TriangleNormal(before[0], before[1], before[2]);
+				vec3 normalAfter = TriangleNormal(after[0], after[1], after[2]);
+				flips = glm::dot(normalBefore, normalAfter) <= 1e-2f * glm::length(normalBefore) * glm::length(normalAfter);
+			}
+			if (flips)
+				continue;
+
+			remap[collapse.from] = collapse.to;
+			AddQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+			resultErrorSquared = glm::max(resultErrorSquared, (f64)collapse.cost);
+			collapseCount++;
+
+			// The whole neighbourhood changes, leave it for the next pass
+			for (u32 j = triangleOffsets[collapse.from]; j < triangleOffsets[collapse.from + 1]; ++j)
+			{
+				const u32* t = &indices[triangles[j] * 3];
+				touched[t[0]] = touched[t[1]] = touched[t[2]] = 1;
+			}
+		}
+
+		if (collapseCount == 0)
+			break;
+
+		// Apply the collapses and drop the triangles that became degenerate
+		size_t writeIndex = 0;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			u32 a = remap[indices[i + 0]];
+			u32 b = remap[indices[i + 1]];
+			u32 c = remap[indices[i + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+
+			indices[writeIndex++] = a;
+			indices[writeIndex++] = b;
+			indices[writeIndex++] = c;
+		}
+		indices.resize(writeIndex);
+	}
+
+	return (f32)sqrt(resultErrorSquared);
+}
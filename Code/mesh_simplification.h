@@ -0,0 +1,16 @@
+//
+// mesh_simplification.h: Quadric error metric simplification used to build the levels of
+// detail of the models at import time.
+//
+
+#pragma once
+
+#include "engine.h"
+
+/**
+ * Collapses edges of the submesh, cheapest quadric error first, until the index count drops
+ * to the target or the next collapse would exceed maxError (in model units). Collapses move
+ * a vertex onto one of its neighbours, so no vertex is created or moved, and vertices on
+ * borders and attribute seams are kept to avoid cracks. Returns the error of the result.
+ */
+f32 SimplifySubmesh(const Submesh& submesh, u32 targetIndexCount, f32 maxError, std::vector<u32>& indices);
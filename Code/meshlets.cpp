@@ -0,0 +1,341 @@
+#include "meshlets.h"
+#include "mesh_conversion.h"
+
+static const VertexBufferAttribute* FindPositionAttribute(const VertexBufferLayout& layout)
+{
+	for (const VertexBufferAttribute& attribute : layout.vbAttributes)
+		if (attribute.location == 0 && attribute.componentCount >= 3)
+			return &attribute;
+	return NULL;
+}
+
+static const VertexBufferAttribute* FindNormalAttribute(const VertexBufferLayout& layout)
+{
+	for (const VertexBufferAttribute& attribute : layout.vbAttributes)
+		if (attribute.location == 1 && attribute.componentCount >= 3)
+			return &attribute;
+	return NULL;
+}
+
+/**
+ * Bounds of the meshlet triangles [indexOffset, indexOffset + 3 * triangleCount) and their
+ * normal cone. Triangle normals are flipped to agree with the vertex normals when there are
+ * some, so the cone follows the shading and not the winding.
+ */
+static void ComputeMeshletBounds(const Submesh& submesh, const u32* indices, const u32* vertices, Meshlet& meshlet)
+{
+	const float* data = submesh.vertices.data();
+	const u32 floatsPerVertex = submesh.vbLayout.stride / sizeof(float);
+	const u32 positionOffset = FindPositionAttribute(submesh.vbLayout)->offset / sizeof(float);
+	const VertexBufferAttribute* normalAttribute = FindNormalAttribute(submesh.vbLayout);
+
+	auto position = [&](u32 v) { const float* p = data + (size_t)v * floatsPerVertex + positionOffset; return vec3(p[0], p[1], p[2]); };
+	auto normal = [&](u32 v) { const float* p = data + (size_t)v * floatsPerVertex + normalAttribute->offset / sizeof(float); return vec3(p[0], p[1], p[2]); };
+
+	// Bounding box and a sphere around its center
+	meshlet.aabbMin = vec3(FLT_MAX);
+	meshlet.aabbMax = vec3(-FLT_MAX);
+	for (u32 i = 0; i < meshlet.vertexCount; ++i)
+	{
+		vec3 p = position(vertices[i]);
+		meshlet.aabbMin = glm::min(meshlet.aabbMin, p);
+		meshlet.aabbMax = glm::max(meshlet.aabbMax, p);
+	}
+	meshlet.center = (meshlet.aabbMin + meshlet.aabbMax) * 0.5f;
+
+	f32 radiusSquared = 0.0f;
+	for (u32 i = 0; i < meshlet.vertexCount; ++i)
+	{
+		vec3 d = position(vertices[i]) - meshlet.center;
+		radiusSquared = glm::max(radiusSquared, glm::dot(d, d));
+	}
+	meshlet.radius = sqrtf(radiusSquared);
+
+	// Normal cone
+	vec3 triangleNormals[MESHLET_MAX_TRIANGLES];
+	vec3 triangleCorners[MESHLET_MAX_TRIANGLES];
+	u32 normalCount = 0;
+	vec3 axis = vec3(0.0f);
+
+	for (u32 t = 0; t < meshlet.triangleCount; ++t)
+	{
+		const u32* triangle = indices + meshlet.indexOffset + t * 3;
+		vec3 p0 = position(triangle[0]);
+		vec3 n = glm::cross(position(triangle[1]) - p0, position(triangle[2]) - p0);
+		f32 length = glm::length(n);
+		if (length <= 0.0f)
+			continue; // degenerate triangles are never visible
+
+		n /= length;
+		if (normalAttribute && glm::dot(n, normal(triangle[0]) + normal(triangle[1]) + normal(triangle[2])) < 0.0f)
+			n = -n;
+
+		triangleNormals[normalCount] = n;
+		triangleCorners[normalCount] = p0;
+		normalCount++;
+		axis += n;
+	}
+
+	meshlet.coneApex = meshlet.center;
+	meshlet.coneAxis = vec3(0.0f, 0.0f, 1.0f);
+	meshlet.coneCutoff = 2.0f;
+
+	f32 axisLength = glm::length(axis);
+	if (normalCount == 0 || axisLength < 1e-6f)
+		return;
+	axis /= axisLength;
+
+	f32 minDot = 1.0f;
+	for (u32 i = 0; i < normalCount; ++i)
+		minDot = glm::min(minDot, glm::dot(axis, triangleNormals[i]));
+
+	// Cones wider than ~85 degrees cull too rarely to be worth testing
+	if (minDot <= 0.1f)
+		return;
+
+	// The apex goes behind the plane of every triangle
+	f32 maxT = 0.0f;
+	for (u32 i = 0; i < normalCount; ++i)
+	{
+		f32 distance = glm::dot(meshlet.center - triangleCorners[i], triangleNormals[i]);
+		maxT = glm::max(maxT, distance / glm::dot(axis, triangleNormals[i]));
+	}
+
+	meshlet.coneApex = meshlet.center - axis * maxT;
+	meshlet.coneAxis = axis;
+	meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+}
+
+void BuildMeshlets(Submesh& submesh)
+{
+	submesh.meshlets.clear();
+
+	const u32 floatsPerVertex = submesh.vbLayout.stride / sizeof(float);
+	const u32 triangleCount = (u32)(submesh.indices.size() / 3);
+	if (!FindPositionAttribute(submesh.vbLayout) || floatsPerVertex == 0 || triangleCount == 0)
+		return;
+
+	const u32 vertexCount = (u32)(submesh.vertices.size() / floatsPerVertex);
+	const u32* indices = submesh.indices.data();
+
+	// Triangles around each vertex. The first liveCounts[v] entries are the ones not emitted yet.
+	std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+	std::vector<u32> liveCounts(vertexCount, 0);
+	for (u32 i = 0; i < triangleCount * 3; ++i)
+		liveCounts[indices[i]]++;
+	for (u32 v = 0; v < vertexCount; ++v)
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveCounts[v];
+
+	std::vector<u32> adjacency(triangleCount * 3);
+	std::vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (u32 i = 0; i < triangleCount * 3; ++i)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	std::vector<u8> emitted(triangleCount, 0);
+	std::vector<u32> vertexMeshlet(vertexCount, UINT32_MAX);
+	std::vector<u32> reordered;
+	reordered.reserve(submesh.indices.size());
+
+	u32 meshletVertices[MESHLET_MAX_VERTICES];
+	Meshlet meshlet = {};
+	u32 meshletIdx = 0;
+	u32 scan = 0;
+
+	auto newVertexCount = [&](u32 t)
+	{
+		const u32* triangle = indices + t * 3;
+		u32 count = 0;
+		for (u32 k = 0; k < 3; ++k)
+			count += vertexMeshlet[triangle[k]] != meshletIdx && (k == 0 || triangle[k] != triangle[0]) && (k < 2 || triangle[k] != triangle[1]) ? 1 : 0;
+		return count;
+	};
+
+	auto flush = [&]()
+	{
+		ComputeMeshletBounds(submesh, reordered.data(), meshletVertices, meshlet);
+		submesh.meshlets.push_back(meshlet);
+		meshlet = {};
+		meshlet.indexOffset = (u32)reordered.size();
+		meshletIdx++;
+	};
+
+	for (u32 emittedCount = 0; emittedCount < triangleCount; ++emittedCount)
+	{
+		// Best neighbour of the current meshlet: fewest new vertices, then fewest remaining
+		// neighbours so the borders left behind are small
+		u32 best = UINT32_MAX;
+		u32 bestNew = 4;
+		u32 bestLive = UINT32_MAX;
+
+		for (u32 i = 0; i < meshlet.vertexCount && bestNew > 0; ++i)
+		{
+			u32 v = meshletVertices[i];
+			for (u32 j = 0; j < liveCounts[v]; ++j)
+			{
+				u32 t = adjacency[adjacencyOffsets[v] + j];
+				u32 added = newVertexCount(t);
+				if (meshlet.vertexCount + added > MESHLET_MAX_VERTICES)
+					continue;
+
+				const u32* triangle = indices + t * 3;
+				u32 live = liveCounts[triangle[0]] + liveCounts[triangle[1]] + liveCounts[triangle[2]];
+				if (added < bestNew || (added == bestNew && live < bestLive))
+				{
+					best = t;
+					bestNew = added;
+					bestLive = live;
+				}
+			}
+		}
+
+		// Nothing connected fits, start a new meshlet from the next triangle in order
+		if (best == UINT32_MAX)
+		{
+			if (meshlet.triangleCount > 0)
+				flush();
+			while (emitted[scan])
+				scan++;
+			best = scan;
+		}
+
+		const u32* triangle = indices + best * 3;
+		for (u32 k = 0; k < 3; ++k)
+		{
+			u32 v = triangle[k];
+			if (vertexMeshlet[v] != meshletIdx)
+			{
+				vertexMeshlet[v] = meshletIdx;
+				meshletVertices[meshlet.vertexCount++] = v;
+			}
+
+			// Remove the triangle from the live part of the vertex adjacency
+			u32* list = &adjacency[adjacencyOffsets[v]];
+			for (u32 j = 0; j < liveCounts[v]; ++j)
+			{
+				if (list[j] == best)
+				{
+					std::swap(list[j], list[liveCounts[v] - 1]);
+					liveCounts[v]--;
+					break;
+				}
+			}
+
+			reordered.push_back(v);
+		}
+		emitted[best] = 1;
+		meshlet.triangleCount++;
+
+		if (meshlet.triangleCount == MESHLET_MAX_TRIANGLES)
+			flush();
+	}
+
+	if (meshlet.triangleCount > 0)
+		flush();
+
+	submesh.indices.swap(reordered);
+}
+
+void ComputeSubmeshBounds(Submesh& submesh)
+{
+	submesh.aabbMin = vec3(FLT_MAX);
+	submesh.aabbMax = vec3(-FLT_MAX);
+	for (const Meshlet& meshlet : submesh.meshlets)
+	{
+		submesh.aabbMin = glm::min(submesh.aabbMin, meshlet.aabbMin);
+		submesh.aabbMax = glm::max(submesh.aabbMax, meshlet.aabbMax);
+	}
+	if (submesh.meshlets.empty())
+		submesh.aabbMin = submesh.aabbMax = vec3(0.0f);
+
+	// The sphere around the center of the box through the farthest meshlet sphere, unless the
+	// half diagonal is smaller
+	submesh.boundsCenter = (submesh.aabbMin + submesh.aabbMax) * 0.5f;
+	submesh.boundsRadius = glm::length(submesh.aabbMax - submesh.aabbMin) * 0.5f;
+
+	f32 meshletRadius = 0.0f;
+	for (const Meshlet& meshlet : submesh.meshlets)
+		meshletRadius = glm::max(meshletRadius, glm::length(meshlet.center - submesh.boundsCenter) + meshlet.radius);
+	if (!submesh.meshlets.empty())
+		submesh.boundsRadius = glm::min(submesh.boundsRadius, meshletRadius);
+}
+
+Frustum MakeFrustum(const glm::mat4& viewProjection)
+{
+	// Planes from the rows of the matrix (Gribb & Hartmann)
+	vec4 row0 = vec4(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+	vec4 row1 = vec4(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+	vec4 row2 = vec4(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+	vec4 row3 = vec4(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0; // left
+	frustum.planes[1] = row3 - row0; // right
+	frustum.planes[2] = row3 + row1; // bottom
+	frustum.planes[3] = row3 - row1; // top
+	frustum.planes[4] = row3 + row2; // near
+	frustum.planes[5] = row3 - row2; // far
+
+	for (vec4& plane : frustum.planes)
+		plane /= glm::length(vec3(plane));
+	return frustum;
+}
+
+bool IsSphereInFrustum(const Frustum& frustum, vec3 center, f32 radius)
+{
+	for (const vec4& plane : frustum.planes)
+		if (glm::dot(vec3(plane), center) + plane.w < -radius)
+			return false;
+	return true;
+}
+
+void CullMeshlets(const Submesh& submesh, const glm::mat4& worldMatrix, const Frustum& frustum, vec3 cameraPosition,
+	bool frustumCulling, bool coneCulling, MeshletDrawList& drawList, MeshletCullingStats& stats)
+{
+	drawList.counts.clear();
+	drawList.offsets.clear();
+	drawList.baseVertices.clear();
+
+	vec3 scale = vec3(glm::length(vec3(worldMatrix[0])), glm::length(vec3(worldMatrix[1])), glm::length(vec3(worldMatrix[2])));
+	f32 maxScale = glm::max(scale.x, glm::max(scale.y, scale.z));
+
+	// The cone test runs in model space, which only keeps the angles with a uniform scale
+	bool uniformScale = glm::max(fabsf(scale.x - scale.y), fabsf(scale.x - scale.z)) <= maxScale * 1e-3f;
+	coneCulling = coneCulling && uniformScale;
+	vec3 modelCamera = coneCulling ? vec3(glm::inverse(worldMatrix) * vec4(cameraPosition, 1.0f)) : vec3(0.0f);
+
+	const u32 indexSize = GetIndexTypeSize(submesh.indexType);
+	u32 rangeEnd = UINT32_MAX;
+
+	for (const Meshlet& meshlet : submesh.meshlets)
+	{
+		stats.meshlets++;
+		stats.triangles += meshlet.triangleCount;
+
+		if (frustumCulling && !IsSphereInFrustum(frustum, vec3(worldMatrix * vec4(meshlet.center, 1.0f)), meshlet.radius * maxScale))
+		{
+			stats.frustumCulledTriangles += meshlet.triangleCount;
+			continue;
+		}
+
+		if (coneCulling && glm::dot(glm::normalize(meshlet.coneApex - modelCamera), meshlet.coneAxis) >= meshlet.coneCutoff)
+		{
+			stats.coneCulledTriangles += meshlet.triangleCount;
+			continue;
+		}
+
+		stats.visibleMeshlets++;
+
+		// Meshlets are contiguous in the index buffer, extend the last range when possible
+		if (rangeEnd == meshlet.indexOffset)
+		{
+			drawList.counts.back() += meshlet.triangleCount * 3;
+		}
+		else
+		{
+			drawList.counts.push_back(meshlet.triangleCount * 3);
+			drawList.offsets.push_back((const void*)(u64)(submesh.indexAllocation.offset + meshlet.indexOffset * indexSize));
+			drawList.baseVertices.push_back((GLint)submesh.vertexAllocation.offset);
+		}
+		rangeEnd = meshlet.indexOffset + meshlet.triangleCount * 3;
+	}
+}
@@ -0,0 +1,47 @@
+//
+// meshlets.h: Splitting of the submeshes into small clusters of triangles with bounds and a
+// normal cone, and the per frame culling of those clusters before drawing.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define MESHLET_MAX_VERTICES  64
+#define MESHLET_MAX_TRIANGLES 124
+
+/**
+ * Groups the triangles of the submesh into meshlets, growing each one with the neighbouring
+ * triangles that add the fewest new vertices. The indices are reordered so every meshlet is a
+ * contiguous range of them.
+ */
+void BuildMeshlets(Submesh& submesh);
+
+/**
+ * Sets the box and sphere of the submesh from its meshlets, which cover every triangle.
+ */
+void ComputeSubmeshBounds(Submesh& submesh);
+
+struct Frustum
+{
+	vec4 planes[6]; // xyz normal pointing inside, w distance
+};
+
+Frustum MakeFrustum(const glm::mat4& viewProjection);
+
+bool IsSphereInFrustum(const Frustum& frustum, vec3 center, f32 radius);
+
+// Index ranges to draw with glMultiDrawElementsBaseVertex
+struct MeshletDrawList
+{
+	std::vector<GLsizei> counts;
+	std::vector<const void*> offsets;
+	std::vector<GLint> baseVertices; // all the base vertex of the submesh
+};
+
+/**
+ * Tests every meshlet of the submesh against the frustum and its normal cone, and fills the
+ * draw list with the visible ones. Neighbouring visible meshlets are merged in one range.
+ */
+void CullMeshlets(const Submesh& submesh, const glm::mat4& worldMatrix, const Frustum& frustum, vec3 cameraPosition,
+	bool frustumCulling, bool coneCulling, MeshletDrawList& drawList, MeshletCullingStats& stats);
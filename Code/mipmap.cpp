@@ -0,0 +1,485 @@
+#include "mipmap.h"
+#include <emmintrin.h>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static bool DetectAVX2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// The OS has to save the AVX registers on context switches
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+static const bool UseAVX2 = DetectAVX2();
+
+bool MipChainUsesAVX2()
+{
+	return UseAVX2;
+}
+
+const char* GetMipFilterName(MipFilter filter)
+{
+	switch (filter)
+	{
+	case MipFilter_Box:    return "Box";
+	case MipFilter_Kaiser: return "Kaiser";
+	default:               return "Unknown";
+	}
+}
+
+std::vector<u8> ConvertImageToRGBA8(const Image& image)
+{
+	std::vector<u8> rgba((size_t)image.size.x * image.size.y * 4);
+	const u8* src = (const u8*)image.pixels;
+
+	for (i32 y = 0; y < image.size.y; ++y)
+	{
+		for (i32 x = 0; x < image.size.x; ++x)
+		{
+			const u8* pixel = src + y * image.stride + x * image.nchannels;
+			u8* dst = &rgba[((size_t)y * image.size.x + x) * 4];
+			switch (image.nchannels)
+			{
+			case 1: dst[0] = dst[1] = dst[2] = pixel[0]; dst[3] = 255; break;
+			case 2: dst[0] = dst[1] = dst[2] = pixel[0]; dst[3] = pixel[1]; break;
+			case 3: dst[0] = pixel[0]; dst[1] = pixel[1]; dst[2] = pixel[2]; dst[3] = 255; break;
+			default: memcpy(dst, pixel, 4); break;
+			}
+		}
+	}
+
+	return rgba;
+}
+
+// sRGB conversion tables, values are kept in the [0, 255] range in both spaces
+struct SRGBTables
+{
+	f32 toLinear[256];
+	u8  toSRGB[4096];
+};
+
+static SRGBTables BuildSRGBTables()
+{
+	SRGBTables tables;
+	for (u32 i = 0; i < 256; ++i)
+	{
+		f32 c = i / 255.0f;
+		f32 linear = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		tables.toLinear[i] = linear * 255.0f;
+	}
+	for (u32 i = 0; i < 4096; ++i)
+	{
+		f32 linear = i / 4095.0f;
+		f32 c = linear <= 0.0031308f ? linear * 12.92f : 1.055f * powf(linear, 1.0f / 2.4f) - 0.055f;
+		tables.toSRGB[i] = (u8)(glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+	}
+	return tables;
+}
+
+static const SRGBTables& GetSRGBTables()
+{
+	static SRGBTables tables = BuildSRGBTables();
+	return tables;
+}
+
+// Separable downsampling kernel, output pixel x reads source pixels [2x + firstTap, 2x + firstTap + tapCount)
+struct MipKernel
+{
+	f32 weights[8];
+	i32 tapCount;
+	i32 firstTap;
+};
+
+static f32 BesselI0(f32 x)
+{
+	f32 sum = 1.0f;
+	f32 term = 1.0f;
+	for (u32 k = 1; k < 16; ++k)
+	{
+		term *= (x * 0.5f / k) * (x * 0.5f / k);
+		sum += term;
+	}
+	return sum;
+}
+
+static MipKernel BuildMipKernel(MipFilter filter)
+{
+	MipKernel kernel = {};
+
+	if (filter == MipFilter_Kaiser)
+	{
+		// Windowed sinc with a support of two destination pixels on each side
+		const f32 alpha = 4.0f;
+		const f32 halfWidth = 2.0f;
+		const f32 pi = 3.14159265f;
+
+		kernel.tapCount = 8;
+		kernel.firstTap = -3;
+
+		f32 total = 0.0f;
+		for (i32 i = 0; i < kernel.tapCount; ++i)
+		{
+			f32 t = ((f32)(kernel.firstTap + i) + 0.5f - 1.0f) * 0.5f; // distance to the center in destination pixels
+			f32 sinc = fabsf(t) < 1e-6f ? 1.0f : sinf(pi * t) / (pi * t);
+			f32 r = t / halfWidth;
+			f32 window = BesselI0(alpha * sqrtf(glm::max(1.0f - r * r, 0.0f))) / BesselI0(alpha);
+			kernel.weights[i] = sinc * window;
+			total += kernel.weights[i];
+		}
+		for (i32 i = 0; i < kernel.tapCount; ++i)
+			kernel.weights[i] /= total;
+	}
+	else
+	{
+		kernel.tapCount = 2;
+		kernel.firstTap = 0;
+		kernel.weights[0] = 0.5f;
+		kernel.weights[1] = 0.5f;
+	}
+
+	return kernel;
+}
+
+static u32 GetMipLevelCount(ivec2 size)
+{
+	u32 levelCount = 1;
+	for (i32 maxSize = glm::max(size.x, size.y); maxSize > 1; maxSize /= 2)
+		levelCount++;
+	return glm::min(levelCount, (u32)MIP_CHAIN_MAX_LEVELS);
+}
+
+// Box filter on 8 bit pixels ////////////////////////////////////////////////////////////////
+
+static void DownsampleBoxRowScalar(const u8* row0, const u8* row1, i32 srcWidth, u8* dst, i32 begin, i32 end)
+{
+	for (i32 x = begin; x < end; ++x)
+	{
+		i32 x0 = glm::min(x * 2, srcWidth - 1);
+		i32 x1 = glm::min(x * 2 + 1, srcWidth - 1);
+		for (i32 c = 0; c < 4; ++c)
+		{
+			u32 sum = row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c];
+			dst[x * 4 + c] = (u8)((sum + 2) >> 2);
+		}
+	}
+}
+
+// Returns how many destination pixels were written, the rest is left for the scalar loop
+static i32 DownsampleBoxRowSSE2(const u8* row0, const u8* row1, u8* dst, i32 count)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+
+	i32 x = 0;
+	for (; x + 2 <= count; x += 2)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+		__m128i b = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+
+		// Vertical sums of source pixels 0-1 and 2-3, then horizontal sums of each pair
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+		lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+		hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+		__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+		_mm_storel_epi64((__m128i*)(dst + x * 4), _mm_packus_epi16(sum, sum));
+	}
+	return x;
+}
+
+TARGET_AVX2
+static i32 DownsampleBoxRowAVX2(const u8* row0, const u8* row1, u8* dst, i32 count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i two = _mm256_set1_epi16(2);
+
+	i32 x = 0;
+	for (; x + 4 <= count; x += 4)
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i*)(row0 + x * 8));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(row1 + x * 8));
+
+		// Same as the SSE2 version in each 128 bit lane
+		__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+		__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+		lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+		hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+
+		__m256i sum = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), two), 2);
+		__m256i packed = _mm256_packus_epi16(sum, sum);
+		packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm_storeu_si128((__m128i*)(dst + x * 4), _mm256_castsi256_si128(packed));
+	}
+	return x;
+}
+
+static void DownsampleBoxRows(const u8* src, ivec2 srcSize, u8* dst, ivec2 dstSize, u32 begin, u32 end)
+{
+	// Only fully covered 2x2 quads go through the SIMD kernels
+	i32 simdCount = glm::min(dstSize.x, srcSize.x / 2);
+
+	for (u32 y = begin; y < end; ++y)
+	{
+		const u8* row0 = src + (size_t)glm::min((i32)y * 2, srcSize.y - 1) * srcSize.x * 4;
+		const u8* row1 = src + (size_t)glm::min((i32)y * 2 + 1, srcSize.y - 1) * srcSize.x * 4;
+		u8* dstRow = dst + (size_t)y * dstSize.x * 4;
+
+		i32 done = UseAVX2 ? DownsampleBoxRowAVX2(row0, row1, dstRow, simdCount) : 0;
+		done += DownsampleBoxRowSSE2(row0 + done * 8, row1 + done * 8, dstRow + done * 4, simdCount - done);
+		DownsampleBoxRowScalar(row0, row1, srcSize.x, dstRow, done, dstSize.x);
+	}
+}
+
+// Separable filters on float pixels ///////////////////////////////////////////////////////
+
+static void FilterRowsHorizontal(const f32* src, ivec2 srcSize, f32* dst, i32 dstWidth, const MipKernel& kernel, u32 begin, u32 end)
+{
+	for (u32 y = begin; y < end; ++y)
+	{
+		const f32* srcRow = src + (size_t)y * srcSize.x * 4;
+		f32* dstRow = dst + (size_t)y * dstWidth * 4;
+
+		for (i32 x = 0; x < dstWidth; ++x)
+		{
+			i32 first = x * 2 + kernel.firstTap;
+			__m128 sum = _mm_setzero_ps();
+			for (i32 i = 0; i < kernel.tapCount; ++i)
+			{
+				i32 sx = glm::clamp(first + i, 0, srcSize.x - 1);
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(srcRow + sx * 4), _mm_set1_ps(kernel.weights[i])));
+			}
+			_mm_storeu_ps(dstRow + x * 4, sum);
+		}
+	}
+}
+
+TARGET_AVX2
+static i32 FilterRowVerticalAVX2(const f32* const* rows, const MipKernel& kernel, f32* dst, i32 count)
+{
+	i32 i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256 sum = _mm256_setzero_ps();
+		for (i32 k = 0; k < kernel.tapCount; ++k)
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[k] + i), _mm256_set1_ps(kernel.weights[k])));
+		_mm256_storeu_ps(dst + i, sum);
+	}
+	return i;
+}
+
+static void FilterRowVerticalSSE2(const f32* const* rows, const MipKernel& kernel, f32* dst, i32 begin, i32 count)
+{
+	for (i32 i = begin; i < count; i += 4)
+	{
+		__m128 sum = _mm_setzero_ps();
+		for (i32 k = 0; k < kernel.tapCount; ++k)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(rows[k] + i), _mm_set1_ps(kernel.weights[k])));
+		_mm_storeu_ps(dst + i, sum);
+	}
+}
+
+static void FilterRowsVertical(const f32* src, i32 srcHeight, f32* dst, ivec2 dstSize, const MipKernel& kernel, u32 begin, u32 end)
+{
+	// Every row has a multiple of four floats, the SSE2 loop needs no scalar tail
+	i32 rowFloats = dstSize.x * 4;
+
+	for (u32 y = begin; y < end; ++y)
+	{
+		const f32* rows[8];
+		for (i32 k = 0; k < kernel.tapCount; ++k)
+			rows[k] = src + (size_t)glm::clamp((i32)y * 2 + kernel.firstTap + k, 0, srcHeight - 1) * rowFloats;
+
+		f32* dstRow = dst + (size_t)y * rowFloats;
+		i32 done = UseAVX2 ? FilterRowVerticalAVX2(rows, kernel, dstRow, rowFloats) : 0;
+		FilterRowVerticalSSE2(rows, kernel, dstRow, done, rowFloats);
+	}
+}
+
+static void ConvertRowsToFloat(const u8* src, f32* dst, i32 width, bool srgb, u32 begin, u32 end)
+{
+	const SRGBTables& tables = GetSRGBTables();
+	const __m128i zero = _mm_setzero_si128();
+
+	for (u32 y = begin; y < end; ++y)
+	{
+		const u8* srcRow = src + (size_t)y * width * 4;
+		f32* dstRow = dst + (size_t)y * width * 4;
+
+		for (i32 x = 0; x < width; ++x)
+		{
+			const u8* pixel = srcRow + x * 4;
+			if (srgb)
+			{
+				_mm_storeu_ps(dstRow + x * 4, _mm_setr_ps(tables.toLinear[pixel[0]], tables.toLinear[pixel[1]], tables.toLinear[pixel[2]], (f32)pixel[3]));
+			}
+			else
+			{
+				i32 packed;
+				memcpy(&packed, pixel, 4);
+				__m128i values = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+				_mm_storeu_ps(dstRow + x * 4, _mm_cvtepi32_ps(values));
+			}
+		}
+	}
+}
+
+static void ConvertRowsToRGBA8(const f32* src, u8* dst, i32 width, bool srgb, u32 begin, u32 end)
+{
+	const SRGBTables& tables = GetSRGBTables();
+	const __m128 maxValue = _mm_set1_ps(255.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (u32 y = begin; y < end; ++y)
+	{
+		const f32* srcRow = src + (size_t)y * width * 4;
+		u8* dstRow = dst + (size_t)y * width * 4;
+
+		for (i32 x = 0; x < width; ++x)
+		{
+			// Negative lobes of the Kaiser filter may push values out of range
+			__m128 value = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(srcRow + x * 4), zero), maxValue);
+			__m128i rounded = _mm_cvtps_epi32(value);
+			__m128i packed = _mm_packs_epi32(rounded, rounded);
+			packed = _mm_packus_epi16(packed, packed);
+			i32 pixel = _mm_cvtsi128_si32(packed);
+			memcpy(dstRow + x * 4, &pixel, 4);
+
+			if (srgb)
+			{
+				alignas(16) f32 linear[4];
+				_mm_store_ps(linear, value);
+				for (u32 c = 0; c < 3; ++c)
+					dstRow[x * 4 + c] = tables.toSRGB[(u32)(linear[c] * (4095.0f / 255.0f) + 0.5f)];
+			}
+		}
+	}
+}
+
+static const u32 MipRowsPerJob = 16;
+
+void GenerateMipChain(ThreadPool* pool, const u8* rgba, ivec2 size, MipFilter filter, bool srgb, MipChain* chain)
+{
+	chain->levelCount = GetMipLevelCount(size);
+
+	size_t dataSize = 0;
+	ivec2 levelSize = size;
+	for (u32 i = 0; i < chain->levelCount; ++i)
+	{
+		chain->levels[i].offset = (u32)dataSize;
+		chain->levels[i].width = levelSize.x;
+		chain->levels[i].height = levelSize.y;
+		dataSize += (size_t)levelSize.x * levelSize.y * 4;
+		levelSize = glm::max(levelSize / 2, ivec2(1));
+	}
+
+	chain->data.resize(dataSize);
+	memcpy(chain->data.data(), rgba, (size_t)size.x * size.y * 4);
+
+	u8* data = chain->data.data();
+
+	// The plain box filter works directly on 8 bit pixels
+	if (filter == MipFilter_Box && !srgb)
+	{
+		for (u32 i = 1; i < chain->levelCount; ++i)
+		{
+			const MipLevel& srcLevel = chain->levels[i - 1];
+			const MipLevel& dstLevel = chain->levels[i];
+			const u8* src = data + srcLevel.offset;
+			u8* dst = data + dstLevel.offset;
+			ivec2 srcSize = ivec2(srcLevel.width, srcLevel.height);
+			ivec2 dstSize = ivec2(dstLevel.width, dstLevel.height);
+
+			ParallelFor(pool, dstSize.y, MipRowsPerJob, [=](u32 begin, u32 end)
+				{
+					DownsampleBoxRows(src, srcSize, dst, dstSize, begin, end);
+				});
+		}
+		return;
+	}
+
+	// Otherwise the levels are filtered in float (and linear space), never requantizing in between
+	MipKernel kernel = BuildMipKernel(filter);
+
+	std::vector<f32> current((size_t)size.x * size.y * 4);
+	std::vector<f32> horizontal;
+	std::vector<f32> next;
+
+	f32* currentData = current.data();
+	ParallelFor(pool, size.y, MipRowsPerJob, [=](u32 begin, u32 end)
+		{
+			ConvertRowsToFloat(rgba, currentData, size.x, srgb, begin, end);
+		});
+
+	for (u32 i = 1; i < chain->levelCount; ++i)
+	{
+		const MipLevel& srcLevel = chain->levels[i - 1];
+		const MipLevel& dstLevel = chain->levels[i];
+		ivec2 srcSize = ivec2(srcLevel.width, srcLevel.height);
+		ivec2 dstSize = ivec2(dstLevel.width, dstLevel.height);
+
+		horizontal.resize((size_t)dstSize.x * srcSize.y * 4);
+		next.resize((size_t)dstSize.x * dstSize.y * 4);
+
+		const f32* srcData = current.data();
+		f32* horizontalData = horizontal.data();
+		f32* nextData = next.data();
+		u8* dst = data + dstLevel.offset;
+
+		ParallelFor(pool, srcSize.y, MipRowsPerJob, [=, &kernel](u32 begin, u32 end)
+			{
+				FilterRowsHorizontal(srcData, srcSize, horizontalData, dstSize.x, kernel, begin, end);
+			});
+
+		ParallelFor(pool, dstSize.y, MipRowsPerJob, [=, &kernel](u32 begin, u32 end)
+			{
+				FilterRowsVertical(horizontalData, srcSize.y, nextData, dstSize, kernel, begin, end);
+				ConvertRowsToRGBA8(nextData, dst, dstSize.x, srgb, begin, end);
+			});
+
+		current.swap(next);
+	}
+}
+
+GLuint CreateTexture2DFromMipChain(const MipChain& chain, GLenum internalFormat)
+{
+	GLuint texHandle;
+	glGenTextures(1, &texHandle);
+	glBindTexture(GL_TEXTURE_2D, texHandle);
+	glTexStorage2D(GL_TEXTURE_2D, chain.levelCount, internalFormat, chain.levels[0].width, chain.levels[0].height);
+	for (u32 i = 0; i < chain.levelCount; ++i)
+	{
+		const MipLevel& level = chain.levels[i];
+		glTexSubImage2D(GL_TEXTURE_2D, i, 0, 0, level.width, level.height, GL_RGBA, GL_UNSIGNED_BYTE, chain.data.data() + level.offset);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return texHandle;
+}
@@ -0,0 +1,46 @@
+//
+// mipmap.h: CPU generation of texture mip chains. Replaces glGenerateMipmap so every driver
+// gets the same (and better filtered) mips, and so the work can be done in the worker threads.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define MIP_CHAIN_MAX_LEVELS 16
+
+struct MipLevel
+{
+	u32 offset; // in bytes, inside MipChain::data
+	i32 width;
+	i32 height;
+};
+
+// Every level of an RGBA8 image, the first one being the image itself
+struct MipChain
+{
+	u32             levelCount;
+	MipLevel        levels[MIP_CHAIN_MAX_LEVELS];
+	std::vector<u8> data;
+};
+
+const char* GetMipFilterName(MipFilter filter);
+
+/**
+ * Whether the kernels run with AVX2. They fall back to SSE2 when the CPU does not support it.
+ */
+bool MipChainUsesAVX2();
+
+std::vector<u8> ConvertImageToRGBA8(const Image& image);
+
+/**
+ * Builds every level down to 1x1 from an RGBA8 image. Each level is computed from the
+ * previous one, split in bands of rows that run in parallel in the thread pool. When srgb is
+ * set the color channels are filtered in linear space (alpha is always linear).
+ */
+void GenerateMipChain(ThreadPool* pool, const u8* rgba, ivec2 size, MipFilter filter, bool srgb, MipChain* chain);
+
+/**
+ * Creates an immutable texture with glTexStorage2D and uploads every level of the chain.
+ */
+GLuint CreateTexture2DFromMipChain(const MipChain& chain, GLenum internalFormat);
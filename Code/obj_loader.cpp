@@ -0,0 +1,876 @@
+#include "obj_loader.h"
+#include "mesh_conversion.h"
+#include <emmintrin.h>
+#include <string.h>
+#include <algorithm>
+#include <unordered_map>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Chunks are cut at line ends. A few per worker balance the uneven line mix of the files.
+#define OBJ_MIN_CHUNK_SIZE    KB(256)
+#define OBJ_CHUNKS_PER_WORKER 4
+
+#define OBJ_NO_INDEX INT32_MIN
+
+static inline u32 CountTrailingZeros(u32 mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (u32)index;
+#else
+	return (u32)__builtin_ctz(mask);
+#endif
+}
+
+// Returns the first '\n' in [p, end), or end. Scans 16 bytes at a time.
+static const char* FindLineEnd(const char* p, const char* end)
+{
+	const __m128i newline = _mm_set1_epi8('\n');
+	for (; end - p >= 16; p += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)p);
+		u32 mask = (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline));
+		if (mask)
+			return p + CountTrailingZeros(mask);
+	}
+	while (p < end && *p != '\n')
+		++p;
+	return p;
+}
+
+static inline bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline bool IsDigit(char c)
+{
+	return (u8)(c - '0') < 10;
+}
+
+static inline const char* SkipSpaces(const char* p, const char* end)
+{
+	while (p < end && IsSpace(*p))
+		++p;
+	return p;
+}
+
+// True if the line starts with the keyword followed by a space
+static bool MatchKeyword(const char*& p, const char* end, const char* keyword)
+{
+	size_t length = strlen(keyword);
+	if ((size_t)(end - p) <= length || memcmp(p, keyword, length) != 0 || !IsSpace(p[length]))
+		return false;
+	p += length;
+	return true;
+}
+
+// The rest of the line without the surrounding spaces
+static std::string ParseRestOfLine(const char* p, const char* end)
+{
+	p = SkipSpaces(p, end);
+	while (end > p && IsSpace(end[-1]))
+		--end;
+	return std::string(p, end);
+}
+
+/**
+ * Eight ASCII digits at once in a 64 bit register (Lemire, "Fast number parsing without
+ * fallback"): pairs, then quads, then the whole number with three multiplications.
+ */
+static inline bool AreEightDigits(u64 chunk)
+{
+	return (((chunk + 0x4646464646464646ull) | (chunk - 0x3030303030303030ull)) & 0x8080808080808080ull) == 0;
+}
+
+static inline u32 ParseEightDigits(u64 chunk)
+{
+	chunk -= 0x3030303030303030ull;
+	chunk = (chunk * 10) + (chunk >> 8);
+	chunk = (((chunk & 0x000000FF000000FFull) * (100 + (1000000ull << 32))) +
+		(((chunk >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+	return (u32)chunk;
+}
+
+// Digits are accumulated in a 64 bit mantissa, the ones that do not fit only move the exponent
+static const char* ParseDigits(const char* p, const char* end, u64& mantissa, u32& digitCount, i32& exponent, bool fraction)
+{
+	while (end - p >= 8 && digitCount + 8 <= 19)
+	{
+		u64 chunk;
+		memcpy(&chunk, p, sizeof(chunk));
+		if (!AreEightDigits(chunk))
+			break;
+
+		mantissa = mantissa * 100000000ull + ParseEightDigits(chunk);
+		if (mantissa != 0)
+			digitCount += 8;
+		if (fraction)
+			exponent -= 8;
+		p += 8;
+	}
+
+	for (; p < end && IsDigit(*p); ++p)
+	{
+		if (digitCount < 19)
+		{
+			mantissa = mantissa * 10 + (u64)(*p - '0');
+			if (mantissa != 0)
+				digitCount++;
+			if (fraction)
+				exponent--;
+		}
+		else if (!fraction)
+		{
+			exponent++;
+		}
+	}
+	return p;
+}
+
+// Returns the end of the number or NULL if there is none
+static const char* ParseFloat(const char* p, const char* end, f32& value)
+{
+	static const f64 powersOf10[] =
+	{
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		++p;
+	}
+
+	const char* digitsBegin = p;
+	u64 mantissa = 0;
+	u32 digitCount = 0;
+	i32 exponent = 0;
+
+	p = ParseDigits(p, end, mantissa, digitCount, exponent, false);
+	bool hasDigits = p != digitsBegin;
+	if (p < end && *p == '.')
+	{
+		const char* fractionBegin = ++p;
+		p = ParseDigits(p, end, mantissa, digitCount, exponent, true);
+		hasDigits = hasDigits || p != fractionBegin;
+	}
+
+	if (!hasDigits)
+		return NULL;
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* q = p + 1;
+		bool negativeExponent = false;
+		if (q < end && (*q == '-' || *q == '+'))
+		{
+			negativeExponent = *q == '-';
+			++q;
+		}
+		if (q < end && IsDigit(*q))
+		{
+			i32 explicitExponent = 0;
+			for (; q < end && IsDigit(*q); ++q)
+				if (explicitExponent < 10000)
+					explicitExponent = explicitExponent * 10 + (*q - '0');
+			exponent += negativeExponent ? -explicitExponent : explicitExponent;
+			p = q;
+		}
+	}
+
+	f64 result = (f64)mantissa;
+	if (exponent < 0 && exponent >= -22)
+		result /= powersOf10[-exponent];
+	else if (exponent > 0 && exponent <= 22)
+		result *= powersOf10[exponent];
+	else if (exponent != 0)
+		result *= pow(10.0, (f64)exponent);
+
+	value = (f32)(negative ? -result : result);
+	return p;
+}
+
+static const char* ParseInt(const char* p, const char* end, i32& value)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		++p;
+	}
+
+	if (p >= end || !IsDigit(*p))
+		return NULL;
+
+	i64 result = 0;
+	for (; p < end && IsDigit(*p); ++p)
+		if (result <= INT32_MAX)
+			result = result * 10 + (*p - '0');
+
+	if (result > INT32_MAX)
+		return NULL;
+
+	value = (i32)(negative ? -result : result);
+	return p;
+}
+
+struct ObjCorner
+{
+	i32 index[3];  // position, texture coordinates and normal, OBJ_NO_INDEX if missing
+	u32 relative;  // bit k set while index[k] is relative to the first element of the chunk
+};
+
+struct ObjMaterialSwitch
+{
+	u32 triangleIdx; // first triangle of the chunk that uses the material
+	std::string name;
+};
+
+struct ObjChunk
+{
+	const char* begin;
+	const char* end;
+	const char* errorAt; // start of the first malformed line
+
+	std::vector<vec3> positions;
+	std::vector<vec2> texCoords;
+	std::vector<vec3> normals;
+	std::vector<ObjCorner> corners; // three per triangle
+	std::vector<ObjMaterialSwitch> materialSwitches;
+	std::vector<std::string> materialLibraries;
+
+	// elements of the previous chunks
+	u32 firstElement[3];
+	bool missingNormals;
+	bool invalidIndices;
+};
+
+static const char* ParseFloats(const char* p, const char* end, float* values, u32 requiredCount, u32 maxCount)
+{
+	for (u32 i = 0; i < maxCount; ++i)
+	{
+		p = SkipSpaces(p, end);
+		if (i >= requiredCount && (p == end || *p == '#'))
+			break;
+		p = ParseFloat(p, end, values[i]);
+		if (!p)
+			return NULL;
+	}
+	return p;
+}
+
+// A face vertex: v, v/vt, v//vn or v/vt/vn
+static const char* ParseCorner(const char* p, const char* end, const ObjChunk& chunk, ObjCorner& corner)
+{
+	const u32 counts[3] = { (u32)chunk.positions.size(), (u32)chunk.texCoords.size(), (u32)chunk.normals.size() };
+
+	corner.index[0] = corner.index[1] = corner.index[2] = OBJ_NO_INDEX;
+	corner.relative = 0;
+
+	for (u32 k = 0; k < 3; ++k)
+	{
+		if (k > 0)
+		{
+			if (p >= end || *p != '/')
+				break;
+			++p;
+			if (p < end && *p == '/')
+				continue;
+		}
+
+		i32 value;
+		p = ParseInt(p, end, value);
+		if (!p || value == 0)
+			return NULL;
+
+		// Negative indices count back from the last element defined before the face
+		if (value > 0)
+		{
+			corner.index[k] = value - 1;
+		}
+		else
+		{
+			corner.index[k] = (i32)counts[k] + value;
+			corner.relative |= 1u << k;
+		}
+	}
+	return p;
+}
+
+static void ParseObjChunk(ObjChunk& chunk)
+{
+	std::vector<ObjCorner> polygon;
+
+	const char* p = chunk.begin;
+	while (p < chunk.end)
+	{
+		const char* lineBegin = p;
+		const char* lineEnd = FindLineEnd(p, chunk.end);
+		p = SkipSpaces(p, lineEnd);
+
+		bool valid = true;
+		if (MatchKeyword(p, lineEnd, "v"))
+		{
+			vec3 position;
+			valid = ParseFloats(p, lineEnd, &position.x, 3, 3) != NULL;
+			chunk.positions.push_back(position);
+		}
+		else if (MatchKeyword(p, lineEnd, "vt"))
+		{
+			vec2 texCoord = vec2(0.0f);
+			valid = ParseFloats(p, lineEnd, &texCoord.x, 1, 2) != NULL;
+			chunk.texCoords.push_back(texCoord);
+		}
+		else if (MatchKeyword(p, lineEnd, "vn"))
+		{
+			vec3 normal;
+			valid = ParseFloats(p, lineEnd, &normal.x, 3, 3) != NULL;
+			chunk.normals.push_back(normal);
+		}
+		else if (MatchKeyword(p, lineEnd, "f"))
+		{
+			polygon.clear();
+			for (p = SkipSpaces(p, lineEnd); p < lineEnd && *p != '#'; p = SkipSpaces(p, lineEnd))
+			{
+				ObjCorner corner;
+				p = ParseCorner(p, lineEnd, chunk, corner);
+				if (!p)
+				{
+					valid = false;
+					break;
+				}
+
+				polygon.push_back(corner);
+				chunk.missingNormals = chunk.missingNormals || corner.index[2] == OBJ_NO_INDEX;
+			}
+
+			// Fan triangulation, faces with less than three vertices are lines or points
+			for (size_t i = 1; valid && i + 1 < polygon.size(); ++i)
+			{
+				chunk.corners.push_back(polygon[0]);
+				chunk.corners.push_back(polygon[i]);
+				chunk.corners.push_back(polygon[i + 1]);
+			}
+		}
+		else if (MatchKeyword(p, lineEnd, "usemtl"))
+		{
+			chunk.materialSwitches.push_back({ (u32)(chunk.corners.size() / 3), ParseRestOfLine(p, lineEnd) });
+		}
+		else if (MatchKeyword(p, lineEnd, "mtllib"))
+		{
+			chunk.materialLibraries.push_back(ParseRestOfLine(p, lineEnd));
+		}
+		// Everything else (comments, objects, groups, smoothing groups, lines...) is ignored
+
+		if (!valid)
+		{
+			chunk.errorAt = lineBegin;
+			return;
+		}
+
+		p = lineEnd + 1;
+	}
+}
+
+static void ParseMtlFile(const std::string& filepath, std::vector<ObjMaterial>& materials)
+{
+	AssetFile file;
+	if (!ReadAssetFile(filepath.c_str(), file))
+	{
+		ELOG("Could not open material library %s", filepath.c_str());
+		return;
+	}
+
+	const char* p = (const char*)file.data;
+	const char* end = p + file.size;
+	ObjMaterial* material = NULL;
+
+	// The library may be in another directory than the OBJ, its textures are relative to it
+	std::string directory = GetDirectoryPrefix(filepath.c_str());
+
+	while (p < end)
+	{
+		const char* lineEnd = FindLineEnd(p, end);
+		p = SkipSpaces(p, lineEnd);
+
+		if (MatchKeyword(p, lineEnd, "newmtl"))
+		{
+			materials.push_back(ObjMaterial{});
+			material = &materials.back();
+			material->name = ParseRestOfLine(p, lineEnd);
+			material->directory = directory;
+			material->diffuse = vec3(0.6f); // same default as Assimp
+			material->emissive = vec3(0.0f);
+			material->shininess = 0.0f;
+		}
+		else if (material)
+		{
+			// Texture options (-bm, -s...) come before the filename, which is the last token
+			int slot = -1;
+			if (MatchKeyword(p, lineEnd, "Kd"))
+				ParseFloats(p, lineEnd, &material->diffuse.x, 3, 3);
+			else if (MatchKeyword(p, lineEnd, "Ke"))
+				ParseFloats(p, lineEnd, &material->emissive.x, 3, 3);
+			else if (MatchKeyword(p, lineEnd, "Ns"))
+				ParseFloats(p, lineEnd, &material->shininess, 1, 1);
+			else if (MatchKeyword(p, lineEnd, "map_Kd"))
+				slot = ObjTexture_Diffuse;
+			else if (MatchKeyword(p, lineEnd, "map_Ke"))
+				slot = ObjTexture_Emissive;
+			else if (MatchKeyword(p, lineEnd, "map_Ks"))
+				slot = ObjTexture_Specular;
+			else if (MatchKeyword(p, lineEnd, "norm") || MatchKeyword(p, lineEnd, "map_Kn"))
+				slot = ObjTexture_Normals;
+			else if (MatchKeyword(p, lineEnd, "bump") || MatchKeyword(p, lineEnd, "map_bump") || MatchKeyword(p, lineEnd, "map_Bump"))
+				slot = ObjTexture_Bump;
+
+			if (slot >= 0)
+			{
+				std::string arguments = ParseRestOfLine(p, lineEnd);
+				size_t lastSpace = arguments.find_last_of(" \t");
+				material->textures[slot] = lastSpace == std::string::npos ? arguments : arguments.substr(lastSpace + 1);
+			}
+		}
+
+		p = lineEnd + 1;
+	}
+
+	FreeAssetFile(file);
+}
+
+struct ObjRun
+{
+	u32 chunkIdx;
+	u32 firstTriangle;
+	u32 triangleCount;
+};
+
+struct ObjVertexKey
+{
+	u32 position;
+	u32 texCoord; // UINT32_MAX if missing
+	u32 normal;
+};
+
+static inline u32 HashVertexKey(const ObjVertexKey& key)
+{
+	u64 hash = key.position * 0x9E3779B97F4A7C15ull ^ key.texCoord * 0xC2B2AE3D27D4EB4Full ^ key.normal * 0x165667B19E3779F9ull;
+	return (u32)(hash ^ (hash >> 32));
+}
+
+struct ObjAttributes
+{
+	std::vector<vec3> positions;
+	std::vector<vec2> texCoords;
+	std::vector<vec3> normals;   // the ones of the file, then the generated ones by position
+	u32 generatedNormalsBase;
+};
+
+// Welds the v/vt/vn triples of the runs of one material and writes the submesh
+static void BuildObjSubmesh(const ObjAttributes& attributes, const std::vector<ObjChunk>& chunks, const std::vector<ObjRun>& runs, Submesh& submesh)
+{
+	u32 indexCount = 0;
+	bool hasTexCoords = false;
+	for (const ObjRun& run : runs)
+	{
+		indexCount += run.triangleCount * 3;
+		const ObjCorner* corners = &chunks[run.chunkIdx].corners[run.firstTriangle * 3];
+		for (u32 i = 0; i < run.triangleCount * 3 && !hasTexCoords; ++i)
+			hasTexCoords = corners[i].index[1] != OBJ_NO_INDEX;
+	}
+
+	// The shaders always read texture coordinates, tangents only make sense with real ones
+	submesh.vbLayout = MakeAssimpVertexLayout(true, hasTexCoords);
+	const u32 floatsPerVertex = submesh.vbLayout.stride / sizeof(float);
+
+	// Open addressing table from the triples to the vertices
+	u32 capacity = 16;
+	while (capacity < indexCount * 2)
+		capacity *= 2;
+	const u32 mask = capacity - 1;
+	std::vector<u32> table(capacity, UINT32_MAX);
+	std::vector<ObjVertexKey> vertexKeys;
+	vertexKeys.reserve(indexCount / 2);
+
+	submesh.indices.resize(indexCount);
+	u32* indices = submesh.indices.data();
+
+	for (const ObjRun& run : runs)
+	{
+		const ObjCorner* corners = &chunks[run.chunkIdx].corners[run.firstTriangle * 3];
+		for (u32 i = 0; i < run.triangleCount * 3; ++i)
+		{
+			const ObjCorner& corner = corners[i];
+			ObjVertexKey key;
+			key.position = (u32)corner.index[0];
+			key.texCoord = corner.index[1] == OBJ_NO_INDEX ? UINT32_MAX : (u32)corner.index[1];
+			key.normal = corner.index[2] == OBJ_NO_INDEX ? attributes.generatedNormalsBase + key.position : (u32)corner.index[2];
+
+			u32 slot = HashVertexKey(key) & mask;
+			for (;;)
+			{
+				u32 vertexIdx = table[slot];
+				if (vertexIdx == UINT32_MAX)
+				{
+					vertexIdx = (u32)vertexKeys.size();
+					vertexKeys.push_back(key);
+					table[slot] = vertexIdx;
+				}
+
+				const ObjVertexKey& other = vertexKeys[vertexIdx];
+				if (other.position == key.position && other.texCoord == key.texCoord && other.normal == key.normal)
+				{
+					*indices++ = vertexIdx;
+					break;
+				}
+				slot = (slot + 1) & mask;
+			}
+		}
+	}
+
+	const u32 vertexCount = (u32)vertexKeys.size();
+	submesh.vertices.resize((size_t)vertexCount * floatsPerVertex);
+	for (u32 v = 0; v < vertexCount; ++v)
+	{
+		const ObjVertexKey& key = vertexKeys[v];
+		float* out = submesh.vertices.data() + (size_t)v * floatsPerVertex;
+		vec3 position = attributes.positions[key.position];
+		vec3 normal = attributes.normals[key.normal];
+		vec2 texCoord = key.texCoord != UINT32_MAX ? attributes.texCoords[key.texCoord] : vec2(0.0f);
+		memcpy(out + 0, &position, sizeof(position));
+		memcpy(out + 3, &normal, sizeof(normal));
+		memcpy(out + 6, &texCoord, sizeof(texCoord));
+	}
+
+	if (!hasTexCoords)
+		return;
+
+	// Tangent space from the texture coordinate gradients, averaged over the faces of each
+	// vertex and made orthogonal to the normal
+	std::vector<vec3> tangents(vertexCount, vec3(0.0f));
+	std::vector<vec3> bitangents(vertexCount, vec3(0.0f));
+	for (u32 i = 0; i + 2 < indexCount; i += 3)
+	{
+		const u32* t = &submesh.indices[i];
+		const float* v0 = &submesh.vertices[(size_t)t[0] * floatsPerVertex];
+		const float* v1 = &submesh.vertices[(size_t)t[1] * floatsPerVertex];
+		const float* v2 = &submesh.vertices[(size_t)t[2] * floatsPerVertex];
+
+		vec3 edge1 = vec3(v1[0] - v0[0], v1[1] - v0[1], v1[2] - v0[2]);
+		vec3 edge2 = vec3(v2[0] - v0[0], v2[1] - v0[1], v2[2] - v0[2]);
+		vec2 delta1 = vec2(v1[6] - v0[6], v1[7] - v0[7]);
+		vec2 delta2 = vec2(v2[6] - v0[6], v2[7] - v0[7]);
+
+		f32 determinant = delta1.x * delta2.y - delta2.x * delta1.y;
+		if (fabsf(determinant) < 1e-12f)
+			continue;
+
+		vec3 tangent = (edge1 * delta2.y - edge2 * delta1.y) / determinant;
+		vec3 bitangent = (edge2 * delta1.x - edge1 * delta2.x) / determinant;
+		f32 tangentLength = glm::length(tangent);
+		f32 bitangentLength = glm::length(bitangent);
+		if (tangentLength <= 0.0f || bitangentLength <= 0.0f)
+			continue;
+
+		for (u32 k = 0; k < 3; ++k)
+		{
+			tangents[t[k]] += tangent / tangentLength;
+			bitangents[t[k]] += bitangent / bitangentLength;
+		}
+	}
+
+	for (u32 v = 0; v < vertexCount; ++v)
+	{
+		float* out = submesh.vertices.data() + (size_t)v * floatsPerVertex;
+		vec3 normal = vec3(out[3], out[4], out[5]);
+
+		vec3 tangent = tangents[v] - normal * glm::dot(normal, tangents[v]);
+		if (glm::dot(tangent, tangent) < 1e-12f)
+			tangent = glm::cross(normal, fabsf(normal.x) < 0.9f ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f));
+		tangent = glm::normalize(tangent);
+
+		vec3 bitangent = bitangents[v] - normal * glm::dot(normal, bitangents[v]);
+		if (glm::dot(bitangent, bitangent) < 1e-12f)
+			bitangent = glm::cross(normal, tangent);
+		bitangent = glm::normalize(bitangent);
+
+		memcpy(out + 8, &tangent, sizeof(tangent));
+		memcpy(out + 11, &bitangent, sizeof(bitangent));
+	}
+}
+
+bool IsObjFile(const char* filename)
+{
+	size_t length = strlen(filename);
+	if (length < 4)
+		return false;
+
+	const char* extension = filename + length - 4;
+	return extension[0] == '.' &&
+		(extension[1] | 0x20) == 'o' &&
+		(extension[2] | 0x20) == 'b' &&
+		(extension[3] | 0x20) == 'j';
+}
+
+bool ParseObjModel(ThreadPool* pool, const char* filename, ObjModel& model)
+{
+	AssetFile file;
+	if (!ReadAssetFile(filename, file))
+	{
+		ELOG("Could not open %s", filename);
+		return false;
+	}
+
+	const char* data = (const char*)file.data;
+	const char* fileEnd = data + file.size;
+
+	// Line aligned chunks
+	u64 chunkSize = file.size / ((u64)(GetWorkerCount(pool) + 1) * OBJ_CHUNKS_PER_WORKER) + 1;
+	if (chunkSize < OBJ_MIN_CHUNK_SIZE)
+		chunkSize = OBJ_MIN_CHUNK_SIZE;
+
+	std::vector<ObjChunk> chunks;
+	for (const char* p = data; p < fileEnd; )
+	{
+		const char* chunkEnd = (u64)(fileEnd - p) <= chunkSize ? fileEnd : FindLineEnd(p + chunkSize, fileEnd);
+		if (chunkEnd < fileEnd)
+			chunkEnd++;
+
+		chunks.push_back(ObjChunk{});
+		chunks.back().begin = p;
+		chunks.back().end = chunkEnd;
+		p = chunkEnd;
+	}
+
+	ParallelFor(pool, (u32)chunks.size(), 1, [&](u32 begin, u32 end)
+		{
+			for (u32 i = begin; i < end; ++i)
+				ParseObjChunk(chunks[i]);
+		});
+
+	for (const ObjChunk& chunk : chunks)
+	{
+		if (chunk.errorAt)
+		{
+			u32 line = 1;
+			for (const char* p = data; p < chunk.errorAt; ++p)
+				line += *p == '\n';
+			ELOG("Error parsing %s at line %u", filename, line);
+			FreeAssetFile(file);
+			return false;
+		}
+	}
+
+	// Elements of the previous chunks, to resolve the relative indices and check the others
+	u64 totals[3] = {};
+	bool missingNormals = false;
+	for (ObjChunk& chunk : chunks)
+	{
+		const u64 counts[3] = { chunk.positions.size(), chunk.texCoords.size(), chunk.normals.size() };
+		for (u32 k = 0; k < 3; ++k)
+		{
+			chunk.firstElement[k] = (u32)totals[k];
+			totals[k] += counts[k];
+		}
+		missingNormals = missingNormals || chunk.missingNormals;
+	}
+
+	if (totals[0] + (missingNormals ? totals[0] : 0) + totals[2] > INT32_MAX || totals[1] > INT32_MAX)
+	{
+		ELOG("Error parsing %s: too many vertices", filename);
+		FreeAssetFile(file);
+		return false;
+	}
+
+	ParallelFor(pool, (u32)chunks.size(), 1, [&](u32 begin, u32 end)
+		{
+			for (u32 i = begin; i < end; ++i)
+			{
+				ObjChunk& chunk = chunks[i];
+				for (ObjCorner& corner : chunk.corners)
+				{
+					for (u32 k = 0; k < 3; ++k)
+					{
+						if (corner.index[k] == OBJ_NO_INDEX)
+							continue;
+						if (corner.relative & (1u << k))
+							corner.index[k] += (i32)chunk.firstElement[k];
+						chunk.invalidIndices = chunk.invalidIndices || corner.index[k] < 0 || (u64)corner.index[k] >= totals[k];
+					}
+				}
+			}
+		});
+
+	for (const ObjChunk& chunk : chunks)
+	{
+		if (chunk.invalidIndices)
+		{
+			ELOG("Error parsing %s: face indices out of range", filename);
+			FreeAssetFile(file);
+			return false;
+		}
+	}
+
+	// Material libraries, relative to the directory of the OBJ file
+	std::string directory = GetDirectoryPrefix(filename);
+
+	std::vector<ObjMaterial> libraryMaterials;
+	for (const ObjChunk& chunk : chunks)
+		for (const std::string& library : chunk.materialLibraries)
+			ParseMtlFile(directory + library, libraryMaterials);
+
+	// Consecutive triangles with the same material, in file order, go to the same submesh.
+	// Faces before the first usemtl use the default material.
+	std::unordered_map<std::string, u32> submeshByName;
+	std::vector<std::vector<ObjRun>> submeshRuns;
+	std::string materialName;
+	model.materials.clear();
+	model.triangleCount = 0;
+
+	auto addRun = [&](u32 chunkIdx, u32 firstTriangle, u32 lastTriangle)
+	{
+		if (firstTriangle == lastTriangle)
+			return;
+
+		auto it = submeshByName.find(materialName);
+		if (it == submeshByName.end())
+		{
+			it = submeshByName.insert({ materialName, (u32)submeshRuns.size() }).first;
+			submeshRuns.push_back({});
+
+			ObjMaterial material = {};
+			material.name = materialName.empty() ? "DefaultMaterial" : materialName;
+			material.diffuse = vec3(0.6f);
+			for (const ObjMaterial& libraryMaterial : libraryMaterials)
+				if (libraryMaterial.name == materialName)
+					material = libraryMaterial;
+			model.materials.push_back(material);
+		}
+		submeshRuns[it->second].push_back({ chunkIdx, firstTriangle, lastTriangle - firstTriangle });
+		model.triangleCount += lastTriangle - firstTriangle;
+	};
+
+	for (u32 chunkIdx = 0; chunkIdx < (u32)chunks.size(); ++chunkIdx)
+	{
+		const ObjChunk& chunk = chunks[chunkIdx];
+		u32 triangle = 0;
+		for (const ObjMaterialSwitch& materialSwitch : chunk.materialSwitches)
+		{
+			addRun(chunkIdx, triangle, materialSwitch.triangleIdx);
+			triangle = materialSwitch.triangleIdx;
+			materialName = materialSwitch.name;
+		}
+		addRun(chunkIdx, triangle, (u32)(chunk.corners.size() / 3));
+	}
+
+	if (submeshRuns.empty())
+	{
+		ELOG("Error parsing %s: no faces", filename);
+		FreeAssetFile(file);
+		return false;
+	}
+
+	ObjAttributes attributes;
+	attributes.positions.resize(totals[0]);
+	attributes.texCoords.resize(totals[1]);
+	attributes.normals.resize(totals[2] + (missingNormals ? totals[0] : 0), vec3(0.0f));
+	attributes.generatedNormalsBase = (u32)totals[2];
+
+	ParallelFor(pool, (u32)chunks.size(), 1, [&](u32 begin, u32 end)
+		{
+			for (u32 i = begin; i < end; ++i)
+			{
+				const ObjChunk& chunk = chunks[i];
+				std::copy(chunk.positions.begin(), chunk.positions.end(), attributes.positions.begin() + chunk.firstElement[0]);
+				std::copy(chunk.texCoords.begin(), chunk.texCoords.end(), attributes.texCoords.begin() + chunk.firstElement[1]);
+				std::copy(chunk.normals.begin(), chunk.normals.end(), attributes.normals.begin() + chunk.firstElement[2]);
+			}
+		});
+
+	// Smooth normals by position, weighted by the area of the faces
+	if (missingNormals)
+	{
+		vec3* generatedNormals = attributes.normals.data() + attributes.generatedNormalsBase;
+		for (const ObjChunk& chunk : chunks)
+		{
+			for (size_t i = 0; i + 2 < chunk.corners.size(); i += 3)
+			{
+				const ObjCorner* t = &chunk.corners[i];
+				vec3 p0 = attributes.positions[t[0].index[0]];
+				vec3 p1 = attributes.positions[t[1].index[0]];
+				vec3 p2 = attributes.positions[t[2].index[0]];
+				vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				for (u32 k = 0; k < 3; ++k)
+					generatedNormals[t[k].index[0]] += normal;
+			}
+		}
+
+		ParallelFor(pool, (u32)totals[0], 65536, [=](u32 begin, u32 end)
+			{
+				for (u32 i = begin; i < end; ++i)
+				{
+					f32 length = glm::length(generatedNormals[i]);
+					generatedNormals[i] = length > 0.0f ? generatedNormals[i] / length : vec3(0.0f, 1.0f, 0.0f);
+				}
+			});
+	}
+
+	model.mesh = Mesh{};
+	model.mesh.submeshes.resize(submeshRuns.size());
+	ParallelFor(pool, (u32)submeshRuns.size(), 1, [&](u32 begin, u32 end)
+		{
+			for (u32 i = begin; i < end; ++i)
+				BuildObjSubmesh(attributes, chunks, submeshRuns[i], model.mesh.submeshes[i]);
+		});
+
+	model.positionCount = (u32)totals[0];
+
+	FreeAssetFile(file);
+	return true;
+}
+
+bool ImportObjModel(ThreadPool* pool, const char* filename, ModelData& data)
+{
+	ObjModel obj;
+	if (!ParseObjModel(pool, filename, obj))
+		return false;
+
+	const TextureUsage textureUsages[ObjTexture_Count] = { TextureUsage_Color, TextureUsage_Color, TextureUsage_Data, TextureUsage_Normal, TextureUsage_Data };
+	u32 Material::* const textureSlots[ObjTexture_Count] =
+	{
+		&Material::albedoTextureIdx,
+		&Material::emissiveTextureIdx,
+		&Material::specularTextureIdx,
+		&Material::normalsTextureIdx,
+		&Material::bumpTextureIdx,
+	};
+
+	// One material per submesh, with the same parameters ProcessAssimpMaterial takes
+	for (u32 materialIdx = 0; materialIdx < (u32)obj.materials.size(); ++materialIdx)
+	{
+		const ObjMaterial& objMaterial = obj.materials[materialIdx];
+
+		Material material = {};
+		material.name = objMaterial.name;
+		material.albedo = objMaterial.diffuse;
+		material.emissive = objMaterial.emissive;
+		material.smoothness = objMaterial.shininess / 256.0f;
+		data.materials.push_back(material);
+		data.submeshMaterials.push_back(materialIdx);
+
+		for (u32 slot = 0; slot < ObjTexture_Count; ++slot)
+			if (!objMaterial.textures[slot].empty())
+				data.textures.push_back({ objMaterial.directory + objMaterial.textures[slot], textureUsages[slot], materialIdx, textureSlots[slot] });
+	}
+
+	data.mesh = std::move(obj.mesh);
+	data.importFlags = OBJ_IMPORT_CACHE_FLAGS;
+	return true;
+}
@@ -0,0 +1,60 @@
+//
+// obj_loader.h: Native Wavefront OBJ/MTL importer, the fast path of LoadModel for .obj files.
+// The file is memory mapped and parsed in line aligned chunks on the thread pool, and the
+// submeshes and materials are produced directly, without going through Assimp.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Written to the mesh cache instead of the Assimp post process flags, so a cache baked by one
+// importer is never loaded by the other
+#define OBJ_IMPORT_CACHE_FLAGS 0x4A424F01
+
+enum ObjTextureSlot
+{
+	ObjTexture_Diffuse,  // map_Kd
+	ObjTexture_Emissive, // map_Ke
+	ObjTexture_Specular, // map_Ks
+	ObjTexture_Normals,  // norm
+	ObjTexture_Bump,     // bump, map_Bump
+	ObjTexture_Count
+};
+
+struct ObjMaterial
+{
+	std::string name;
+	vec3 diffuse;
+	vec3 emissive;
+	f32 shininess;
+	std::string textures[ObjTexture_Count]; // as written in the MTL file, relative to its directory
+	std::string directory;                  // of the MTL file, with the trailing slash
+};
+
+// One submesh and one material for each material used by the faces
+struct ObjModel
+{
+	Mesh mesh;
+	std::vector<ObjMaterial> materials;
+	u32 positionCount;
+	u32 triangleCount;
+};
+
+bool IsObjFile(const char* filename);
+
+/**
+ * Parses an OBJ file and the MTL libraries it references. Polygons are triangulated as fans,
+ * faces are grouped in one submesh per material and their v/vt/vn triples are welded into
+ * unique vertices. Like the Assimp flags of ImportModel, missing normals are generated from
+ * the faces around each position and tangents are computed when there are texture
+ * coordinates. Returns false if the file cannot be mapped, is malformed or has no faces.
+ */
+bool ParseObjModel(ThreadPool* pool, const char* filename, ObjModel& model);
+
+/**
+ * Parses the file with ParseObjModel into the data of a model, with the texture paths made
+ * relative to the working directory. Returns false on failure, so the caller can fall back
+ * to Assimp.
+ */
+bool ImportObjModel(ThreadPool* pool, const char* filename, ModelData& data);
@@ -0,0 +1,207 @@
+#include "occlusion_culling.h"
+#include <emmintrin.h>
+#include <float.h>
+
+void ClearOcclusionBuffer(OcclusionBuffer& buffer)
+{
+	buffer.depth.assign(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 0.0f);
+	for (u32 tile = 0; tile < OCCLUSION_TILE_COUNT; ++tile)
+	{
+		buffer.tileFarthest[tile] = 0.0f;
+		buffer.bins[tile].clear();
+	}
+	buffer.triangles.clear();
+}
+
+// Pixel coordinates from the top left corner, and the inverse depth
+static glm::vec3 ProjectToBuffer(const glm::vec4& clip)
+{
+	f32 invW = 1.0f / clip.w;
+	return glm::vec3((clip.x * invW * 0.5f + 0.5f) * OCCLUSION_WIDTH, (0.5f - clip.y * invW * 0.5f) * OCCLUSION_HEIGHT, invW);
+}
+
+void AddOccluder(OcclusionBuffer& buffer, const glm::vec3* positions, u32 triangleCount, const glm::mat4& worldViewProjection)
+{
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		glm::vec4 clip[3];
+		bool behind = false;
+		for (u32 k = 0; k < 3; ++k)
+		{
+			clip[k] = worldViewProjection * glm::vec4(positions[t * 3 + k], 1.0f);
+			behind = behind || clip[k].z < -clip[k].w;
+		}
+		if (behind)
+			continue;
+
+		glm::vec3 v[3] = { ProjectToBuffer(clip[0]), ProjectToBuffer(clip[1]), ProjectToBuffer(clip[2]) };
+
+		f32 area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+		if (area == 0.0f)
+			continue;
+
+		OcclusionTriangle triangle;
+		f32 minX = glm::min(v[0].x, glm::min(v[1].x, v[2].x));
+		f32 maxX = glm::max(v[0].x, glm::max(v[1].x, v[2].x));
+		f32 minY = glm::min(v[0].y, glm::min(v[1].y, v[2].y));
+		f32 maxY = glm::max(v[0].y, glm::max(v[1].y, v[2].y));
+		triangle.minX = glm::max((i32)ceilf(minX - 0.5f), 0);
+		triangle.minY = glm::max((i32)ceilf(minY - 0.5f), 0);
+		triangle.maxX = glm::min((i32)floorf(maxX - 0.5f), OCCLUSION_WIDTH - 1);
+		triangle.maxY = glm::min((i32)floorf(maxY - 0.5f), OCCLUSION_HEIGHT - 1);
+		if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+			continue; // no pixel center inside, or off the screen
+
+		// Edges oriented so the inside is positive whatever the winding
+		f32 sign = area > 0.0f ? 1.0f : -1.0f;
+		for (u32 e = 0; e < 3; ++e)
+		{
+			const glm::vec3& a = v[e];
+			const glm::vec3& b = v[(e + 1) % 3];
+			triangle.edgeA[e] = sign * (a.y - b.y);
+			triangle.edgeB[e] = sign * (b.x - a.x);
+			triangle.edgeC[e] = sign * (a.x * b.y - b.x * a.y);
+		}
+
+		triangle.depthA = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+		triangle.depthB = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+		triangle.depthC = v[0].z - triangle.depthA * v[0].x - triangle.depthB * v[0].y;
+
+		u32 triangleIdx = (u32)buffer.triangles.size();
+		buffer.triangles.push_back(triangle);
+
+		for (i32 tileY = triangle.minY / OCCLUSION_TILE_SIZE; tileY <= triangle.maxY / OCCLUSION_TILE_SIZE; ++tileY)
+			for (i32 tileX = triangle.minX / OCCLUSION_TILE_SIZE; tileX <= triangle.maxX / OCCLUSION_TILE_SIZE; ++tileX)
+				buffer.bins[tileY * OCCLUSION_TILES_X + tileX].push_back(triangleIdx);
+	}
+}
+
+static void RasterizeTile(OcclusionBuffer& buffer, u32 tile)
+{
+	const i32 tileMinX = (tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE;
+	const i32 tileMinY = (tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_SIZE;
+	const i32 tileMaxX = tileMinX + OCCLUSION_TILE_SIZE - 1;
+	const i32 tileMaxY = tileMinY + OCCLUSION_TILE_SIZE - 1;
+	const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (u32 triangleIdx : buffer.bins[tile])
+	{
+		const OcclusionTriangle& triangle = buffer.triangles[triangleIdx];
+
+		// Groups of 4 pixels start on multiples of 4, so they never leave the tile
+		i32 minX = glm::max(triangle.minX, tileMinX) & ~3;
+		i32 maxX = glm::min(triangle.maxX, tileMaxX);
+		i32 minY = glm::max(triangle.minY, tileMinY);
+		i32 maxY = glm::min(triangle.maxY, tileMaxY);
+
+		__m128 edgeA0 = _mm_set1_ps(triangle.edgeA[0]), edgeA1 = _mm_set1_ps(triangle.edgeA[1]), edgeA2 = _mm_set1_ps(triangle.edgeA[2]);
+		__m128 depthA = _mm_set1_ps(triangle.depthA);
+
+		for (i32 y = minY; y <= maxY; ++y)
+		{
+			f32 centerY = y + 0.5f;
+			__m128 rowEdge0 = _mm_set1_ps(triangle.edgeB[0] * centerY + triangle.edgeC[0]);
+			__m128 rowEdge1 = _mm_set1_ps(triangle.edgeB[1] * centerY + triangle.edgeC[1]);
+			__m128 rowEdge2 = _mm_set1_ps(triangle.edgeB[2] * centerY + triangle.edgeC[2]);
+			__m128 rowDepth = _mm_set1_ps(triangle.depthB * centerY + triangle.depthC);
+
+			f32* row = &buffer.depth[y * OCCLUSION_WIDTH];
+			for (i32 x = minX; x <= maxX; x += 4)
+			{
+				__m128 centerX = _mm_add_ps(_mm_set1_ps((f32)x), laneOffsets);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(edgeA0, centerX), rowEdge0);
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(edgeA1, centerX), rowEdge1);
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(edgeA2, centerX), rowEdge2);
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				// Larger inverse depth is nearer
+				__m128 depth = _mm_add_ps(_mm_mul_ps(depthA, centerX), rowDepth);
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearest = _mm_max_ps(old, depth);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+			}
+		}
+	}
+
+	// Farthest depth of the tile, a box beyond it is hidden in the whole tile
+	__m128 farthest = _mm_set1_ps(FLT_MAX);
+	for (i32 y = tileMinY; y <= tileMaxY; ++y)
+		for (i32 x = tileMinX; x <= tileMaxX; x += 4)
+			farthest = _mm_min_ps(farthest, _mm_loadu_ps(&buffer.depth[y * OCCLUSION_WIDTH + x]));
+
+	f32 lanes[4];
+	_mm_storeu_ps(lanes, farthest);
+	buffer.tileFarthest[tile] = glm::min(glm::min(lanes[0], lanes[1]), glm::min(lanes[2], lanes[3]));
+}
+
+void RasterizeOccluders(OcclusionBuffer& buffer, ThreadPool* pool)
+{
+	ParallelFor(pool, OCCLUSION_TILE_COUNT, 1, [&buffer](u32 begin, u32 end)
+		{
+			for (u32 tile = begin; tile < end; ++tile)
+				RasterizeTile(buffer, tile);
+		});
+}
+
+bool IsBoxOccluded(const OcclusionBuffer& buffer, glm::vec3 aabbMin, glm::vec3 aabbMax, const glm::mat4& viewProjection)
+{
+	// Screen rectangle of the corners and the inverse depth of the nearest one
+	f32 minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	f32 nearest = 0.0f;
+	for (u32 corner = 0; corner < 8; ++corner)
+	{
+		glm::vec3 p = glm::vec3(corner & 1 ? aabbMax.x : aabbMin.x, corner & 2 ? aabbMax.y : aabbMin.y, corner & 4 ? aabbMax.z : aabbMin.z);
+		glm::vec4 clip = viewProjection * glm::vec4(p, 1.0f);
+		if (clip.z < -clip.w)
+			return false;
+
+		glm::vec3 v = ProjectToBuffer(clip);
+		minX = glm::min(minX, v.x);
+		maxX = glm::max(maxX, v.x);
+		minY = glm::min(minY, v.y);
+		maxY = glm::max(maxY, v.y);
+		nearest = glm::max(nearest, v.z);
+	}
+
+	// Every pixel the rectangle touches, even partly
+	i32 x0 = glm::max((i32)floorf(minX), 0);
+	i32 y0 = glm::max((i32)floorf(minY), 0);
+	i32 x1 = glm::min((i32)ceilf(maxX) - 1, OCCLUSION_WIDTH - 1);
+	i32 y1 = glm::min((i32)ceilf(maxY) - 1, OCCLUSION_HEIGHT - 1);
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	// Hidden where the buffer is nearer than the biased box
+	const f32 boxDepth = nearest * (1.0f + OCCLUSION_DEPTH_BIAS);
+	const __m128 boxDepth4 = _mm_set1_ps(boxDepth);
+
+	for (i32 tileY = y0 / OCCLUSION_TILE_SIZE; tileY <= y1 / OCCLUSION_TILE_SIZE; ++tileY)
+	{
+		for (i32 tileX = x0 / OCCLUSION_TILE_SIZE; tileX <= x1 / OCCLUSION_TILE_SIZE; ++tileX)
+		{
+			if (boxDepth < buffer.tileFarthest[tileY * OCCLUSION_TILES_X + tileX])
+				continue;
+
+			i32 rowMinX = glm::max(x0, tileX * OCCLUSION_TILE_SIZE);
+			i32 rowMaxX = glm::min(x1, tileX * OCCLUSION_TILE_SIZE + OCCLUSION_TILE_SIZE - 1);
+			i32 rowMinY = glm::max(y0, tileY * OCCLUSION_TILE_SIZE);
+			i32 rowMaxY = glm::min(y1, tileY * OCCLUSION_TILE_SIZE + OCCLUSION_TILE_SIZE - 1);
+			for (i32 y = rowMinY; y <= rowMaxY; ++y)
+			{
+				const f32* row = &buffer.depth[y * OCCLUSION_WIDTH];
+				i32 x = rowMinX;
+				for (; x + 3 <= rowMaxX; x += 4)
+					if (_mm_movemask_ps(_mm_cmpge_ps(boxDepth4, _mm_loadu_ps(row + x))) != 0)
+						return false;
+				for (; x <= rowMaxX; ++x)
+					if (boxDepth >= row[x])
+						return false;
+			}
+		}
+	}
+
+	return true;
+}
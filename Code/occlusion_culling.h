@@ -0,0 +1,68 @@
+//
+// occlusion_culling.h: Occlusion culling with a small depth buffer rasterized on the CPU. A few
+// large occluders, drawn with their full meshes, are binned into tiles and every tile is
+// rasterized in its own job, four pixels at a time with SSE. Boxes are then tested against the
+// buffer, and the ones behind the occluders at every pixel they cover are not drawn.
+// Nothing here touches OpenGL.
+//
+
+#pragma once
+
+#include "job_system.h"
+
+#define OCCLUSION_WIDTH       256
+#define OCCLUSION_HEIGHT      128
+#define OCCLUSION_TILE_SIZE   32
+#define OCCLUSION_TILES_X     (OCCLUSION_WIDTH / OCCLUSION_TILE_SIZE)
+#define OCCLUSION_TILES_Y     (OCCLUSION_HEIGHT / OCCLUSION_TILE_SIZE)
+#define OCCLUSION_TILE_COUNT  (OCCLUSION_TILES_X * OCCLUSION_TILES_Y)
+
+// Boxes must be this much farther than the occluders, relative to their distance, so surfaces
+// do not hide themselves through rounding
+#define OCCLUSION_DEPTH_BIAS  1e-3f
+
+// A triangle set up for rasterization, in pixels
+struct OcclusionTriangle
+{
+	f32 edgeA[3];  // inside where A x + B y + C >= 0 for the three edges
+	f32 edgeB[3];
+	f32 edgeC[3];
+	f32 depthA;    // inverse depth at (x, y) is A x + B y + C
+	f32 depthB;
+	f32 depthC;
+	i32 minX, minY; // pixels whose centers may be inside
+	i32 maxX, maxY;
+};
+
+struct OcclusionBuffer
+{
+	// Inverse of the clip space w of the nearest occluder, 0 where there is none. It is linear
+	// in screen space and keeps its precision far away. Rows go from the top.
+	std::vector<f32> depth;
+	f32 tileFarthest[OCCLUSION_TILE_COUNT];
+
+	std::vector<OcclusionTriangle> triangles;
+	std::vector<u32> bins[OCCLUSION_TILE_COUNT]; // triangles overlapping each tile
+};
+
+/**
+ * Empties the buffer and the queued occluders.
+ */
+void ClearOcclusionBuffer(OcclusionBuffer& buffer);
+
+/**
+ * Projects the triangles, three positions each, with the matrix and queues them in the tiles
+ * they overlap. Triangles crossing the near plane are dropped, which only lets more through.
+ */
+void AddOccluder(OcclusionBuffer& buffer, const glm::vec3* positions, u32 triangleCount, const glm::mat4& worldViewProjection);
+
+/**
+ * Rasterizes the queued triangles, every tile in a job of the pool, keeping the nearest depth.
+ */
+void RasterizeOccluders(OcclusionBuffer& buffer, ThreadPool* pool);
+
+/**
+ * True when the box is farther than the occluders at every pixel it covers, on the part of it
+ * inside the screen. Boxes crossing the near plane are never occluded.
+ */
+bool IsBoxOccluded(const OcclusionBuffer& buffer, glm::vec3 aabbMin, glm::vec3 aabbMax, const glm::mat4& viewProjection);
@@ -12,6 +12,8 @@
 #else
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
@@ -22,6 +24,7 @@
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <chrono>
 
 #define WINDOW_TITLE  "Gud engine"
 #define WINDOW_WIDTH  800
@@ -159,6 +162,7 @@ int main()
 		ELOG("Failed to initialize OpenGL context\n");
 		return -1;
 	}
+	LoadBufferStorage((GLADloadproc)glfwGetProcAddress);
 
 	IMGUI_CHECKVERSION();
 	ImGui::CreateContext();
@@ -262,6 +266,8 @@ int main()
 		GlobalFrameArenaHead = 0;
 	}
 
+	Shutdown(&app);
+
 	free(GlobalFrameArenaMemory);
 
 	ImGui_ImplOpenGL3_Shutdown();
@@ -350,6 +356,13 @@ String GetDirectoryPart(String path)
 	return str;
 }
 
+std::string GetDirectoryPrefix(const char* path)
+{
+	std::string directory = path;
+	size_t separator = directory.find_last_of("/\\");
+	return separator == std::string::npos ? std::string() : directory.substr(0, separator + 1);
+}
+
 String ReadTextFile(const char* filepath)
 {
 	String fileText = {};
@@ -400,6 +413,111 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
 	return 0;
 }
 
+static MappedFile MapFileCountingCalls(const char* filepath, u32& calls)
+{
+	MappedFile file = {};
+
+#ifdef _WIN32
+	calls++;
+	HANDLE fileHandle = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return file;
+
+	calls++;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0)
+	{
+		calls++;
+		CloseHandle(fileHandle);
+		return file;
+	}
+
+	calls++;
+	HANDLE mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == NULL)
+	{
+		calls++;
+		CloseHandle(fileHandle);
+		return file;
+	}
+
+	calls++;
+	file.data = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (file.data == NULL)
+	{
+		calls += 2;
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		return file;
+	}
+
+	file.size = (u64)fileSize.QuadPart;
+	file.fileHandle = fileHandle;
+	file.mappingHandle = mappingHandle;
+#else
+	calls++;
+	int fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+		return file;
+
+	calls++;
+	struct stat attrib;
+	if (fstat(fd, &attrib) != 0 || attrib.st_size == 0)
+	{
+		calls++;
+		close(fd);
+		return file;
+	}
+
+	calls += 2;
+	void* data = mmap(NULL, attrib.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps its own reference to the file
+
+	if (data == MAP_FAILED)
+		return file;
+
+	file.data = data;
+	file.size = (u64)attrib.st_size;
+#endif
+
+	return file;
+}
+
+MappedFile MapFile(const char* filepath, u32* osCalls)
+{
+	u32 calls = 0;
+	MappedFile file = MapFileCountingCalls(filepath, calls);
+	if (osCalls)
+		*osCalls += calls;
+	return file;
+}
+
+void UnmapFile(MappedFile& file, u32* osCalls)
+{
+	if (file.data == NULL)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle((HANDLE)file.mappingHandle);
+	CloseHandle((HANDLE)file.fileHandle);
+	if (osCalls)
+		*osCalls += 3;
+#else
+	munmap(file.data, file.size);
+	if (osCalls)
+		*osCalls += 1;
+#endif
+
+	file = {};
+}
+
+f64 GetTimestamp()
+{
+	using namespace std::chrono;
+	return duration_cast<duration<f64>>(steady_clock::now().time_since_epoch()).count();
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
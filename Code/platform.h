@@ -69,6 +69,12 @@ String MakePath(String dir, String filename);
 
 String GetDirectoryPart(String path);
 
+/**
+ * Directory of the path with its trailing separator, or an empty string if there is none.
+ * Unlike GetDirectoryPart it does not use the frame arena, so any thread can call it.
+ */
+std::string GetDirectoryPrefix(const char* path);
+
 /**
  * Reads a whole file and returns a string with its contents. The returned string
  * is temporary and should be copied if it needs to persist for several frames.
@@ -81,6 +87,32 @@ String ReadTextFile(const char* filepath);
  */
 u64 GetFileLastWriteTimestamp(const char* filepath);
 
+struct MappedFile
+{
+	void* data;
+	u64   size;
+	void* fileHandle;
+	void* mappingHandle;
+};
+
+/**
+ * Maps a whole file into memory in read-only mode. If the file could not be
+ * opened, the returned MappedFile has its data pointer set to NULL.
+ * The number of OS calls issued, failed ones included, is added to osCalls.
+ */
+MappedFile MapFile(const char* filepath, u32* osCalls = NULL);
+
+/**
+ * Releases a file previously mapped with MapFile, adding the OS calls to osCalls.
+ */
+void UnmapFile(MappedFile& file, u32* osCalls = NULL);
+
+/**
+ * It retrieves a high resolution timestamp in seconds. Only differences between
+ * two timestamps are meaningful (e.g. to profile asset loading).
+ */
+f64 GetTimestamp();
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
@@ -0,0 +1,825 @@
+#include "texture_compression.h"
+#include "mipmap.h"
+#include <emmintrin.h>
+#include <float.h>
+
+// Pixels of a 4x4 block in SoA layout, so four pixels can be processed per SSE instruction
+struct BlockPixels
+{
+	alignas(16) f32 r[16];
+	alignas(16) f32 g[16];
+	alignas(16) f32 b[16];
+	alignas(16) f32 a[16];
+};
+
+static const vec4 ChannelMaskR = vec4(1.0f, 0.0f, 0.0f, 0.0f);
+static const vec4 ChannelMaskRGB = vec4(1.0f, 1.0f, 1.0f, 0.0f);
+static const vec4 ChannelMaskRGBA = vec4(1.0f, 1.0f, 1.0f, 1.0f);
+
+static const u32 BC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+BlockFormat ChooseBlockFormat(TextureUsage usage, i32 nchannels, bool supportsS3TC)
+{
+	BlockFormat format = BlockFormat_BC1;
+
+	switch (usage)
+	{
+	case TextureUsage_Color:  format = nchannels == 4 ? BlockFormat_BC7 : BlockFormat_BC1; break;
+	case TextureUsage_Normal: format = BlockFormat_BC5; break;
+	case TextureUsage_Data:   format = nchannels == 4 ? BlockFormat_BC3 : BlockFormat_BC1; break;
+	}
+
+	if (!supportsS3TC && (format == BlockFormat_BC1 || format == BlockFormat_BC3))
+		format = BlockFormat_BC7;
+
+	return format;
+}
+
+GLenum GetBlockFormatGLFormat(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BlockFormat_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BlockFormat_BC5: return GL_COMPRESSED_RG_RGTC2;
+	case BlockFormat_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default:              return GL_NONE;
+	}
+}
+
+const char* GetBlockFormatName(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat_BC1: return "BC1";
+	case BlockFormat_BC3: return "BC3";
+	case BlockFormat_BC5: return "BC5";
+	case BlockFormat_BC7: return "BC7";
+	default:              return "Unknown";
+	}
+}
+
+static u32 GetBlockSize(BlockFormat format)
+{
+	return format == BlockFormat_BC1 ? 8 : 16;
+}
+
+// Bit packing helpers (little endian, as laid out by the BC formats)
+struct BitWriter
+{
+	u8* data;
+	u32 bit;
+};
+
+static void WriteBits(BitWriter& writer, u32 value, u32 count)
+{
+	for (u32 i = 0; i < count; ++i, ++writer.bit)
+		if ((value >> i) & 1)
+			writer.data[writer.bit >> 3] |= (u8)(1 << (writer.bit & 7));
+}
+
+struct BitReader
+{
+	const u8* data;
+	u32 bit;
+};
+
+static u32 ReadBits(BitReader& reader, u32 count)
+{
+	u32 value = 0;
+	for (u32 i = 0; i < count; ++i, ++reader.bit)
+		value |= ((reader.data[reader.bit >> 3] >> (reader.bit & 7)) & 1) << i;
+	return value;
+}
+
+static void LoadBlockPixels(const u8* rgba, u32 width, u32 height, u32 blockX, u32 blockY, BlockPixels& pixels)
+{
+	// Blocks crossing the image border replicate the edge pixels
+	for (u32 y = 0; y < 4; ++y)
+	{
+		u32 py = glm::min(blockY * 4 + y, height - 1);
+		for (u32 x = 0; x < 4; ++x)
+		{
+			u32 px = glm::min(blockX * 4 + x, width - 1);
+			const u8* pixel = rgba + (py * width + px) * 4;
+			u32 i = y * 4 + x;
+			pixels.r[i] = pixel[0];
+			pixels.g[i] = pixel[1];
+			pixels.b[i] = pixel[2];
+			pixels.a[i] = pixel[3];
+		}
+	}
+}
+
+/**
+ * For every pixel of the block finds the closest palette entry. Four pixels are compared
+ * against each palette entry at once. Returns the total squared error of the block.
+ */
+static f32 FindNearestIndices(const BlockPixels& pixels, const vec4* palette, u32 paletteSize, const vec4& channelMask, u8* indices)
+{
+	__m128 totalError = _mm_setzero_ps();
+
+	for (u32 group = 0; group < 16; group += 4)
+	{
+		__m128 r = _mm_load_ps(pixels.r + group);
+		__m128 g = _mm_load_ps(pixels.g + group);
+		__m128 b = _mm_load_ps(pixels.b + group);
+		__m128 a = _mm_load_ps(pixels.a + group);
+
+		__m128 bestError = _mm_set1_ps(FLT_MAX);
+		__m128i bestIndex = _mm_setzero_si128();
+
+		for (u32 i = 0; i < paletteSize; ++i)
+		{
+			__m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[i].r));
+			__m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[i].g));
+			__m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[i].b));
+			__m128 da = _mm_sub_ps(a, _mm_set1_ps(palette[i].a));
+
+			__m128 error = _mm_mul_ps(_mm_mul_ps(dr, dr), _mm_set1_ps(channelMask.r));
+			error = _mm_add_ps(error, _mm_mul_ps(_mm_mul_ps(dg, dg), _mm_set1_ps(channelMask.g)));
+			error = _mm_add_ps(error, _mm_mul_ps(_mm_mul_ps(db, db), _mm_set1_ps(channelMask.b)));
+			error = _mm_add_ps(error, _mm_mul_ps(_mm_mul_ps(da, da), _mm_set1_ps(channelMask.a)));
+
+			__m128i better = _mm_castps_si128(_mm_cmplt_ps(error, bestError));
+			bestIndex = _mm_or_si128(_mm_and_si128(better, _mm_set1_epi32(i)), _mm_andnot_si128(better, bestIndex));
+			bestError = _mm_min_ps(error, bestError);
+		}
+
+		alignas(16) u32 groupIndices[4];
+		_mm_store_si128((__m128i*)groupIndices, bestIndex);
+		for (u32 i = 0; i < 4; ++i)
+			indices[group + i] = (u8)groupIndices[i];
+
+		totalError = _mm_add_ps(totalError, bestError);
+	}
+
+	alignas(16) f32 errors[4];
+	_mm_store_ps(errors, totalError);
+	return errors[0] + errors[1] + errors[2] + errors[3];
+}
+
+static vec4 GetPixel(const BlockPixels& pixels, u32 i)
+{
+	return vec4(pixels.r[i], pixels.g[i], pixels.b[i], pixels.a[i]);
+}
+
+/**
+ * Finds the line that best fits the block colors (mean + principal axis of the covariance
+ * by power iteration) and returns its extremes as the initial endpoints.
+ */
+static void FindEndpoints(const BlockPixels& pixels, const vec4& channelMask, vec4& endpoint0, vec4& endpoint1)
+{
+	vec4 mean = vec4(0.0f);
+	vec4 minColor = vec4(FLT_MAX);
+	vec4 maxColor = vec4(-FLT_MAX);
+	for (u32 i = 0; i < 16; ++i)
+	{
+		vec4 pixel = GetPixel(pixels, i) * channelMask;
+		mean += pixel;
+		minColor = glm::min(minColor, pixel);
+		maxColor = glm::max(maxColor, pixel);
+	}
+	mean /= 16.0f;
+
+	glm::mat4 covariance = glm::mat4(0.0f);
+	for (u32 i = 0; i < 16; ++i)
+	{
+		vec4 d = GetPixel(pixels, i) * channelMask - mean;
+		covariance += glm::outerProduct(d, d);
+	}
+
+	vec4 axis = maxColor - minColor;
+	if (glm::dot(axis, axis) < 1e-6f)
+	{
+		endpoint0 = mean;
+		endpoint1 = mean;
+		return;
+	}
+
+	for (u32 iteration = 0; iteration < 8; ++iteration)
+	{
+		vec4 next = covariance * axis;
+		f32 length = glm::length(next);
+		if (length < 1e-6f)
+			break;
+		axis = next / length;
+	}
+	axis = glm::normalize(axis);
+
+	f32 minT = FLT_MAX;
+	f32 maxT = -FLT_MAX;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		f32 t = glm::dot(GetPixel(pixels, i) * channelMask - mean, axis);
+		minT = glm::min(minT, t);
+		maxT = glm::max(maxT, t);
+	}
+
+	endpoint0 = glm::clamp(mean + axis * minT, vec4(0.0f), vec4(255.0f));
+	endpoint1 = glm::clamp(mean + axis * maxT, vec4(0.0f), vec4(255.0f));
+}
+
+/**
+ * Least squares refit of the endpoints for the current indices. Each pixel is modelled as
+ * (1 - t) * endpoint0 + t * endpoint1, with t given by its palette index.
+ */
+static bool RefitEndpoints(const BlockPixels& pixels, const u8* indices, const f32* indexWeights, vec4& endpoint0, vec4& endpoint1)
+{
+	f32 aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	vec4 ax = vec4(0.0f), bx = vec4(0.0f);
+
+	for (u32 i = 0; i < 16; ++i)
+	{
+		f32 t = indexWeights[indices[i]];
+		f32 s = 1.0f - t;
+		vec4 pixel = GetPixel(pixels, i);
+		aa += s * s;
+		ab += s * t;
+		bb += t * t;
+		ax += pixel * s;
+		bx += pixel * t;
+	}
+
+	f32 determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f)
+		return false;
+
+	f32 invDeterminant = 1.0f / determinant;
+	endpoint0 = glm::clamp((ax * bb - bx * ab) * invDeterminant, vec4(0.0f), vec4(255.0f));
+	endpoint1 = glm::clamp((bx * aa - ax * ab) * invDeterminant, vec4(0.0f), vec4(255.0f));
+	return true;
+}
+
+// BC1 ////////////////////////////////////////////////////////////////
+
+static u16 PackColor565(const vec4& color)
+{
+	u32 r = (u32)(color.r * (31.0f / 255.0f) + 0.5f);
+	u32 g = (u32)(color.g * (63.0f / 255.0f) + 0.5f);
+	u32 b = (u32)(color.b * (31.0f / 255.0f) + 0.5f);
+	return (u16)((r << 11) | (g << 5) | b);
+}
+
+static vec4 UnpackColor565(u16 color)
+{
+	u32 r = (color >> 11) & 31;
+	u32 g = (color >> 5) & 63;
+	u32 b = color & 31;
+	return vec4((f32)((r << 3) | (r >> 2)), (f32)((g << 2) | (g >> 4)), (f32)((b << 3) | (b >> 2)), 255.0f);
+}
+
+static const f32 BC1IndexWeights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+static f32 EvaluateBC1(const BlockPixels& pixels, const vec4& endpoint0, const vec4& endpoint1, u16& color0, u16& color1, u8* indices)
+{
+	color0 = PackColor565(endpoint0);
+	color1 = PackColor565(endpoint1);
+
+	// Four color mode requires color0 > color1
+	if (color0 < color1)
+	{
+		u16 tmp = color0;
+		color0 = color1;
+		color1 = tmp;
+	}
+
+	vec4 palette[4];
+	palette[0] = UnpackColor565(color0);
+	palette[1] = UnpackColor565(color1);
+	palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+	palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+
+	u32 paletteSize = color0 == color1 ? 1 : 4;
+	return FindNearestIndices(pixels, palette, paletteSize, ChannelMaskRGB, indices);
+}
+
+static void EncodeBC1Block(const BlockPixels& pixels, u8* block)
+{
+	vec4 endpoint0, endpoint1;
+	FindEndpoints(pixels, ChannelMaskRGB, endpoint0, endpoint1);
+
+	u16 color0, color1;
+	u8 indices[16];
+	f32 error = EvaluateBC1(pixels, endpoint1, endpoint0, color0, color1, indices);
+
+	// Endpoints are refitted against the indices (expressed from color0 to color1)
+	vec4 refit0 = UnpackColor565(color0);
+	vec4 refit1 = UnpackColor565(color1);
+	if (color0 != color1 && RefitEndpoints(pixels, indices, BC1IndexWeights, refit0, refit1))
+	{
+		u16 refitColor0, refitColor1;
+		u8 refitIndices[16];
+		f32 refitError = EvaluateBC1(pixels, refit0, refit1, refitColor0, refitColor1, refitIndices);
+		if (refitError < error)
+		{
+			color0 = refitColor0;
+			color1 = refitColor1;
+			memcpy(indices, refitIndices, sizeof(indices));
+		}
+	}
+
+	u32 packedIndices = 0;
+	for (u32 i = 0; i < 16; ++i)
+		packedIndices |= (u32)indices[i] << (i * 2);
+
+	memcpy(block + 0, &color0, 2);
+	memcpy(block + 2, &color1, 2);
+	memcpy(block + 4, &packedIndices, 4);
+}
+
+static void DecodeBC1Block(const u8* block, u8* rgba, bool forceFourColors)
+{
+	u16 color0, color1;
+	u32 packedIndices;
+	memcpy(&color0, block + 0, 2);
+	memcpy(&color1, block + 2, 2);
+	memcpy(&packedIndices, block + 4, 4);
+
+	vec4 palette[4];
+	palette[0] = UnpackColor565(color0);
+	palette[1] = UnpackColor565(color1);
+	if (color0 > color1 || forceFourColors)
+	{
+		palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+		palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+	}
+	else
+	{
+		palette[2] = (palette[0] + palette[1]) * 0.5f;
+		palette[3] = vec4(0.0f, 0.0f, 0.0f, 255.0f);
+	}
+
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const vec4& color = palette[(packedIndices >> (i * 2)) & 3];
+		for (u32 c = 0; c < 4; ++c)
+			rgba[i * 4 + c] = (u8)(color[c] + 0.5f);
+	}
+}
+
+// BC4 (used for the alpha of BC3 and both channels of BC5) ////////////
+
+static void EncodeBC4Block(const f32* values, u8* block)
+{
+	BlockPixels pixels = {};
+	f32 minValue = 255.0f;
+	f32 maxValue = 0.0f;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		pixels.r[i] = values[i];
+		minValue = glm::min(minValue, values[i]);
+		maxValue = glm::max(maxValue, values[i]);
+	}
+
+	u8 value0 = (u8)(maxValue + 0.5f);
+	u8 value1 = (u8)(minValue + 0.5f);
+	u8 indices[16] = {};
+
+	// Eight values mode requires value0 > value1
+	if (value0 > value1)
+	{
+		vec4 palette[8];
+		palette[0] = vec4((f32)value0, 0.0f, 0.0f, 0.0f);
+		palette[1] = vec4((f32)value1, 0.0f, 0.0f, 0.0f);
+		for (u32 i = 2; i < 8; ++i)
+			palette[i] = vec4(((8 - i) * value0 + (i - 1) * value1) / 7.0f, 0.0f, 0.0f, 0.0f);
+
+		FindNearestIndices(pixels, palette, 8, ChannelMaskR, indices);
+	}
+
+	u64 packedIndices = 0;
+	for (u32 i = 0; i < 16; ++i)
+		packedIndices |= (u64)indices[i] << (i * 3);
+
+	block[0] = value0;
+	block[1] = value1;
+	for (u32 i = 0; i < 6; ++i)
+		block[2 + i] = (u8)(packedIndices >> (i * 8));
+}
+
+static void DecodeBC4Block(const u8* block, u8* values, u32 stride)
+{
+	u32 value0 = block[0];
+	u32 value1 = block[1];
+
+	u32 palette[8];
+	palette[0] = value0;
+	palette[1] = value1;
+	if (value0 > value1)
+	{
+		for (u32 i = 2; i < 8; ++i)
+			palette[i] = ((8 - i) * value0 + (i - 1) * value1 + 3) / 7;
+	}
+	else
+	{
+		for (u32 i = 2; i < 6; ++i)
+			palette[i] = ((6 - i) * value0 + (i - 1) * value1 + 2) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	u64 packedIndices = 0;
+	for (u32 i = 0; i < 6; ++i)
+		packedIndices |= (u64)block[2 + i] << (i * 8);
+
+	for (u32 i = 0; i < 16; ++i)
+		values[i * stride] = (u8)palette[(packedIndices >> (i * 3)) & 7];
+}
+
+// BC7 (mode 6: one subset, RGBA endpoints with 7 bits + p-bit, 4 bit indices) ///
+
+static void QuantizeBC7Endpoint(const vec4& endpoint, u32* quantized, u32& pbit)
+{
+	f32 bestError = FLT_MAX;
+	for (u32 p = 0; p < 2; ++p)
+	{
+		u32 candidate[4];
+		f32 error = 0.0f;
+		for (u32 c = 0; c < 4; ++c)
+		{
+			i32 q = (i32)((endpoint[c] - (f32)p) * 0.5f + 0.5f);
+			candidate[c] = (u32)glm::clamp(q, 0, 127);
+			f32 d = (f32)((candidate[c] << 1) | p) - endpoint[c];
+			error += d * d;
+		}
+
+		if (error < bestError)
+		{
+			bestError = error;
+			pbit = p;
+			memcpy(quantized, candidate, sizeof(candidate));
+		}
+	}
+}
+
+static f32 EvaluateBC7(const BlockPixels& pixels, const vec4& endpoint0, const vec4& endpoint1, u32* quantized0, u32* quantized1, u32& pbit0, u32& pbit1, u8* indices)
+{
+	QuantizeBC7Endpoint(endpoint0, quantized0, pbit0);
+	QuantizeBC7Endpoint(endpoint1, quantized1, pbit1);
+
+	vec4 palette[16];
+	for (u32 i = 0; i < 16; ++i)
+	{
+		for (u32 c = 0; c < 4; ++c)
+		{
+			u32 e0 = (quantized0[c] << 1) | pbit0;
+			u32 e1 = (quantized1[c] << 1) | pbit1;
+			palette[i][c] = (f32)(((64 - BC7Weights4[i]) * e0 + BC7Weights4[i] * e1 + 32) >> 6);
+		}
+	}
+
+	return FindNearestIndices(pixels, palette, 16, ChannelMaskRGBA, indices);
+}
+
+static void EncodeBC7Block(const BlockPixels& pixels, u8* block)
+{
+	vec4 endpoint0, endpoint1;
+	FindEndpoints(pixels, ChannelMaskRGBA, endpoint0, endpoint1);
+
+	u32 quantized0[4], quantized1[4], pbit0, pbit1;
+	u8 indices[16];
+	f32 error = EvaluateBC7(pixels, endpoint0, endpoint1, quantized0, quantized1, pbit0, pbit1, indices);
+
+	f32 indexWeights[16];
+	for (u32 i = 0; i < 16; ++i)
+		indexWeights[i] = BC7Weights4[i] / 64.0f;
+
+	vec4 refit0 = endpoint0;
+	vec4 refit1 = endpoint1;
+	if (RefitEndpoints(pixels, indices, indexWeights, refit0, refit1))
+	{
+		u32 refitQuantized0[4], refitQuantized1[4], refitPbit0, refitPbit1;
+		u8 refitIndices[16];
+		f32 refitError = EvaluateBC7(pixels, refit0, refit1, refitQuantized0, refitQuantized1, refitPbit0, refitPbit1, refitIndices);
+		if (refitError < error)
+		{
+			memcpy(quantized0, refitQuantized0, sizeof(quantized0));
+			memcpy(quantized1, refitQuantized1, sizeof(quantized1));
+			pbit0 = refitPbit0;
+			pbit1 = refitPbit1;
+			memcpy(indices, refitIndices, sizeof(indices));
+		}
+	}
+
+	// The most significant bit of the first index is implicit (zero): swap the endpoints if needed
+	if (indices[0] & 8)
+	{
+		for (u32 c = 0; c < 4; ++c)
+		{
+			u32 tmp = quantized0[c];
+			quantized0[c] = quantized1[c];
+			quantized1[c] = tmp;
+		}
+		u32 tmp = pbit0;
+		pbit0 = pbit1;
+		pbit1 = tmp;
+		for (u32 i = 0; i < 16; ++i)
+			indices[i] = 15 - indices[i];
+	}
+
+	memset(block, 0, 16);
+	BitWriter writer = { block, 0 };
+	WriteBits(writer, 1 << 6, 7); // mode 6
+	for (u32 c = 0; c < 4; ++c)
+	{
+		WriteBits(writer, quantized0[c], 7);
+		WriteBits(writer, quantized1[c], 7);
+	}
+	WriteBits(writer, pbit0, 1);
+	WriteBits(writer, pbit1, 1);
+	WriteBits(writer, indices[0], 3);
+	for (u32 i = 1; i < 16; ++i)
+		WriteBits(writer, indices[i], 4);
+}
+
+static void DecodeBC7Block(const u8* block, u8* rgba)
+{
+	// Only mode 6 is produced by the encoder above
+	if ((block[0] & 0x7F) != 0x40)
+	{
+		memset(rgba, 0, 64);
+		return;
+	}
+
+	BitReader reader = { block, 7 };
+	u32 endpoints[2][4];
+	for (u32 c = 0; c < 4; ++c)
+	{
+		endpoints[0][c] = ReadBits(reader, 7);
+		endpoints[1][c] = ReadBits(reader, 7);
+	}
+	u32 pbit0 = ReadBits(reader, 1);
+	u32 pbit1 = ReadBits(reader, 1);
+
+	for (u32 c = 0; c < 4; ++c)
+	{
+		endpoints[0][c] = (endpoints[0][c] << 1) | pbit0;
+		endpoints[1][c] = (endpoints[1][c] << 1) | pbit1;
+	}
+
+	for (u32 i = 0; i < 16; ++i)
+	{
+		u32 index = ReadBits(reader, i == 0 ? 3 : 4);
+		u32 weight = BC7Weights4[index];
+		for (u32 c = 0; c < 4; ++c)
+			rgba[i * 4 + c] = (u8)(((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6);
+	}
+}
+
+// Blocks /////////////////////////////////////////////////////////////
+
+static void EncodeBlock(BlockFormat format, const BlockPixels& pixels, u8* block)
+{
+	switch (format)
+	{
+	case BlockFormat_BC1:
+		EncodeBC1Block(pixels, block);
+		break;
+	case BlockFormat_BC3:
+		EncodeBC4Block(pixels.a, block);
+		EncodeBC1Block(pixels, block + 8);
+		break;
+	case BlockFormat_BC5:
+		EncodeBC4Block(pixels.r, block);
+		EncodeBC4Block(pixels.g, block + 8);
+		break;
+	case BlockFormat_BC7:
+		EncodeBC7Block(pixels, block);
+		break;
+	default:
+		break;
+	}
+}
+
+static void DecodeBlock(BlockFormat format, const u8* block, u8* rgba)
+{
+	switch (format)
+	{
+	case BlockFormat_BC1:
+		DecodeBC1Block(block, rgba, false);
+		break;
+	case BlockFormat_BC3:
+		DecodeBC1Block(block + 8, rgba, true);
+		DecodeBC4Block(block, rgba + 3, 4);
+		break;
+	case BlockFormat_BC5:
+		memset(rgba, 0, 64);
+		DecodeBC4Block(block, rgba + 0, 4);
+		DecodeBC4Block(block + 8, rgba + 1, 4);
+		break;
+	case BlockFormat_BC7:
+		DecodeBC7Block(block, rgba);
+		break;
+	default:
+		break;
+	}
+}
+
+static f32 ComputePSNR(const std::vector<u8>& source, const u8* blocks, BlockFormat format, i32 width, i32 height, u32 channelCount)
+{
+	u32 blocksX = (width + 3) / 4;
+	u32 blocksY = (height + 3) / 4;
+	u32 blockSize = GetBlockSize(format);
+
+	f64 squaredError = 0.0;
+	for (u32 by = 0; by < blocksY; ++by)
+	{
+		for (u32 bx = 0; bx < blocksX; ++bx)
+		{
+			u8 decoded[64];
+			DecodeBlock(format, blocks + (by * blocksX + bx) * blockSize, decoded);
+
+			for (u32 y = 0; y < 4 && by * 4 + y < (u32)height; ++y)
+			{
+				for (u32 x = 0; x < 4 && bx * 4 + x < (u32)width; ++x)
+				{
+					const u8* original = &source[(((size_t)by * 4 + y) * width + bx * 4 + x) * 4];
+					for (u32 c = 0; c < channelCount; ++c)
+					{
+						f64 d = (f64)original[c] - (f64)decoded[(y * 4 + x) * 4 + c];
+						squaredError += d * d;
+					}
+				}
+			}
+		}
+	}
+
+	f64 mse = squaredError / ((f64)width * height * channelCount);
+	if (mse <= 0.0)
+		return 99.0f;
+	return (f32)(10.0 * log10(255.0 * 255.0 / mse));
+}
+
+bool CompressImage(ThreadPool* pool, const Image& image, BlockFormat format, MipFilter mipFilter, bool srgb, CompressedTexture* compressed)
+{
+	if (!image.pixels || image.nchannels < 1 || image.nchannels > 4)
+		return false;
+
+	std::vector<u8> rgba = ConvertImageToRGBA8(image);
+	MipChain mips;
+	GenerateMipChain(pool, rgba.data(), image.size, mipFilter, srgb, &mips);
+
+	compressed->format = format;
+	compressed->mipFilter = mipFilter;
+	compressed->size = image.size;
+	compressed->levelCount = glm::min(mips.levelCount, (u32)COMPRESSED_TEXTURE_MAX_LEVELS);
+	compressed->data.clear();
+
+	u32 blockSize = GetBlockSize(format);
+
+	for (u32 i = 0; i < compressed->levelCount; ++i)
+	{
+		i32 width = mips.levels[i].width;
+		i32 height = mips.levels[i].height;
+		u32 blocksX = (width + 3) / 4;
+		u32 blocksY = (height + 3) / 4;
+
+		CompressedTextureLevel& level = compressed->levels[i];
+		level.offset = (u32)compressed->data.size();
+		level.size = blocksX * blocksY * blockSize;
+		level.width = width;
+		level.height = height;
+		compressed->data.resize(level.offset + level.size);
+
+		u8* levelBlocks = compressed->data.data() + level.offset;
+		const u8* levelPixels = mips.data.data() + mips.levels[i].offset;
+		ParallelFor(pool, blocksY, 4, [=](u32 begin, u32 end)
+			{
+				BlockPixels pixels;
+				for (u32 by = begin; by < end; ++by)
+				{
+					for (u32 bx = 0; bx < blocksX; ++bx)
+					{
+						LoadBlockPixels(levelPixels, width, height, bx, by, pixels);
+						EncodeBlock(format, pixels, levelBlocks + (by * blocksX + bx) * blockSize);
+					}
+				}
+			});
+	}
+
+	u32 channelCount = 4;
+	switch (format)
+	{
+	case BlockFormat_BC1: channelCount = 3; break;
+	case BlockFormat_BC5: channelCount = 2; break;
+	default:              channelCount = image.nchannels == 4 ? 4 : 3; break;
+	}
+	compressed->psnr = ComputePSNR(rgba, compressed->data.data(), format, image.size.x, image.size.y, channelCount);
+
+	return true;
+}
+
+static std::string MakeContainerPath(const char* filepath)
+{
+	return std::string(filepath) + COMPRESSED_TEXTURE_EXTENSION;
+}
+
+bool LoadCompressedTexture(const char* filepath, TextureUsage usage, MipFilter mipFilter, bool supportsS3TC, CompressedTexture* compressed)
+{
+	std::string containerPath = MakeContainerPath(filepath);
+
+	AssetFile file;
+	if (!ReadAssetFile(containerPath.c_str(), file))
+		return false;
+
+	const CompressedTextureHeader* header = (const CompressedTextureHeader*)file.data;
+
+	bool valid = file.size >= sizeof(CompressedTextureHeader) &&
+		header->magic == COMPRESSED_TEXTURE_MAGIC &&
+		header->version == COMPRESSED_TEXTURE_VERSION &&
+		header->usage == (u32)usage &&
+		header->mipFilter == (u32)mipFilter &&
+		header->format < BlockFormat_Count &&
+		header->glFormat == GetBlockFormatGLFormat((BlockFormat)header->format) &&
+		header->supportsS3TC == (supportsS3TC ? 1u : 0u) &&
+		header->levelCount > 0 && header->levelCount <= COMPRESSED_TEXTURE_MAX_LEVELS &&
+		header->sourceTimestamp == GetAssetTimestamp(filepath);
+
+	// Every level holds exactly the blocks of its size, inside the data
+	u64 dataSize = valid ? file.size - sizeof(CompressedTextureHeader) : 0;
+	for (u32 i = 0; valid && i < header->levelCount; ++i)
+	{
+		const CompressedTextureLevel& level = header->levels[i];
+		u64 blockCount = level.width > 0 && level.height > 0 ? (u64)((level.width + 3) / 4) * (u64)((level.height + 3) / 4) : 0;
+		valid = blockCount > 0 && level.size == blockCount * GetBlockSize((BlockFormat)header->format) &&
+			(u64)level.offset + level.size <= dataSize;
+	}
+
+	if (valid)
+	{
+		const u8* data = (const u8*)file.data + sizeof(CompressedTextureHeader);
+		compressed->format = (BlockFormat)header->format;
+		compressed->mipFilter = mipFilter;
+		compressed->size = ivec2(header->width, header->height);
+		compressed->levelCount = header->levelCount;
+		compressed->psnr = header->psnr;
+		memcpy(compressed->levels, header->levels, sizeof(header->levels));
+		compressed->data.assign(data, data + dataSize);
+	}
+
+	FreeAssetFile(file);
+	return valid;
+}
+
+void SaveCompressedTexture(const char* filepath, TextureUsage usage, bool supportsS3TC, const CompressedTexture& compressed)
+{
+	CompressedTextureHeader header = {};
+	header.magic = COMPRESSED_TEXTURE_MAGIC;
+	header.version = COMPRESSED_TEXTURE_VERSION;
+	header.sourceTimestamp = GetAssetTimestamp(filepath);
+	header.usage = usage;
+	header.format = compressed.format;
+	header.glFormat = GetBlockFormatGLFormat(compressed.format);
+	header.supportsS3TC = supportsS3TC ? 1 : 0;
+	header.mipFilter = compressed.mipFilter;
+	header.width = compressed.size.x;
+	header.height = compressed.size.y;
+	header.levelCount = compressed.levelCount;
+	header.psnr = compressed.psnr;
+	memcpy(header.levels, compressed.levels, sizeof(header.levels));
+
+	std::string containerPath = MakeContainerPath(filepath);
+	FILE* file = fopen(containerPath.c_str(), "wb");
+	if (!file)
+	{
+		ELOG("fopen() failed writing file %s", containerPath.c_str());
+		return;
+	}
+
+	bool writeFailed = fwrite(&header, sizeof(header), 1, file) != 1;
+	if (!writeFailed && !compressed.data.empty() && fwrite(compressed.data.data(), 1, compressed.data.size(), file) != compressed.data.size())
+		writeFailed = true;
+
+	// Do not leave a truncated container behind
+	if (fclose(file) != 0)
+		writeFailed = true;
+	if (writeFailed)
+	{
+		ELOG("fwrite() failed writing file %s", containerPath.c_str());
+		remove(containerPath.c_str());
+	}
+}
+
+GLuint CreateTexture2DFromCompressed(const CompressedTexture& compressed)
+{
+	GLenum internalFormat = GetBlockFormatGLFormat(compressed.format);
+
+	GLuint texHandle;
+	glGenTextures(1, &texHandle);
+	glBindTexture(GL_TEXTURE_2D, texHandle);
+	for (u32 i = 0; i < compressed.levelCount; ++i)
+	{
+		const CompressedTextureLevel& level = compressed.levels[i];
+		glCompressedTexImage2D(GL_TEXTURE_2D, i, internalFormat, level.width, level.height, 0, level.size, compressed.data.data() + level.offset);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, compressed.levelCount - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return texHandle;
+}
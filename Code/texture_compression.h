@@ -0,0 +1,99 @@
+//
+// texture_compression.h: CPU block compression (BC1/BC3/BC5/BC7) done at import time.
+// Compressed textures are stored with their whole mip chain in a small container next to
+// the source image, so later runs only have to upload them with glCompressedTexImage2D.
+//
+
+#pragma once
+
+#include "engine.h"
+
+#define COMPRESSED_TEXTURE_MAGIC      0x58455443 // "CTEX"
+#define COMPRESSED_TEXTURE_VERSION    3
+#define COMPRESSED_TEXTURE_EXTENSION  ".ctex"
+#define COMPRESSED_TEXTURE_MAX_LEVELS 16
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+enum BlockFormat
+{
+	BlockFormat_BC1, // RGB, 4 bpp
+	BlockFormat_BC3, // RGBA, 8 bpp
+	BlockFormat_BC5, // Two channels (normal maps), 8 bpp
+	BlockFormat_BC7, // RGBA, 8 bpp, high quality
+	BlockFormat_Count
+};
+
+struct CompressedTextureLevel
+{
+	u32 offset; // in bytes, inside CompressedTexture::data
+	u32 size;
+	i32 width;
+	i32 height;
+};
+
+struct CompressedTexture
+{
+	BlockFormat            format;
+	MipFilter              mipFilter;
+	ivec2                  size;
+	u32                    levelCount;
+	CompressedTextureLevel levels[COMPRESSED_TEXTURE_MAX_LEVELS];
+	std::vector<u8>        data;
+	f32                    psnr; // of the first level against the source image, in dB
+};
+
+struct CompressedTextureHeader
+{
+	u32 magic;
+	u32 version;
+	u64 sourceTimestamp;
+	u32 usage;
+	u32 format;
+	u32 glFormat;     // internal format the levels are uploaded with
+	u32 supportsS3TC; // of the driver that chose the format, see ChooseBlockFormat
+	u32 mipFilter;
+	i32 width;
+	i32 height;
+	u32 levelCount;
+	f32 psnr;
+	CompressedTextureLevel levels[COMPRESSED_TEXTURE_MAX_LEVELS];
+};
+
+/**
+ * Picks the block format for a texture: colors go to BC1 (or BC7 when they have alpha),
+ * normal maps to BC5 and other data maps to BC1/BC3. When S3TC is not available every
+ * BC1/BC3 choice falls back to BC7, which is core since OpenGL 4.2.
+ */
+BlockFormat ChooseBlockFormat(TextureUsage usage, i32 nchannels, bool supportsS3TC);
+
+GLenum GetBlockFormatGLFormat(BlockFormat format);
+
+const char* GetBlockFormatName(BlockFormat format);
+
+/**
+ * Builds the mip chain of the image (see GenerateMipChain) and encodes every level. Blocks
+ * are encoded in parallel in the given thread pool. The PSNR of the first level is computed
+ * by decoding the result back.
+ */
+bool CompressImage(ThreadPool* pool, const Image& image, BlockFormat format, MipFilter mipFilter, bool srgb, CompressedTexture* compressed);
+
+/**
+ * Reads the compressed container of an image. Fails if there is no container, if it is
+ * older than the source image, if it was compressed for another usage, mip filter or driver
+ * (with or without S3TC), or if a level does not have the size of its blocks.
+ */
+bool LoadCompressedTexture(const char* filepath, TextureUsage usage, MipFilter mipFilter, bool supportsS3TC, CompressedTexture* compressed);
+
+/**
+ * Writes the container next to the image. A container that could not be written completely
+ * is deleted, so it is not trusted on the next run.
+ */
+void SaveCompressedTexture(const char* filepath, TextureUsage usage, bool supportsS3TC, const CompressedTexture& compressed);
+
+GLuint CreateTexture2DFromCompressed(const CompressedTexture& compressed);
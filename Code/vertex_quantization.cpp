@@ -0,0 +1,275 @@
+#include "vertex_quantization.h"
+#include <glm/gtc/packing.hpp>
+
+const char* GetVertexQuantizationName(VertexQuantization quantization)
+{
+	switch (quantization)
+	{
+	case VertexQuantization_None:    return "Float";
+	case VertexQuantization_Half:    return "Half positions";
+	case VertexQuantization_SNorm16: return "16 bit positions";
+	default:                         return "Unknown";
+	}
+}
+
+static vec2 SignNotZero(vec2 v)
+{
+	return vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+vec2 EncodeOctahedral(vec3 n)
+{
+	n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	vec2 e = vec2(n.x, n.y);
+	if (n.z < 0.0f)
+		e = (vec2(1.0f) - glm::abs(vec2(e.y, e.x))) * SignNotZero(e);
+	return e;
+}
+
+vec3 DecodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+	if (n.z < 0.0f)
+	{
+		vec2 xy = (vec2(1.0f) - glm::abs(vec2(n.y, n.x))) * SignNotZero(vec2(n.x, n.y));
+		n.x = xy.x;
+		n.y = xy.y;
+	}
+	return glm::normalize(n);
+}
+
+static i16 QuantizeSNorm16(f32 value)
+{
+	return (i16)roundf(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+static f32 DequantizeSNorm16(i16 value)
+{
+	return glm::max(value / 32767.0f, -1.0f);
+}
+
+static u16 QuantizeUNorm16(f32 value)
+{
+	return (u16)roundf(glm::clamp(value, 0.0f, 1.0f) * 65535.0f);
+}
+
+static f32 AngleBetween(vec3 a, vec3 b)
+{
+	return glm::degrees(acosf(glm::clamp(glm::dot(a, b), -1.0f, 1.0f)));
+}
+
+/**
+ * Rounding each coordinate to the nearest value is not always the closest direction, so the
+ * four neighbouring encodings are tried. Returns the angular error in degrees.
+ */
+static f32 EncodeOctahedralSNorm16(vec3 n, i16* encoded)
+{
+	vec2 e = EncodeOctahedral(n);
+	vec2 base = glm::floor(glm::clamp(e, vec2(-1.0f), vec2(1.0f)) * 32767.0f);
+
+	f32 bestError = FLT_MAX;
+	for (u32 i = 0; i < 4; ++i)
+	{
+		i16 candidate[2];
+		candidate[0] = (i16)glm::clamp(base.x + (f32)(i & 1), -32767.0f, 32767.0f);
+		candidate[1] = (i16)glm::clamp(base.y + (f32)(i >> 1), -32767.0f, 32767.0f);
+
+		f32 error = AngleBetween(n, DecodeOctahedral(vec2(DequantizeSNorm16(candidate[0]), DequantizeSNorm16(candidate[1]))));
+		if (error < bestError)
+		{
+			bestError = error;
+			encoded[0] = candidate[0];
+			encoded[1] = candidate[1];
+		}
+	}
+	return bestError;
+}
+
+static const VertexBufferAttribute* FindAttribute(const VertexBufferLayout& layout, u8 location)
+{
+	for (const VertexBufferAttribute& attribute : layout.vbAttributes)
+		if (attribute.location == location)
+			return &attribute;
+	return NULL;
+}
+
+static VertexDecode IdentityDecode()
+{
+	VertexDecode decode = {};
+	decode.positionScale = vec3(1.0f);
+	decode.texCoordScale = vec2(1.0f);
+	return decode;
+}
+
+QuantizationError QuantizeSubmeshVertices(Submesh& submesh, VertexQuantization quantization, std::vector<u8>& gpuVertices)
+{
+	QuantizationError error = {};
+	submesh.decode = IdentityDecode();
+
+	const VertexBufferAttribute* positionAttribute = FindAttribute(submesh.vbLayout, 0);
+	const VertexBufferAttribute* normalAttribute = FindAttribute(submesh.vbLayout, 1);
+	const VertexBufferAttribute* texCoordAttribute = FindAttribute(submesh.vbLayout, 2);
+	const VertexBufferAttribute* tangentAttribute = FindAttribute(submesh.vbLayout, 3);
+	const VertexBufferAttribute* bitangentAttribute = FindAttribute(submesh.vbLayout, 4);
+
+	// Only the standard attributes (see MakeAssimpVertexLayout) are known how to be quantized
+	bool quantizable = positionAttribute && positionAttribute->componentCount == 3 &&
+		(!normalAttribute || normalAttribute->componentCount == 3) &&
+		(!texCoordAttribute || texCoordAttribute->componentCount == 2) &&
+		(!tangentAttribute || tangentAttribute->componentCount == 3) &&
+		(tangentAttribute != NULL) == (bitangentAttribute != NULL) &&
+		submesh.vbLayout.vbAttributes.size() <= 5;
+
+	if (quantization == VertexQuantization_None || !quantizable)
+	{
+		submesh.gpuLayout = submesh.vbLayout;
+		gpuVertices.clear();
+		return error;
+	}
+
+	const u32 floatsPerVertex = submesh.vbLayout.stride / sizeof(float);
+	const u32 vertexCount = (u32)(submesh.vertices.size() / floatsPerVertex);
+	const float* vertices = submesh.vertices.data();
+
+	auto readVec3 = [&](const VertexBufferAttribute* attribute, u32 i)
+	{
+		const float* v = vertices + (size_t)i * floatsPerVertex + attribute->offset / sizeof(float);
+		return vec3(v[0], v[1], v[2]);
+	};
+	auto readVec2 = [&](const VertexBufferAttribute* attribute, u32 i)
+	{
+		const float* v = vertices + (size_t)i * floatsPerVertex + attribute->offset / sizeof(float);
+		return vec2(v[0], v[1]);
+	};
+
+	// Layout: position in 3 x 16 bits padded to 8 bytes, then 2 x 16 bits per other attribute.
+	// No shader reads a tangent space, so the tangents and bitangents are not uploaded.
+	bool halfPositions = quantization == VertexQuantization_Half;
+	VertexBufferLayout& layout = submesh.gpuLayout;
+	layout = {};
+	layout.vbAttributes.push_back({ 0, 3, 0, (u8)(halfPositions ? VertexFormat_Float16 : VertexFormat_SNorm16), (u8)(halfPositions ? 0 : 1) });
+	layout.stride = 8;
+	u8 normalOffset = layout.stride;
+	if (normalAttribute)
+	{
+		layout.vbAttributes.push_back({ 1, 2, normalOffset, VertexFormat_SNorm16, 1 });
+		layout.stride += 4;
+	}
+	u8 texCoordOffset = layout.stride;
+	if (texCoordAttribute)
+	{
+		layout.vbAttributes.push_back({ 2, 2, texCoordOffset, VertexFormat_UNorm16, 1 });
+		layout.stride += 4;
+	}
+
+	// Bounds of the positions and texture coordinates
+	vec3 minPosition = vec3(FLT_MAX), maxPosition = vec3(-FLT_MAX);
+	vec2 minTexCoord = vec2(FLT_MAX), maxTexCoord = vec2(-FLT_MAX);
+	for (u32 i = 0; i < vertexCount; ++i)
+	{
+		vec3 position = readVec3(positionAttribute, i);
+		minPosition = glm::min(minPosition, position);
+		maxPosition = glm::max(maxPosition, position);
+		if (texCoordAttribute)
+		{
+			vec2 texCoord = readVec2(texCoordAttribute, i);
+			minTexCoord = glm::min(minTexCoord, texCoord);
+			maxTexCoord = glm::max(maxTexCoord, texCoord);
+		}
+	}
+
+	VertexDecode& decode = submesh.decode;
+	decode.octahedralNormals = true;
+	if (!halfPositions && vertexCount > 0)
+	{
+		decode.positionOffset = (minPosition + maxPosition) * 0.5f;
+		decode.positionScale = glm::max((maxPosition - minPosition) * 0.5f, vec3(1e-8f));
+	}
+	if (texCoordAttribute && vertexCount > 0)
+	{
+		decode.texCoordOffset = minTexCoord;
+		decode.texCoordScale = glm::max(maxTexCoord - minTexCoord, vec2(1e-8f));
+	}
+
+	gpuVertices.assign((size_t)vertexCount * layout.stride, 0);
+
+	for (u32 i = 0; i < vertexCount; ++i)
+	{
+		u8* out = gpuVertices.data() + (size_t)i * layout.stride;
+
+		// Position
+		vec3 position = readVec3(positionAttribute, i);
+		vec3 decodedPosition;
+		if (halfPositions)
+		{
+			u16 encoded[4] = { glm::packHalf1x16(position.x), glm::packHalf1x16(position.y), glm::packHalf1x16(position.z) };
+			memcpy(out, encoded, sizeof(encoded));
+			decodedPosition = vec3(glm::unpackHalf1x16(encoded[0]), glm::unpackHalf1x16(encoded[1]), glm::unpackHalf1x16(encoded[2]));
+		}
+		else
+		{
+			vec3 normalized = (position - decode.positionOffset) / decode.positionScale;
+			i16 encoded[4] = { QuantizeSNorm16(normalized.x), QuantizeSNorm16(normalized.y), QuantizeSNorm16(normalized.z) };
+			memcpy(out, encoded, sizeof(encoded));
+			decodedPosition = vec3(DequantizeSNorm16(encoded[0]), DequantizeSNorm16(encoded[1]), DequantizeSNorm16(encoded[2])) * decode.positionScale + decode.positionOffset;
+		}
+		error.position = glm::max(error.position, glm::length(decodedPosition - position));
+
+		// Normal
+		if (normalAttribute)
+		{
+			vec3 normal = glm::normalize(readVec3(normalAttribute, i));
+			i16 encoded[2];
+			error.normal = glm::max(error.normal, EncodeOctahedralSNorm16(normal, encoded));
+			memcpy(out + normalOffset, encoded, sizeof(encoded));
+		}
+
+		// Texture coordinates
+		if (texCoordAttribute)
+		{
+			vec2 texCoord = readVec2(texCoordAttribute, i);
+			vec2 normalized = (texCoord - decode.texCoordOffset) / decode.texCoordScale;
+			u16 encoded[2] = { QuantizeUNorm16(normalized.x), QuantizeUNorm16(normalized.y) };
+			memcpy(out + texCoordOffset, encoded, sizeof(encoded));
+
+			vec2 decodedTexCoord = vec2(encoded[0] / 65535.0f, encoded[1] / 65535.0f) * decode.texCoordScale + decode.texCoordOffset;
+			error.texCoord = glm::max(error.texCoord, glm::max(fabsf(decodedTexCoord.x - texCoord.x), fabsf(decodedTexCoord.y - texCoord.y)));
+		}
+	}
+
+	return error;
+}
+
+void DecodeSubmeshPositions(const Submesh& submesh, const u8* gpuVertices, std::vector<vec3>& positions)
+{
+	positions.clear();
+
+	const VertexBufferAttribute* attribute = FindAttribute(submesh.gpuLayout, 0);
+	if (!attribute || attribute->componentCount < 3)
+		return;
+
+	const VertexDecode& decode = submesh.decode;
+	positions.resize(submesh.vertexCount);
+	for (u32 i = 0; i < submesh.vertexCount; ++i)
+	{
+		const u8* in = gpuVertices + (size_t)i * submesh.gpuLayout.stride + attribute->offset;
+		if (attribute->format == VertexFormat_Float16)
+		{
+			u16 encoded[3];
+			memcpy(encoded, in, sizeof(encoded));
+			positions[i] = vec3(glm::unpackHalf1x16(encoded[0]), glm::unpackHalf1x16(encoded[1]), glm::unpackHalf1x16(encoded[2]));
+		}
+		else if (attribute->format == VertexFormat_SNorm16)
+		{
+			i16 encoded[3];
+			memcpy(encoded, in, sizeof(encoded));
+			positions[i] = vec3(DequantizeSNorm16(encoded[0]), DequantizeSNorm16(encoded[1]), DequantizeSNorm16(encoded[2])) * decode.positionScale + decode.positionOffset;
+		}
+		else
+		{
+			f32 position[3];
+			memcpy(position, in, sizeof(position));
+			positions[i] = vec3(position[0], position[1], position[2]);
+		}
+	}
+}
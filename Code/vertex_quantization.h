@@ -0,0 +1,33 @@
+//
+// vertex_quantization.h: Import time compression of the vertex streams. Positions become half
+// floats or 16 bit integers inside the submesh bounds, normals 16 bit octahedral coordinates and
+// texture coordinates 16 bit integers. The shaders undo it with VertexDecode. Tangents and
+// bitangents are dropped, as no shader reads them.
+//
+
+#pragma once
+
+#include "engine.h"
+
+const char* GetVertexQuantizationName(VertexQuantization quantization);
+
+/**
+ * Builds the VBO contents of a submesh from its float vertices. Fills the GPU layout and the
+ * decode parameters of the submesh and returns the largest error the quantization introduced.
+ * With VertexQuantization_None, or attributes it does not know, gpuVertices is left empty and
+ * the float vertices are meant to be uploaded as they are.
+ */
+QuantizationError QuantizeSubmeshVertices(Submesh& submesh, VertexQuantization quantization, std::vector<u8>& gpuVertices);
+
+/**
+ * Positions of the vertexCount GPU vertices of a submesh, as the shaders decode them. For the
+ * meshes that have no float vertices, positions is left empty if the layout has no position.
+ */
+void DecodeSubmeshPositions(const Submesh& submesh, const u8* gpuVertices, std::vector<vec3>& positions);
+
+/**
+ * Octahedral mapping of a unit vector to [-1, 1]^2 and back.
+ */
+vec2 EncodeOctahedral(vec3 n);
+
+vec3 DecodeOctahedral(vec2 e);
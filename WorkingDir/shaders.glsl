@@ -45,7 +45,11 @@ void main()
 // The third parameter of the LoadProgram function in engine.cpp allows
 // chosing the shader you want to load by name.
 
-#ifdef SHOW_TEXTURED_MESH
+// INDIRECT_TEXTURED_MESH is the same shader for glMultiDrawElementsIndirect, the data of each
+// draw comes from a storage buffer indexed with the base instance of the draw command.
+// CULLED_TEXTURED_MESH draws the commands written by GPU_FRUSTUM_CULLING, each instance has the
+// entity and the batch (whose data is a DrawData) it belongs to.
+#if defined(SHOW_TEXTURED_MESH) || defined(INDIRECT_TEXTURED_MESH) || defined(CULLED_TEXTURED_MESH)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
@@ -55,15 +59,52 @@ layout(location = 2) in vec2 aTexCoord;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
+	mat4 uViewProjectionMatrix;
 	vec3 uCameraPosition;
 	unsigned int uLightCount;
 	Light uLight[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
+#if defined(INDIRECT_TEXTURED_MESH) || defined(CULLED_TEXTURED_MESH)
+
+struct DrawData
+{
+	vec4 positionScale;     // w is 1 when normals are octahedral
+	vec4 positionOffset;
+	vec4 texCoordTransform; // scale in xy, offset in zw
+	uint materialIdx;
+	uint transformIdx;
+};
+
+layout(binding = 0, std430) readonly buffer DrawDataBuffer
 {
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
+	DrawData uDraws[];
+};
+
+#ifdef INDIRECT_TEXTURED_MESH
+// 0, 1, 2... per instance, so it is the base instance of the command (INDIRECT_DRAW_ID_LOCATION)
+layout(location = 15) in uint aDrawId;
+#else
+// Entity and batch of the instance (GPU_CULLING_INSTANCE_LOCATION)
+layout(location = 14) in uvec2 aInstance;
+#endif
+
+#else
+
+uniform uint uTransformIdx;
+
+// Quantized vertices (see VertexDecode)
+uniform vec3 uPositionScale;
+uniform vec3 uPositionOffset;
+uniform vec4 uTexCoordTransform; // scale in xy, offset in zw
+uniform bool uOctahedralNormals;
+
+#endif
+
+// World matrices of the entities, written only when they move
+layout(binding = 1, std430) readonly buffer TransformBuffer
+{
+	mat4 uWorldMatrices[];
 };
 
 out vec2 vTexCoord;
@@ -71,13 +112,44 @@ out vec3 vPosition; // In world space
 out vec3 vNormal; 	// In world space
 out vec3 vViewDir;  // In world space
 
+vec3 DecodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	if (n.z < 0.0)
+		n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
+
 void main()
 {
-	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
+#if defined(INDIRECT_TEXTURED_MESH) || defined(CULLED_TEXTURED_MESH)
+#ifdef INDIRECT_TEXTURED_MESH
+	DrawData draw = uDraws[aDrawId];
+	mat4 worldMatrix = uWorldMatrices[draw.transformIdx];
+#else
+	DrawData draw = uDraws[aInstance.y];
+	mat4 worldMatrix = uWorldMatrices[aInstance.x];
+#endif
+	vec3 positionScale = draw.positionScale.xyz;
+	vec3 positionOffset = draw.positionOffset.xyz;
+	vec4 texCoordTransform = draw.texCoordTransform;
+	bool octahedralNormals = draw.positionScale.w > 0.5;
+#else
+	mat4 worldMatrix = uWorldMatrices[uTransformIdx];
+	vec3 positionScale = uPositionScale;
+	vec3 positionOffset = uPositionOffset;
+	vec4 texCoordTransform = uTexCoordTransform;
+	bool octahedralNormals = uOctahedralNormals;
+#endif
+
+	vec3 position = aPosition * positionScale + positionOffset;
+	vec3 normal = octahedralNormals ? DecodeOctahedral(aNormal.xy) : aNormal;
+
+	vTexCoord = aTexCoord * texCoordTransform.xy + texCoordTransform.zw;
+	vPosition = vec3(worldMatrix * vec4(position, 1.0));
+	vNormal = vec3(worldMatrix * vec4(normal, 0.0));
 	vViewDir = uCameraPosition - vPosition;
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjectionMatrix * vec4(vPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -93,6 +165,7 @@ uniform sampler2D uPosition;
 
 layout(binding = 0, std140) uniform GlobalParams 
 {
+	mat4 uViewProjectionMatrix;
 	vec3 uCameraPosition;
 	unsigned int uLightCount;
 	Light uLight[16];
@@ -182,6 +255,237 @@ void main()
 #endif
 #endif
 
+// Frustum culling and level of detail selection of every entity, one invocation each. Visible
+// entities are appended to the commands of the batches of their level (see gpu_culling.h).
+// With Hi-Z, the early phase draws the entities visible last frame, and the late phase tests
+// every entity against the depth pyramid built from them and draws the ones that appeared.
+#ifdef GPU_FRUSTUM_CULLING
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 64) in; // GPU_CULLING_GROUP_SIZE
+
+struct CullModel
+{
+	vec4 bounds; // center in xyz, radius in w
+	float lodError[5];
+	uint lodCount;
+	uint lodBatchOffset[5];
+	uint lodBatchCount[5];
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int baseVertex;
+	uint baseInstance;
+};
+
+layout(binding = 0, std430) readonly buffer EntityModelBuffer
+{
+	uint uEntityModels[];
+};
+
+layout(binding = 1, std430) readonly buffer TransformBuffer
+{
+	mat4 uWorldMatrices[];
+};
+
+layout(binding = 2, std430) readonly buffer ModelBuffer
+{
+	CullModel uModels[];
+};
+
+layout(binding = 3, std430) readonly buffer LodBatchBuffer
+{
+	uint uLodBatches[];
+};
+
+layout(binding = 4, std430) buffer CommandBuffer
+{
+	DrawCommand uCommands[];
+};
+
+layout(binding = 5, std430) writeonly buffer InstanceBuffer
+{
+	uvec2 uInstances[];
+};
+
+layout(binding = 6, std430) buffer VisibilityBuffer
+{
+	uint uVisibility[]; // of each entity, after the late phase of the last frame
+};
+
+layout(binding = 7, std430) buffer LodBuffer
+{
+	uint uEntityLods[]; // of each entity, when it was last visible
+};
+
+layout(binding = 1) uniform sampler2D uDepthPyramid; // farthest depth, see DEPTH_PYRAMID
+
+uniform vec4 uFrustumPlanes[6]; // xyz normal pointing inside, w distance
+uniform vec3 uCameraPosition;
+uniform uint uEntityCount;
+uniform bool uFrustumCulling;
+uniform bool uLods;
+uniform float uPixelsPerUnit;
+uniform float uPixelError;
+uniform float uHysteresis;
+
+uniform uint uPhase; // 0 without Hi-Z, 1 early, 2 late (GpuCullingPhase)
+uniform uint uCommandOffset;
+uniform mat4 uViewProjection;
+uniform ivec2 uPyramidSize;
+uniform int uPyramidLevels;
+
+// True when the box around the sphere is farther than the depth pyramid everywhere it covers,
+// tested at the level where it spans at most 2x2 texels
+bool IsOccluded(vec3 center, float radius)
+{
+	vec2 minUv = vec2(1.0);
+	vec2 maxUv = vec2(0.0);
+	float nearestDepth = 1.0;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		vec3 offset = vec3((corner & 1) != 0 ? radius : -radius, (corner & 2) != 0 ? radius : -radius, (corner & 4) != 0 ? radius : -radius);
+		vec4 clip = uViewProjection * vec4(center + offset, 1.0);
+		if (clip.z < -clip.w)
+			return false; // crosses the near plane
+
+		vec3 ndc = clip.xyz / clip.w;
+		minUv = min(minUv, ndc.xy * 0.5 + 0.5);
+		maxUv = max(maxUv, ndc.xy * 0.5 + 0.5);
+		nearestDepth = min(nearestDepth, ndc.z * 0.5 + 0.5);
+	}
+
+	ivec2 minTexel = clamp(ivec2(floor(clamp(minUv, 0.0, 1.0) * vec2(uPyramidSize))), ivec2(0), uPyramidSize - 1);
+	ivec2 maxTexel = clamp(ivec2(floor(clamp(maxUv, 0.0, 1.0) * vec2(uPyramidSize))), ivec2(0), uPyramidSize - 1);
+	ivec2 extent = maxTexel - minTexel + 1;
+	int level = clamp(int(ceil(log2(float(max(extent.x, extent.y))))), 0, uPyramidLevels - 1);
+
+	ivec2 levelMax = textureSize(uDepthPyramid, level) - 1;
+	ivec2 a = min(minTexel >> level, levelMax);
+	ivec2 b = min(maxTexel >> level, levelMax);
+	float farthest = max(max(texelFetch(uDepthPyramid, a, level).r, texelFetch(uDepthPyramid, ivec2(b.x, a.y), level).r),
+	                     max(texelFetch(uDepthPyramid, ivec2(a.x, b.y), level).r, texelFetch(uDepthPyramid, b, level).r));
+	return nearestDepth > farthest;
+}
+
+void main()
+{
+	uint entity = gl_GlobalInvocationID.x;
+	if (entity >= uEntityCount)
+		return;
+
+	CullModel model = uModels[uEntityModels[entity]];
+	mat4 worldMatrix = uWorldMatrices[entity];
+	float scale = max(length(worldMatrix[0].xyz), max(length(worldMatrix[1].xyz), length(worldMatrix[2].xyz)));
+	vec3 center = vec3(worldMatrix * vec4(model.bounds.xyz, 1.0));
+	float radius = model.bounds.w * scale;
+
+	bool inFrustum = true;
+	if (uFrustumCulling)
+	{
+		for (int i = 0; i < 6; ++i)
+			inFrustum = inFrustum && dot(uFrustumPlanes[i].xyz, center) + uFrustumPlanes[i].w >= -radius;
+	}
+
+	if (uPhase == 1u)
+	{
+		if (!inFrustum || uVisibility[entity] == 0u)
+			return;
+	}
+	else if (uPhase == 2u)
+	{
+		// Entities drawn in the early phase are not drawn again
+		bool visible = inFrustum && !IsOccluded(center, radius);
+		bool drawn = inFrustum && uVisibility[entity] != 0u;
+		uVisibility[entity] = visible ? 1u : 0u;
+		if (!visible || drawn)
+			return;
+	}
+	else if (!inFrustum)
+		return;
+
+	// Coarsest level whose error stays under the pixel error, and a coarser level than the last
+	// one only with the margin of the hysteresis, as SelectLod
+	uint lod = 0;
+	if (uLods && model.lodCount > 1)
+	{
+		float cameraDistance = length(center - uCameraPosition);
+		if (cameraDistance > radius)
+		{
+			float projectedRadius = radius / cameraDistance * uPixelsPerUnit;
+			for (uint i = 1; i < model.lodCount; ++i)
+				if (model.lodError[i] * projectedRadius <= uPixelError)
+					lod = i;
+
+			uint previousLod = uEntityLods[entity];
+			while (lod > previousLod && model.lodError[lod] * projectedRadius > uPixelError * (1.0 - uHysteresis))
+				lod--;
+		}
+	}
+	uEntityLods[entity] = lod;
+
+	for (uint i = 0; i < model.lodBatchCount[lod]; ++i)
+	{
+		uint batch = uLodBatches[model.lodBatchOffset[lod] + i];
+		uint slot = atomicAdd(uCommands[uCommandOffset + batch].instanceCount, 1u);
+		uInstances[uCommands[uCommandOffset + batch].baseInstance + slot] = uvec2(entity, batch);
+	}
+}
+
+#endif
+#endif
+
+// One level of the depth pyramid (see depth_pyramid.h): a copy of the depth buffer for level 0,
+// and the farthest of the 2x2 texels below for the others, or 3 on the last row and column of
+// odd sizes.
+#ifdef DEPTH_PYRAMID
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 8, local_size_y = 8) in; // DEPTH_PYRAMID_GROUP_SIZE
+
+layout(binding = 1) uniform sampler2D uDepth;
+layout(binding = 0, r32f) readonly uniform image2D uSource;
+layout(binding = 1, r32f) writeonly uniform image2D uDestination;
+
+uniform bool uFromDepth;
+uniform ivec2 uSourceSize;
+uniform ivec2 uDestinationSize;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(texel, uDestinationSize)))
+		return;
+
+	if (uFromDepth)
+	{
+		imageStore(uDestination, texel, vec4(texelFetch(uDepth, texel, 0).r));
+		return;
+	}
+
+	ivec2 first = texel * 2;
+	ivec2 last = min(first + 1, uSourceSize - 1);
+	if (texel.x == uDestinationSize.x - 1)
+		last.x = uSourceSize.x - 1;
+	if (texel.y == uDestinationSize.y - 1)
+		last.y = uSourceSize.y - 1;
+
+	float farthest = 0.0;
+	for (int y = first.y; y <= last.y; ++y)
+		for (int x = first.x; x <= last.x; ++x)
+			farthest = max(farthest, imageLoad(uSource, ivec2(x, y)).r);
+	imageStore(uDestination, texel, vec4(farthest));
+}
+
+#endif
+#endif
+
 #ifdef DEFERRED
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
@@ -212,6 +516,7 @@ uniform sampler2D uEmissive;
 
 layout(binding = 0, std140) uniform GlobalParams 
 {
+	mat4 uViewProjectionMatrix;
 	vec3 uCameraPosition;
 	unsigned int uLightCount;
 	Light uLight[16];